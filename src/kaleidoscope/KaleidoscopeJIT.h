@@ -14,11 +14,11 @@
 #define LLVM_EXECUTIONENGINE_ORC_KALEIDOSCOPEJIT_H
 
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/iterator_range.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
-#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
@@ -31,6 +31,7 @@
 #include <algorithm>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -40,42 +41,99 @@ namespace orc {
 class KaleidoscopeJIT {
 public:
   using ObjLayerT = LegacyRTDyldObjectLinkingLayer;
-  using CompileLayerT = LegacyIRCompileLayer<ObjLayerT, SimpleCompiler>;
 
   KaleidoscopeJIT()
       : Resolver(createLegacyLookupResolver(
             ES,
             [this](const std::string &Name) { return findMangledSymbol(Name); },
             [](Error Err) { cantFail(std::move(Err), "lookupFlags failed"); })),
-        TM(EngineBuilder().selectTarget()), DL(TM->createDataLayout()),
+        TM(EngineBuilder().selectTarget()),
+        BaselineTM(
+            EngineBuilder().setOptLevel(CodeGenOpt::None).selectTarget()),
+        OptimizedTM(EngineBuilder()
+                        .setOptLevel(CodeGenOpt::Aggressive)
+                        .selectTarget()),
+        DL(TM->createDataLayout()),
         ObjectLayer(AcknowledgeORCv1Deprecation, ES,
                     [this](VModuleKey) {
                       return ObjLayerT::Resources{
                           std::make_shared<SectionMemoryManager>(), Resolver};
-                    }),
-        CompileLayer(AcknowledgeORCv1Deprecation, ObjectLayer,
-                     SimpleCompiler(*TM)) {
+                    }) {
+    // Select instructions quickly at the baseline level, at the expense of
+    // code quality.
+    BaselineTM->setFastISel(true);
     llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
   }
 
   TargetMachine &getTargetMachine() { return *TM; }
 
-  VModuleKey addModule(std::unique_ptr<Module> M) {
+  // Get the target machine compiling modules at an optimization level.
+  // CodeGenOpt::Less is compiled as CodeGenOpt::Default.
+  TargetMachine &getTargetMachine(CodeGenOpt::Level OptLevel) {
+    switch (OptLevel) {
+    case CodeGenOpt::None:
+      return *BaselineTM;
+    case CodeGenOpt::Aggressive:
+      return *OptimizedTM;
+    default:
+      return *TM;
+    }
+  }
+
+  // Compile a module into machine code, and add it to the JIT.
+  //
+  // Modules may be added from multiple threads, which compile concurrently as
+  // long as they use different optimization levels (a target machine is not
+  // thread-safe).
+  VModuleKey addModule(std::unique_ptr<Module> M,
+                       CodeGenOpt::Level OptLevel = CodeGenOpt::Default) {
+    auto Obj = SimpleCompiler(getTargetMachine(OptLevel))(*M);
+    std::lock_guard<std::mutex> Lock(Mutex);
     auto K = ES.allocateVModule();
-    cantFail(CompileLayer.addModule(K, std::move(M)));
+    cantFail(ObjectLayer.addObject(K, std::move(Obj)));
     ModuleKeys.push_back(K);
     return K;
   }
 
   void removeModule(VModuleKey K) {
+    std::lock_guard<std::mutex> Lock(Mutex);
     ModuleKeys.erase(find(ModuleKeys, K));
-    cantFail(CompileLayer.removeModule(K));
+    cantFail(ObjectLayer.removeObject(K));
+  }
+
+  // Define a symbol of the host process, such as a function callable by JIT
+  // compiled code.  Host symbols are found without searching the process.
+  void addHostSymbol(const std::string &Name, JITTargetAddress Address) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    HostSymbols[mangle(Name)] = Address;
+  }
+
+  // Enable or disable searching the whole process for the symbols which are
+  // neither JIT compiled, nor host symbols.  Enabled by default.
+  void setProcessSymbolSearch(bool Enabled) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    ProcessSymbolSearch = Enabled;
   }
 
+  // Find a symbol.  The symbol is materialized lazily by getAddress(), so use
+  // getSymbolAddress() instead while modules are added from other threads.
   JITSymbol findSymbol(const std::string Name) {
     return findMangledSymbol(mangle(Name));
   }
 
+  // Find and materialize a symbol.
+  // Returns 0 if the symbol could not be found.
+  JITTargetAddress getSymbolAddress(const std::string Name) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (auto Sym = findMangledSymbol(mangle(Name))) {
+      if (auto Addr = Sym.getAddress())
+        return *Addr;
+      else
+        consumeError(Addr.takeError());
+    }
+    return 0;
+  }
+
 private:
   std::string mangle(const std::string &Name) {
     std::string MangledName;
@@ -104,9 +162,17 @@ private:
     // This is the opposite of the usual search order for dlsym, but makes more
     // sense in a REPL where we want to bind to the newest available definition.
     for (auto H : make_range(ModuleKeys.rbegin(), ModuleKeys.rend()))
-      if (auto Sym = CompileLayer.findSymbolIn(H, Name, ExportedSymbolsOnly))
+      if (auto Sym = ObjectLayer.findSymbolIn(H, Name, ExportedSymbolsOnly))
         return Sym;
 
+    // Look up the symbols defined by the host, before searching the process.
+    auto HostSymbol = HostSymbols.find(Name);
+    if (HostSymbol != HostSymbols.end())
+      return JITSymbol(HostSymbol->second, JITSymbolFlags::Exported);
+
+    if (!ProcessSymbolSearch)
+      return nullptr;
+
     // If we can't find the symbol in the JIT, try looking in the host process.
     if (auto SymAddr = RTDyldMemoryManager::getSymbolAddressInProcess(Name))
       return JITSymbol(SymAddr, JITSymbolFlags::Exported);
@@ -127,10 +193,14 @@ private:
   ExecutionSession ES;
   std::shared_ptr<SymbolResolver> Resolver;
   std::unique_ptr<TargetMachine> TM;
+  std::unique_ptr<TargetMachine> BaselineTM;
+  std::unique_ptr<TargetMachine> OptimizedTM;
   const DataLayout DL;
   ObjLayerT ObjectLayer;
-  CompileLayerT CompileLayer;
   std::vector<VModuleKey> ModuleKeys;
+  StringMap<JITTargetAddress> HostSymbols;
+  bool ProcessSymbolSearch = true;
+  std::mutex Mutex; // Guards the object layer, ModuleKeys, and host symbols.
 };
 
 } // end namespace orc
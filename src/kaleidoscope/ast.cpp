@@ -1,5 +1,7 @@
 #include <kaleidoscope/ast.h>
 #include <kaleidoscope/codeGenContext.h>
+#include <kaleidoscope/exprCodeGen.h>
+#include <kaleidoscope/hostFunctions.h>
 #include <kaleidoscope/logger.h>
 
 #include <llvm/IR/BasicBlock.h>
@@ -9,122 +11,137 @@
 
 namespace kaleidoscope
 {
-llvm::Value* NumericExprAST::GenerateCode( CodeGenContext& io_context )
+ExprKind ExprAST::GetKind() const
 {
-    return llvm::ConstantFP::get( io_context.GetLLVMContext(), llvm::APFloat( m_value ) );
+    return m_kind;
 }
 
-llvm::Value* VariableExprAST::GenerateCode( CodeGenContext& io_context )
+bool ExprAST::HasSideEffects() const
 {
-    std::map< std::string, llvm::Value* >::const_iterator valueIt = io_context.GetNamedValuesInScope().find( m_name );
-    if ( valueIt == io_context.GetNamedValuesInScope().end() )
-    {
-        LogError( "Unknown variable name: %s", m_name.c_str() );
-        return nullptr;
-    }
+    return m_hasSideEffects;
+}
 
-    return valueIt->second;
+uint32_t ExprAST::GetDepth() const
+{
+    return m_depth;
 }
 
-llvm::Value* BinaryExprAST::GenerateCode( CodeGenContext& io_context )
+double NumericExprAST::GetValue() const
 {
-    // Extract Values from operands.
-    llvm::Value* leftValue  = m_lhs->GenerateCode( io_context );
-    llvm::Value* rightValue = m_rhs->GenerateCode( io_context );
-    if ( leftValue == nullptr || rightValue == nullptr )
-    {
-        return nullptr;
-    }
+    return m_value;
+}
 
-    // Generate appropriate instruction per operand.
-    switch ( m_operation )
-    {
-    case '+':
-        return io_context.GetIRBuilder().CreateFAdd( leftValue, rightValue, "addtmp" );
-    case '-':
-        return io_context.GetIRBuilder().CreateFSub( leftValue, rightValue, "subtmp" );
-    case '*':
-        return io_context.GetIRBuilder().CreateFMul( leftValue, rightValue, "multmp" );
-    case '<':
-    {
-        llvm::Value* integerValue = io_context.GetIRBuilder().CreateFCmpULT( leftValue, rightValue, "cmptmp" );
-        return io_context.GetIRBuilder().CreateUIToFP( integerValue,
-                                                       llvm::Type::getDoubleTy( io_context.GetLLVMContext() ),
-                                                       "booltmp" );
-    }
-    default:
-        LogError( "Invalid binary operation: %s", m_operation );
-        return nullptr;
-    }
+SymbolId VariableExprAST::GetName() const
+{
+    return m_name;
 }
 
-llvm::Value* CallExprAST::GenerateCode( CodeGenContext& io_context )
+uint32_t VariableExprAST::GetSlot() const
 {
-    // Look up function name in global module table.
-    llvm::Function* calleeFunc = io_context.GetFunction( m_callee );
-    if ( calleeFunc == nullptr )
-    {
-        LogError( "Unknown function '%s' referenced.", m_callee.c_str() );
-        return nullptr;
-    }
+    return m_slot;
+}
 
-    if ( calleeFunc->arg_size() != m_arguments.size() )
-    {
-        LogError( "LLVM function arg size %lu != expression size %lu.", calleeFunc->arg_size(), m_arguments.size() );
-        return nullptr;
-    }
+bool VariableExprAST::IsMutable() const
+{
+    // Only reads of mutable variables are considered to have side effects.
+    return HasSideEffects();
+}
 
-    std::vector< llvm::Value* > argumentValues( calleeFunc->arg_size(), nullptr );
-    for ( size_t argIndex = 0; argIndex < calleeFunc->arg_size(); ++argIndex )
-    {
-        llvm::Value* argumentValue = m_arguments[ argIndex ]->GenerateCode( io_context );
-        if ( argumentValue == nullptr )
-        {
-            LogError( "Invalid argument." );
-            return nullptr;
-        }
-
-        argumentValues[ argIndex ] = argumentValue;
-    }
+char BinaryExprAST::GetOperation() const
+{
+    return m_operation;
+}
+
+ExprAST* BinaryExprAST::GetLHS() const
+{
+    return m_lhs;
+}
+
+ExprAST* BinaryExprAST::GetRHS() const
+{
+    return m_rhs;
+}
 
-    return io_context.GetIRBuilder().CreateCall( calleeFunc, argumentValues, "calltmp" );
+SymbolId CallExprAST::GetCallee() const
+{
+    return m_callee;
 }
 
-const std::string& PrototypeAST::GetName() const
+ArenaArray< ExprAST* > CallExprAST::GetArguments() const
+{
+    return m_arguments;
+}
+
+SymbolId PrototypeAST::GetName() const
 {
     return m_name;
 }
 
+ArenaArray< SymbolId > PrototypeAST::GetArguments() const
+{
+    return m_arguments;
+}
+
 llvm::Function* PrototypeAST::GenerateCode( CodeGenContext& io_context )
 {
-    // Create Function type from our argument types.
-    std::vector< llvm::Type* > argumentTypes( m_arguments.size(),
-                                              llvm::Type::getDoubleTy( io_context.GetLLVMContext() ) );
-    llvm::FunctionType*        functionType =
-        llvm::FunctionType::get( llvm::Type::getDoubleTy( io_context.GetLLVMContext() ), argumentTypes, false );
+    // A host function is called with the arguments of its registration.
+    const HostFunction* hostFunction = io_context.FindHostFunction( m_name );
+    if ( hostFunction != nullptr && hostFunction->m_argumentCount != m_arguments.GetSize() )
+    {
+        LogError( "Host function '%s' takes %zu arguments, but is declared with %zu",
+                  io_context.GetSymbolTable().GetName( m_name ).c_str(),
+                  hostFunction->m_argumentCount,
+                  m_arguments.GetSize() );
+        return nullptr;
+    }
+
+    // Function types are shared by every function of the same number of arguments.
+    llvm::FunctionType* functionType = io_context.GetFunctionType( m_arguments.GetSize() );
 
     // Create new IR Function in our modulefrom functionType.
     llvm::Function* function = llvm::Function::Create( functionType,
                                                        llvm::Function::ExternalLinkage,
-                                                       llvm::Twine( m_name ),
+                                                       io_context.GetSymbolTable().GetName( m_name ),
                                                        io_context.GetModule() );
 
     // Set argument names to make IR more readable.
     size_t argIndex = 0;
     for ( llvm::Argument& arg : function->args() )
     {
-        arg.setName( m_arguments[ argIndex ] );
+        arg.setName( io_context.GetSymbolTable().GetName( m_arguments[ argIndex ] ) );
         argIndex += 1;
     }
 
+    if ( hostFunction != nullptr )
+    {
+        HostFunctionTable::ApplyAttributes( *hostFunction, *function );
+    }
+
     return function;
 }
 
+PrototypeAST* FunctionAST::GetPrototype() const
+{
+    return m_prototype;
+}
+
+ExprAST* FunctionAST::GetBody() const
+{
+    return m_body;
+}
+
 llvm::Function* FunctionAST::GenerateCode( CodeGenContext& io_context )
 {
     // Check for existing function generated from previous 'extern' declaration.
-    PrototypeAST& prototype = *m_prototype;
-    io_context.AddFunction( m_prototype );
+    PrototypeAST&       prototype     = *m_prototype;
+    const std::string&  prototypeName = io_context.GetSymbolTable().GetName( prototype.GetName() );
+    if ( io_context.FindHostFunction( prototype.GetName() ) != nullptr )
+    {
+        LogError( "Function '%s' is defined by the host, and cannot be redefined", prototypeName.c_str() );
+        return nullptr;
+    }
+
+    io_context.AddFunction( prototype, /* isDefinition */ true );
     llvm::Function* function = io_context.GetFunction( prototype.GetName() );
     if ( function == nullptr )
     {
@@ -134,20 +151,20 @@ llvm::Function* FunctionAST::GenerateCode( CodeGenContext& io_context )
     // Function has not been previously declared, create one from prototype.
     if ( function == nullptr )
     {
-        function = m_prototype->GenerateCode( io_context );
+        function = prototype.GenerateCode( io_context );
     }
 
     // Error handling.
     if ( function == nullptr )
     {
-        LogError( "Failed to create function %s", m_prototype->GetName().c_str() );
+        LogError( "Failed to create function %s", prototypeName.c_str() );
         return nullptr;
     }
 
     // Cannot re-define the same function twice.
     if ( !function->empty() )
     {
-        LogError( "Function '%s' cannot be redefined", m_prototype->GetName().c_str() );
+        LogError( "Function '%s' cannot be redefined", prototypeName.c_str() );
         return nullptr;
     }
 
@@ -155,200 +172,107 @@ llvm::Function* FunctionAST::GenerateCode( CodeGenContext& io_context )
     llvm::BasicBlock* basicBlock = llvm::BasicBlock::Create( io_context.GetLLVMContext(), "entry", function );
     io_context.GetIRBuilder().SetInsertPoint( basicBlock );
 
-    // Clear scope variables, and add function arguments.
-    io_context.GetNamedValuesInScope().clear();
+    // Clear scope variables, and add function arguments, which occupy the first slots.
+    io_context.GetSlotValues().clear();
+    io_context.ClearExprValues();
     for ( llvm::Argument& arg : function->args() )
     {
-        io_context.GetNamedValuesInScope()[ arg.getName() ] = &arg;
+        io_context.GetSlotValues().push_back( &arg );
     }
 
     // Create a return value for this block.
     // The return value is based off the body's evaluated expression.
-    llvm::Value* returnValue = m_body->GenerateCode( io_context );
+    llvm::Value* returnValue = ExprCodeGenerator( io_context ).Visit( m_body );
     if ( returnValue )
     {
         io_context.GetIRBuilder().CreateRet( returnValue );
+        io_context.GenerateTailCalls( *function );
         llvm::verifyFunction( *function );
-        io_context.GetFunctionPassManager()->run( *function );
         return function;
     }
     else
     {
         // Failed to generate body expression.  Delete function.
-        function->eraseFromParent();
+        io_context.EraseFunction( prototype.GetName() );
         return nullptr;
     }
 
     return function;
 }
 
-llvm::Value* IfExprAST::GenerateCode( CodeGenContext& io_context )
+ExprAST* IfExprAST::GetCondition() const
 {
-    llvm::Value* ifValue = m_if->GenerateCode( io_context );
-    if ( ifValue == nullptr )
-    {
-        LogError( "Failed to generate code for if condition." );
-        return nullptr;
-    }
-
-    // Compare if condition != 0.0.
-    ifValue = io_context.GetIRBuilder().CreateFCmpONE(
-        ifValue,
-        llvm::ConstantFP::get( io_context.GetLLVMContext(), llvm::APFloat( 0.0 ) ),
-        "ifcond" );
-
-    // Get the function which this condition resides in.
-    llvm::Function*   function        = io_context.GetIRBuilder().GetInsertBlock()->getParent();
-    llvm::BasicBlock* thenBasicBlock  = llvm::BasicBlock::Create( io_context.GetLLVMContext(), "then", function );
-    llvm::BasicBlock* elseBasicBlock  = llvm::BasicBlock::Create( io_context.GetLLVMContext(), "else" );
-    llvm::BasicBlock* mergeBasicBlock = llvm::BasicBlock::Create( io_context.GetLLVMContext(), "ifcont" );
-
-    // Create branch into 'then' and 'else'
-    io_context.GetIRBuilder().CreateCondBr( ifValue, thenBasicBlock, elseBasicBlock );
-
-    // Generate code for 'then'
-    io_context.GetIRBuilder().SetInsertPoint( thenBasicBlock );
-
-    llvm::Value* thenValue = m_then->GenerateCode( io_context );
-    if ( thenValue == nullptr )
-    {
-        LogError( "Failed to generate code for 'then'." );
-        return nullptr;
-    }
-
-    // Direct 'then' into merge block.
-    io_context.GetIRBuilder().CreateBr( mergeBasicBlock );
-
-    // Generating the 'then' code can change the current block.  Fetch the most up to date block for insertion.
-    thenBasicBlock = io_context.GetIRBuilder().GetInsertBlock();
-
-    // Add else block to the function.
-    function->getBasicBlockList().push_back( elseBasicBlock );
-    io_context.GetIRBuilder().SetInsertPoint( elseBasicBlock );
-
-    llvm::Value* elseValue = m_else->GenerateCode( io_context );
-    if ( elseValue == nullptr )
-    {
-        LogError( "Failed to generate code for 'else'." );
-        return nullptr;
-    }
-
-    // Direct 'else' into merge block.
-    io_context.GetIRBuilder().CreateBr( mergeBasicBlock );
-
-    // Generating the 'else' code can change the current block.  Fetch the most up to date block for insertion.
-    elseBasicBlock = io_context.GetIRBuilder().GetInsertBlock();
-
-    // Emit merge block.
-    function->getBasicBlockList().push_back( mergeBasicBlock );
-    io_context.GetIRBuilder().SetInsertPoint( mergeBasicBlock );
-
-    // Create a PHI node which will consume different values depending on which control was executed.
-    llvm::PHINode* phiNode =
-        io_context.GetIRBuilder().CreatePHI( llvm::Type::getDoubleTy( io_context.GetLLVMContext() ), 2, "iftmp" );
-
-    phiNode->addIncoming( thenValue, thenBasicBlock );
-    phiNode->addIncoming( elseValue, elseBasicBlock );
-
-    return phiNode;
+    return m_if;
 }
 
-llvm::Value* ForExprAST::GenerateCode( CodeGenContext& io_context )
+ExprAST* IfExprAST::GetThen() const
 {
-    // Generate code for start expression.
-    llvm::Value* startVariable = m_start->GenerateCode( io_context );
-    if ( startVariable == nullptr )
-    {
-        LogError( "Failed to generate code for loop start." );
-        return nullptr;
-    }
-
-    llvm::IRBuilder<>& builder     = io_context.GetIRBuilder();
-    llvm::LLVMContext& llvmContext = io_context.GetLLVMContext();
-
-    // Get insertion point by querying parent, because this for-loop could be within another condition or block.
-    llvm::Function*   function            = builder.GetInsertBlock()->getParent();
-    llvm::BasicBlock* preHeaderBasicBlock = builder.GetInsertBlock();
-    llvm::BasicBlock* loopBasicBlock      = llvm::BasicBlock::Create( io_context.GetLLVMContext(), "loop", function );
-
-    // Direct parent block into loop.
-    builder.CreateBr( loopBasicBlock );
-
-    // Start insertion point into loop body.
-    builder.SetInsertPoint( loopBasicBlock );
+    return m_then;
+}
 
-    // PHI node to store start value.
-    llvm::PHINode* currentVariable =
-        builder.CreatePHI( llvm::Type::getDoubleTy( io_context.GetLLVMContext() ), 2, m_variableName.c_str() );
-    currentVariable->addIncoming( startVariable, preHeaderBasicBlock );
+ExprAST* IfExprAST::GetElse() const
+{
+    return m_else;
+}
 
-    // The start variable may shadow an existing variable, so cache the old variable.
-    // Insert a new variable to be available in scope.
-    std::map< std::string, llvm::Value* >&                namedValues = io_context.GetNamedValuesInScope();
-    std::map< std::string, llvm::Value* >::const_iterator oldValueIt  = namedValues.find( m_variableName );
-    namedValues[ m_variableName ] = currentVariable;
+SymbolId ForExprAST::GetVariableName() const
+{
+    return m_variableName;
+}
 
-    // Emit code for body.
-    if ( m_body->GenerateCode( io_context ) == nullptr )
-    {
-        LogError( "Failed to generate code for loop body." );
-        return nullptr;
-    }
+uint32_t ForExprAST::GetVariableSlot() const
+{
+    return m_variableSlot;
+}
 
-    // Optional step expression.
-    llvm::Value* stepValue = nullptr;
-    if ( m_step != nullptr )
-    {
-        stepValue = m_step->GenerateCode( io_context );
-        if ( stepValue == nullptr )
-        {
-            LogError( "Failed to generate code for loop step expression." );
-            return nullptr;
-        }
-    }
-    else
-    {
-        stepValue = llvm::ConstantFP::get( io_context.GetLLVMContext(), llvm::APFloat( 1.0 ) );
-    }
+ExprAST* ForExprAST::GetStart() const
+{
+    return m_start;
+}
 
-    // Next variable = current variable + step value.
-    llvm::Value* nextVariable = builder.CreateFAdd( currentVariable, stepValue, "nextvar" );
+ExprAST* ForExprAST::GetEnd() const
+{
+    return m_end;
+}
 
-    // Compute the end condition.
-    llvm::Value* endCondition = m_end->GenerateCode( io_context );
-    if ( endCondition == nullptr )
-    {
-        LogError( "Failed to generate code for loop end expression." );
-    }
+ExprAST* ForExprAST::GetStep() const
+{
+    return m_step;
+}
 
-    // Convert condition to boolean value.
-    endCondition =
-        builder.CreateFCmpONE( endCondition, llvm::ConstantFP::get( llvmContext, llvm::APFloat( 0.0 ) ), "loopcond" );
+ExprAST* ForExprAST::GetBody() const
+{
+    return m_body;
+}
 
-    // Create after-loop block
-    llvm::BasicBlock* loopEndBasicBlock = builder.GetInsertBlock();
-    llvm::BasicBlock* afterBasicBlock   = llvm::BasicBlock::Create( llvmContext, "afterloop", function );
+SymbolId VarExprAST::GetVariableName() const
+{
+    return m_variableName;
+}
 
-    // Create condition to check
-    builder.CreateCondBr( endCondition, loopBasicBlock, afterBasicBlock );
+uint32_t VarExprAST::GetVariableSlot() const
+{
+    return m_variableSlot;
+}
 
-    // Set code insertion point to afterLoop basic block.
-    builder.SetInsertPoint( afterBasicBlock );
+ExprAST* VarExprAST::GetInitializer() const
+{
+    return m_initializer;
+}
 
-    // Assign nextVariable to currentVariable.
-    currentVariable->addIncoming( nextVariable, loopEndBasicBlock );
+ExprAST* VarExprAST::GetBody() const
+{
+    return m_body;
+}
 
-    if ( oldValueIt != namedValues.end() )
-    {
-        namedValues[ m_variableName ] = oldValueIt->second;
-    }
-    else
-    {
-        // Does not shadow a previous variable, so erase it from scope.
-        namedValues.erase( m_variableName );
-    }
+VariableExprAST* AssignExprAST::GetVariable() const
+{
+    return m_variable;
+}
 
-    return llvm::Constant::getNullValue( llvm::Type::getDoubleTy( llvmContext ) );
+ExprAST* AssignExprAST::GetValue() const
+{
+    return m_value;
 }
 
 } // namespace kaleidoscope
@@ -3,15 +3,16 @@
 /* AST (Abstract Syntax Tree) nodes describing the constructs of the Kaleidoscope language */
 
 #include <kaleidoscope/api.h>
+#include <kaleidoscope/astArena.h>
+#include <kaleidoscope/symbolTable.h>
 
-#include <memory>
-#include <string>
-#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
 
 /// Forward declarations for LLVM types.
 namespace llvm
 {
-class Value;
 class Function;
 } // namespace llvm
 
@@ -19,18 +20,81 @@ namespace kaleidoscope
 {
 class CodeGenContext;
 
+/// ExprKind identifies the type of an expression node.
+enum ExprKind : uint8_t
+{
+    ExprKind_Numeric  = 0,
+    ExprKind_Variable = 1,
+    ExprKind_Binary   = 2,
+    ExprKind_Call     = 3,
+    ExprKind_If       = 4,
+    ExprKind_For      = 5,
+    ExprKind_Var      = 6,
+    ExprKind_Assign   = 7
+};
+
 /// ExprAST is the base class for all expression nodes in the AST.
+///
+/// Nodes are allocated from an ASTArena, which frees them all at once rather than destroying them
+/// individually, so nodes (and their destructors) must remain trivial.
+///
+/// Nodes have no virtual methods: operations on expressions, such as code generation, are passes which
+/// dispatch on GetKind (see ExprVisitor).
 class ExprAST
 {
 public:
+    /// Get the type of this expression.
+    KALEIDOSCOPE_API
+    ExprKind GetKind() const;
+
+    /// Whether evaluating this expression may have an effect other than producing its value.
+    /// Calls may perform I/O, and loops may not terminate, so both are conservatively assumed to have side effects.
+    /// The value of a mutable variable depends on when it is read, so reading one is treated as a side effect too.
+    /// Expressions without side effects may be evaluated once for all their occurrences.
     KALEIDOSCOPE_API
-    virtual ~ExprAST()
+    bool HasSideEffects() const;
+
+    /// Get the depth of this expression, which is 1 for a leaf, and one more than its deepest operand otherwise.
+    /// Passes over expressions recurse on their operands, so the depth bounds their use of the native stack.
+    KALEIDOSCOPE_API
+    uint32_t GetDepth() const;
+
+protected:
+    ExprAST( ExprKind i_kind, bool i_hasSideEffects, uint32_t i_depth = 1 )
+        : m_kind( i_kind )
+        , m_hasSideEffects( i_hasSideEffects )
+        , m_depth( i_depth )
     {
     }
 
-    /// Abstract method to generate code.
-    KALEIDOSCOPE_API
-    virtual llvm::Value* GenerateCode( CodeGenContext& io_context ) = 0;
+    /// Get the depth of an expression of the given operands, which may be nullptr.
+    static uint32_t getDepth( std::initializer_list< const ExprAST* > i_operands )
+    {
+        uint32_t depth = 0;
+        for ( const ExprAST* operand : i_operands )
+        {
+            depth = operand != nullptr ? std::max( depth, operand->m_depth ) : depth;
+        }
+
+        return depth + 1;
+    }
+
+    /// Get the depth of an expression of the given operands.
+    static uint32_t getDepth( ArenaArray< ExprAST* > i_operands )
+    {
+        uint32_t depth = 0;
+        for ( const ExprAST* operand : i_operands )
+        {
+            depth = std::max( depth, operand->m_depth );
+        }
+
+        return depth + 1;
+    }
+
+private:
+    ExprKind m_kind;           /// Type of this expression.
+    bool     m_hasSideEffects; /// Whether this expression, or any of its operands, has side effects.
+    uint32_t m_depth;          /// Depth of this expression.
 };
 
 /// NumericExprAST represents numeric literals, like "1.0".
@@ -39,12 +103,14 @@ class NumericExprAST : public ExprAST
 public:
     KALEIDOSCOPE_API
     NumericExprAST( double i_value )
-        : m_value( i_value )
+        : ExprAST( ExprKind_Numeric, false )
+        , m_value( i_value )
     {
     }
 
+    /// Get the numeric value.
     KALEIDOSCOPE_API
-    virtual llvm::Value* GenerateCode( CodeGenContext& io_context ) override;
+    double GetValue() const;
 
 private:
     /// Internal storage for numeric value.
@@ -52,20 +118,36 @@ private:
 };
 
 /// VariableExprAST represents a variable, like "foo".
+///
+/// A variable is resolved by the parser into the slot of its binding.  The slots of a function are its
+/// arguments, followed by the variables of the loops and 'var' expressions enclosing the variable, innermost last.
+/// Only variables bound by 'var' are mutable.
 class VariableExprAST : public ExprAST
 {
 public:
     KALEIDOSCOPE_API
-    VariableExprAST( const std::string& i_name )
-        : m_name( i_name )
+    VariableExprAST( SymbolId i_name, uint32_t i_slot, bool i_isMutable )
+        : ExprAST( ExprKind_Variable, i_isMutable )
+        , m_name( i_name )
+        , m_slot( i_slot )
     {
     }
 
+    /// Get the name of the variable.
+    KALEIDOSCOPE_API
+    SymbolId GetName() const;
+
+    /// Get the slot of the binding which the variable refers to.
+    KALEIDOSCOPE_API
+    uint32_t GetSlot() const;
+
+    /// Whether the variable is bound by 'var', so may be assigned.
     KALEIDOSCOPE_API
-    virtual llvm::Value* GenerateCode( CodeGenContext& io_context ) override;
+    bool IsMutable() const;
 
 private:
-    std::string m_name = ""; /// Internal storage for variable name.
+    SymbolId m_name = 0; /// Internal storage for variable name.
+    uint32_t m_slot = 0; /// Slot of the binding.
 };
 
 /// BinaryExprAST represents a binary operation.
@@ -74,20 +156,30 @@ class BinaryExprAST : public ExprAST
 {
 public:
     KALEIDOSCOPE_API
-    BinaryExprAST( char i_operation, std::unique_ptr< ExprAST > i_lhs, std::unique_ptr< ExprAST > i_rhs )
-        : m_operation( i_operation )
-        , m_lhs( std::move( i_lhs ) )
-        , m_rhs( std::move( i_rhs ) )
+    BinaryExprAST( char i_operation, ExprAST* i_lhs, ExprAST* i_rhs )
+        : ExprAST( ExprKind_Binary, i_lhs->HasSideEffects() || i_rhs->HasSideEffects(), getDepth( {i_lhs, i_rhs} ) )
+        , m_operation( i_operation )
+        , m_lhs( i_lhs )
+        , m_rhs( i_rhs )
     {
     }
 
+    /// Get the operation, as its operator character.
+    KALEIDOSCOPE_API
+    char GetOperation() const;
+
+    /// Get the left hand side operand.
     KALEIDOSCOPE_API
-    virtual llvm::Value* GenerateCode( CodeGenContext& io_context ) override;
+    ExprAST* GetLHS() const;
+
+    /// Get the right hand side operand.
+    KALEIDOSCOPE_API
+    ExprAST* GetRHS() const;
 
 private:
-    char                       m_operation = ' ';     /// Type of operation.
-    std::unique_ptr< ExprAST > m_lhs       = nullptr; /// Left hand side operand.
-    std::unique_ptr< ExprAST > m_rhs       = nullptr; /// Right hand side operand.
+    char     m_operation = ' ';     /// Type of operation.
+    ExprAST* m_lhs       = nullptr; /// Left hand side operand.
+    ExprAST* m_rhs       = nullptr; /// Right hand side operand.
 };
 
 /// CallExprAST represents a function call.
@@ -96,18 +188,24 @@ class CallExprAST : public ExprAST
 {
 public:
     KALEIDOSCOPE_API
-    CallExprAST( const std::string& i_callee, std::vector< std::unique_ptr< ExprAST > > i_arguments )
-        : m_callee( i_callee )
-        , m_arguments( std::move( i_arguments ) )
+    CallExprAST( SymbolId i_callee, ArenaArray< ExprAST* > i_arguments )
+        : ExprAST( ExprKind_Call, true, getDepth( i_arguments ) )
+        , m_callee( i_callee )
+        , m_arguments( i_arguments )
     {
     }
 
+    /// Get the name of the function being called.
+    KALEIDOSCOPE_API
+    SymbolId GetCallee() const;
+
+    /// Get the arguments passed into the function.
     KALEIDOSCOPE_API
-    virtual llvm::Value* GenerateCode( CodeGenContext& io_context ) override;
+    ArenaArray< ExprAST* > GetArguments() const;
 
 private:
-    std::string                               m_callee;    // Name of the function being called.
-    std::vector< std::unique_ptr< ExprAST > > m_arguments; // Arguments passed into the function.
+    SymbolId               m_callee;    // Name of the function being called.
+    ArenaArray< ExprAST* > m_arguments; // Arguments passed into the function.
 };
 
 /// PrototypeAST represents a function prototype, capturing its name, and names of arguments.
@@ -115,7 +213,7 @@ class PrototypeAST
 {
 public:
     KALEIDOSCOPE_API
-    PrototypeAST( const std::string& i_name, const std::vector< std::string >& i_arguments )
+    PrototypeAST( SymbolId i_name, ArenaArray< SymbolId > i_arguments )
         : m_name( i_name )
         , m_arguments( i_arguments )
     {
@@ -123,15 +221,19 @@ public:
 
     /// Returns the function name.
     KALEIDOSCOPE_API
-    const std::string& GetName() const;
+    SymbolId GetName() const;
+
+    /// Returns the names of the arguments.
+    KALEIDOSCOPE_API
+    ArenaArray< SymbolId > GetArguments() const;
 
     /// Generate code for a function.
     KALEIDOSCOPE_API
     llvm::Function* GenerateCode( CodeGenContext& io_context );
 
 private:
-    std::string                m_name;      /// Name of the function prototype.
-    std::vector< std::string > m_arguments; /// Names of the arguments.
+    SymbolId               m_name;      /// Name of the function prototype.
+    ArenaArray< SymbolId > m_arguments; /// Names of the arguments.
 };
 
 /// FunctionAST represents a function definition, composed of a prototype (signature)
@@ -140,19 +242,27 @@ class FunctionAST
 {
 public:
     KALEIDOSCOPE_API
-    FunctionAST( std::unique_ptr< PrototypeAST > i_prototype, std::unique_ptr< ExprAST > i_body )
-        : m_prototype( std::move( i_prototype ) )
-        , m_body( std::move( i_body ) )
+    FunctionAST( PrototypeAST* i_prototype, ExprAST* i_body )
+        : m_prototype( i_prototype )
+        , m_body( i_body )
     {
     }
 
+    /// Get the prototype of this function.
+    KALEIDOSCOPE_API
+    PrototypeAST* GetPrototype() const;
+
+    /// Get the function body.
+    KALEIDOSCOPE_API
+    ExprAST* GetBody() const;
+
     /// Generate code for a function.
     KALEIDOSCOPE_API
     llvm::Function* GenerateCode( CodeGenContext& io_context );
 
 private:
-    std::unique_ptr< PrototypeAST > m_prototype; /// This function's associated prototype.
-    std::unique_ptr< ExprAST >      m_body;      /// Function body.
+    PrototypeAST* m_prototype; /// This function's associated prototype.
+    ExprAST*      m_body;      /// Function body.
 };
 
 /// IfExprAST represents a conditional expression.
@@ -160,21 +270,32 @@ class IfExprAST : public ExprAST
 {
 public:
     KALEIDOSCOPE_API
-    IfExprAST( std::unique_ptr< ExprAST > i_if, std::unique_ptr< ExprAST > i_then, std::unique_ptr< ExprAST > i_else )
-        : m_if( std::move( i_if ) )
-        , m_then( std::move( i_then ) )
-        , m_else( std::move( i_else ) )
+    IfExprAST( ExprAST* i_if, ExprAST* i_then, ExprAST* i_else )
+        : ExprAST( ExprKind_If,
+                   i_if->HasSideEffects() || i_then->HasSideEffects() || i_else->HasSideEffects(),
+                   getDepth( {i_if, i_then, i_else} ) )
+        , m_if( i_if )
+        , m_then( i_then )
+        , m_else( i_else )
     {
     }
 
-    /// Generate code for a conditional expression.
+    /// Get the conditional expression.
+    KALEIDOSCOPE_API
+    ExprAST* GetCondition() const;
+
+    /// Get the expression evaluated if the condition is true.
+    KALEIDOSCOPE_API
+    ExprAST* GetThen() const;
+
+    /// Get the expression evaluated if the condition is false.
     KALEIDOSCOPE_API
-    llvm::Value* GenerateCode( CodeGenContext& io_context ) override;
+    ExprAST* GetElse() const;
 
 private:
-    std::unique_ptr< ExprAST > m_if;   /// Conditional statement
-    std::unique_ptr< ExprAST > m_then; /// Expression if condition == true.
-    std::unique_ptr< ExprAST > m_else; /// Expression if condition == false.
+    ExprAST* m_if;   /// Conditional statement
+    ExprAST* m_then; /// Expression if condition == true.
+    ExprAST* m_else; /// Expression if condition == false.
 };
 
 /// ForExprAST represents a for loop expression.
@@ -182,29 +303,118 @@ class ForExprAST : public ExprAST
 {
 public:
     KALEIDOSCOPE_API
-    ForExprAST( const std::string&         i_variableName,
-                std::unique_ptr< ExprAST > i_start,
-                std::unique_ptr< ExprAST > i_end,
-                std::unique_ptr< ExprAST > i_step,
-                std::unique_ptr< ExprAST > i_body )
-        : m_variableName( i_variableName )
-        , m_start( std::move( i_start ) )
-        , m_end( std::move( i_end ) )
-        , m_step( std::move( i_step ) )
-        , m_body( std::move( i_body ) )
+    ForExprAST( SymbolId i_variableName,
+                uint32_t i_variableSlot,
+                ExprAST* i_start,
+                ExprAST* i_end,
+                ExprAST* i_step,
+                ExprAST* i_body )
+        : ExprAST( ExprKind_For, true, getDepth( {i_start, i_end, i_step, i_body} ) )
+        , m_variableName( i_variableName )
+        , m_variableSlot( i_variableSlot )
+        , m_start( i_start )
+        , m_end( i_end )
+        , m_step( i_step )
+        , m_body( i_body )
     {
     }
 
-    /// Generate code for a conditional expression.
+    /// Get the name of the loop variable.
+    KALEIDOSCOPE_API
+    SymbolId GetVariableName() const;
+
+    /// Get the slot of the loop variable, which is bound within the end, step, and body expressions.
+    KALEIDOSCOPE_API
+    uint32_t GetVariableSlot() const;
+
+    /// Get the initial value expression.
+    KALEIDOSCOPE_API
+    ExprAST* GetStart() const;
+
+    /// Get the loop termination expression.
+    KALEIDOSCOPE_API
+    ExprAST* GetEnd() const;
+
+    /// Get the increment expression, which is nullptr if the loop increments by 1.0.
+    KALEIDOSCOPE_API
+    ExprAST* GetStep() const;
+
+    /// Get the loop body expression.
+    KALEIDOSCOPE_API
+    ExprAST* GetBody() const;
+
+private:
+    SymbolId m_variableName; /// Loop variable name.
+    uint32_t m_variableSlot; /// Slot of the loop variable.
+    ExprAST* m_start;        /// Initial value expression.
+    ExprAST* m_end;          /// Expression to check for loop termination.
+    ExprAST* m_step;         /// Increment expression after each iteration of the loop.
+    ExprAST* m_body;         /// Expression to evaluate for for each iteration of the loop.
+};
+
+/// VarExprAST represents the binding of a mutable variable within an expression.
+/// For example: "var x = 1.0 in ( x = x + 1.0 )"
+/// Each variable of a 'var' expression binding several variables is a nested VarExprAST.
+class VarExprAST : public ExprAST
+{
+public:
+    KALEIDOSCOPE_API
+    VarExprAST( SymbolId i_variableName, uint32_t i_variableSlot, ExprAST* i_initializer, ExprAST* i_body )
+        : ExprAST( ExprKind_Var, true, getDepth( {i_initializer, i_body} ) )
+        , m_variableName( i_variableName )
+        , m_variableSlot( i_variableSlot )
+        , m_initializer( i_initializer )
+        , m_body( i_body )
+    {
+    }
+
+    /// Get the name of the variable.
+    KALEIDOSCOPE_API
+    SymbolId GetVariableName() const;
+
+    /// Get the slot of the variable, which is bound within the body.
+    KALEIDOSCOPE_API
+    uint32_t GetVariableSlot() const;
+
+    /// Get the initial value expression, which is evaluated before the variable is bound.
+    KALEIDOSCOPE_API
+    ExprAST* GetInitializer() const;
+
+    /// Get the expression which the variable is bound within, and which the 'var' expression evaluates to.
+    KALEIDOSCOPE_API
+    ExprAST* GetBody() const;
+
+private:
+    SymbolId m_variableName; /// Variable name.
+    uint32_t m_variableSlot; /// Slot of the variable.
+    ExprAST* m_initializer;  /// Initial value expression.
+    ExprAST* m_body;         /// Expression which the variable is bound within.
+};
+
+/// AssignExprAST represents the assignment of a mutable variable, which evaluates to the assigned value.
+/// For example: "x = x + 1.0"
+class AssignExprAST : public ExprAST
+{
+public:
+    KALEIDOSCOPE_API
+    AssignExprAST( VariableExprAST* i_variable, ExprAST* i_value )
+        : ExprAST( ExprKind_Assign, true, getDepth( {i_variable, i_value} ) )
+        , m_variable( i_variable )
+        , m_value( i_value )
+    {
+    }
+
+    /// Get the variable being assigned.
+    KALEIDOSCOPE_API
+    VariableExprAST* GetVariable() const;
+
+    /// Get the expression of the assigned value.
     KALEIDOSCOPE_API
-    llvm::Value* GenerateCode( CodeGenContext& io_context ) override;
+    ExprAST* GetValue() const;
 
 private:
-    std::string                m_variableName; /// Loop variable name.
-    std::unique_ptr< ExprAST > m_start;        /// Initial value expression.
-    std::unique_ptr< ExprAST > m_end;          /// Expression to check for loop termination.
-    std::unique_ptr< ExprAST > m_step;         /// Increment expression after each iteration of the loop.
-    std::unique_ptr< ExprAST > m_body;         /// Expression to evaluate for for each iteration of the loop.
+    VariableExprAST* m_variable; /// Variable being assigned.
+    ExprAST*         m_value;    /// Assigned value expression.
 };
 
 } // namespace kaleidoscope
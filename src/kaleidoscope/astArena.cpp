@@ -0,0 +1,15 @@
+#include <kaleidoscope/astArena.h>
+
+namespace kaleidoscope
+{
+void ASTArena::Reset()
+{
+    m_allocator.Reset();
+}
+
+size_t ASTArena::GetBytesAllocated() const
+{
+    return m_allocator.getBytesAllocated();
+}
+
+} // namespace kaleidoscope
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <kaleidoscope/api.h>
+
+#include <llvm/Support/Allocator.h>
+
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+namespace kaleidoscope
+{
+/// ArenaArray is a non-owning, fixed-size array whose elements are allocated from an ASTArena.
+template < typename ElementT >
+class ArenaArray
+{
+public:
+    ArenaArray() = default;
+
+    ArenaArray( const ElementT* i_data, size_t i_size )
+        : m_data( i_data )
+        , m_size( i_size )
+    {
+    }
+
+    /// Get the number of elements.
+    size_t GetSize() const
+    {
+        return m_size;
+    }
+
+    /// Get an element.
+    const ElementT& operator[]( size_t i_index ) const
+    {
+        return m_data[ i_index ];
+    }
+
+    /// Iteration, for range-based for loops.
+    const ElementT* begin() const
+    {
+        return m_data;
+    }
+
+    const ElementT* end() const
+    {
+        return m_data + m_size;
+    }
+
+private:
+    const ElementT* m_data = nullptr; /// First element.
+    size_t          m_size = 0;       /// Number of elements.
+};
+
+/// ASTArena bump-allocates AST nodes and their arrays, and frees all of them at once.
+///
+/// Allocation is a pointer increment within large slabs, so nodes are allocated without a call to malloc,
+/// and nodes which are parsed together are adjacent in memory.  Nodes are never destroyed individually,
+/// so they must be trivially destructible.
+///
+/// Typically an arena is owned per translation unit, or reset after each top-level item of an interactive
+/// session.  Every node allocated from an arena is invalidated when it is reset or destroyed.
+class ASTArena
+{
+public:
+    KALEIDOSCOPE_API
+    ASTArena() = default;
+
+    /// Construct a node within the arena.
+    /// \param i_args arguments forwarded to the constructor of the node.
+    /// \return the constructed node, which is owned by the arena.
+    template < typename NodeT, typename... ArgsT >
+    KALEIDOSCOPE_API NodeT* Create( ArgsT&&... i_args )
+    {
+        static_assert( std::is_trivially_destructible< NodeT >::value,
+                       "Nodes allocated from an ASTArena are never destroyed." );
+        return new ( m_allocator.Allocate< NodeT >() ) NodeT( std::forward< ArgsT >( i_args )... );
+    }
+
+    /// Copy an array of elements into the arena.
+    /// \param i_data the first element to copy.
+    /// \param i_size the number of elements to copy.
+    /// \return the copied array, which is owned by the arena.
+    template < typename ElementT >
+    KALEIDOSCOPE_API ArenaArray< ElementT > CopyArray( const ElementT* i_data, size_t i_size )
+    {
+        static_assert( std::is_trivially_copyable< ElementT >::value,
+                       "Elements of an ArenaArray are copied and never destroyed." );
+        if ( i_size == 0 )
+        {
+            return ArenaArray< ElementT >();
+        }
+
+        ElementT* data = m_allocator.Allocate< ElementT >( i_size );
+        memcpy( data, i_data, i_size * sizeof( ElementT ) );
+        return ArenaArray< ElementT >( data, i_size );
+    }
+
+    /// Free all the nodes and arrays allocated from this arena.
+    /// The first slab of memory is retained for subsequent allocations.
+    KALEIDOSCOPE_API
+    void Reset();
+
+    /// Get the total number of bytes allocated from this arena.
+    KALEIDOSCOPE_API
+    size_t GetBytesAllocated() const;
+
+private:
+    llvm::BumpPtrAllocator m_allocator; /// Slab allocator backing the arena.
+};
+
+} // namespace kaleidoscope
@@ -0,0 +1,112 @@
+#pragma once
+
+/* Statically dispatched traversal of expression nodes */
+
+#include <kaleidoscope/ast.h>
+
+#include <llvm/Support/Compiler.h>
+#include <llvm/Support/CrashRecoveryContext.h>
+
+#include <cassert>
+#include <cstdint>
+
+namespace kaleidoscope
+{
+/// Number of nested visits which run on a single native stack (see ExprVisitor::Visit).
+constexpr uint32_t s_visitsPerStack = 1024;
+
+/// Size of the native stack of a thread which continues a deeply nested visit.
+constexpr unsigned s_visitStackSize = 8 * 1024 * 1024;
+
+/// Run a function on a new thread with a stack of s_visitStackSize, and wait for it to return.
+template < typename FunctionT >
+void RunOnNewStack( const FunctionT& i_function )
+{
+    llvm::CrashRecoveryContext().RunSafelyOnThread( i_function, s_visitStackSize );
+}
+
+/// ExprVisitor dispatches an expression to the handler of its kind, on a derived visitor class.
+///
+/// Dispatch is a switch on ExprAST::GetKind, and handlers are resolved at compile time (CRTP), so a pass over
+/// the AST involves no virtual calls, and handlers may be inlined into the traversal.  A pass derives from
+/// ExprVisitor< PassT, ResultT >, and implements a handler for every kind of expression:
+///
+/// \code
+/// class PassT : public ExprVisitor< PassT, ResultT >
+/// {
+/// public:
+///     ResultT VisitNumeric( NumericExprAST* i_expr );
+///     ResultT VisitVariable( VariableExprAST* i_expr );
+///     ResultT VisitBinary( BinaryExprAST* i_expr );
+///     ResultT VisitCall( CallExprAST* i_expr );
+///     ResultT VisitIf( IfExprAST* i_expr );
+///     ResultT VisitFor( ForExprAST* i_expr );
+///     ResultT VisitVar( VarExprAST* i_expr );
+///     ResultT VisitAssign( AssignExprAST* i_expr );
+/// };
+/// \endcode
+///
+/// Handlers visit operands by calling Visit, so each pass controls the order of, and whether to, traverse them.
+///
+/// A pass recurses once per level of depth of the expression, and expressions may be nested hundreds of thousands
+/// deep, so every s_visitsPerStack nested visits continue on a new thread with a stack of its own.  The visiting
+/// thread waits for it, so a pass still runs sequentially, and handlers need not be thread-safe.
+template < typename DerivedT, typename ResultT >
+class ExprVisitor
+{
+public:
+    /// Visit an expression with the handler of its kind.
+    ResultT Visit( ExprAST* i_expr )
+    {
+        if ( ++m_nestedVisits % s_visitsPerStack == 0 )
+        {
+            return visitOnNewStack( i_expr );
+        }
+
+        ResultT result = dispatch( i_expr );
+        --m_nestedVisits;
+        return result;
+    }
+
+private:
+    /// Continue a visit on a new thread with a stack of its own.
+    LLVM_ATTRIBUTE_NOINLINE ResultT visitOnNewStack( ExprAST* i_expr )
+    {
+        ResultT result = ResultT();
+        RunOnNewStack( [&]() { result = dispatch( i_expr ); } );
+        --m_nestedVisits;
+        return result;
+    }
+
+    /// Call the handler of the kind of an expression.
+    ResultT dispatch( ExprAST* i_expr )
+    {
+        DerivedT& derived = static_cast< DerivedT& >( *this );
+        switch ( i_expr->GetKind() )
+        {
+        case ExprKind_Numeric:
+            return derived.VisitNumeric( static_cast< NumericExprAST* >( i_expr ) );
+        case ExprKind_Variable:
+            return derived.VisitVariable( static_cast< VariableExprAST* >( i_expr ) );
+        case ExprKind_Binary:
+            return derived.VisitBinary( static_cast< BinaryExprAST* >( i_expr ) );
+        case ExprKind_Call:
+            return derived.VisitCall( static_cast< CallExprAST* >( i_expr ) );
+        case ExprKind_If:
+            return derived.VisitIf( static_cast< IfExprAST* >( i_expr ) );
+        case ExprKind_For:
+            return derived.VisitFor( static_cast< ForExprAST* >( i_expr ) );
+        case ExprKind_Var:
+            return derived.VisitVar( static_cast< VarExprAST* >( i_expr ) );
+        case ExprKind_Assign:
+            return derived.VisitAssign( static_cast< AssignExprAST* >( i_expr ) );
+        }
+
+        assert( false && "Unknown expression kind." );
+        return ResultT();
+    }
+
+    uint32_t m_nestedVisits = 0; /// Number of visits in progress.
+};
+
+} // namespace kaleidoscope
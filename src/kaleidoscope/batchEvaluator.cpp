@@ -0,0 +1,120 @@
+#include <kaleidoscope/batchEvaluator.h>
+#include <kaleidoscope/codeGenContext.h>
+#include <kaleidoscope/logger.h>
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace
+{
+/// Minimum rows evaluated per thread, so that each thread amortizes the cost of starting it.
+constexpr size_t s_minimumRowsPerThread = 16384;
+
+} // namespace
+
+namespace kaleidoscope
+{
+llvm::Function* GenerateBatchFunction( CodeGenContext& io_context, SymbolId i_name )
+{
+    llvm::Function* function = io_context.GetFunction( i_name );
+    if ( function == nullptr )
+    {
+        LogError( "Unknown function '%s'", io_context.GetSymbolTable().GetName( i_name ).c_str() );
+        return nullptr;
+    }
+
+    llvm::LLVMContext& llvmContext = io_context.GetLLVMContext();
+    llvm::Type*        doubleType  = llvm::Type::getDoubleTy( llvmContext );
+    llvm::Type*        columnType  = doubleType->getPointerTo();
+    llvm::Type*        rowType     = llvm::Type::getInt64Ty( llvmContext );
+
+    // The signature of BatchFunction.
+    llvm::Type*         argumentTypes[] = {columnType->getPointerTo(), columnType, rowType, rowType};
+    llvm::FunctionType* batchType =
+        llvm::FunctionType::get( llvm::Type::getVoidTy( llvmContext ), argumentTypes, /* isVarArg */ false );
+    llvm::Function* batchFunction = llvm::Function::Create( batchType,
+                                                            llvm::Function::ExternalLinkage,
+                                                            "__batch_" + function->getName().str(),
+                                                            io_context.GetModule() );
+
+    // The output does not overlap the input columns, so that storing a result does not invalidate the loads of the
+    // following rows, and the loop can be vectorized.
+    llvm::Function::arg_iterator argumentIt = batchFunction->arg_begin();
+    llvm::Argument*              columns    = &*argumentIt++;
+    llvm::Argument*              output     = &*argumentIt++;
+    llvm::Argument*              rowBegin   = &*argumentIt++;
+    llvm::Argument*              rowEnd     = &*argumentIt++;
+    output->addAttr( llvm::Attribute::NoAlias );
+
+    llvm::IRBuilder<>& builder    = io_context.GetIRBuilder();
+    llvm::BasicBlock*  entryBlock = llvm::BasicBlock::Create( llvmContext, "entry", batchFunction );
+    llvm::BasicBlock*  loopBlock  = llvm::BasicBlock::Create( llvmContext, "loop", batchFunction );
+    llvm::BasicBlock*  afterBlock = llvm::BasicBlock::Create( llvmContext, "afterloop", batchFunction );
+
+    // The columns are loaded once, ahead of the loop.
+    builder.SetInsertPoint( entryBlock );
+    std::vector< llvm::Value* > argumentColumns( function->arg_size() );
+    for ( size_t argIndex = 0; argIndex < argumentColumns.size(); ++argIndex )
+    {
+        llvm::Value* columnAddress = builder.CreateConstInBoundsGEP1_64( columnType, columns, argIndex );
+        argumentColumns[ argIndex ] = builder.CreateLoad( columnType, columnAddress, "column" );
+    }
+
+    builder.CreateCondBr( builder.CreateICmpULT( rowBegin, rowEnd ), loopBlock, afterBlock );
+
+    // Evaluate a row per iteration.
+    builder.SetInsertPoint( loopBlock );
+    llvm::PHINode* row = builder.CreatePHI( rowType, 2, "row" );
+    row->addIncoming( rowBegin, entryBlock );
+
+    std::vector< llvm::Value* > arguments( argumentColumns.size() );
+    for ( size_t argIndex = 0; argIndex < arguments.size(); ++argIndex )
+    {
+        llvm::Value* argumentAddress = builder.CreateInBoundsGEP( doubleType, argumentColumns[ argIndex ], row );
+        arguments[ argIndex ]        = builder.CreateLoad( doubleType, argumentAddress, "argument" );
+    }
+
+    llvm::Value* result = builder.CreateCall( function, arguments, "result" );
+    builder.CreateStore( result, builder.CreateInBoundsGEP( doubleType, output, row ) );
+
+    llvm::Value* nextRow = builder.CreateAdd( row, llvm::ConstantInt::get( rowType, 1 ), "nextrow" );
+    row->addIncoming( nextRow, loopBlock );
+    builder.CreateCondBr( builder.CreateICmpULT( nextRow, rowEnd ), loopBlock, afterBlock );
+
+    builder.SetInsertPoint( afterBlock );
+    builder.CreateRetVoid();
+    return batchFunction;
+}
+
+void EvaluateBatch( BatchFunction        i_function,
+                    const double* const* i_columns,
+                    double*              o_output,
+                    size_t               i_rowCount,
+                    size_t               i_threadCount )
+{
+    size_t threadCount = i_threadCount != 0 ? i_threadCount : std::max( 1u, std::thread::hardware_concurrency() );
+    threadCount        = std::max< size_t >( 1, std::min( threadCount, i_rowCount / s_minimumRowsPerThread ) );
+
+    // Each thread evaluates a contiguous range of rows, so that threads do not write to the same cache lines.
+    // The calling thread evaluates the first range.
+    size_t                     rowsPerThread = ( i_rowCount + threadCount - 1 ) / threadCount;
+    std::vector< std::thread > threads;
+    for ( size_t threadIndex = 1; threadIndex < threadCount; ++threadIndex )
+    {
+        size_t rowBegin = std::min( i_rowCount, threadIndex * rowsPerThread );
+        size_t rowEnd   = std::min( i_rowCount, rowBegin + rowsPerThread );
+        threads.emplace_back( i_function, i_columns, o_output, rowBegin, rowEnd );
+    }
+
+    i_function( i_columns, o_output, 0, std::min( i_rowCount, rowsPerThread ) );
+    for ( std::thread& thread : threads )
+    {
+        thread.join();
+    }
+}
+
+} // namespace kaleidoscope
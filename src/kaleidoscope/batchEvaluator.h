@@ -0,0 +1,62 @@
+#pragma once
+
+/* Evaluation of a function over many rows of columnar inputs */
+
+#include <kaleidoscope/api.h>
+#include <kaleidoscope/symbolTable.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace llvm
+{
+class Function;
+} // namespace llvm
+
+namespace kaleidoscope
+{
+class CodeGenContext;
+
+/// Compiled entry point of a batch function, which evaluates a function over the rows [i_rowBegin, i_rowEnd).
+/// \param i_columns a column per argument of the function, each holding an argument value per row.
+/// \param o_output the column receiving the result of each row.  It must not overlap the input columns.
+/// \param i_rowBegin the first row to evaluate.
+/// \param i_rowEnd one past the last row to evaluate.
+using BatchFunction = void ( * )( const double* const* i_columns,
+                                  double*              o_output,
+                                  uint64_t             i_rowBegin,
+                                  uint64_t             i_rowEnd );
+
+/// Generate the batch function of a function, into the current module of io_context.
+///
+/// The batch function is a loop over rows, which loads the arguments of each row from the input columns, calls the
+/// function, and stores its result into the output column.  Generating it into the module which defines the
+/// function allows OptimizeModule to inline the function into the loop, and vectorize the loop across rows.
+/// Otherwise, the function is called from the loop, unless it is imported for inlining (see SetInlineImportLimit).
+///
+/// The batch function is named after the function, with a "__batch_" prefix, to look it up in the JIT by.
+///
+/// \param io_context the context to generate the batch function with.  Its module must be initialized.
+/// \param i_name the name of the function, which must have been added to io_context.
+/// \return the batch function, or nullptr if the function is unknown.
+KALEIDOSCOPE_API
+llvm::Function* GenerateBatchFunction( CodeGenContext& io_context, SymbolId i_name );
+
+/// Evaluate a compiled batch function over all the rows of its columns.
+///
+/// The rows are split into contiguous ranges of similar size, evaluated on multiple threads.  Batches too small to
+/// amortize starting a thread are evaluated on the calling thread.
+///
+/// \param i_function the compiled batch function.
+/// \param i_columns a column per argument of the function, each of i_rowCount values.
+/// \param o_output the column receiving the i_rowCount results.
+/// \param i_rowCount the number of rows.
+/// \param i_threadCount the number of threads.  0 uses a thread per hardware thread.
+KALEIDOSCOPE_API
+void EvaluateBatch( BatchFunction        i_function,
+                    const double* const* i_columns,
+                    double*              o_output,
+                    size_t               i_rowCount,
+                    size_t               i_threadCount = 1 );
+
+} // namespace kaleidoscope
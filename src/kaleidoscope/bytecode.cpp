@@ -0,0 +1,482 @@
+#include <kaleidoscope/astVisitor.h>
+#include <kaleidoscope/bytecode.h>
+#include <kaleidoscope/logger.h>
+
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+using namespace kaleidoscope;
+
+/// Register returned by the BytecodeCompiler upon failure.
+constexpr uint32_t s_invalidRegister = UINT32_MAX;
+
+/// BytecodeCompiler compiles the body of a function into bytecode.
+///
+/// Registers are allocated as a stack: the value of each expression is in the register returned by its handler,
+/// and temporaries above the value are free once the expression is compiled.  Arguments, loop variables and
+/// 'var' variables are bound to registers, which variable references use directly, and which assignments write.
+class BytecodeCompiler : public ExprVisitor< BytecodeCompiler, uint32_t >
+{
+public:
+    BytecodeCompiler( BytecodeModule& io_module, BytecodeFunction& io_function )
+        : m_module( io_module )
+        , m_function( io_function )
+    {
+    }
+
+    /// Compile a function body, whose arguments are bound to the first registers.
+    bool Compile( const PrototypeAST& i_prototype, ExprAST* i_body )
+    {
+        for ( size_t argIndex = 0; argIndex < i_prototype.GetArguments().GetSize(); ++argIndex )
+        {
+            m_slotRegisters.push_back( allocateRegister() );
+        }
+
+        uint32_t result = Visit( i_body );
+        if ( result == s_invalidRegister )
+        {
+            return false;
+        }
+
+        emit( Opcode_Return, result );
+        return true;
+    }
+
+    uint32_t VisitNumeric( NumericExprAST* i_expr )
+    {
+        return loadConstant( i_expr->GetValue() );
+    }
+
+    uint32_t VisitVariable( VariableExprAST* i_expr )
+    {
+        // Variables are resolved to slots by the parser, which rejects unknown variables.
+        assert( i_expr->GetSlot() < m_slotRegisters.size() );
+        return m_slotRegisters[ i_expr->GetSlot() ];
+    }
+
+    uint32_t VisitBinary( BinaryExprAST* i_expr )
+    {
+        Opcode opcode = Opcode_Count;
+        switch ( i_expr->GetOperation() )
+        {
+        case '+':
+            opcode = Opcode_Add;
+            break;
+        case '-':
+            opcode = Opcode_Subtract;
+            break;
+        case '*':
+            opcode = Opcode_Multiply;
+            break;
+        case '<':
+            opcode = Opcode_Less;
+            break;
+        default:
+            LogError( "Invalid binary operation: %c", i_expr->GetOperation() );
+            return s_invalidRegister;
+        }
+
+        uint32_t top = m_top;
+        uint32_t lhs = Visit( i_expr->GetLHS() );
+        if ( lhs == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+        else if ( lhs < top && i_expr->GetLHS()->HasSideEffects() && i_expr->GetRHS()->HasSideEffects() )
+        {
+            // The left hand side is the register of a mutable variable, which the right hand side may assign, so
+            // its current value is copied.
+            uint32_t value = allocateRegister();
+            emitMove( value, lhs );
+            lhs = value;
+        }
+
+        uint32_t rhs = Visit( i_expr->GetRHS() );
+        if ( rhs == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+
+        // The operands are read before the result is written, so the result may reuse an operand's register.
+        m_top           = top;
+        uint32_t result = allocateRegister();
+        emit( opcode, result, lhs, rhs );
+        return result;
+    }
+
+    uint32_t VisitCall( CallExprAST* i_expr )
+    {
+        BytecodeFunction* callee = m_module.FindFunction( i_expr->GetCallee() );
+        if ( callee == nullptr )
+        {
+            LogError( "Unknown function '%s' referenced.",
+                      m_module.GetSymbolTable().GetName( i_expr->GetCallee() ).c_str() );
+            return s_invalidRegister;
+        }
+
+        ArenaArray< ExprAST* > arguments = i_expr->GetArguments();
+        if ( callee->m_argumentCount != arguments.GetSize() )
+        {
+            LogError( "Function '%s' takes %u arguments, but %zu were passed.",
+                      m_module.GetSymbolTable().GetName( i_expr->GetCallee() ).c_str(),
+                      callee->m_argumentCount,
+                      arguments.GetSize() );
+            return s_invalidRegister;
+        }
+
+        // Arguments are passed in consecutive registers, which are reserved ahead of evaluating them.
+        uint32_t argumentsBegin = m_top;
+        for ( size_t argIndex = 0; argIndex < arguments.GetSize(); ++argIndex )
+        {
+            allocateRegister();
+        }
+
+        for ( size_t argIndex = 0; argIndex < arguments.GetSize(); ++argIndex )
+        {
+            uint32_t top      = m_top;
+            uint32_t argument = Visit( arguments[ argIndex ] );
+            if ( argument == s_invalidRegister )
+            {
+                return s_invalidRegister;
+            }
+
+            emitMove( argumentsBegin + static_cast< uint32_t >( argIndex ), argument );
+            m_top = top;
+        }
+
+        m_top           = argumentsBegin;
+        uint32_t result = allocateRegister();
+        emit( Opcode_Call, result, m_module.GetFunctionIndex( *callee ), argumentsBegin );
+        return result;
+    }
+
+    uint32_t VisitIf( IfExprAST* i_expr )
+    {
+        uint32_t result    = allocateRegister();
+        uint32_t condition = Visit( i_expr->GetCondition() );
+        if ( condition == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+
+        size_t jumpToElse = emit( Opcode_JumpIfFalse, condition );
+        m_top             = result + 1;
+
+        uint32_t thenValue = Visit( i_expr->GetThen() );
+        if ( thenValue == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+
+        emitMove( result, thenValue );
+        size_t jumpToEnd = emit( Opcode_Jump );
+        m_top            = result + 1;
+
+        patchJump( jumpToElse );
+        uint32_t elseValue = Visit( i_expr->GetElse() );
+        if ( elseValue == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+
+        emitMove( result, elseValue );
+        patchJump( jumpToEnd );
+        m_top = result + 1;
+        return result;
+    }
+
+    uint32_t VisitFor( ForExprAST* i_expr )
+    {
+        // Same semantics as the generated code: the body executes at least once, the end condition is evaluated
+        // with the current value of the loop variable, and the loop variable is then incremented.
+        uint32_t result = allocateRegister();
+        uint32_t start  = Visit( i_expr->GetStart() );
+        if ( start == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+
+        m_top             = result + 1;
+        uint32_t variable = allocateRegister();
+        emitMove( variable, start );
+
+        // The loop variable occupies the next slot, for the duration of the loop.
+        assert( i_expr->GetVariableSlot() == m_slotRegisters.size() );
+        m_slotRegisters.push_back( variable );
+
+        uint32_t loopBegin = static_cast< uint32_t >( m_function.m_instructions.size() );
+        uint32_t loopTop   = m_top;
+        if ( Visit( i_expr->GetBody() ) == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+
+        m_top         = loopTop;
+        uint32_t step = i_expr->GetStep() != nullptr ? Visit( i_expr->GetStep() ) : loadConstant( 1.0 );
+        if ( step == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+
+        m_top                 = loopTop;
+        uint32_t nextVariable = allocateRegister();
+        emit( Opcode_Add, nextVariable, variable, step );
+
+        uint32_t endCondition = Visit( i_expr->GetEnd() );
+        if ( endCondition == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+        else if ( endCondition == variable )
+        {
+            // The condition is tested after the loop variable is incremented.
+            uint32_t condition = allocateRegister();
+            emitMove( condition, endCondition );
+            endCondition = condition;
+        }
+
+        emitMove( variable, nextVariable );
+        emit( Opcode_JumpIfTrue, endCondition, loopBegin );
+
+        m_slotRegisters.pop_back();
+
+        // The loop evaluates to 0.0.
+        m_top = result;
+        return loadConstant( 0.0 );
+    }
+
+    uint32_t VisitVar( VarExprAST* i_expr )
+    {
+        // The initializer is evaluated before the variable is bound.
+        uint32_t result  = allocateRegister();
+        uint32_t initial = Visit( i_expr->GetInitializer() );
+        if ( initial == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+
+        m_top             = result + 1;
+        uint32_t variable = allocateRegister();
+        emitMove( variable, initial );
+
+        // The variable occupies the next slot, for the duration of the body.
+        assert( i_expr->GetVariableSlot() == m_slotRegisters.size() );
+        m_slotRegisters.push_back( variable );
+
+        uint32_t body = Visit( i_expr->GetBody() );
+        if ( body == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+
+        m_slotRegisters.pop_back();
+
+        // The body may evaluate to the register of the variable, which is freed.
+        emitMove( result, body );
+        m_top = result + 1;
+        return result;
+    }
+
+    uint32_t VisitAssign( AssignExprAST* i_expr )
+    {
+        uint32_t value = Visit( i_expr->GetValue() );
+        if ( value == s_invalidRegister )
+        {
+            return s_invalidRegister;
+        }
+
+        // The assignment evaluates to the register of the variable, holding the assigned value.
+        uint32_t variable = VisitVariable( i_expr->GetVariable() );
+        emitMove( variable, value );
+        return variable;
+    }
+
+private:
+    /// Load a constant into a new register.
+    uint32_t loadConstant( double i_value )
+    {
+        // Constants are de-duplicated by their bits, so that 0.0 and -0.0 are distinct.
+        uint64_t bits = 0;
+        std::memcpy( &bits, &i_value, sizeof( double ) );
+
+        std::unordered_map< uint64_t, uint32_t >::const_iterator constantIt = m_constantIndices.find( bits );
+        uint32_t                                                  constantIndex = 0;
+        if ( constantIt != m_constantIndices.end() )
+        {
+            constantIndex = constantIt->second;
+        }
+        else
+        {
+            constantIndex = static_cast< uint32_t >( m_function.m_constants.size() );
+            m_function.m_constants.push_back( i_value );
+            m_constantIndices[ bits ] = constantIndex;
+        }
+
+        uint32_t result = allocateRegister();
+        emit( Opcode_LoadConstant, result, constantIndex );
+        return result;
+    }
+
+    /// Allocate the register above the current top of the register stack.
+    uint32_t allocateRegister()
+    {
+        uint32_t reg               = m_top++;
+        m_function.m_registerCount = std::max( m_function.m_registerCount, m_top );
+        return reg;
+    }
+
+    /// Emit an instruction.
+    /// \return the index of the instruction.
+    size_t emit( Opcode i_opcode, uint32_t i_a = 0, uint32_t i_b = 0, uint32_t i_c = 0 )
+    {
+        m_function.m_instructions.push_back( {i_opcode, i_a, i_b, i_c} );
+        return m_function.m_instructions.size() - 1;
+    }
+
+    /// Emit a move between registers, unless they are the same.
+    void emitMove( uint32_t i_destination, uint32_t i_source )
+    {
+        if ( i_destination != i_source )
+        {
+            emit( Opcode_Move, i_destination, i_source );
+        }
+    }
+
+    /// Target a jump at the next instruction to be emitted.
+    void patchJump( size_t i_jump )
+    {
+        m_function.m_instructions[ i_jump ].m_b = static_cast< uint32_t >( m_function.m_instructions.size() );
+    }
+
+    BytecodeModule&   m_module;   /// Module of the callees.
+    BytecodeFunction& m_function; /// Function being compiled.
+
+    uint32_t                                 m_top = 0;         /// Top of the register stack.
+    std::vector< uint32_t >                  m_slotRegisters;   /// Register of the variable of each slot in scope.
+    std::unordered_map< uint64_t, uint32_t > m_constantIndices; /// Index of each constant, by its bits.
+};
+
+} // namespace
+
+namespace kaleidoscope
+{
+BytecodeModule::BytecodeModule( SymbolTable& io_symbolTable )
+    : m_symbolTable( io_symbolTable )
+{
+}
+
+BytecodeFunction* BytecodeModule::DeclareFunction( const PrototypeAST& i_prototype )
+{
+    return declareFunction( i_prototype.GetName(), i_prototype.GetArguments().GetSize() );
+}
+
+BytecodeFunction* BytecodeModule::DefineNativeFunction( SymbolId i_name, size_t i_argumentCount, void* i_address )
+{
+    if ( i_argumentCount > s_maxNativeArguments )
+    {
+        LogError( "Native function '%s' has more than %zu arguments.",
+                  m_symbolTable.GetName( i_name ).c_str(),
+                  s_maxNativeArguments );
+        return nullptr;
+    }
+
+    BytecodeFunction* function = declareFunction( i_name, i_argumentCount );
+    if ( function == nullptr )
+    {
+        return nullptr;
+    }
+
+    if ( !function->m_instructions.empty() || function->m_nativeAddress != nullptr )
+    {
+        LogError( "Function '%s' cannot be redefined", m_symbolTable.GetName( i_name ).c_str() );
+        return nullptr;
+    }
+
+    function->m_nativeAddress = i_address;
+    return function;
+}
+
+BytecodeFunction* BytecodeModule::CompileFunction( const FunctionAST& i_function )
+{
+    const PrototypeAST& prototype = *i_function.GetPrototype();
+    BytecodeFunction*   function  = DeclareFunction( prototype );
+    if ( function == nullptr )
+    {
+        return nullptr;
+    }
+
+    if ( !function->m_instructions.empty() || function->m_nativeAddress != nullptr )
+    {
+        LogError( "Function '%s' cannot be redefined", m_symbolTable.GetName( prototype.GetName() ).c_str() );
+        return nullptr;
+    }
+
+    BytecodeCompiler compiler( *this, *function );
+    if ( !compiler.Compile( prototype, i_function.GetBody() ) )
+    {
+        RemoveFunction( prototype.GetName() );
+        return nullptr;
+    }
+
+    return function;
+}
+
+void BytecodeModule::RemoveFunction( SymbolId i_name )
+{
+    BytecodeFunction* function = FindFunction( i_name );
+    if ( function != nullptr )
+    {
+        function->m_registerCount = 0;
+        function->m_instructions.clear();
+        function->m_constants.clear();
+        function->m_threadedCode.clear();
+        function->m_nativeAddress = nullptr;
+    }
+}
+
+BytecodeFunction* BytecodeModule::FindFunction( SymbolId i_name )
+{
+    std::unordered_map< SymbolId, uint32_t >::const_iterator indexIt = m_functionIndices.find( i_name );
+    return indexIt != m_functionIndices.end() ? &m_functions[ indexIt->second ] : nullptr;
+}
+
+BytecodeFunction& BytecodeModule::GetFunction( size_t i_functionIndex )
+{
+    return m_functions[ i_functionIndex ];
+}
+
+uint32_t BytecodeModule::GetFunctionIndex( const BytecodeFunction& i_function ) const
+{
+    return m_functionIndices.at( i_function.m_name );
+}
+
+BytecodeFunction* BytecodeModule::declareFunction( SymbolId i_name, size_t i_argumentCount )
+{
+    BytecodeFunction* function = FindFunction( i_name );
+    if ( function == nullptr )
+    {
+        m_functionIndices[ i_name ] = static_cast< uint32_t >( m_functions.size() );
+        m_functions.emplace_back();
+        function                  = &m_functions.back();
+        function->m_name          = i_name;
+        function->m_argumentCount = static_cast< uint32_t >( i_argumentCount );
+    }
+    else if ( function->m_argumentCount != i_argumentCount )
+    {
+        // Calls to the function are compiled against its number of arguments.
+        LogError( "Function '%s' redeclared with a different number of arguments.",
+                  m_symbolTable.GetName( i_name ).c_str() );
+        return nullptr;
+    }
+
+    return function;
+}
+
+SymbolTable& BytecodeModule::GetSymbolTable()
+{
+    return m_symbolTable;
+}
+
+} // namespace kaleidoscope
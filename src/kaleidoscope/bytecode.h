@@ -0,0 +1,126 @@
+#pragma once
+
+/* A compact, register-based bytecode, compiled from the AST and executed by the VirtualMachine */
+
+#include <kaleidoscope/api.h>
+#include <kaleidoscope/ast.h>
+#include <kaleidoscope/symbolTable.h>
+
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+namespace kaleidoscope
+{
+/// Opcode identifies the operation of a bytecode instruction.
+///
+/// Registers are the (double) values of the frame of the executing function.  The arguments of a function occupy
+/// its first registers.
+enum Opcode : uint8_t
+{
+    Opcode_LoadConstant = 0, /// r[a] = constants[b]
+    Opcode_Move,             /// r[a] = r[b]
+    Opcode_Add,              /// r[a] = r[b] + r[c]
+    Opcode_Subtract,         /// r[a] = r[b] - r[c]
+    Opcode_Multiply,         /// r[a] = r[b] * r[c]
+    Opcode_Less,             /// r[a] = r[b] < r[c] (or unordered) ? 1.0 : 0.0
+    Opcode_Jump,             /// Continue at instruction b.
+    Opcode_JumpIfFalse,      /// Continue at instruction b, if r[a] is zero or NaN.
+    Opcode_JumpIfTrue,       /// Continue at instruction b, if r[a] is neither zero nor NaN.
+    Opcode_Call,             /// r[a] = functions[b]( r[c], r[c + 1], ... )
+    Opcode_Return,           /// Return r[a] to the caller.
+    Opcode_Count
+};
+
+/// A bytecode instruction, of an opcode and up to 3 operands.
+struct Instruction
+{
+    Opcode   m_opcode; /// Operation.
+    uint32_t m_a;      /// Destination or tested register.
+    uint32_t m_b;      /// Source register, constant index, jump target, or function index.
+    uint32_t m_c;      /// Source register, or first argument register.
+};
+
+/// The maximum number of arguments of a native function called from bytecode.
+constexpr size_t s_maxNativeArguments = 8;
+
+/// BytecodeFunction is a function callable from bytecode, which is either defined as bytecode, or is a native
+/// function (a JIT compiled, or host function) taking and returning doubles.  A function which is neither has
+/// only been declared.
+struct BytecodeFunction
+{
+    SymbolId                   m_name;                    /// Name of the function.
+    uint32_t                   m_argumentCount = 0;       /// Number of arguments.
+    uint32_t                   m_registerCount = 0;       /// Number of registers of a frame, including arguments.
+    std::vector< Instruction > m_instructions;            /// Bytecode, which is empty if not defined as bytecode.
+    std::vector< double >      m_constants;               /// Constants loaded by the bytecode.
+    void*                      m_nativeAddress = nullptr; /// Address of a native function.
+
+    /// Address of the handler of each instruction, which the VirtualMachine fills upon first executing the
+    /// function, so that it dispatches without decoding opcodes.
+    std::vector< const void* > m_threadedCode;
+};
+
+/// BytecodeModule compiles functions into bytecode, and stores the functions callable from bytecode.
+///
+/// Functions are identified by name, and by their index in the module, which calls are compiled against.
+/// An index remains valid for the lifetime of the module, so a call may be compiled to a function which is only
+/// declared, and defined (as bytecode or natively) later on.
+class BytecodeModule
+{
+public:
+    KALEIDOSCOPE_API
+    explicit BytecodeModule( SymbolTable& io_symbolTable );
+
+    /// Declare a function, so that it may be called.
+    /// \return the declared function, or nullptr if it was declared with a different number of arguments.
+    KALEIDOSCOPE_API
+    BytecodeFunction* DeclareFunction( const PrototypeAST& i_prototype );
+
+    /// Define a function as native code, such as a JIT compiled function, or a host function.
+    /// \param i_address address of a function taking i_argumentCount doubles, and returning a double.
+    /// \return the defined function, or nullptr if it is already defined or has too many arguments.
+    KALEIDOSCOPE_API
+    BytecodeFunction* DefineNativeFunction( SymbolId i_name, size_t i_argumentCount, void* i_address );
+
+    /// Compile a function definition into bytecode.
+    /// \return the compiled function, or nullptr if the function is already defined or could not be compiled.
+    KALEIDOSCOPE_API
+    BytecodeFunction* CompileFunction( const FunctionAST& i_function );
+
+    /// Remove the definition of a function, such as the anonymous function of an evaluated top-level expression,
+    /// so that it may be defined again.  The function remains declared.
+    KALEIDOSCOPE_API
+    void RemoveFunction( SymbolId i_name );
+
+    /// Find a function by name.
+    /// \return nullptr if the function is not declared.
+    KALEIDOSCOPE_API
+    BytecodeFunction* FindFunction( SymbolId i_name );
+
+    /// Get a function by its index.
+    KALEIDOSCOPE_API
+    BytecodeFunction& GetFunction( size_t i_functionIndex );
+
+    /// Get the index of a function, which calls to it are compiled against.
+    KALEIDOSCOPE_API
+    uint32_t GetFunctionIndex( const BytecodeFunction& i_function ) const;
+
+    /// Get the table of interned names.
+    KALEIDOSCOPE_API
+    SymbolTable& GetSymbolTable();
+
+private:
+    /// Find or add a function.
+    /// \return nullptr if the function exists, with a different number of arguments.
+    BytecodeFunction* declareFunction( SymbolId i_name, size_t i_argumentCount );
+
+    SymbolTable& m_symbolTable; /// Interned names, shared with the parser.
+
+    /// Functions are never removed, so that their indices and addresses remain stable.
+    std::deque< BytecodeFunction >           m_functions;
+    std::unordered_map< SymbolId, uint32_t > m_functionIndices; /// Index of each function, by name.
+};
+
+} // namespace kaleidoscope
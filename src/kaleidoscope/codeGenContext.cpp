@@ -1,50 +1,170 @@
 #include <kaleidoscope/KaleidoscopeJIT.h>
 #include <kaleidoscope/ast.h>
 #include <kaleidoscope/codeGenContext.h>
+#include <kaleidoscope/hostFunctions.h>
 
-#include <llvm/Transforms/InstCombine/InstCombine.h>
-#include <llvm/Transforms/Scalar.h>
-#include <llvm/Transforms/Scalar/GVN.h>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
-namespace kaleidoscope
+#include <cassert>
+#include <vector>
+
+namespace
 {
-CodeGenContext::CodeGenContext()
-    : m_irBuilder( m_context )
+/// The instructions imported into a module for inlining are capped to this multiple of the inline import limit.
+constexpr size_t s_inlineImportBudgetFactor = 4;
+
+/// A function of the C math library, and the LLVM intrinsic of the same semantics.
+struct MathIntrinsic
 {
+    const char*         m_name;          /// Name of the function.
+    size_t              m_argumentCount; /// Number of arguments of the function.
+    llvm::Intrinsic::ID m_intrinsic;     /// Intrinsic generated for calls to the function.
+};
+
+/// Functions of the C math library which have an intrinsic.  The intrinsics without an instruction of the target are
+/// lowered back into calls to these functions.
+const MathIntrinsic s_mathIntrinsics[] = {
+    {"sin", 1, llvm::Intrinsic::sin},
+    {"cos", 1, llvm::Intrinsic::cos},
+    {"exp", 1, llvm::Intrinsic::exp},
+    {"exp2", 1, llvm::Intrinsic::exp2},
+    {"log", 1, llvm::Intrinsic::log},
+    {"log2", 1, llvm::Intrinsic::log2},
+    {"log10", 1, llvm::Intrinsic::log10},
+    {"sqrt", 1, llvm::Intrinsic::sqrt},
+    {"fabs", 1, llvm::Intrinsic::fabs},
+    {"floor", 1, llvm::Intrinsic::floor},
+    {"ceil", 1, llvm::Intrinsic::ceil},
+    {"trunc", 1, llvm::Intrinsic::trunc},
+    {"round", 1, llvm::Intrinsic::round},
+    {"rint", 1, llvm::Intrinsic::rint},
+    {"nearbyint", 1, llvm::Intrinsic::nearbyint},
+    {"pow", 2, llvm::Intrinsic::pow},
+    {"copysign", 2, llvm::Intrinsic::copysign},
+    {"fmin", 2, llvm::Intrinsic::minnum},
+    {"fmax", 2, llvm::Intrinsic::maxnum},
+    {"fma", 3, llvm::Intrinsic::fma},
+};
+
+/// Clone the body of a function into a declaration of the same type, in another module of the same LLVM context.
+/// The functions called by the body are mapped to the functions of the same name in the module of io_destination,
+/// which are declared as needed.
+void CloneFunctionBody( const llvm::Function& i_source, llvm::Function& io_destination )
+{
+    assert( i_source.getFunctionType() == io_destination.getFunctionType() );
+    llvm::ValueToValueMapTy      valueMap;
+    llvm::Function::arg_iterator destinationArgument = io_destination.arg_begin();
+    for ( const llvm::Argument& argument : i_source.args() )
+    {
+        valueMap[ &argument ] = &*destinationArgument++;
+    }
+
+    // Globals missing from the map would be left referring to the source module.
+    llvm::Module& destinationModule = *io_destination.getParent();
+    valueMap[ &i_source ]           = &io_destination;
+    for ( const llvm::BasicBlock& block : i_source )
+    {
+        for ( const llvm::Instruction& instruction : block )
+        {
+            const llvm::CallInst* call = llvm::dyn_cast< llvm::CallInst >( &instruction );
+            if ( call == nullptr || call->getCalledFunction() == nullptr ||
+                 valueMap.count( call->getCalledFunction() ) )
+            {
+                continue;
+            }
+
+            llvm::Function* callee = call->getCalledFunction();
+            valueMap[ callee ] =
+                destinationModule.getOrInsertFunction( callee->getName(), callee->getFunctionType() ).getCallee();
+        }
+    }
+
+    llvm::SmallVector< llvm::ReturnInst*, 4 > returns;
+    llvm::CloneFunctionInto( &io_destination, &i_source, valueMap, /* ModuleLevelChanges */ true, returns );
 }
 
-void CodeGenContext::Print()
+/// Counts the loops vectorized by the loop vectorizer, from the optimization remarks it emits for them.
+/// Other diagnostics are left to the default handling of the LLVM context.
+class VectorizedLoopCounter : public llvm::DiagnosticHandler
 {
-    assert( m_module != nullptr );
-    m_module->print( llvm::errs(), nullptr );
+public:
+    explicit VectorizedLoopCounter( size_t& io_vectorizedLoopCount )
+        : m_vectorizedLoopCount( io_vectorizedLoopCount )
+    {
+    }
+
+    bool isAnyRemarkEnabled() const override
+    {
+        return true;
+    }
+
+    bool isPassedOptRemarkEnabled( llvm::StringRef i_passName ) const override
+    {
+        return i_passName == "loop-vectorize";
+    }
+
+    bool handleDiagnostics( const llvm::DiagnosticInfo& i_info ) override
+    {
+        const llvm::OptimizationRemark* remark = llvm::dyn_cast< llvm::OptimizationRemark >( &i_info );
+        if ( remark == nullptr )
+        {
+            return false;
+        }
+
+        // A loop which is only interleaved is remarked as "Interleaved".
+        if ( remark->getRemarkName() == "Vectorized" )
+        {
+            m_vectorizedLoopCount += 1;
+        }
+
+        return true;
+    }
+
+private:
+    size_t& m_vectorizedLoopCount; /// Count of the CodeGenContext.
+};
+
+} // namespace
+
+namespace kaleidoscope
+{
+CodeGenContext::CodeGenContext( SymbolTable& io_symbolTable )
+    : m_symbolTable( io_symbolTable )
+    , m_irBuilder( m_context )
+{
+    m_context.setDiagnosticHandler( std::make_unique< VectorizedLoopCounter >( m_vectorizedLoopCount ) );
 }
 
-void CodeGenContext::InitializePassManager()
+void CodeGenContext::Print()
 {
     assert( m_module != nullptr );
-    m_passManager = std::make_unique< llvm::legacy::FunctionPassManager >( m_module.get() );
-    m_passManager->add( llvm::createInstructionCombiningPass() );
-    m_passManager->add( llvm::createReassociatePass() );
-    m_passManager->add( llvm::createGVNPass() );
-    m_passManager->add( llvm::createCFGSimplificationPass() );
-    m_passManager->doInitialization();
+    m_module->print( llvm::errs(), nullptr );
 }
 
 void CodeGenContext::InitializeModule( const std::string& i_targetTriple, llvm::TargetMachine* i_targetMachine )
 {
     assert( m_module == nullptr );
     m_module = std::make_unique< llvm::Module >( "MyModule", m_context );
+    m_moduleGeneration += 1;
     m_module->setDataLayout( i_targetMachine->createDataLayout() );
     m_module->setTargetTriple( i_targetTriple );
-    InitializePassManager();
+    m_targetMachine = i_targetMachine;
 }
 
 void CodeGenContext::InitializeModuleWithJIT( llvm::orc::KaleidoscopeJIT& io_jit )
 {
     assert( m_module == nullptr );
     m_module = std::make_unique< llvm::Module >( "MyModule", m_context );
+    m_moduleGeneration += 1;
     m_module->setDataLayout( io_jit.getTargetMachine().createDataLayout() );
-    InitializePassManager();
+    m_targetMachine = &io_jit.getTargetMachine();
 }
 
 llvm::LLVMContext& CodeGenContext::GetLLVMContext()
@@ -52,6 +172,11 @@ llvm::LLVMContext& CodeGenContext::GetLLVMContext()
     return m_context;
 }
 
+SymbolTable& CodeGenContext::GetSymbolTable()
+{
+    return m_symbolTable;
+}
+
 llvm::IRBuilder<>& CodeGenContext::GetIRBuilder()
 {
     return m_irBuilder;
@@ -69,40 +194,505 @@ std::unique_ptr< llvm::Module > CodeGenContext::MoveModule()
     return std::move( m_module );
 }
 
-std::map< std::string, llvm::Value* >& CodeGenContext::GetNamedValuesInScope()
+std::vector< llvm::Value* >& CodeGenContext::GetSlotValues()
+{
+    return m_slotValues;
+}
+
+llvm::AllocaInst* CodeGenContext::CreateEntryBlockAlloca( SymbolId i_name )
+{
+    // Allocas are placed at the beginning of the entry block, where mem2reg can promote them.
+    llvm::Function*   function   = m_irBuilder.GetInsertBlock()->getParent();
+    llvm::BasicBlock& entryBlock = function->getEntryBlock();
+    llvm::IRBuilder<> entryBuilder( &entryBlock, entryBlock.begin() );
+    return entryBuilder.CreateAlloca(
+        llvm::Type::getDoubleTy( m_context ), nullptr, m_symbolTable.GetName( i_name ) );
+}
+
+void CodeGenContext::GenerateTailCalls( llvm::Function& io_function )
+{
+    std::vector< llvm::ReturnInst* > returns;
+    for ( llvm::BasicBlock& block : io_function )
+    {
+        if ( llvm::ReturnInst* returnInst = llvm::dyn_cast< llvm::ReturnInst >( block.getTerminator() ) )
+        {
+            returns.push_back( returnInst );
+        }
+    }
+
+    while ( !returns.empty() )
+    {
+        llvm::ReturnInst* returnInst = returns.back();
+        returns.pop_back();
+
+        // A block which only returns a phi is folded into the predecessors branching into it unconditionally, such
+        // as the 'then' and 'else' blocks of an 'if'.  The returns of the predecessors are folded in turn, for nested
+        // 'if's.
+        llvm::BasicBlock* block = returnInst->getParent();
+        llvm::PHINode*    phi   = llvm::dyn_cast< llvm::PHINode >( returnInst->getReturnValue() );
+        if ( phi != nullptr && phi->getParent() == block && &block->front() == phi && phi->getNextNode() == returnInst )
+        {
+            for ( llvm::BasicBlock* predecessor : llvm::SmallVector< llvm::BasicBlock*, 4 >( phi->blocks() ) )
+            {
+                llvm::BranchInst* branch = llvm::dyn_cast< llvm::BranchInst >( predecessor->getTerminator() );
+                if ( branch == nullptr || !branch->isUnconditional() )
+                {
+                    continue;
+                }
+
+                llvm::Value* value = phi->getIncomingValueForBlock( predecessor );
+                phi->removeIncomingValue( predecessor, /* DeletePHIIfEmpty */ false );
+                branch->eraseFromParent();
+                returns.push_back( llvm::ReturnInst::Create( m_context, value, predecessor ) );
+            }
+
+            if ( phi->getNumIncomingValues() == 0 )
+            {
+                block->eraseFromParent();
+            }
+
+            continue;
+        }
+
+        // Intrinsics are not called, but lowered into instructions or library calls by the backend.
+        llvm::CallInst* call = llvm::dyn_cast< llvm::CallInst >( returnInst->getReturnValue() );
+        if ( call == nullptr || call->getNextNode() != returnInst || llvm::isa< llvm::IntrinsicInst >( call ) )
+        {
+            continue;
+        }
+
+        // Arguments are passed by value, so the callee never accesses the stack of the caller.
+        bool isSameType = call->getFunctionType() == io_function.getFunctionType() &&
+                          call->getCallingConv() == io_function.getCallingConv();
+        call->setTailCallKind( isSameType ? llvm::CallInst::TCK_MustTail : llvm::CallInst::TCK_Tail );
+    }
+}
+
+void CodeGenContext::SetFloatingPointMode( FloatingPointMode i_mode )
+{
+    // The IR builder stamps its fast-math flags onto every floating point instruction it creates.
+    llvm::FastMathFlags flags;
+    switch ( i_mode )
+    {
+    case FloatingPointMode_Strict:
+        break;
+    case FloatingPointMode_Contract:
+        flags.setAllowContract( true );
+        break;
+    case FloatingPointMode_Fast:
+        flags.setFast();
+        break;
+    }
+
+    m_irBuilder.setFastMathFlags( flags );
+    m_floatingPointMode = i_mode;
+}
+
+FloatingPointMode CodeGenContext::GetFloatingPointMode() const
 {
-    return m_namedValuesInScope;
+    return m_floatingPointMode;
 }
 
-llvm::legacy::FunctionPassManager* CodeGenContext::GetFunctionPassManager()
+void CodeGenContext::SetMathIntrinsics( bool i_enabled )
 {
-    assert( m_passManager != nullptr );
-    return m_passManager.get();
+    m_mathIntrinsics = i_enabled;
 }
 
-llvm::Function* CodeGenContext::GetFunction( const std::string& i_functionName )
+bool CodeGenContext::GetMathIntrinsics() const
 {
-    // Check if the function exists in the *current* module.
-    llvm::Function* func = m_module->getFunction( i_functionName );
-    if ( func != nullptr )
+    return m_mathIntrinsics;
+}
+
+llvm::Function* CodeGenContext::GetMathIntrinsic( SymbolId i_functionName, size_t i_argumentCount )
+{
+    if ( !m_mathIntrinsics )
+    {
+        return nullptr;
+    }
+
+    // A function defined in Kaleidoscope, in this module or a previous one, is called rather than the library.
+    FunctionDeclarationMap::const_iterator declarationIt = m_functionDeclarations.find( i_functionName );
+    if ( declarationIt != m_functionDeclarations.end() && declarationIt->second.m_isDefined )
     {
-        return func;
+        return nullptr;
     }
 
-    // Check for existing declaration from a *different* module, in m_functionPrototypes.
-    FunctionPrototypeMap::const_iterator funcProtoIt = m_functionPrototypes.find( i_functionName );
-    if ( funcProtoIt != m_functionPrototypes.end() )
+    const std::string& functionName = m_symbolTable.GetName( i_functionName );
+    for ( const MathIntrinsic& mathIntrinsic : s_mathIntrinsics )
     {
-        return funcProtoIt->second->GenerateCode( *this );
+        if ( mathIntrinsic.m_argumentCount == i_argumentCount && functionName == mathIntrinsic.m_name )
+        {
+            // The intrinsics are overloaded by type, and Kaleidoscope only has doubles.
+            return llvm::Intrinsic::getDeclaration(
+                m_module.get(), mathIntrinsic.m_intrinsic, {llvm::Type::getDoubleTy( m_context )} );
+        }
     }
 
-    // Could not find prototype.
     return nullptr;
 }
 
-void CodeGenContext::AddFunction( std::unique_ptr< PrototypeAST >& io_prototype )
+size_t CodeGenContext::GetVectorizedLoopCount() const
+{
+    return m_vectorizedLoopCount;
+}
+
+void CodeGenContext::SetOptimizationLevel( OptimizationLevel i_level )
+{
+    m_optimizationLevel = i_level;
+}
+
+OptimizationLevel CodeGenContext::GetOptimizationLevel() const
+{
+    return m_optimizationLevel;
+}
+
+llvm::CodeGenOpt::Level GetCodeGenOptLevel( OptimizationLevel i_level )
+{
+    switch ( i_level )
+    {
+    case OptimizationLevel_O0:
+        return llvm::CodeGenOpt::None;
+    case OptimizationLevel_O1:
+        return llvm::CodeGenOpt::Less;
+    case OptimizationLevel_O2:
+        return llvm::CodeGenOpt::Default;
+    case OptimizationLevel_O3:
+        return llvm::CodeGenOpt::Aggressive;
+    }
+
+    return llvm::CodeGenOpt::Default;
+}
+
+void RunOptimizationPipeline( llvm::Module& io_module, llvm::TargetMachine* i_targetMachine, OptimizationLevel i_level )
+{
+    if ( i_level == OptimizationLevel_O0 )
+    {
+        return;
+    }
+
+    // The vectorizers are enabled from O2, as by clang.
+    llvm::PipelineTuningOptions tuningOptions;
+    tuningOptions.LoopVectorization = i_level >= OptimizationLevel_O2;
+    tuningOptions.SLPVectorization  = i_level >= OptimizationLevel_O2;
+
+    // The target machine provides the cost of instructions, and the width of vectors, to the passes.
+    llvm::PassBuilder             passBuilder( i_targetMachine, tuningOptions );
+    llvm::LoopAnalysisManager     loopAnalysisManager;
+    llvm::FunctionAnalysisManager functionAnalysisManager;
+    llvm::CGSCCAnalysisManager    cgsccAnalysisManager;
+    llvm::ModuleAnalysisManager   moduleAnalysisManager;
+    passBuilder.registerModuleAnalyses( moduleAnalysisManager );
+    passBuilder.registerCGSCCAnalyses( cgsccAnalysisManager );
+    passBuilder.registerFunctionAnalyses( functionAnalysisManager );
+    passBuilder.registerLoopAnalyses( loopAnalysisManager );
+    passBuilder.crossRegisterProxies(
+        loopAnalysisManager, functionAnalysisManager, cgsccAnalysisManager, moduleAnalysisManager );
+
+    llvm::PassBuilder::OptimizationLevel level = llvm::PassBuilder::OptimizationLevel::O2;
+    switch ( i_level )
+    {
+    case OptimizationLevel_O1:
+        level = llvm::PassBuilder::OptimizationLevel::O1;
+        break;
+    case OptimizationLevel_O3:
+        level = llvm::PassBuilder::OptimizationLevel::O3;
+        break;
+    default:
+        break;
+    }
+
+    llvm::ModulePassManager modulePassManager = passBuilder.buildPerModuleDefaultPipeline( level );
+    modulePassManager.run( io_module, moduleAnalysisManager );
+}
+
+llvm::CodeGenOpt::Level CodeGenContext::GetCodeGenOptLevel() const
+{
+    return kaleidoscope::GetCodeGenOptLevel( m_optimizationLevel );
+}
+
+void CodeGenContext::OptimizeModule()
+{
+    assert( m_module != nullptr && m_targetMachine != nullptr );
+    if ( m_optimizationLevel == OptimizationLevel_O0 )
+    {
+        return;
+    }
+
+    ImportInlineCandidates();
+    RunOptimizationPipeline( *m_module, m_targetMachine, m_optimizationLevel );
+    RecordInlineCandidates();
+}
+
+void CodeGenContext::SetInlineImportLimit( size_t i_instructionCount )
+{
+    m_inlineImportLimit = i_instructionCount;
+}
+
+size_t CodeGenContext::GetInlineImportCount() const
+{
+    return m_inlineImportCount;
+}
+
+void CodeGenContext::ImportInlineCandidates()
+{
+    if ( m_inlineImportLimit == 0 || m_inlineLibrary == nullptr )
+    {
+        return;
+    }
+
+    size_t importBudget = m_inlineImportLimit * s_inlineImportBudgetFactor;
+    for ( llvm::Function& function : *m_module )
+    {
+        if ( !function.isDeclaration() || function.use_empty() )
+        {
+            continue;
+        }
+
+        // A candidate of another type was recorded before the function was redeclared with another arity.
+        llvm::Function* candidate = m_inlineLibrary->getFunction( function.getName() );
+        if ( candidate == nullptr || candidate->isDeclaration() ||
+             candidate->getFunctionType() != function.getFunctionType() ||
+             candidate->getInstructionCount() > importBudget )
+        {
+            continue;
+        }
+
+        // The body is only available for inlining.  The function is still called from the module defining it,
+        // where it is not inlined.
+        importBudget -= candidate->getInstructionCount();
+        CloneFunctionBody( *candidate, function );
+        function.setLinkage( llvm::GlobalValue::AvailableExternallyLinkage );
+        m_inlineImportCount += 1;
+    }
+}
+
+void CodeGenContext::RecordInlineCandidates()
+{
+    if ( m_inlineImportLimit == 0 )
+    {
+        return;
+    }
+
+    if ( m_inlineLibrary == nullptr )
+    {
+        m_inlineLibrary = std::make_unique< llvm::Module >( "InlineLibrary", m_context );
+        m_inlineLibrary->setDataLayout( m_module->getDataLayout() );
+    }
+
+    // Top-level expressions are never called, so are not recorded.
+    const std::string& anonymousExprName = m_symbolTable.GetName( Symbol_AnonymousExpr );
+    for ( const llvm::Function& function : *m_module )
+    {
+        if ( function.isDeclaration() || function.hasAvailableExternallyLinkage() ||
+             function.getName() == anonymousExprName )
+        {
+            continue;
+        }
+
+        // The body of a redefined function replaces the previous one.  If the function is now too large, or takes
+        // another number of arguments, the previous body is erased, so that it is not imported in its stead.
+        llvm::Function* candidate = m_inlineLibrary->getFunction( function.getName() );
+        bool            isSmall   = function.getInstructionCount() <= m_inlineImportLimit;
+        if ( candidate != nullptr && ( !isSmall || candidate->getFunctionType() != function.getFunctionType() ) )
+        {
+            EraseInlineCandidate( *candidate );
+            candidate = nullptr;
+        }
+
+        if ( !isSmall )
+        {
+            continue;
+        }
+
+        if ( candidate == nullptr )
+        {
+            candidate = llvm::Function::Create( function.getFunctionType(),
+                                                llvm::Function::ExternalLinkage,
+                                                function.getName(),
+                                                m_inlineLibrary.get() );
+        }
+
+        candidate->deleteBody();
+        CloneFunctionBody( function, *candidate );
+    }
+}
+
+void CodeGenContext::EraseInlineCandidate( llvm::Function& io_candidate )
+{
+    // The bodies calling the candidate were recorded against its previous type, so they are dropped along with it,
+    // and their functions are no longer imported.
+    std::vector< llvm::Function* > callers;
+    for ( llvm::User* user : io_candidate.users() )
+    {
+        if ( llvm::Instruction* instruction = llvm::dyn_cast< llvm::Instruction >( user ) )
+        {
+            callers.push_back( instruction->getFunction() );
+        }
+    }
+
+    for ( llvm::Function* caller : callers )
+    {
+        caller->deleteBody();
+    }
+
+    io_candidate.eraseFromParent();
+}
+
+void CodeGenContext::SetTieredJIT( TieredJIT* io_tieredJIT )
+{
+    m_tieredJIT = io_tieredJIT;
+}
+
+TieredJIT* CodeGenContext::GetTieredJIT()
+{
+    return m_tieredJIT;
+}
+
+void CodeGenContext::SetHostFunctions( const HostFunctionTable* i_hostFunctions )
+{
+    m_hostFunctions = i_hostFunctions;
+}
+
+const HostFunction* CodeGenContext::FindHostFunction( SymbolId i_functionName ) const
+{
+    if ( m_hostFunctions == nullptr )
+    {
+        return nullptr;
+    }
+
+    return m_hostFunctions->Find( m_symbolTable.GetName( i_functionName ) );
+}
+
+llvm::FunctionType* CodeGenContext::GetFunctionType( size_t i_argumentCount )
+{
+    if ( i_argumentCount >= m_functionTypes.size() )
+    {
+        m_functionTypes.resize( i_argumentCount + 1, nullptr );
+    }
+
+    llvm::FunctionType*& functionType = m_functionTypes[ i_argumentCount ];
+    if ( functionType == nullptr )
+    {
+        llvm::Type*                doubleType = llvm::Type::getDoubleTy( m_context );
+        std::vector< llvm::Type* > argumentTypes( i_argumentCount, doubleType );
+        functionType = llvm::FunctionType::get( doubleType, argumentTypes, /* isVarArg */ false );
+    }
+
+    return functionType;
+}
+
+llvm::Function* CodeGenContext::GetFunction( SymbolId i_functionName )
+{
+    FunctionDeclarationMap::iterator declarationIt = m_functionDeclarations.find( i_functionName );
+    if ( declarationIt == m_functionDeclarations.end() )
+    {
+        // Not discoverable by callers, but may exist in the *current* module.
+        return m_module->getFunction( m_symbolTable.GetName( i_functionName ) );
+    }
+
+    // Check for a declaration already made in the *current* module.
+    FunctionDeclaration& declaration = declarationIt->second;
+    if ( declaration.m_moduleGeneration == m_moduleGeneration )
+    {
+        return declaration.m_function;
+    }
+
+    // The function may have been created in the current module without the cache, such as by an extern.
+    // Otherwise, declare it from the prototype, such as a function defined in a *different* module.
+    llvm::Function* function = m_module->getFunction( m_symbolTable.GetName( i_functionName ) );
+    if ( function == nullptr )
+    {
+        function = declaration.m_prototype->GenerateCode( *this );
+        m_declarationCount += 1;
+    }
+
+    if ( function != nullptr && declaration.m_isDefined )
+    {
+        MarkDefined( *function );
+    }
+
+    declaration.m_function         = function;
+    declaration.m_moduleGeneration = m_moduleGeneration;
+    return function;
+}
+
+void CodeGenContext::EraseFunction( SymbolId i_functionName )
+{
+    llvm::Function* function = GetFunction( i_functionName );
+    if ( function == nullptr )
+    {
+        return;
+    }
+
+    FunctionDeclarationMap::iterator declarationIt = m_functionDeclarations.find( i_functionName );
+    if ( declarationIt != m_functionDeclarations.end() )
+    {
+        declarationIt->second.m_function         = nullptr;
+        declarationIt->second.m_moduleGeneration = 0;
+    }
+
+    function->eraseFromParent();
+}
+
+llvm::Value* CodeGenContext::FindExprValue( const ExprAST* i_expr ) const
+{
+    ExprValueMap::const_iterator valueIt = m_exprValues.find( i_expr );
+    return valueIt != m_exprValues.end() ? valueIt->second : nullptr;
+}
+
+void CodeGenContext::AddExprValue( const ExprAST* i_expr, llvm::Value* i_value )
+{
+    if ( m_exprValues.emplace( i_expr, i_value ).second )
+    {
+        m_exprValueLog.push_back( i_expr );
+    }
+}
+
+size_t CodeGenContext::BeginExprValueScope()
+{
+    return m_exprValueLog.size();
+}
+
+void CodeGenContext::EndExprValueScope( size_t i_scope )
+{
+    for ( size_t logIndex = i_scope; logIndex < m_exprValueLog.size(); ++logIndex )
+    {
+        m_exprValues.erase( m_exprValueLog[ logIndex ] );
+    }
+
+    m_exprValueLog.resize( i_scope );
+}
+
+void CodeGenContext::ClearExprValues()
+{
+    m_exprValues.clear();
+    m_exprValueLog.clear();
+}
+
+void CodeGenContext::AddFunction( const PrototypeAST& i_prototype, bool i_isDefinition )
+{
+    ArenaArray< SymbolId > arguments = i_prototype.GetArguments();
+    PrototypeAST*          prototype = m_prototypeArena.Create< PrototypeAST >(
+        i_prototype.GetName(), m_prototypeArena.CopyArray( arguments.begin(), arguments.GetSize() ) );
+    FunctionDeclaration& declaration = m_functionDeclarations[ i_prototype.GetName() ];
+    declaration.m_prototype          = prototype;
+    declaration.m_isDefined          = declaration.m_isDefined || i_isDefinition;
+    if ( i_isDefinition && declaration.m_function != nullptr && declaration.m_moduleGeneration == m_moduleGeneration )
+    {
+        MarkDefined( *declaration.m_function );
+    }
+}
+
+void CodeGenContext::MarkDefined( llvm::Function& io_function )
+{
+    // LLVM recognizes the functions of the C library by name, and would fold or replace calls to a function of the
+    // same name defined in Kaleidoscope as if they were calls to the library.
+    io_function.addFnAttr( llvm::Attribute::NoBuiltin );
+}
+
+size_t CodeGenContext::GetDeclarationCount() const
 {
-    m_functionPrototypes[ io_prototype->GetName() ] = std::move( io_prototype );
+    return m_declarationCount;
 }
 
 } // namespace kaleidoscope
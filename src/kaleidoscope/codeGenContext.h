@@ -1,13 +1,19 @@
 #pragma once
 
 #include <kaleidoscope/api.h>
+#include <kaleidoscope/astArena.h>
+#include <kaleidoscope/symbolTable.h>
 
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
-#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Support/CodeGen.h>
+
+#include <unordered_map>
+#include <vector>
 
 namespace llvm
 {
+class Module;
 class TargetMachine;
 namespace orc
 {
@@ -18,7 +24,43 @@ class KaleidoscopeJIT;
 namespace kaleidoscope
 {
 
+class ExprAST;
+class HostFunctionTable;
 class PrototypeAST;
+class TieredJIT;
+struct HostFunction;
+
+/// FloatingPointMode selects the semantics of the floating point instructions of generated code.
+enum FloatingPointMode
+{
+    FloatingPointMode_Strict = 0, /// Each operation is rounded, in the order of the source.
+    FloatingPointMode_Contract,   /// Multiplications may be fused with additions, such as into FMA instructions.
+    FloatingPointMode_Fast        /// Operations may be reordered, and values are assumed finite, as by -ffast-math.
+};
+
+/// OptimizationLevel selects the optimization pipeline of generated modules, as the -O options of a compiler.
+enum OptimizationLevel
+{
+    OptimizationLevel_O0 = 0, /// No IR passes, and the fastest instruction selection.
+    OptimizationLevel_O1,     /// Fast optimizations, which keep compilation quick.
+    OptimizationLevel_O2,     /// Most optimizations, including the loop and SLP vectorizers.
+    OptimizationLevel_O3      /// Every optimization, including those which increase code size.
+};
+
+/// Get the level of machine code generation matching an optimization level.
+KALEIDOSCOPE_API
+llvm::CodeGenOpt::Level GetCodeGenOptLevel( OptimizationLevel i_level );
+
+/// Run the default pipeline of the new pass manager for an optimization level over a module, which runs no passes
+/// at OptimizationLevel_O0.  The vectorizers are enabled from OptimizationLevel_O2.
+/// \param io_module the module to optimize.
+/// \param i_targetMachine the target of the module, which provides the cost of instructions, and the width of
+/// vectors, to the passes.
+/// \param i_level the optimization level.
+KALEIDOSCOPE_API
+void RunOptimizationPipeline( llvm::Module&        io_module,
+                              llvm::TargetMachine* i_targetMachine,
+                              OptimizationLevel    i_level );
 
 /// CodeGenContext is a structure storing the internal state
 /// of the generated IR code, and various LLVM objects which
@@ -28,18 +70,20 @@ class PrototypeAST;
 /// - LLVM context
 /// - a module.
 /// - an IR builder.
-/// - a function pass manager.
 ///
-/// The module and function pass manager are not initialized upon CodeGenContext construction,
+/// The module is not initialized upon CodeGenContext construction,
 /// Use InitializeModule() in situations which only demand IR and/or object code generation.
 /// Or, use InitializeModuleWithJIT() in situations which require both IR code generation and JIT execution.
 ///
 /// MoveModule() facilitates ownership transfer of its module over to the JIT engine.
+///
+/// Names are referred to by their SymbolId in the SymbolTable shared with the Parser, which must outlive
+/// the CodeGenContext.
 class CodeGenContext
 {
 public:
     KALEIDOSCOPE_API
-    CodeGenContext();
+    explicit CodeGenContext( SymbolTable& io_symbolTable );
 
     /// Print out the generated IR code described in the module thus far.
     KALEIDOSCOPE_API
@@ -49,6 +93,10 @@ public:
     KALEIDOSCOPE_API
     llvm::LLVMContext& GetLLVMContext();
 
+    /// Get the table of interned names.
+    KALEIDOSCOPE_API
+    SymbolTable& GetSymbolTable();
+
     /// Get the LLVM IR Builder.
     KALEIDOSCOPE_API
     llvm::IRBuilder<>& GetIRBuilder();
@@ -69,41 +117,242 @@ public:
     KALEIDOSCOPE_API
     std::unique_ptr< llvm::Module > MoveModule();
 
-    /// Get all the named values in scope.
+    /// Get the values of the variables in scope, indexed by the slot of each variable (see VariableExprAST).
+    KALEIDOSCOPE_API
+    std::vector< llvm::Value* >& GetSlotValues();
+
+    /// Find the value generated for an expression without side effects, which may be reused by another
+    /// occurrence of the same (shared) expression node.
+    /// \return nullptr if the expression has not been generated in the current scope.
+    KALEIDOSCOPE_API
+    llvm::Value* FindExprValue( const ExprAST* i_expr ) const;
+
+    /// Record the value generated for an expression without side effects.
+    KALEIDOSCOPE_API
+    void AddExprValue( const ExprAST* i_expr, llvm::Value* i_value );
+
+    /// Begin a scope of expression values, for code which is conditionally executed.
+    /// Values generated within the scope do not dominate the code following it, so are forgotten upon
+    /// EndExprValueScope.  Values generated prior to the scope remain available within it.
+    /// \return the scope, to pass to EndExprValueScope.
+    KALEIDOSCOPE_API
+    size_t BeginExprValueScope();
+
+    KALEIDOSCOPE_API
+    void EndExprValueScope( size_t i_scope );
+
+    /// Forget all the expression values, at the beginning of a function.
+    KALEIDOSCOPE_API
+    void ClearExprValues();
+
+    /// Create the stack storage of a mutable variable, in the entry block of the function being generated.
+    KALEIDOSCOPE_API
+    llvm::AllocaInst* CreateEntryBlockAlloca( SymbolId i_name );
+
+    /// Return directly from the calls in tail position of a generated function, and mark them as tail calls.
+    ///
+    /// The value of an 'if' in tail position is merged by a phi, which is returned.  Its 'then' and 'else' blocks
+    /// are made to return their values directly, so that a call producing the value is immediately followed by a
+    /// return.  Such a call is marked musttail when its callee has the same type as the function, which guarantees
+    /// that it reuses the stack frame of the function, at any optimization level.  Otherwise, it is marked tail, and
+    /// is left to the target.  The TailCallElim pass of OptimizeModule then turns self-recursion into loops.
+    KALEIDOSCOPE_API
+    void GenerateTailCalls( llvm::Function& io_function );
+
+    /// Set the optimization level of the modules, which OptimizeModule runs the pipeline of.
+    KALEIDOSCOPE_API
+    void SetOptimizationLevel( OptimizationLevel i_level );
+
+    /// Get the optimization level of the modules.
+    KALEIDOSCOPE_API
+    OptimizationLevel GetOptimizationLevel() const;
+
+    /// Get the level of machine code generation matching the optimization level, to compile the modules with.
+    KALEIDOSCOPE_API
+    llvm::CodeGenOpt::Level GetCodeGenOptLevel() const;
+
+    /// Optimize the current module as a whole, with the default pipeline of the new pass manager for the
+    /// optimization level.  Above OptimizationLevel_O0, the pipeline promotes mutable variables into registers,
+    /// inlines calls to the functions defined in the module, propagates constants (SCCP), optimizes loops, and
+    /// removes unused globals.  From OptimizationLevel_O2, it also runs the loop and SLP vectorizers.  Loops of
+    /// floating point reductions are only vectorized with FloatingPointMode_Fast, as vectorizing reorders them.
+    KALEIDOSCOPE_API
+    void OptimizeModule();
+
+    /// Set the size of the functions which OptimizeModule imports into the modules calling them, so that they can be
+    /// inlined across modules, such as the definitions of an interpreter which are each compiled in their own module.
+    ///
+    /// OptimizeModule keeps a copy of the optimized IR of each function of up to i_instructionCount instructions.
+    /// Later modules declaring such a function import its body as available_externally, which the inliner may
+    /// inline, and which is otherwise discarded rather than compiled again.  The imports of a module are capped to
+    /// a few times i_instructionCount, to bound the growth of its code.
+    ///
+    /// \param i_instructionCount the maximum instructions of an imported function.  0, the default, disables
+    /// importing, for a single module compiled ahead of time.
+    KALEIDOSCOPE_API
+    void SetInlineImportLimit( size_t i_instructionCount );
+
+    /// Get the number of functions imported by OptimizeModule for inlining, into all the modules of the context thus
+    /// far.
+    KALEIDOSCOPE_API
+    size_t GetInlineImportCount() const;
+
+    /// Set the semantics of the floating point instructions generated from then on.
+    KALEIDOSCOPE_API
+    void SetFloatingPointMode( FloatingPointMode i_mode );
+
+    /// Get the semantics of the floating point instructions being generated.
     KALEIDOSCOPE_API
-    std::map< std::string, llvm::Value* >& GetNamedValuesInScope();
+    FloatingPointMode GetFloatingPointMode() const;
 
-    /// Get the function pass manager.
+    /// Set whether calls to the functions of the C math library, such as sin and sqrt, are generated as the LLVM
+    /// intrinsics of the same semantics, which is the default.
+    ///
+    /// Unlike calls to external functions, intrinsics are constant folded, hoisted out of loops and vectorized, and
+    /// some are single instructions, such as sqrt and floor.  As the builtins of a C compiler, the names of the math
+    /// library are then assumed to refer to it, unless a function of that name is defined in Kaleidoscope, which is
+    /// then called instead.  This is disabled to call host functions of those names which differ from the library.
     KALEIDOSCOPE_API
-    llvm::legacy::FunctionPassManager* GetFunctionPassManager();
+    void SetMathIntrinsics( bool i_enabled );
 
-    /// Generate code from an existing function prototype
-    llvm::Function* GetFunction( const std::string& i_functionName );
+    /// Get whether calls to the functions of the C math library are generated as LLVM intrinsics.
+    KALEIDOSCOPE_API
+    bool GetMathIntrinsics() const;
+
+    /// Get the LLVM intrinsic of a function of the C math library, declared in the current module.
+    /// \param i_functionName the name of the called function.
+    /// \param i_argumentCount the number of arguments of the call.
+    /// \return nullptr if math intrinsics are disabled, the function was given a definition (see AddFunction), or
+    /// it has no intrinsic of that many arguments.
+    KALEIDOSCOPE_API
+    llvm::Function* GetMathIntrinsic( SymbolId i_functionName, size_t i_argumentCount );
+
+    /// Get the number of loops vectorized by OptimizeModule, in all the modules of the context thus far.
+    KALEIDOSCOPE_API
+    size_t GetVectorizedLoopCount() const;
+
+    /// Set the tiered JIT which the generated code is compiled by, or nullptr if it is not compiled by one.
+    /// Functions are then generated for its baseline tier, which runs no IR passes, and calls to the functions
+    /// declared by it are made through their stubs.
+    KALEIDOSCOPE_API
+    void SetTieredJIT( TieredJIT* io_tieredJIT );
+
+    /// Get the tiered JIT which the generated code is compiled by.
+    /// \return nullptr if the generated code is not compiled by a tiered JIT.
+    KALEIDOSCOPE_API
+    TieredJIT* GetTieredJIT();
+
+    /// Set the host functions callable by the generated code, or nullptr if there are none.
+    /// Their declarations are generated with their attributes, and they cannot be defined by the generated code.
+    /// The table is not copied, so it must outlive the context.
+    KALEIDOSCOPE_API
+    void SetHostFunctions( const HostFunctionTable* i_hostFunctions );
+
+    /// Find a host function by name.
+    /// \return nullptr if no host function table is set, or the function is not registered in it.
+    KALEIDOSCOPE_API
+    const HostFunction* FindHostFunction( SymbolId i_functionName ) const;
+
+    /// Get the type of a function taking i_argumentCount doubles, and returning a double.
+    /// Each type is created once, and reused by every module of the context.
+    KALEIDOSCOPE_API
+    llvm::FunctionType* GetFunctionType( size_t i_argumentCount );
+
+    /// Get a function of the current module, declaring it from its prototype if it was added by AddFunction, but
+    /// not yet declared in the current module, such as a function defined in a previous module.
+    /// The declaration is cached, so subsequent calls within the same module do not look up the name.
+    /// \return nullptr if the function is unknown.
+    KALEIDOSCOPE_API
+    llvm::Function* GetFunction( SymbolId i_functionName );
+
+    /// Erase a function from the current module, such as a definition which failed to generate.
+    KALEIDOSCOPE_API
+    void EraseFunction( SymbolId i_functionName );
 
     /// Add a function prototype to be discoverable by callers.
+    /// The prototype is copied, so it may be freed along with the rest of its AST.
+    /// \param i_isDefinition whether the prototype is of a definition, rather than of an extern.  A function which
+    /// was ever defined is no longer called as a math intrinsic (see GetMathIntrinsic), even if declared again.
     KALEIDOSCOPE_API
-    void AddFunction( std::unique_ptr< PrototypeAST >& io_prototype );
+    void AddFunction( const PrototypeAST& i_prototype, bool i_isDefinition );
+
+    /// Get the number of function declarations materialized from prototypes, into all the modules of the
+    /// context thus far.
+    KALEIDOSCOPE_API
+    size_t GetDeclarationCount() const;
 
 private:
-    /// Used internally for setting up optimization passes.
-    void InitializePassManager();
+    /// Import the bodies of the functions declared by the current module from the inline library, within the budget.
+    void ImportInlineCandidates();
+
+    /// Copy the small functions defined by the current module into the inline library.
+    void RecordInlineCandidates();
+
+    /// Erase a function of the inline library which is stale, along with the bodies calling it.
+    void EraseInlineCandidate( llvm::Function& io_candidate );
 
-    llvm::LLVMContext m_context;   /// Storage of LLVM internals.
-    llvm::IRBuilder<> m_irBuilder; /// Helper object for generating instructions.
+    /// Mark a function defined in Kaleidoscope, or its declaration, as not being a function of the C library.
+    void MarkDefined( llvm::Function& io_function );
 
-    /// Manager all the optimization passes.
-    std::unique_ptr< llvm::legacy::FunctionPassManager > m_passManager = nullptr;
+    SymbolTable&      m_symbolTable; /// Interned names, shared with the parser.
+    llvm::LLVMContext m_context;     /// Storage of LLVM internals.
+    llvm::IRBuilder<> m_irBuilder;   /// Helper object for generating instructions.
+
+    /// Target of the current module, which the optimization pipeline queries for the cost of instructions.
+    llvm::TargetMachine* m_targetMachine = nullptr;
+
+    /// Tiered JIT which the generated code is compiled by, if any.
+    TieredJIT* m_tieredJIT = nullptr;
+
+    /// Host functions callable by the generated code, if any.
+    const HostFunctionTable* m_hostFunctions = nullptr;
+
+    FloatingPointMode m_floatingPointMode   = FloatingPointMode_Strict; /// Semantics of floating point instructions.
+    OptimizationLevel m_optimizationLevel   = OptimizationLevel_O2;     /// Optimization pipeline of the modules.
+    size_t            m_vectorizedLoopCount = 0;                        /// Loops vectorized by OptimizeModule.
+    bool              m_mathIntrinsics      = true;                     /// Call math functions as intrinsics.
 
     /// Top-level container for functions and global variables.
     std::unique_ptr< llvm::Module > m_module = nullptr;
 
-    /// Keeps track of values defined in the scope, mapped to their IR.
-    /// Currently, only function parameters are referencable.
-    std::map< std::string, llvm::Value* > m_namedValuesInScope;
+    /// Values of the variables in scope, indexed by slot: the function arguments, followed by the variables of the
+    /// enclosing loops.
+    std::vector< llvm::Value* > m_slotValues;
+
+    /// Values generated for expressions without side effects, in the current scope.
+    /// m_exprValueLog records the order in which they were added, so that a scope can forget the values added
+    /// within it.
+    using ExprValueMap = std::unordered_map< const ExprAST*, llvm::Value* >;
+    ExprValueMap                  m_exprValues;
+    std::vector< const ExprAST* > m_exprValueLog;
+
+    /// Identifies the current module, so that the declarations of previous modules are not reused.
+    size_t m_moduleGeneration = 0;
+
+    /// A function discoverable by callers, and its declaration in the current module.
+    struct FunctionDeclaration
+    {
+        PrototypeAST*   m_prototype        = nullptr; /// Prototype of the function.
+        llvm::Function* m_function         = nullptr; /// Declaration, if m_moduleGeneration is current.
+        size_t          m_moduleGeneration = 0;       /// Generation of the module of m_function.
+        bool            m_isDefined        = false;   /// Whether the function was ever defined, not only by externs.
+    };
 
     /// Tracks existing function prototypes which are declared.
-    using FunctionPrototypeMap = std::map< std::string, std::unique_ptr< PrototypeAST > >;
-    FunctionPrototypeMap m_functionPrototypes;
+    /// The prototypes are copied into an arena owned by this context, as they outlive the AST they were parsed into.
+    using FunctionDeclarationMap = std::unordered_map< SymbolId, FunctionDeclaration >;
+    FunctionDeclarationMap m_functionDeclarations;
+    ASTArena               m_prototypeArena;
+    size_t                 m_declarationCount = 0; /// Number of declarations materialized from prototypes.
+
+    /// Optimized functions of previous modules, which are small enough to be imported for inlining.
+    /// It is a module of the LLVM context of this CodeGenContext, so that its functions can be cloned directly.
+    std::unique_ptr< llvm::Module > m_inlineLibrary;
+    size_t                          m_inlineImportLimit = 0; /// Maximum instructions of an imported function.
+    size_t                          m_inlineImportCount = 0; /// Number of functions imported thus far.
+
+    /// Function types, indexed by their number of arguments.
+    std::vector< llvm::FunctionType* > m_functionTypes;
 };
 
 } // namespace kaleidoscope
@@ -0,0 +1,222 @@
+#include <kaleidoscope/KaleidoscopeJIT.h>
+#include <kaleidoscope/batchEvaluator.h>
+#include <kaleidoscope/codeGenContext.h>
+#include <kaleidoscope/engine.h>
+#include <kaleidoscope/logger.h>
+#include <kaleidoscope/parser.h>
+#include <kaleidoscope/simplifier.h>
+
+#include <llvm/Support/TargetSelect.h>
+
+namespace kaleidoscope
+{
+/// The machine code of a compiled source, and the arity of the functions it defines.
+/// Each source is compiled by a JIT of its own, so destroying the JIT frees exactly the machine code of the source.
+class CompiledModule
+{
+public:
+    /// Look up the machine code of a function.
+    /// \param i_functionName the name of the function.
+    /// \param i_argumentCount the number of arguments the function is called with.
+    /// \param i_symbolPrefix the prefix of the symbol to look up, such as "__batch_" for the batch function.
+    /// \return the address of the symbol, or 0 if the function is not defined, or its arity is not i_argumentCount.
+    uintptr_t GetFunctionAddress( std::string_view i_functionName,
+                                  size_t           i_argumentCount,
+                                  std::string_view i_symbolPrefix = "" );
+
+    llvm::orc::KaleidoscopeJIT                m_jit;              /// JIT owning the machine code.
+    std::unordered_map< std::string, size_t > m_functionArities; /// Argument counts of the defined functions.
+};
+
+namespace
+{
+/// Parse, optimize, and JIT compile a source, which may call the host functions of i_hostFunctions, along with the
+/// batch function of each of its functions.
+/// \param io_vectorizedLoopCount incremented by the number of loops vectorized.
+/// \return the compiled source, or nullptr if it failed to compile.
+std::shared_ptr< CompiledModule > CompileModule( std::string_view         i_source,
+                                                 const HostFunctionTable& i_hostFunctions,
+                                                 size_t&                  io_vectorizedLoopCount )
+{
+    std::shared_ptr< CompiledModule > module = std::make_shared< CompiledModule >();
+    i_hostFunctions.AddToJIT( module->m_jit );
+
+    SymbolTable    symbolTable;
+    Parser         parser( i_source, symbolTable );
+    CodeGenContext codeGenContext( symbolTable );
+    codeGenContext.SetHostFunctions( &i_hostFunctions );
+    codeGenContext.InitializeModuleWithJIT( module->m_jit );
+    while ( parser.ParseCurrentToken() != Token_Eof )
+    {
+        switch ( parser.ParseCurrentToken() )
+        {
+        case ';': // ignore top-level semicolons.
+            parser.ParseNextToken();
+            break;
+        case Token_Def:
+        {
+            FunctionAST* expr = parser.ParseDefinitionExpr();
+            if ( expr == nullptr )
+            {
+                return nullptr;
+            }
+
+            expr = SimplifyFunction( expr, parser.GetInterner(), SimplifyMode_Strict );
+            const PrototypeAST& prototype = *expr->GetPrototype();
+            if ( expr->GenerateCode( codeGenContext ) == nullptr ||
+                 GenerateBatchFunction( codeGenContext, prototype.GetName() ) == nullptr )
+            {
+                return nullptr;
+            }
+
+            const std::string&  functionName = symbolTable.GetName( prototype.GetName() );
+            module->m_functionArities[ functionName ] = prototype.GetArguments().GetSize();
+            break;
+        }
+        case Token_Extern:
+        {
+            PrototypeAST* expr = parser.ParseExternExpr();
+            if ( expr == nullptr || expr->GenerateCode( codeGenContext ) == nullptr )
+            {
+                return nullptr;
+            }
+
+            codeGenContext.AddFunction( *expr, /* isDefinition */ false );
+            break;
+        }
+        default:
+            // A top-level expression would be evaluated once, when there is no caller to return its value to.
+            LogError( "Expected a definition or an extern." );
+            return nullptr;
+        }
+    }
+
+    codeGenContext.OptimizeModule();
+    io_vectorizedLoopCount += codeGenContext.GetVectorizedLoopCount();
+    module->m_jit.addModule( codeGenContext.MoveModule(), codeGenContext.GetCodeGenOptLevel() );
+    return module;
+}
+
+} // namespace
+
+uintptr_t CompiledModule::GetFunctionAddress( std::string_view i_functionName,
+                                              size_t           i_argumentCount,
+                                              std::string_view i_symbolPrefix )
+{
+    // The arity is checked against the prototype, as the native function is called with i_argumentCount arguments.
+    std::string                                         functionName( i_functionName );
+    std::unordered_map< std::string, size_t >::iterator arityIt = m_functionArities.find( functionName );
+    if ( arityIt == m_functionArities.end() )
+    {
+        LogError( "The source does not define a function '%s'.", functionName.c_str() );
+        return 0;
+    }
+
+    if ( arityIt->second != i_argumentCount )
+    {
+        LogError( "Function '%s' takes %zu arguments, rather than %zu.",
+                  functionName.c_str(),
+                  arityIt->second,
+                  i_argumentCount );
+        return 0;
+    }
+
+    return m_jit.getSymbolAddress( std::string( i_symbolPrefix ) + functionName );
+}
+
+bool BatchEvaluator::Evaluate( std::string_view     i_functionName,
+                               const double* const* i_columns,
+                               size_t               i_columnCount,
+                               double*              o_output,
+                               size_t               i_rowCount,
+                               size_t               i_threadCount ) const
+{
+    if ( m_module == nullptr )
+    {
+        LogError( "The batch evaluator has no compiled source." );
+        return false;
+    }
+
+    // The batch function loads a column per argument, so the arity is checked against the number of columns.
+    uintptr_t address = m_module->GetFunctionAddress( i_functionName, i_columnCount, "__batch_" );
+    if ( address == 0 )
+    {
+        return false;
+    }
+
+    EvaluateBatch( reinterpret_cast< BatchFunction >( address ), i_columns, o_output, i_rowCount, i_threadCount );
+    return true;
+}
+
+Engine::Engine()
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    m_hostFunctions.RegisterMathFunctions();
+}
+
+Engine::~Engine() = default;
+
+HostFunctionTable& Engine::GetHostFunctions()
+{
+    return m_hostFunctions;
+}
+
+size_t Engine::GetCompileCount() const
+{
+    return m_compileCount;
+}
+
+size_t Engine::GetVectorizedLoopCount() const
+{
+    return m_vectorizedLoopCount;
+}
+
+BatchEvaluator Engine::CompileBatch( std::string_view i_source )
+{
+    return BatchEvaluator( compileModule( i_source ) );
+}
+
+std::shared_ptr< CompiledModule > Engine::compileModule( std::string_view i_source )
+{
+    std::weak_ptr< CompiledModule >&  cachedModule = m_cache[ std::string( i_source ) ];
+    std::shared_ptr< CompiledModule > module       = cachedModule.lock();
+    if ( module == nullptr )
+    {
+        module = CompileModule( i_source, m_hostFunctions, m_vectorizedLoopCount );
+        if ( module == nullptr )
+        {
+            m_cache.erase( std::string( i_source ) );
+            return nullptr;
+        }
+
+        cachedModule = module;
+        m_compileCount += 1;
+
+        // Forget the sources whose machine code was freed.
+        for ( auto cacheIt = m_cache.begin(); cacheIt != m_cache.end(); )
+        {
+            cacheIt = cacheIt->second.expired() ? m_cache.erase( cacheIt ) : std::next( cacheIt );
+        }
+    }
+
+    return module;
+}
+
+uintptr_t Engine::compileFunction( std::string_view                   i_source,
+                                   std::string_view                   i_functionName,
+                                   size_t                             i_argumentCount,
+                                   std::shared_ptr< CompiledModule >& o_module )
+{
+    o_module = compileModule( i_source );
+    if ( o_module == nullptr )
+    {
+        return 0;
+    }
+
+    return o_module->GetFunctionAddress( i_functionName, i_argumentCount );
+}
+
+} // namespace kaleidoscope
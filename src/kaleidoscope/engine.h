@@ -0,0 +1,205 @@
+#pragma once
+
+/* Embedding API, which compiles sources into strongly typed native functions */
+
+#include <kaleidoscope/api.h>
+#include <kaleidoscope/hostFunctions.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+
+namespace kaleidoscope
+{
+/// The machine code of a compiled source, shared by the Compiled handles of its functions.
+class CompiledModule;
+
+/// Compiled is a handle to a native function compiled by an Engine, which is called as a function of signature Sig.
+///
+/// Kaleidoscope functions take and return doubles, so Sig must be of the form double( double, ... ).
+template < class Sig >
+class Compiled
+{
+    static_assert( !std::is_same< Sig, Sig >::value, "Compiled functions take and return doubles." );
+};
+
+template < class... Args >
+class Compiled< double( Args... ) >
+{
+    static_assert( std::conjunction< std::is_same< Args, double >... >::value,
+                   "Compiled functions take and return doubles." );
+
+public:
+    /// Native function pointer of the compiled function.
+    using FunctionPointer = double ( * )( Args... );
+
+    /// Number of arguments of the compiled function.
+    static constexpr size_t s_argumentCount = sizeof...( Args );
+
+    /// An empty handle, which is not callable.
+    Compiled() = default;
+
+    /// Whether the handle refers to a compiled function, which is false if compilation failed.
+    explicit operator bool() const
+    {
+        return m_function != nullptr;
+    }
+
+    /// Call the compiled function, directly through its native function pointer.
+    double operator()( Args... i_arguments ) const
+    {
+        return m_function( i_arguments... );
+    }
+
+    /// Get the native function pointer, which is valid as long as a handle to its source is held.
+    FunctionPointer GetFunctionPointer() const
+    {
+        return m_function;
+    }
+
+private:
+    friend class Engine;
+
+    Compiled( FunctionPointer i_function, std::shared_ptr< CompiledModule > i_module )
+        : m_function( i_function )
+        , m_module( std::move( i_module ) )
+    {
+    }
+
+    FunctionPointer                   m_function = nullptr; /// Native function.
+    std::shared_ptr< CompiledModule > m_module;             /// Keeps the machine code of the function alive.
+};
+
+/// BatchEvaluator is a handle to a source compiled by an Engine, which evaluates its functions over many rows of
+/// columnar inputs, with their batch functions.
+class BatchEvaluator
+{
+public:
+    /// An empty handle, which evaluates no function.
+    BatchEvaluator() = default;
+
+    /// Whether the handle refers to a compiled source, which is false if compilation failed.
+    explicit operator bool() const
+    {
+        return m_module != nullptr;
+    }
+
+    /// Evaluate a function of the source over every row of a batch.
+    ///
+    /// \param i_functionName the name of the function.
+    /// \param i_columns a column per argument of the function, each of i_rowCount values.
+    /// \param i_columnCount the number of columns, which must be the number of arguments of the function.
+    /// \param o_output the column receiving the i_rowCount results.  It must not overlap the input columns.
+    /// \param i_rowCount the number of rows.
+    /// \param i_threadCount the number of threads evaluating the rows.  0 uses a thread per hardware thread.
+    /// \return false if the source does not define a function of that name taking i_columnCount arguments, in which
+    /// case o_output is left untouched.
+    KALEIDOSCOPE_API
+    bool Evaluate( std::string_view     i_functionName,
+                   const double* const* i_columns,
+                   size_t               i_columnCount,
+                   double*              o_output,
+                   size_t               i_rowCount,
+                   size_t               i_threadCount = 1 ) const;
+
+private:
+    friend class Engine;
+
+    explicit BatchEvaluator( std::shared_ptr< CompiledModule > i_module )
+        : m_module( std::move( i_module ) )
+    {
+    }
+
+    std::shared_ptr< CompiledModule > m_module; /// Keeps the machine code of the source alive.
+};
+
+/// Engine compiles Kaleidoscope sources into native functions, for embedding into a host application.
+///
+/// Each source is parsed, optimized and JIT compiled as a module of its own, so the functions of different
+/// sources do not collide.  A source may only contain definitions and externs.  Its machine code is freed once
+/// every Compiled handle to its functions is destroyed, which may outlive the Engine.
+///
+/// Compiled sources are cached, so that compiling another function of a source, or compiling a source again,
+/// reuses its machine code while a handle to it is held.
+///
+/// The externs of a source are resolved through the host functions of the Engine, which include the C math library.
+/// Functions are registered before compiling the sources calling them, as cached sources are not compiled again.
+///
+/// Every function of a source is also compiled into a batch function (see GenerateBatchFunction), which evaluates it
+/// over many rows of columnar inputs through a BatchEvaluator.
+///
+/// Engine is not thread-safe, but the compiled functions may be called from any thread.
+class Engine
+{
+public:
+    KALEIDOSCOPE_API
+    Engine();
+
+    KALEIDOSCOPE_API
+    ~Engine();
+
+    /// Compile a source, and get one of its functions.
+    ///
+    /// \param i_source the source defining the function.
+    /// \param i_functionName the name of the function.
+    /// \return a handle to the function, which is empty if the source failed to compile, or does not define a
+    /// function of that name taking as many arguments as Sig.
+    template < class Sig >
+    Compiled< Sig > Compile( std::string_view i_source, std::string_view i_functionName )
+    {
+        std::shared_ptr< CompiledModule > module;
+        uintptr_t address = compileFunction( i_source, i_functionName, Compiled< Sig >::s_argumentCount, module );
+        if ( address == 0 )
+        {
+            return Compiled< Sig >();
+        }
+
+        return Compiled< Sig >( reinterpret_cast< typename Compiled< Sig >::FunctionPointer >( address ),
+                                std::move( module ) );
+    }
+
+    /// Compile a source, and get a handle evaluating its functions over batches of rows.
+    ///
+    /// \param i_source the source defining the functions.
+    /// \return a handle to the source, which is empty if the source failed to compile.
+    KALEIDOSCOPE_API
+    BatchEvaluator CompileBatch( std::string_view i_source );
+
+    /// Get the host functions callable by the compiled sources, to register functions of the application.
+    KALEIDOSCOPE_API
+    HostFunctionTable& GetHostFunctions();
+
+    /// Get the number of sources compiled thus far, excluding those found in the cache.
+    KALEIDOSCOPE_API
+    size_t GetCompileCount() const;
+
+    /// Get the number of loops vectorized while compiling the sources thus far.
+    KALEIDOSCOPE_API
+    size_t GetVectorizedLoopCount() const;
+
+private:
+    /// Compile a source, or find it in the cache.
+    /// \return the compiled source, or nullptr if it could not be compiled.
+    std::shared_ptr< CompiledModule > compileModule( std::string_view i_source );
+
+    /// Compile a source, or find it in the cache, and look up one of its functions.
+    /// \return the address of the function, or 0 if it could not be compiled, or its arity is not i_argumentCount.
+    KALEIDOSCOPE_API
+    uintptr_t compileFunction( std::string_view                   i_source,
+                               std::string_view                   i_functionName,
+                               size_t                             i_argumentCount,
+                               std::shared_ptr< CompiledModule >& o_module );
+
+    /// Compiled sources, by their text.  Expired entries are removed upon compiling a source.
+    std::unordered_map< std::string, std::weak_ptr< CompiledModule > > m_cache;
+    size_t                                                             m_compileCount        = 0;
+    size_t                                                             m_vectorizedLoopCount = 0;
+
+    /// Host functions callable by the compiled sources.
+    HostFunctionTable m_hostFunctions;
+};
+
+} // namespace kaleidoscope
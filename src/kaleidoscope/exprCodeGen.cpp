@@ -0,0 +1,360 @@
+#include <kaleidoscope/codeGenContext.h>
+#include <kaleidoscope/exprCodeGen.h>
+#include <kaleidoscope/logger.h>
+#include <kaleidoscope/tieredJIT.h>
+
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+
+#include <cassert>
+
+namespace kaleidoscope
+{
+ExprCodeGenerator::ExprCodeGenerator( CodeGenContext& io_context )
+    : m_context( io_context )
+{
+}
+
+llvm::Value* ExprCodeGenerator::VisitNumeric( NumericExprAST* i_expr )
+{
+    return llvm::ConstantFP::get( m_context.GetLLVMContext(), llvm::APFloat( i_expr->GetValue() ) );
+}
+
+llvm::Value* ExprCodeGenerator::VisitVariable( VariableExprAST* i_expr )
+{
+    // Variables are resolved to slots by the parser, which rejects unknown variables.
+    assert( i_expr->GetSlot() < m_context.GetSlotValues().size() );
+    llvm::Value* slotValue = m_context.GetSlotValues()[ i_expr->GetSlot() ];
+
+    // The slot of a mutable variable holds its alloca.
+    if ( i_expr->IsMutable() )
+    {
+        return m_context.GetIRBuilder().CreateLoad( llvm::Type::getDoubleTy( m_context.GetLLVMContext() ),
+                                                    slotValue,
+                                                    m_context.GetSymbolTable().GetName( i_expr->GetName() ) );
+    }
+
+    return slotValue;
+}
+
+llvm::Value* ExprCodeGenerator::VisitBinary( BinaryExprAST* i_expr )
+{
+    // A shared operation without side effects is generated once, for all its occurrences within the function.
+    llvm::Value* value = i_expr->HasSideEffects() ? nullptr : m_context.FindExprValue( i_expr );
+    if ( value != nullptr )
+    {
+        return value;
+    }
+
+    // Extract Values from operands.
+    llvm::Value* leftValue  = Visit( i_expr->GetLHS() );
+    llvm::Value* rightValue = Visit( i_expr->GetRHS() );
+    if ( leftValue == nullptr || rightValue == nullptr )
+    {
+        return nullptr;
+    }
+
+    // Generate appropriate instruction per operand.
+    switch ( i_expr->GetOperation() )
+    {
+    case '+':
+        value = m_context.GetIRBuilder().CreateFAdd( leftValue, rightValue, "addtmp" );
+        break;
+    case '-':
+        value = m_context.GetIRBuilder().CreateFSub( leftValue, rightValue, "subtmp" );
+        break;
+    case '*':
+        value = m_context.GetIRBuilder().CreateFMul( leftValue, rightValue, "multmp" );
+        break;
+    case '<':
+    {
+        llvm::Value* integerValue = m_context.GetIRBuilder().CreateFCmpULT( leftValue, rightValue, "cmptmp" );
+        value                     = m_context.GetIRBuilder().CreateUIToFP(
+            integerValue, llvm::Type::getDoubleTy( m_context.GetLLVMContext() ), "booltmp" );
+        break;
+    }
+    default:
+        LogError( "Invalid binary operation: %s", i_expr->GetOperation() );
+        return nullptr;
+    }
+
+    if ( !i_expr->HasSideEffects() )
+    {
+        m_context.AddExprValue( i_expr, value );
+    }
+
+    return value;
+}
+
+llvm::Value* ExprCodeGenerator::VisitCall( CallExprAST* i_expr )
+{
+    // Look up function name in global module table.
+    SymbolId        callee     = i_expr->GetCallee();
+    llvm::Function* calleeFunc = m_context.GetFunction( callee );
+    if ( calleeFunc == nullptr )
+    {
+        LogError( "Unknown function '%s' referenced.", m_context.GetSymbolTable().GetName( callee ).c_str() );
+        return nullptr;
+    }
+
+    ArenaArray< ExprAST* > arguments = i_expr->GetArguments();
+
+    if ( calleeFunc->arg_size() != arguments.GetSize() )
+    {
+        LogError( "LLVM function arg size %lu != expression size %lu.", calleeFunc->arg_size(), arguments.GetSize() );
+        return nullptr;
+    }
+
+    std::vector< llvm::Value* > argumentValues( calleeFunc->arg_size(), nullptr );
+    for ( size_t argIndex = 0; argIndex < calleeFunc->arg_size(); ++argIndex )
+    {
+        llvm::Value* argumentValue = Visit( arguments[ argIndex ] );
+        if ( argumentValue == nullptr )
+        {
+            LogError( "Invalid argument." );
+            return nullptr;
+        }
+
+        argumentValues[ argIndex ] = argumentValue;
+    }
+
+    // Functions compiled by a tiered JIT are called through their stubs, so that callers pick up their latest tier.
+    TieredJIT*      tieredJIT      = m_context.GetTieredJIT();
+    TieredFunction* tieredFunction = tieredJIT != nullptr ? tieredJIT->FindFunction( callee ) : nullptr;
+    if ( tieredFunction != nullptr )
+    {
+        return tieredJIT->GenerateCall(
+            m_context.GetIRBuilder(), *tieredFunction, calleeFunc->getFunctionType(), argumentValues );
+    }
+
+    // Functions of the C math library which are only declared by externs are called as intrinsics, which the
+    // optimizer understands.
+    llvm::Function* intrinsic = m_context.GetMathIntrinsic( callee, argumentValues.size() );
+    if ( intrinsic != nullptr )
+    {
+        return m_context.GetIRBuilder().CreateCall( intrinsic, argumentValues, "calltmp" );
+    }
+
+    return m_context.GetIRBuilder().CreateCall( calleeFunc, argumentValues, "calltmp" );
+}
+
+llvm::Value* ExprCodeGenerator::VisitIf( IfExprAST* i_expr )
+{
+    llvm::Value* ifValue = Visit( i_expr->GetCondition() );
+    if ( ifValue == nullptr )
+    {
+        LogError( "Failed to generate code for if condition." );
+        return nullptr;
+    }
+
+    // Compare if condition != 0.0.
+    ifValue = m_context.GetIRBuilder().CreateFCmpONE(
+        ifValue,
+        llvm::ConstantFP::get( m_context.GetLLVMContext(), llvm::APFloat( 0.0 ) ),
+        "ifcond" );
+
+    // Get the function which this condition resides in.
+    llvm::Function*   function        = m_context.GetIRBuilder().GetInsertBlock()->getParent();
+    llvm::BasicBlock* thenBasicBlock  = llvm::BasicBlock::Create( m_context.GetLLVMContext(), "then", function );
+    llvm::BasicBlock* elseBasicBlock  = llvm::BasicBlock::Create( m_context.GetLLVMContext(), "else" );
+    llvm::BasicBlock* mergeBasicBlock = llvm::BasicBlock::Create( m_context.GetLLVMContext(), "ifcont" );
+
+    // Create branch into 'then' and 'else'
+    m_context.GetIRBuilder().CreateCondBr( ifValue, thenBasicBlock, elseBasicBlock );
+
+    // Generate code for 'then'
+    // Values generated within either branch do not dominate the other branch, nor the merge block.
+    m_context.GetIRBuilder().SetInsertPoint( thenBasicBlock );
+
+    size_t       branchScope = m_context.BeginExprValueScope();
+    llvm::Value* thenValue   = Visit( i_expr->GetThen() );
+    m_context.EndExprValueScope( branchScope );
+    if ( thenValue == nullptr )
+    {
+        LogError( "Failed to generate code for 'then'." );
+        return nullptr;
+    }
+
+    // Direct 'then' into merge block.
+    m_context.GetIRBuilder().CreateBr( mergeBasicBlock );
+
+    // Generating the 'then' code can change the current block.  Fetch the most up to date block for insertion.
+    thenBasicBlock = m_context.GetIRBuilder().GetInsertBlock();
+
+    // Add else block to the function.
+    function->getBasicBlockList().push_back( elseBasicBlock );
+    m_context.GetIRBuilder().SetInsertPoint( elseBasicBlock );
+
+    branchScope            = m_context.BeginExprValueScope();
+    llvm::Value* elseValue = Visit( i_expr->GetElse() );
+    m_context.EndExprValueScope( branchScope );
+    if ( elseValue == nullptr )
+    {
+        LogError( "Failed to generate code for 'else'." );
+        return nullptr;
+    }
+
+    // Direct 'else' into merge block.
+    m_context.GetIRBuilder().CreateBr( mergeBasicBlock );
+
+    // Generating the 'else' code can change the current block.  Fetch the most up to date block for insertion.
+    elseBasicBlock = m_context.GetIRBuilder().GetInsertBlock();
+
+    // Emit merge block.
+    function->getBasicBlockList().push_back( mergeBasicBlock );
+    m_context.GetIRBuilder().SetInsertPoint( mergeBasicBlock );
+
+    // Create a PHI node which will consume different values depending on which control was executed.
+    llvm::PHINode* phiNode =
+        m_context.GetIRBuilder().CreatePHI( llvm::Type::getDoubleTy( m_context.GetLLVMContext() ), 2, "iftmp" );
+
+    phiNode->addIncoming( thenValue, thenBasicBlock );
+    phiNode->addIncoming( elseValue, elseBasicBlock );
+
+    return phiNode;
+}
+
+llvm::Value* ExprCodeGenerator::VisitFor( ForExprAST* i_expr )
+{
+    SymbolId variableName = i_expr->GetVariableName();
+
+    // Generate code for start expression.
+    llvm::Value* startVariable = Visit( i_expr->GetStart() );
+    if ( startVariable == nullptr )
+    {
+        LogError( "Failed to generate code for loop start." );
+        return nullptr;
+    }
+
+    llvm::IRBuilder<>& builder     = m_context.GetIRBuilder();
+    llvm::LLVMContext& llvmContext = m_context.GetLLVMContext();
+
+    // Get insertion point by querying parent, because this for-loop could be within another condition or block.
+    llvm::Function*   function            = builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock* preHeaderBasicBlock = builder.GetInsertBlock();
+    llvm::BasicBlock* loopBasicBlock      = llvm::BasicBlock::Create( m_context.GetLLVMContext(), "loop", function );
+
+    // Direct parent block into loop.
+    builder.CreateBr( loopBasicBlock );
+
+    // Start insertion point into loop body.
+    builder.SetInsertPoint( loopBasicBlock );
+
+    // PHI node to store start value.
+    llvm::PHINode* currentVariable = builder.CreatePHI( llvm::Type::getDoubleTy( m_context.GetLLVMContext() ),
+                                                        2,
+                                                        m_context.GetSymbolTable().GetName( variableName ) );
+    currentVariable->addIncoming( startVariable, preHeaderBasicBlock );
+
+    // The loop variable occupies the next slot, for the duration of the loop.  It may shadow a variable of the
+    // same name, which is referred to by variable nodes of a different slot.
+    std::vector< llvm::Value* >& slotValues = m_context.GetSlotValues();
+    assert( i_expr->GetVariableSlot() == slotValues.size() );
+    slotValues.push_back( currentVariable );
+
+    // Values generated within the loop do not dominate the code following it.
+    size_t loopScope = m_context.BeginExprValueScope();
+
+    // Emit code for body.
+    if ( Visit( i_expr->GetBody() ) == nullptr )
+    {
+        LogError( "Failed to generate code for loop body." );
+        return nullptr;
+    }
+
+    // Optional step expression.
+    llvm::Value* stepValue = nullptr;
+    if ( i_expr->GetStep() != nullptr )
+    {
+        stepValue = Visit( i_expr->GetStep() );
+        if ( stepValue == nullptr )
+        {
+            LogError( "Failed to generate code for loop step expression." );
+            return nullptr;
+        }
+    }
+    else
+    {
+        stepValue = llvm::ConstantFP::get( m_context.GetLLVMContext(), llvm::APFloat( 1.0 ) );
+    }
+
+    // Next variable = current variable + step value.
+    llvm::Value* nextVariable = builder.CreateFAdd( currentVariable, stepValue, "nextvar" );
+
+    // Compute the end condition.
+    llvm::Value* endCondition = Visit( i_expr->GetEnd() );
+    if ( endCondition == nullptr )
+    {
+        LogError( "Failed to generate code for loop end expression." );
+    }
+
+    // Convert condition to boolean value.
+    endCondition =
+        builder.CreateFCmpONE( endCondition, llvm::ConstantFP::get( llvmContext, llvm::APFloat( 0.0 ) ), "loopcond" );
+
+    m_context.EndExprValueScope( loopScope );
+
+    // Create after-loop block
+    llvm::BasicBlock* loopEndBasicBlock = builder.GetInsertBlock();
+    llvm::BasicBlock* afterBasicBlock   = llvm::BasicBlock::Create( llvmContext, "afterloop", function );
+
+    // Create condition to check
+    builder.CreateCondBr( endCondition, loopBasicBlock, afterBasicBlock );
+
+    // Set code insertion point to afterLoop basic block.
+    builder.SetInsertPoint( afterBasicBlock );
+
+    // Assign nextVariable to currentVariable.
+    currentVariable->addIncoming( nextVariable, loopEndBasicBlock );
+
+    slotValues.pop_back();
+
+    return llvm::Constant::getNullValue( llvm::Type::getDoubleTy( llvmContext ) );
+}
+
+llvm::Value* ExprCodeGenerator::VisitVar( VarExprAST* i_expr )
+{
+    // The initializer is evaluated before the variable is bound.
+    llvm::Value* initialValue = Visit( i_expr->GetInitializer() );
+    if ( initialValue == nullptr )
+    {
+        LogError( "Failed to generate code for variable initializer." );
+        return nullptr;
+    }
+
+    // The variable is stored on the stack, which mem2reg promotes into registers.
+    llvm::AllocaInst* alloca = m_context.CreateEntryBlockAlloca( i_expr->GetVariableName() );
+    m_context.GetIRBuilder().CreateStore( initialValue, alloca );
+
+    // The variable occupies the next slot, for the duration of the body.
+    std::vector< llvm::Value* >& slotValues = m_context.GetSlotValues();
+    assert( i_expr->GetVariableSlot() == slotValues.size() );
+    slotValues.push_back( alloca );
+
+    llvm::Value* bodyValue = Visit( i_expr->GetBody() );
+    slotValues.pop_back();
+    if ( bodyValue == nullptr )
+    {
+        LogError( "Failed to generate code for variable body." );
+    }
+
+    return bodyValue;
+}
+
+llvm::Value* ExprCodeGenerator::VisitAssign( AssignExprAST* i_expr )
+{
+    llvm::Value* value = Visit( i_expr->GetValue() );
+    if ( value == nullptr )
+    {
+        return nullptr;
+    }
+
+    // Only mutable variables are assigned, whose slots hold their allocas.
+    VariableExprAST* variable = i_expr->GetVariable();
+    assert( variable->IsMutable() && variable->GetSlot() < m_context.GetSlotValues().size() );
+    m_context.GetIRBuilder().CreateStore( value, m_context.GetSlotValues()[ variable->GetSlot() ] );
+    return value;
+}
+
+} // namespace kaleidoscope
@@ -0,0 +1,65 @@
+#pragma once
+
+/* Generation of LLVM IR from expressions */
+
+#include <kaleidoscope/api.h>
+#include <kaleidoscope/astVisitor.h>
+
+/// Forward declarations for LLVM types.
+namespace llvm
+{
+class Value;
+} // namespace llvm
+
+namespace kaleidoscope
+{
+class CodeGenContext;
+
+/// ExprCodeGenerator generates the IR of an expression, at the insertion point of the IR builder of a
+/// CodeGenContext.
+///
+/// Each handler returns the value of its expression, or nullptr if code could not be generated.
+class ExprCodeGenerator : public ExprVisitor< ExprCodeGenerator, llvm::Value* >
+{
+public:
+    KALEIDOSCOPE_API
+    explicit ExprCodeGenerator( CodeGenContext& io_context );
+
+    /// Generate a numeric constant.
+    KALEIDOSCOPE_API
+    llvm::Value* VisitNumeric( NumericExprAST* i_expr );
+
+    /// Look up the value of a variable in scope, loading it if the variable is mutable.
+    KALEIDOSCOPE_API
+    llvm::Value* VisitVariable( VariableExprAST* i_expr );
+
+    /// Generate a binary operation.  An operation without side effects is generated once per function, and
+    /// reused by the other occurrences of its (shared) node.
+    KALEIDOSCOPE_API
+    llvm::Value* VisitBinary( BinaryExprAST* i_expr );
+
+    /// Generate a function call.
+    KALEIDOSCOPE_API
+    llvm::Value* VisitCall( CallExprAST* i_expr );
+
+    /// Generate a conditional expression, with a block per branch.
+    KALEIDOSCOPE_API
+    llvm::Value* VisitIf( IfExprAST* i_expr );
+
+    /// Generate a loop, which evaluates to 0.0.
+    KALEIDOSCOPE_API
+    llvm::Value* VisitFor( ForExprAST* i_expr );
+
+    /// Generate a mutable variable binding, as an alloca in the entry block of the function.
+    KALEIDOSCOPE_API
+    llvm::Value* VisitVar( VarExprAST* i_expr );
+
+    /// Generate an assignment, which evaluates to the assigned value.
+    KALEIDOSCOPE_API
+    llvm::Value* VisitAssign( AssignExprAST* i_expr );
+
+private:
+    CodeGenContext& m_context; /// Context to generate code into.
+};
+
+} // namespace kaleidoscope
@@ -0,0 +1,204 @@
+#include <kaleidoscope/exprInterner.h>
+
+#include <cstring>
+#include <functional>
+
+namespace
+{
+/// Mix a value into a hash.
+inline size_t CombineHash( size_t i_hash, size_t i_value )
+{
+    return i_hash ^ ( i_value + 0x9e3779b97f4a7c15ull + ( i_hash << 6 ) + ( i_hash >> 2 ) );
+}
+
+} // namespace
+
+namespace kaleidoscope
+{
+bool ExprInterner::Key::operator==( const Key& i_other ) const
+{
+    if ( m_kind != i_other.m_kind || m_operation != i_other.m_operation || m_symbol != i_other.m_symbol ||
+         m_valueBits != i_other.m_valueBits || m_argumentCount != i_other.m_argumentCount )
+    {
+        return false;
+    }
+
+    for ( size_t operandIndex = 0; operandIndex < 4; ++operandIndex )
+    {
+        if ( m_operands[ operandIndex ] != i_other.m_operands[ operandIndex ] )
+        {
+            return false;
+        }
+    }
+
+    for ( size_t argIndex = 0; argIndex < m_argumentCount; ++argIndex )
+    {
+        if ( m_arguments[ argIndex ] != i_other.m_arguments[ argIndex ] )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t ExprInterner::KeyHash::operator()( const Key& i_key ) const
+{
+    size_t hash = CombineHash( i_key.m_kind, static_cast< unsigned char >( i_key.m_operation ) );
+    hash        = CombineHash( hash, i_key.m_symbol );
+    hash        = CombineHash( hash, std::hash< uint64_t >()( i_key.m_valueBits ) );
+    for ( ExprAST* operand : i_key.m_operands )
+    {
+        hash = CombineHash( hash, std::hash< ExprAST* >()( operand ) );
+    }
+
+    for ( size_t argIndex = 0; argIndex < i_key.m_argumentCount; ++argIndex )
+    {
+        hash = CombineHash( hash, std::hash< ExprAST* >()( i_key.m_arguments[ argIndex ] ) );
+    }
+
+    return hash;
+}
+
+ExprInterner::ExprInterner( ASTArena& io_arena )
+    : m_arena( io_arena )
+{
+}
+
+ASTArena& ExprInterner::GetArena()
+{
+    return m_arena;
+}
+
+ExprInterner::Key ExprInterner::makeKey( ExprKind i_kind )
+{
+    Key key{};
+    key.m_kind = i_kind;
+    return key;
+}
+
+template < typename NodeT, typename... ArgsT >
+NodeT* ExprInterner::intern( const Key& i_key, ArgsT&&... i_args )
+{
+    m_requestCount++;
+    std::unordered_map< Key, ExprAST*, KeyHash >::const_iterator nodeIt = m_nodes.find( i_key );
+    if ( nodeIt != m_nodes.end() )
+    {
+        m_sharedCount++;
+        return static_cast< NodeT* >( nodeIt->second );
+    }
+
+    NodeT* node = m_arena.Create< NodeT >( std::forward< ArgsT >( i_args )... );
+    m_nodes.emplace( i_key, node );
+    return node;
+}
+
+NumericExprAST* ExprInterner::GetNumeric( double i_value )
+{
+    Key key = makeKey( ExprKind_Numeric );
+    std::memcpy( &key.m_valueBits, &i_value, sizeof( double ) );
+    return intern< NumericExprAST >( key, i_value );
+}
+
+VariableExprAST* ExprInterner::GetVariable( SymbolId i_name, uint32_t i_slot, bool i_isMutable )
+{
+    // A slot may be reused by sibling bindings of the same name, of which only 'var' bindings are mutable.
+    Key key         = makeKey( ExprKind_Variable );
+    key.m_symbol    = i_name;
+    key.m_valueBits = static_cast< uint64_t >( i_slot ) | ( static_cast< uint64_t >( i_isMutable ) << 32 );
+    return intern< VariableExprAST >( key, i_name, i_slot, i_isMutable );
+}
+
+BinaryExprAST* ExprInterner::GetBinary( char i_operation, ExprAST* i_lhs, ExprAST* i_rhs )
+{
+    Key key             = makeKey( ExprKind_Binary );
+    key.m_operation     = i_operation;
+    key.m_operands[ 0 ] = i_lhs;
+    key.m_operands[ 1 ] = i_rhs;
+    return intern< BinaryExprAST >( key, i_operation, i_lhs, i_rhs );
+}
+
+CallExprAST* ExprInterner::GetCall( SymbolId i_callee, ExprAST* const* i_arguments, size_t i_argumentCount )
+{
+    Key key             = makeKey( ExprKind_Call );
+    key.m_symbol        = i_callee;
+    key.m_arguments     = i_arguments;
+    key.m_argumentCount = i_argumentCount;
+
+    m_requestCount++;
+    std::unordered_map< Key, ExprAST*, KeyHash >::const_iterator nodeIt = m_nodes.find( key );
+    if ( nodeIt != m_nodes.end() )
+    {
+        m_sharedCount++;
+        return static_cast< CallExprAST* >( nodeIt->second );
+    }
+
+    // The key must refer to the arguments owned by the node, rather than the transient ones.
+    ArenaArray< ExprAST* > arguments = m_arena.CopyArray( i_arguments, i_argumentCount );
+    CallExprAST*           node      = m_arena.Create< CallExprAST >( i_callee, arguments );
+    key.m_arguments                  = arguments.begin();
+    m_nodes.emplace( key, node );
+    return node;
+}
+
+IfExprAST* ExprInterner::GetIf( ExprAST* i_if, ExprAST* i_then, ExprAST* i_else )
+{
+    Key key             = makeKey( ExprKind_If );
+    key.m_operands[ 0 ] = i_if;
+    key.m_operands[ 1 ] = i_then;
+    key.m_operands[ 2 ] = i_else;
+    return intern< IfExprAST >( key, i_if, i_then, i_else );
+}
+
+ForExprAST* ExprInterner::GetFor( SymbolId i_variableName,
+                                  uint32_t i_variableSlot,
+                                  ExprAST* i_start,
+                                  ExprAST* i_end,
+                                  ExprAST* i_step,
+                                  ExprAST* i_body )
+{
+    Key key             = makeKey( ExprKind_For );
+    key.m_symbol        = i_variableName;
+    key.m_valueBits     = i_variableSlot;
+    key.m_operands[ 0 ] = i_start;
+    key.m_operands[ 1 ] = i_end;
+    key.m_operands[ 2 ] = i_step;
+    key.m_operands[ 3 ] = i_body;
+    return intern< ForExprAST >( key, i_variableName, i_variableSlot, i_start, i_end, i_step, i_body );
+}
+
+VarExprAST*
+ExprInterner::GetVar( SymbolId i_variableName, uint32_t i_variableSlot, ExprAST* i_initializer, ExprAST* i_body )
+{
+    Key key             = makeKey( ExprKind_Var );
+    key.m_symbol        = i_variableName;
+    key.m_valueBits     = i_variableSlot;
+    key.m_operands[ 0 ] = i_initializer;
+    key.m_operands[ 1 ] = i_body;
+    return intern< VarExprAST >( key, i_variableName, i_variableSlot, i_initializer, i_body );
+}
+
+AssignExprAST* ExprInterner::GetAssign( VariableExprAST* i_variable, ExprAST* i_value )
+{
+    Key key             = makeKey( ExprKind_Assign );
+    key.m_operands[ 0 ] = i_variable;
+    key.m_operands[ 1 ] = i_value;
+    return intern< AssignExprAST >( key, i_variable, i_value );
+}
+
+void ExprInterner::Clear()
+{
+    m_nodes.clear();
+}
+
+size_t ExprInterner::GetRequestCount() const
+{
+    return m_requestCount;
+}
+
+size_t ExprInterner::GetSharedCount() const
+{
+    return m_sharedCount;
+}
+
+} // namespace kaleidoscope
@@ -0,0 +1,119 @@
+#pragma once
+
+/* Hash-consing of expression nodes, so that structurally identical expressions are a single shared node */
+
+#include <kaleidoscope/api.h>
+#include <kaleidoscope/ast.h>
+#include <kaleidoscope/astArena.h>
+
+#include <cstdint>
+#include <unordered_map>
+
+namespace kaleidoscope
+{
+/// ExprInterner constructs expression nodes, such that structurally identical expressions are the same node.
+///
+/// The operands of an expression are interned before the expression itself, so two expressions are structurally
+/// identical if they are of the same kind, have the same value or name, and have the same operand pointers.
+/// Each node is therefore hashed and compared in constant time (or linear in the number of call arguments),
+/// without traversing its sub-trees.
+///
+/// Shared nodes turn the AST into a directed acyclic graph, which code generation exploits by generating a
+/// side-effect free expression once per function (see CodeGenContext::FindExprValue).
+///
+/// Nodes are allocated from an ASTArena.  The table of interned nodes must be cleared before the arena is reset.
+class ExprInterner
+{
+public:
+    KALEIDOSCOPE_API
+    explicit ExprInterner( ASTArena& io_arena );
+
+    /// Get a numeric literal.  Values are compared by their bits, so 0.0 and -0.0 are distinct.
+    KALEIDOSCOPE_API
+    NumericExprAST* GetNumeric( double i_value );
+
+    /// Get a variable reference, resolved to the slot of its binding.
+    /// References to different bindings of the same name are distinct nodes.
+    KALEIDOSCOPE_API
+    VariableExprAST* GetVariable( SymbolId i_name, uint32_t i_slot, bool i_isMutable );
+
+    /// Get a binary operation of interned operands.
+    KALEIDOSCOPE_API
+    BinaryExprAST* GetBinary( char i_operation, ExprAST* i_lhs, ExprAST* i_rhs );
+
+    /// Get a call of interned arguments.
+    /// The arguments are copied into the arena if the call is not already interned, so may be transient.
+    KALEIDOSCOPE_API
+    CallExprAST* GetCall( SymbolId i_callee, ExprAST* const* i_arguments, size_t i_argumentCount );
+
+    /// Get a conditional of interned operands.
+    KALEIDOSCOPE_API
+    IfExprAST* GetIf( ExprAST* i_if, ExprAST* i_then, ExprAST* i_else );
+
+    /// Get a loop of interned operands.  i_step may be nullptr.
+    KALEIDOSCOPE_API
+    ForExprAST* GetFor( SymbolId i_variableName,
+                        uint32_t i_variableSlot,
+                        ExprAST* i_start,
+                        ExprAST* i_end,
+                        ExprAST* i_step,
+                        ExprAST* i_body );
+
+    /// Get a mutable variable binding of interned operands.
+    KALEIDOSCOPE_API
+    VarExprAST* GetVar( SymbolId i_variableName, uint32_t i_variableSlot, ExprAST* i_initializer, ExprAST* i_body );
+
+    /// Get an assignment of interned operands.
+    KALEIDOSCOPE_API
+    AssignExprAST* GetAssign( VariableExprAST* i_variable, ExprAST* i_value );
+
+    /// Get the arena which the nodes are allocated from.
+    KALEIDOSCOPE_API
+    ASTArena& GetArena();
+
+    /// Forget all the interned nodes, which remain allocated in the arena.
+    /// Subsequently constructed nodes are not shared with previously constructed ones.
+    KALEIDOSCOPE_API
+    void Clear();
+
+    /// Get the number of nodes constructed, and the number of those which were shared with an existing node.
+    KALEIDOSCOPE_API
+    size_t GetRequestCount() const;
+
+    KALEIDOSCOPE_API
+    size_t GetSharedCount() const;
+
+private:
+    /// Structural identity of an expression node.
+    struct Key
+    {
+        ExprKind        m_kind;          /// Type of the expression.
+        char            m_operation;     /// Binary operator character.
+        SymbolId        m_symbol;        /// Variable name, callee, or loop variable.
+        uint64_t        m_valueBits;     /// Bits of a numeric value, or slot (and mutability) of a variable.
+        ExprAST*        m_operands[ 4 ]; /// Operands, other than call arguments.
+        ExprAST* const* m_arguments;     /// Call arguments.
+        size_t          m_argumentCount; /// Number of call arguments.
+
+        bool operator==( const Key& i_other ) const;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()( const Key& i_key ) const;
+    };
+
+    /// Make a key, with the fields common to all kinds of expressions.
+    static Key makeKey( ExprKind i_kind );
+
+    /// Find a node by its key, or create it.
+    template < typename NodeT, typename... ArgsT >
+    NodeT* intern( const Key& i_key, ArgsT&&... i_args );
+
+    ASTArena&                                    m_arena;            /// Storage of the nodes.
+    std::unordered_map< Key, ExprAST*, KeyHash > m_nodes;            /// Interned nodes.
+    size_t                                       m_requestCount = 0; /// Number of nodes constructed.
+    size_t                                       m_sharedCount  = 0; /// Number of nodes which were shared.
+};
+
+} // namespace kaleidoscope
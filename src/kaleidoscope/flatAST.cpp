@@ -0,0 +1,515 @@
+#include <kaleidoscope/astVisitor.h>
+#include <kaleidoscope/exprInterner.h>
+#include <kaleidoscope/flatAST.h>
+#include <kaleidoscope/logger.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+using namespace kaleidoscope;
+
+/// Identifies a serialized FlatAST.
+constexpr uint32_t s_flatASTMagic = 0x54534146; // "FAST"
+
+/// Leading record of a serialized FlatAST, followed by each array in order of declaration.
+struct FlatASTHeader
+{
+    uint32_t m_magic;
+    uint32_t m_nodeCount;
+    uint32_t m_functionCount;
+    uint32_t m_numericValueCount;
+    uint32_t m_childCount;
+    uint32_t m_argumentNameCount;
+};
+
+/// Append the contents of an array to a buffer of bytes.
+template < typename ElementT >
+void WriteArray( const std::vector< ElementT >& i_array, std::vector< char >& io_buffer )
+{
+    size_t offset = io_buffer.size();
+    io_buffer.resize( offset + i_array.size() * sizeof( ElementT ) );
+    if ( !i_array.empty() )
+    {
+        memcpy( io_buffer.data() + offset, i_array.data(), i_array.size() * sizeof( ElementT ) );
+    }
+}
+
+/// Read i_count elements from a buffer of bytes into an array, advancing the read position.
+/// \return false if the buffer does not contain i_count elements.
+template < typename ElementT >
+bool ReadArray( const char*& io_position, const char* i_end, uint32_t i_count, std::vector< ElementT >& o_array )
+{
+    size_t size = ( size_t ) i_count * sizeof( ElementT );
+    if ( ( size_t )( i_end - io_position ) < size )
+    {
+        return false;
+    }
+
+    o_array.resize( i_count );
+    if ( size > 0 )
+    {
+        memcpy( o_array.data(), io_position, size );
+    }
+
+    io_position += size;
+    return true;
+}
+
+} // namespace
+
+namespace kaleidoscope
+{
+FlatNodeIndex FlatAST::appendNode( ExprKind i_kind, char i_operation, uint32_t i_op0, uint32_t i_op1, uint32_t i_op2 )
+{
+    FlatNode node;
+    node.m_kind          = i_kind;
+    node.m_operation     = i_operation;
+    node.m_reserved      = 0;
+    node.m_operands[ 0 ] = i_op0;
+    node.m_operands[ 1 ] = i_op1;
+    node.m_operands[ 2 ] = i_op2;
+    m_nodes.push_back( node );
+    return static_cast< FlatNodeIndex >( m_nodes.size() - 1 );
+}
+
+FlatNodeIndex FlatAST::AppendExpr( const ExprAST& i_expr )
+{
+    // Continue deeply nested appends on a new stack, as the passes over expressions do (see ExprVisitor::Visit).
+    FlatNodeIndex node = FlatNode_None;
+    if ( ++m_nestedAppends % s_visitsPerStack == 0 )
+    {
+        RunOnNewStack( [&]() { node = appendExpr( i_expr ); } );
+    }
+    else
+    {
+        node = appendExpr( i_expr );
+    }
+
+    --m_nestedAppends;
+    return node;
+}
+
+FlatNodeIndex FlatAST::appendExpr( const ExprAST& i_expr )
+{
+    switch ( i_expr.GetKind() )
+    {
+    case ExprKind_Numeric:
+    {
+        const NumericExprAST& numeric = static_cast< const NumericExprAST& >( i_expr );
+        m_numericValues.push_back( numeric.GetValue() );
+        return appendNode( ExprKind_Numeric, 0, static_cast< uint32_t >( m_numericValues.size() - 1 ), 0, 0 );
+    }
+    case ExprKind_Variable:
+    {
+        const VariableExprAST& variable = static_cast< const VariableExprAST& >( i_expr );
+        return appendNode( ExprKind_Variable, 0, variable.GetName(), variable.GetSlot(), variable.IsMutable() );
+    }
+    case ExprKind_Binary:
+    {
+        const BinaryExprAST& binary = static_cast< const BinaryExprAST& >( i_expr );
+        FlatNodeIndex        lhs    = AppendExpr( *binary.GetLHS() );
+        FlatNodeIndex        rhs    = AppendExpr( *binary.GetRHS() );
+        return appendNode( ExprKind_Binary, binary.GetOperation(), lhs, rhs, 0 );
+    }
+    case ExprKind_Call:
+    {
+        // Reserve the argument slots up front, as appending the arguments may append to the child side table.
+        const CallExprAST&     call      = static_cast< const CallExprAST& >( i_expr );
+        ArenaArray< ExprAST* > arguments = call.GetArguments();
+        uint32_t               begin     = static_cast< uint32_t >( m_children.size() );
+        m_children.resize( m_children.size() + arguments.GetSize() );
+        for ( size_t argIndex = 0; argIndex < arguments.GetSize(); ++argIndex )
+        {
+            FlatNodeIndex argument         = AppendExpr( *arguments[ argIndex ] );
+            m_children[ begin + argIndex ] = argument;
+        }
+
+        return appendNode(
+            ExprKind_Call, 0, call.GetCallee(), begin, static_cast< uint32_t >( arguments.GetSize() ) );
+    }
+    case ExprKind_If:
+    {
+        const IfExprAST& conditional = static_cast< const IfExprAST& >( i_expr );
+        FlatNodeIndex    condition   = AppendExpr( *conditional.GetCondition() );
+        FlatNodeIndex    thenNode    = AppendExpr( *conditional.GetThen() );
+        FlatNodeIndex    elseNode    = AppendExpr( *conditional.GetElse() );
+        return appendNode( ExprKind_If, 0, condition, thenNode, elseNode );
+    }
+    case ExprKind_For:
+    {
+        const ForExprAST& loop  = static_cast< const ForExprAST& >( i_expr );
+        uint32_t          begin = static_cast< uint32_t >( m_children.size() );
+        m_children.resize( m_children.size() + 4 );
+
+        FlatNodeIndex start     = AppendExpr( *loop.GetStart() );
+        FlatNodeIndex end       = AppendExpr( *loop.GetEnd() );
+        FlatNodeIndex step      = loop.GetStep() != nullptr ? AppendExpr( *loop.GetStep() ) : FlatNode_None;
+        FlatNodeIndex body      = AppendExpr( *loop.GetBody() );
+        m_children[ begin ]     = start;
+        m_children[ begin + 1 ] = end;
+        m_children[ begin + 2 ] = step;
+        m_children[ begin + 3 ] = body;
+        return appendNode( ExprKind_For, 0, loop.GetVariableName(), begin, loop.GetVariableSlot() );
+    }
+    case ExprKind_Var:
+    {
+        const VarExprAST& var   = static_cast< const VarExprAST& >( i_expr );
+        uint32_t          begin = static_cast< uint32_t >( m_children.size() );
+        m_children.resize( m_children.size() + 2 );
+
+        FlatNodeIndex initializer = AppendExpr( *var.GetInitializer() );
+        FlatNodeIndex body        = AppendExpr( *var.GetBody() );
+        m_children[ begin ]       = initializer;
+        m_children[ begin + 1 ]   = body;
+        return appendNode( ExprKind_Var, 0, var.GetVariableName(), begin, var.GetVariableSlot() );
+    }
+    case ExprKind_Assign:
+    {
+        const AssignExprAST& assign   = static_cast< const AssignExprAST& >( i_expr );
+        FlatNodeIndex        variable = AppendExpr( *assign.GetVariable() );
+        FlatNodeIndex        value    = AppendExpr( *assign.GetValue() );
+        return appendNode( ExprKind_Assign, 0, variable, value, 0 );
+    }
+    }
+
+    assert( false );
+    return FlatNode_None;
+}
+
+size_t FlatAST::AppendFunction( const FunctionAST& i_function )
+{
+    const PrototypeAST&    prototype = *i_function.GetPrototype();
+    ArenaArray< SymbolId > arguments = prototype.GetArguments();
+
+    FlatFunction function;
+    function.m_name           = prototype.GetName();
+    function.m_argumentsBegin = static_cast< uint32_t >( m_argumentNames.size() );
+    function.m_argumentCount  = static_cast< uint32_t >( arguments.GetSize() );
+    m_argumentNames.insert( m_argumentNames.end(), arguments.begin(), arguments.end() );
+    function.m_body = AppendExpr( *i_function.GetBody() );
+
+    m_functions.push_back( function );
+    return m_functions.size() - 1;
+}
+
+void FlatAST::Clear()
+{
+    m_nodes.clear();
+    m_functions.clear();
+    m_numericValues.clear();
+    m_children.clear();
+    m_argumentNames.clear();
+}
+
+size_t FlatAST::GetNodeCount() const
+{
+    return m_nodes.size();
+}
+
+ExprKind FlatAST::GetKind( FlatNodeIndex i_node ) const
+{
+    return m_nodes[ i_node ].m_kind;
+}
+
+double FlatAST::GetNumericValue( FlatNodeIndex i_node ) const
+{
+    assert( m_nodes[ i_node ].m_kind == ExprKind_Numeric );
+    return m_numericValues[ m_nodes[ i_node ].m_operands[ 0 ] ];
+}
+
+SymbolId FlatAST::GetSymbol( FlatNodeIndex i_node ) const
+{
+    assert( m_nodes[ i_node ].m_kind == ExprKind_Variable || m_nodes[ i_node ].m_kind == ExprKind_Call ||
+            m_nodes[ i_node ].m_kind == ExprKind_For || m_nodes[ i_node ].m_kind == ExprKind_Var );
+    return m_nodes[ i_node ].m_operands[ 0 ];
+}
+
+uint32_t FlatAST::GetSlot( FlatNodeIndex i_node ) const
+{
+    const FlatNode& node = m_nodes[ i_node ];
+    assert( node.m_kind == ExprKind_Variable || node.m_kind == ExprKind_For || node.m_kind == ExprKind_Var );
+    return node.m_kind == ExprKind_Variable ? node.m_operands[ 1 ] : node.m_operands[ 2 ];
+}
+
+bool FlatAST::IsMutable( FlatNodeIndex i_node ) const
+{
+    assert( m_nodes[ i_node ].m_kind == ExprKind_Variable );
+    return m_nodes[ i_node ].m_operands[ 2 ] != 0;
+}
+
+char FlatAST::GetOperation( FlatNodeIndex i_node ) const
+{
+    assert( m_nodes[ i_node ].m_kind == ExprKind_Binary );
+    return m_nodes[ i_node ].m_operation;
+}
+
+size_t FlatAST::GetChildCount( FlatNodeIndex i_node ) const
+{
+    const FlatNode& node = m_nodes[ i_node ];
+    switch ( node.m_kind )
+    {
+    case ExprKind_Binary:
+    case ExprKind_Var:
+    case ExprKind_Assign:
+        return 2;
+    case ExprKind_Call:
+        return node.m_operands[ 2 ];
+    case ExprKind_If:
+        return 3;
+    case ExprKind_For:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+FlatNodeIndex FlatAST::GetChild( FlatNodeIndex i_node, size_t i_childIndex ) const
+{
+    assert( i_childIndex < GetChildCount( i_node ) );
+    const FlatNode& node = m_nodes[ i_node ];
+    switch ( node.m_kind )
+    {
+    case ExprKind_Binary:
+    case ExprKind_If:
+    case ExprKind_Assign:
+        return node.m_operands[ i_childIndex ];
+    case ExprKind_Call:
+    case ExprKind_For:
+    case ExprKind_Var:
+        return m_children[ node.m_operands[ 1 ] + i_childIndex ];
+    default:
+        return FlatNode_None;
+    }
+}
+
+size_t FlatAST::GetFunctionCount() const
+{
+    return m_functions.size();
+}
+
+const FlatFunction& FlatAST::GetFunction( size_t i_functionIndex ) const
+{
+    return m_functions[ i_functionIndex ];
+}
+
+ArenaArray< SymbolId > FlatAST::GetArgumentNames( const FlatFunction& i_function ) const
+{
+    return ArenaArray< SymbolId >( m_argumentNames.data() + i_function.m_argumentsBegin, i_function.m_argumentCount );
+}
+
+size_t FlatAST::GetMemoryUsage() const
+{
+    return m_nodes.size() * sizeof( FlatNode ) + m_functions.size() * sizeof( FlatFunction ) +
+           m_numericValues.size() * sizeof( double ) + m_children.size() * sizeof( FlatNodeIndex ) +
+           m_argumentNames.size() * sizeof( SymbolId );
+}
+
+void FlatAST::Serialize( std::vector< char >& o_buffer ) const
+{
+    FlatASTHeader header;
+    header.m_magic             = s_flatASTMagic;
+    header.m_nodeCount         = static_cast< uint32_t >( m_nodes.size() );
+    header.m_functionCount     = static_cast< uint32_t >( m_functions.size() );
+    header.m_numericValueCount = static_cast< uint32_t >( m_numericValues.size() );
+    header.m_childCount        = static_cast< uint32_t >( m_children.size() );
+    header.m_argumentNameCount = static_cast< uint32_t >( m_argumentNames.size() );
+
+    o_buffer.resize( sizeof( FlatASTHeader ) );
+    o_buffer.reserve( sizeof( FlatASTHeader ) + GetMemoryUsage() );
+    memcpy( o_buffer.data(), &header, sizeof( FlatASTHeader ) );
+    WriteArray( m_nodes, o_buffer );
+    WriteArray( m_functions, o_buffer );
+    WriteArray( m_numericValues, o_buffer );
+    WriteArray( m_children, o_buffer );
+    WriteArray( m_argumentNames, o_buffer );
+}
+
+bool FlatAST::Deserialize( const char* i_buffer, size_t i_size )
+{
+    Clear();
+
+    FlatASTHeader header;
+    if ( i_size < sizeof( FlatASTHeader ) )
+    {
+        LogError( "Serialized FlatAST is truncated." );
+        return false;
+    }
+
+    memcpy( &header, i_buffer, sizeof( FlatASTHeader ) );
+    if ( header.m_magic != s_flatASTMagic )
+    {
+        LogError( "Buffer is not a serialized FlatAST." );
+        return false;
+    }
+
+    const char* position = i_buffer + sizeof( FlatASTHeader );
+    const char* end      = i_buffer + i_size;
+    if ( !ReadArray( position, end, header.m_nodeCount, m_nodes ) ||
+         !ReadArray( position, end, header.m_functionCount, m_functions ) ||
+         !ReadArray( position, end, header.m_numericValueCount, m_numericValues ) ||
+         !ReadArray( position, end, header.m_childCount, m_children ) ||
+         !ReadArray( position, end, header.m_argumentNameCount, m_argumentNames ) )
+    {
+        LogError( "Serialized FlatAST is truncated." );
+        Clear();
+        return false;
+    }
+
+    if ( !isWellFormed() )
+    {
+        LogError( "Serialized FlatAST is malformed." );
+        Clear();
+        return false;
+    }
+
+    return true;
+}
+
+ExprAST* FlatAST::ExpandExpr( FlatNodeIndex i_root, ExprInterner& io_interner ) const
+{
+    // Collect the nodes of the expression with an explicit stack, rather than by recursion, as the expression
+    // may be nested deeper than the native stack allows.
+    std::vector< FlatNodeIndex > nodes;
+    std::vector< FlatNodeIndex > pending = {i_root};
+    while ( !pending.empty() )
+    {
+        FlatNodeIndex node = pending.back();
+        pending.pop_back();
+        nodes.push_back( node );
+        for ( size_t childIndex = 0; childIndex < GetChildCount( node ); ++childIndex )
+        {
+            FlatNodeIndex child = GetChild( node, childIndex );
+            if ( child != FlatNode_None )
+            {
+                pending.push_back( child );
+            }
+        }
+    }
+
+    // Children precede their parents, so expanding in order of increasing index expands the children of a node
+    // before the node itself.
+    std::sort( nodes.begin(), nodes.end() );
+    FlatNodeIndex            first = nodes.front();
+    std::vector< ExprAST* >  expanded( i_root - first + 1, nullptr );
+    std::vector< ExprAST* >  arguments;
+    auto                     getChild = [&]( FlatNodeIndex i_node, size_t i_childIndex ) -> ExprAST* {
+        FlatNodeIndex child = GetChild( i_node, i_childIndex );
+        return child != FlatNode_None ? expanded[ child - first ] : nullptr;
+    };
+
+    for ( FlatNodeIndex node : nodes )
+    {
+        ExprAST*& expr = expanded[ node - first ];
+        switch ( GetKind( node ) )
+        {
+        case ExprKind_Numeric:
+            expr = io_interner.GetNumeric( GetNumericValue( node ) );
+            break;
+        case ExprKind_Variable:
+            expr = io_interner.GetVariable( GetSymbol( node ), GetSlot( node ), IsMutable( node ) );
+            break;
+        case ExprKind_Binary:
+            expr = io_interner.GetBinary( GetOperation( node ), getChild( node, 0 ), getChild( node, 1 ) );
+            break;
+        case ExprKind_Call:
+            arguments.clear();
+            for ( size_t argIndex = 0; argIndex < GetChildCount( node ); ++argIndex )
+            {
+                arguments.push_back( getChild( node, argIndex ) );
+            }
+
+            expr = io_interner.GetCall( GetSymbol( node ), arguments.data(), arguments.size() );
+            break;
+        case ExprKind_If:
+            expr = io_interner.GetIf( getChild( node, 0 ), getChild( node, 1 ), getChild( node, 2 ) );
+            break;
+        case ExprKind_For:
+            expr = io_interner.GetFor( GetSymbol( node ),
+                                       GetSlot( node ),
+                                       getChild( node, 0 ),
+                                       getChild( node, 1 ),
+                                       getChild( node, 2 ),
+                                       getChild( node, 3 ) );
+            break;
+        case ExprKind_Var:
+            expr = io_interner.GetVar( GetSymbol( node ), GetSlot( node ), getChild( node, 0 ), getChild( node, 1 ) );
+            break;
+        case ExprKind_Assign:
+            expr = io_interner.GetAssign( static_cast< VariableExprAST* >( getChild( node, 0 ) ), getChild( node, 1 ) );
+            break;
+        }
+    }
+
+    return expanded[ i_root - first ];
+}
+
+FunctionAST* FlatAST::ExpandFunction( size_t i_functionIndex, ExprInterner& io_interner ) const
+{
+    const FlatFunction&    flatFunction  = m_functions[ i_functionIndex ];
+    ArenaArray< SymbolId > argumentNames = GetArgumentNames( flatFunction );
+    ASTArena&              arena         = io_interner.GetArena();
+    PrototypeAST*          prototype     = arena.Create< PrototypeAST >(
+        flatFunction.m_name, arena.CopyArray( argumentNames.begin(), argumentNames.GetSize() ) );
+    return arena.Create< FunctionAST >( prototype, ExpandExpr( flatFunction.m_body, io_interner ) );
+}
+
+bool FlatAST::isWellFormed() const
+{
+    // Every reference must be in range, and every child must precede its parent, which ExpandExpr relies upon.
+    for ( FlatNodeIndex node = 0; node < m_nodes.size(); ++node )
+    {
+        const FlatNode& flatNode = m_nodes[ node ];
+        switch ( flatNode.m_kind )
+        {
+        case ExprKind_Numeric:
+            if ( flatNode.m_operands[ 0 ] >= m_numericValues.size() )
+            {
+                return false;
+            }
+            break;
+        case ExprKind_Variable:
+        case ExprKind_Binary:
+        case ExprKind_If:
+        case ExprKind_Assign:
+            break;
+        case ExprKind_Call:
+        case ExprKind_For:
+        case ExprKind_Var:
+            if ( uint64_t( flatNode.m_operands[ 1 ] ) + GetChildCount( node ) > m_children.size() )
+            {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+
+        for ( size_t childIndex = 0; childIndex < GetChildCount( node ); ++childIndex )
+        {
+            FlatNodeIndex child        = GetChild( node, childIndex );
+            bool          isOptional   = flatNode.m_kind == ExprKind_For && childIndex == 2;
+            bool          isAssignment = flatNode.m_kind == ExprKind_Assign && childIndex == 0;
+            if ( ( child == FlatNode_None && !isOptional ) || ( child != FlatNode_None && child >= node ) ||
+                 ( isAssignment && m_nodes[ child ].m_kind != ExprKind_Variable ) )
+            {
+                return false;
+            }
+        }
+    }
+
+    for ( const FlatFunction& function : m_functions )
+    {
+        if ( function.m_body >= m_nodes.size() ||
+             uint64_t( function.m_argumentsBegin ) + function.m_argumentCount > m_argumentNames.size() )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+} // namespace kaleidoscope
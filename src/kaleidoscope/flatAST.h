@@ -0,0 +1,177 @@
+#pragma once
+
+/* A compact, index-based encoding of the AST */
+
+#include <kaleidoscope/api.h>
+#include <kaleidoscope/ast.h>
+#include <kaleidoscope/symbolTable.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace kaleidoscope
+{
+class ExprInterner;
+
+/// FlatNodeIndex refers to a node within a FlatAST.
+using FlatNodeIndex = uint32_t;
+
+/// Index of an absent node, such as the step of a for loop which increments by 1.0.
+constexpr FlatNodeIndex FlatNode_None = UINT32_MAX;
+
+/// FlatNode is a single expression record of a FlatAST.
+///
+/// The meaning of the operands depends on the kind of the expression:
+/// - ExprKind_Numeric:  index of the value in the numeric side table.
+/// - ExprKind_Variable: symbol of the variable name, slot of the variable, whether the variable is mutable.
+/// - ExprKind_Binary:   left hand side node, right hand side node.
+/// - ExprKind_Call:     symbol of the callee, first argument in the child side table, number of arguments.
+/// - ExprKind_If:       condition node, then node, else node.
+/// - ExprKind_For:      symbol of the loop variable, first of the start, end, step, and body nodes in the
+///                      child side table, slot of the loop variable.
+/// - ExprKind_Var:      symbol of the variable name, first of the initializer and body nodes in the child side
+///                      table, slot of the variable.
+/// - ExprKind_Assign:   variable node, value node.
+struct FlatNode
+{
+    ExprKind m_kind;        /// Type of the expression.
+    char     m_operation;   /// Operator character, of a binary expression.
+    uint16_t m_reserved;    /// Padding, which is always zero.
+    uint32_t m_operands[3]; /// Operands, described above.
+};
+
+static_assert( sizeof( FlatNode ) == 16, "FlatNode is expected to be 16 bytes." );
+
+/// FlatFunction is a function definition of a FlatAST.
+struct FlatFunction
+{
+    SymbolId      m_name;           /// Name of the function.
+    uint32_t      m_argumentsBegin; /// First argument name in the argument name side table.
+    uint32_t      m_argumentCount;  /// Number of arguments.
+    FlatNodeIndex m_body;           /// Root node of the function body.
+};
+
+/// FlatAST is an alternative encoding of the AST, where expression nodes are stored contiguously as
+/// 16-byte records, and children are referred to by 32-bit index rather than by pointer.
+///
+/// Numeric literals, variable length child lists, and argument names are stored in side tables, and names
+/// are stored as symbols of the SymbolTable the AST was parsed with.
+///
+/// Children are appended before their parents, so a node always has a greater index than its children.
+/// All the storage is plain data, so a FlatAST is serialized by copying each array verbatim.  A serialized
+/// FlatAST is only meaningful alongside the SymbolTable it was built with.
+class FlatAST
+{
+public:
+    /// Append an expression tree.
+    /// \return the index of the root node of the expression.
+    KALEIDOSCOPE_API
+    FlatNodeIndex AppendExpr( const ExprAST& i_expr );
+
+    /// Append a function definition, and its body.
+    /// \return the index of the function.
+    KALEIDOSCOPE_API
+    size_t AppendFunction( const FunctionAST& i_function );
+
+    /// Remove all nodes and functions.
+    KALEIDOSCOPE_API
+    void Clear();
+
+    /// Get the number of expression nodes.
+    KALEIDOSCOPE_API
+    size_t GetNodeCount() const;
+
+    /// Get the type of a node.
+    KALEIDOSCOPE_API
+    ExprKind GetKind( FlatNodeIndex i_node ) const;
+
+    /// Get the value of an ExprKind_Numeric node.
+    KALEIDOSCOPE_API
+    double GetNumericValue( FlatNodeIndex i_node ) const;
+
+    /// Get the symbol of a node, which is the name of an ExprKind_Variable, the callee of an ExprKind_Call,
+    /// the loop variable of an ExprKind_For, or the variable of an ExprKind_Var.
+    KALEIDOSCOPE_API
+    SymbolId GetSymbol( FlatNodeIndex i_node ) const;
+
+    /// Get the slot of the variable of an ExprKind_Variable or ExprKind_Var node, or of the loop variable of an
+    /// ExprKind_For node (see VariableExprAST).
+    KALEIDOSCOPE_API
+    uint32_t GetSlot( FlatNodeIndex i_node ) const;
+
+    /// Get whether the variable of an ExprKind_Variable node is mutable, as it is bound by 'var'.
+    KALEIDOSCOPE_API
+    bool IsMutable( FlatNodeIndex i_node ) const;
+
+    /// Get the operator character of an ExprKind_Binary node.
+    KALEIDOSCOPE_API
+    char GetOperation( FlatNodeIndex i_node ) const;
+
+    /// Get the number of children of a node.
+    KALEIDOSCOPE_API
+    size_t GetChildCount( FlatNodeIndex i_node ) const;
+
+    /// Get a child of a node.
+    /// Children are ordered as: lhs, rhs of a binary expression; the arguments of a call; condition, then,
+    /// else of a conditional; start, end, step, body of a for loop; initializer, body of a 'var'; variable, value
+    /// of an assignment.  The step may be FlatNode_None.
+    KALEIDOSCOPE_API
+    FlatNodeIndex GetChild( FlatNodeIndex i_node, size_t i_childIndex ) const;
+
+    /// Get the number of functions.
+    KALEIDOSCOPE_API
+    size_t GetFunctionCount() const;
+
+    /// Get a function.
+    KALEIDOSCOPE_API
+    const FlatFunction& GetFunction( size_t i_functionIndex ) const;
+
+    /// Get the argument names of a function.
+    KALEIDOSCOPE_API
+    ArenaArray< SymbolId > GetArgumentNames( const FlatFunction& i_function ) const;
+
+    /// Get the number of bytes used to store the nodes, functions, and side tables.
+    KALEIDOSCOPE_API
+    size_t GetMemoryUsage() const;
+
+    /// Serialize into a buffer of bytes, replacing its contents.
+    KALEIDOSCOPE_API
+    void Serialize( std::vector< char >& o_buffer ) const;
+
+    /// Deserialize from a buffer produced by Serialize, replacing the contents of this FlatAST.
+    /// \return false if the buffer is malformed, in which case this FlatAST is cleared.
+    KALEIDOSCOPE_API
+    bool Deserialize( const char* i_buffer, size_t i_size );
+
+    /// Expand an expression tree back into expression nodes, constructed by an ExprInterner.
+    /// Code is generated for the expanded expression as for a parsed one, with ExprCodeGenerator.
+    /// \return the root of the expression.
+    KALEIDOSCOPE_API
+    ExprAST* ExpandExpr( FlatNodeIndex i_root, ExprInterner& io_interner ) const;
+
+    /// Expand a function definition, and its body, with nodes allocated from the arena of an ExprInterner.
+    KALEIDOSCOPE_API
+    FunctionAST* ExpandFunction( size_t i_functionIndex, ExprInterner& io_interner ) const;
+
+private:
+    /// Check that every reference of the nodes and functions is in range, and that children precede parents.
+    bool isWellFormed() const;
+
+    /// Append an expression tree, recursing on its operands (see AppendExpr).
+    /// \return the index of the root node of the expression.
+    FlatNodeIndex appendExpr( const ExprAST& i_expr );
+
+    /// Append a node.
+    /// \return the index of the node.
+    FlatNodeIndex appendNode( ExprKind i_kind, char i_operation, uint32_t i_op0, uint32_t i_op1, uint32_t i_op2 );
+
+    std::vector< FlatNode >      m_nodes;         /// Expression nodes.
+    std::vector< FlatFunction >  m_functions;     /// Function definitions.
+    std::vector< double >        m_numericValues; /// Side table of numeric literals.
+    std::vector< FlatNodeIndex > m_children;      /// Side table of call arguments and for loop children.
+    std::vector< SymbolId >      m_argumentNames; /// Side table of function argument names.
+
+    uint32_t m_nestedAppends = 0; /// Number of AppendExpr in progress.
+};
+
+} // namespace kaleidoscope
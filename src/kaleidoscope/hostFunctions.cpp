@@ -0,0 +1,116 @@
+#include <kaleidoscope/KaleidoscopeJIT.h>
+#include <kaleidoscope/hostFunctions.h>
+
+#include <llvm/IR/Function.h>
+
+#include <cmath>
+
+namespace
+{
+using UnaryFunction  = double ( * )( double );
+using BinaryFunction = double ( * )( double, double );
+
+/// Functions of the C math library, registered by RegisterMathFunctions.
+/// The overloads taking doubles are selected by casting to the type of the function pointer.
+struct MathFunction
+{
+    const char* m_name;          /// Name of the function.
+    void*       m_address;       /// Address of the function.
+    size_t      m_argumentCount; /// Number of arguments of the function.
+};
+
+const MathFunction s_mathFunctions[] = {
+    {"sin", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::sin ) ), 1},
+    {"cos", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::cos ) ), 1},
+    {"tan", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::tan ) ), 1},
+    {"asin", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::asin ) ), 1},
+    {"acos", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::acos ) ), 1},
+    {"atan", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::atan ) ), 1},
+    {"exp", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::exp ) ), 1},
+    {"log", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::log ) ), 1},
+    {"log10", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::log10 ) ), 1},
+    {"sqrt", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::sqrt ) ), 1},
+    {"fabs", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::fabs ) ), 1},
+    {"floor", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::floor ) ), 1},
+    {"ceil", reinterpret_cast< void* >( static_cast< UnaryFunction >( &std::ceil ) ), 1},
+    {"atan2", reinterpret_cast< void* >( static_cast< BinaryFunction >( &std::atan2 ) ), 2},
+    {"pow", reinterpret_cast< void* >( static_cast< BinaryFunction >( &std::pow ) ), 2},
+    {"fmod", reinterpret_cast< void* >( static_cast< BinaryFunction >( &std::fmod ) ), 2},
+};
+
+} // namespace
+
+namespace kaleidoscope
+{
+bool HostFunctionTable::Register( const std::string& i_name,
+                                  void*              i_address,
+                                  size_t             i_argumentCount,
+                                  uint32_t           i_attributes )
+{
+    return m_functions.emplace( i_name, HostFunction{i_address, i_argumentCount, i_attributes} ).second;
+}
+
+void HostFunctionTable::RegisterMathFunctions()
+{
+    // The functions may set errno upon a domain error, which generated code never reads, so they are pure as far as
+    // generated code is concerned.
+    for ( const MathFunction& function : s_mathFunctions )
+    {
+        Register( function.m_name,
+                  function.m_address,
+                  function.m_argumentCount,
+                  HostFunctionAttribute_Pure | HostFunctionAttribute_NoUnwind );
+    }
+}
+
+const HostFunction* HostFunctionTable::Find( const std::string& i_name ) const
+{
+    std::unordered_map< std::string, HostFunction >::const_iterator functionIt = m_functions.find( i_name );
+    return functionIt != m_functions.end() ? &functionIt->second : nullptr;
+}
+
+void HostFunctionTable::SetProcessSymbolSearch( bool i_enabled )
+{
+    m_processSymbolSearch = i_enabled;
+}
+
+bool HostFunctionTable::GetProcessSymbolSearch() const
+{
+    return m_processSymbolSearch;
+}
+
+void HostFunctionTable::AddToJIT( llvm::orc::KaleidoscopeJIT& io_jit ) const
+{
+    for ( const std::pair< const std::string, HostFunction >& function : m_functions )
+    {
+        io_jit.addHostSymbol( function.first, reinterpret_cast< uintptr_t >( function.second.m_address ) );
+    }
+
+    io_jit.setProcessSymbolSearch( m_processSymbolSearch );
+}
+
+void HostFunctionTable::ApplyAttributes( const HostFunction& i_hostFunction, llvm::Function& io_declaration )
+{
+    if ( i_hostFunction.m_attributes & HostFunctionAttribute_Pure )
+    {
+        io_declaration.setDoesNotAccessMemory();
+    }
+    else if ( i_hostFunction.m_attributes & HostFunctionAttribute_ReadOnly )
+    {
+        io_declaration.setOnlyReadsMemory();
+    }
+
+    // A call which may not return has an effect of its own, which keeps it from being removed or speculated, even
+    // if it does not write memory.
+    if ( i_hostFunction.m_attributes & ( HostFunctionAttribute_Pure | HostFunctionAttribute_ReadOnly ) )
+    {
+        io_declaration.addFnAttr( llvm::Attribute::WillReturn );
+    }
+
+    if ( i_hostFunction.m_attributes & HostFunctionAttribute_NoUnwind )
+    {
+        io_declaration.setDoesNotThrow();
+    }
+}
+
+} // namespace kaleidoscope
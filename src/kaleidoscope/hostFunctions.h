@@ -0,0 +1,108 @@
+#pragma once
+
+/* Registration of the host functions callable by generated code */
+
+#include <kaleidoscope/api.h>
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+
+namespace llvm
+{
+class Function;
+namespace orc
+{
+class KaleidoscopeJIT;
+}
+} // namespace llvm
+
+namespace kaleidoscope
+{
+/// HostFunctionAttribute describes what a host function may do, for the optimizer to exploit.  Attributes are
+/// combined as a bit mask.
+enum HostFunctionAttribute : uint32_t
+{
+    HostFunctionAttribute_None = 0,
+
+    /// The result only depends on the arguments, no memory is read or written, and the function always returns, so
+    /// calls with the same arguments may be merged, hoisted out of loops, or removed if their result is unused.
+    HostFunctionAttribute_Pure = 1 << 0,
+
+    /// Memory may be read, but is never written, and the function always returns.
+    HostFunctionAttribute_ReadOnly = 1 << 1,
+
+    /// The function never unwinds, such as by throwing an exception.
+    HostFunctionAttribute_NoUnwind = 1 << 2
+};
+
+/// A function of the host process, callable by generated code.
+struct HostFunction
+{
+    void*    m_address;       /// Address of the function, which takes and returns doubles.
+    size_t   m_argumentCount; /// Number of arguments of the function.
+    uint32_t m_attributes;    /// Bit mask of HostFunctionAttribute.
+};
+
+/// HostFunctionTable registers the host functions callable by generated code, by name.
+///
+/// An 'extern' of a registered function is resolved through the table, rather than by searching the symbols of the
+/// whole process, and is declared with the attributes of the function.  The search of the process may be disabled
+/// altogether, so that generated code can only call the registered functions.
+///
+/// A registered function cannot be defined by generated code, as its attributes would then be applied to calls to
+/// the definition.
+class HostFunctionTable
+{
+public:
+    /// Register a host function.
+    /// \param i_name the name of the function, as declared by 'extern'.
+    /// \param i_address the address of the function, which takes i_argumentCount doubles and returns a double.
+    /// \param i_argumentCount the number of arguments of the function.
+    /// \param i_attributes bit mask of HostFunctionAttribute.
+    /// \return false if a function of the same name is already registered.
+    KALEIDOSCOPE_API
+    bool Register( const std::string& i_name, void* i_address, size_t i_argumentCount, uint32_t i_attributes );
+
+    /// Register a host function, inferring its number of arguments from its type.
+    template < class... Args >
+    bool Register( const std::string& i_name, double ( *i_function )( Args... ), uint32_t i_attributes )
+    {
+        static_assert( std::conjunction< std::is_same< Args, double >... >::value,
+                       "Host functions take and return doubles." );
+        return Register( i_name, reinterpret_cast< void* >( i_function ), sizeof...( Args ), i_attributes );
+    }
+
+    /// Register the functions of the C math library taking and returning doubles, such as sin and pow, as pure.
+    KALEIDOSCOPE_API
+    void RegisterMathFunctions();
+
+    /// Find a registered function.
+    /// \return nullptr if no function of the name is registered.
+    KALEIDOSCOPE_API
+    const HostFunction* Find( const std::string& i_name ) const;
+
+    /// Set whether symbols which are not registered are searched for in the whole process, which is the default.
+    KALEIDOSCOPE_API
+    void SetProcessSymbolSearch( bool i_enabled );
+
+    /// Get whether symbols which are not registered are searched for in the whole process.
+    KALEIDOSCOPE_API
+    bool GetProcessSymbolSearch() const;
+
+    /// Define the registered functions in a JIT, which resolves the calls of generated code to them, and configure
+    /// its search of the process.  Functions registered afterwards must be added again.
+    KALEIDOSCOPE_API
+    void AddToJIT( llvm::orc::KaleidoscopeJIT& io_jit ) const;
+
+    /// Apply the attributes of a registered function to its declaration.
+    KALEIDOSCOPE_API
+    static void ApplyAttributes( const HostFunction& i_hostFunction, llvm::Function& io_declaration );
+
+private:
+    std::unordered_map< std::string, HostFunction > m_functions;                 /// Registered functions, by name.
+    bool                                            m_processSymbolSearch = true; /// Search the process when missing.
+};
+
+} // namespace kaleidoscope
@@ -1,35 +1,368 @@
 #include <kaleidoscope/lexer.h>
 #include <kaleidoscope/logger.h>
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#elif defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
 namespace
 {
-/// Static storage of different types of token values.
+using namespace kaleidoscope;
+
+/// Capacity of the buffer which streamed text is pulled into.  This also bounds the length of a single token.
+constexpr size_t s_streamBufferSize = 64 * 1024;
+
+/// Numeric literals up to this length are converted from a stack buffer, rather than a heap allocated string.
+constexpr size_t s_numericBufferSize = 64;
+
+/// Convert the text of a numeric literal into a double.
+/// The text is not null-terminated, so it is copied into a bounded buffer before conversion.
+double ParseNumeric( std::string_view i_text )
+{
+    if ( i_text.size() < s_numericBufferSize )
+    {
+        char buffer[ s_numericBufferSize ];
+        i_text.copy( buffer, i_text.size() );
+        buffer[ i_text.size() ] = '\0';
+        return strtod( buffer, nullptr );
+    }
+
+    std::string numberStr( i_text );
+    return strtod( numberStr.c_str(), nullptr );
+}
+
+/// Convert the text of a numeric literal into a double, in place.
+/// Like strtod, the longest valid prefix is converted and a text without any digits converts to 0.0.
+double ParseNumericInPlace( std::string_view i_text )
+{
+#if defined( __cpp_lib_to_chars )
+    double value = 0.0;
+    std::from_chars( i_text.data(), i_text.data() + i_text.size(), value );
+    return value;
+#else
+    // Floating point std::from_chars is not provided by this standard library.
+    return ParseNumeric( i_text );
+#endif
+}
+
+/// Bit flags classifying a character, for the accelerated lexer.
+enum CharacterClass : uint8_t
+{
+    CharacterClass_Whitespace = 1 << 0,
+    CharacterClass_Alpha      = 1 << 1,
+    CharacterClass_Digit      = 1 << 2,
+    CharacterClass_Dot        = 1 << 3,
+};
+
+/// Build a table of CharacterClass flags, indexed by character.
+/// Classification matches the "C" locale isspace, isalpha and isdigit.
+constexpr std::array< uint8_t, 256 > BuildCharacterClassTable()
+{
+    std::array< uint8_t, 256 > table{};
+    for ( size_t c = '\t'; c <= '\r'; ++c )
+    {
+        table[ c ] |= CharacterClass_Whitespace;
+    }
+    table[ ' ' ] |= CharacterClass_Whitespace;
+
+    for ( size_t c = 'a'; c <= 'z'; ++c )
+    {
+        table[ c ] |= CharacterClass_Alpha;
+        table[ c - 'a' + 'A' ] |= CharacterClass_Alpha;
+    }
+
+    for ( size_t c = '0'; c <= '9'; ++c )
+    {
+        table[ c ] |= CharacterClass_Digit;
+    }
+    table[ '.' ] |= CharacterClass_Dot;
+
+    return table;
+}
+
+constexpr std::array< uint8_t, 256 > s_characterClasses = BuildCharacterClassTable();
+
+/// Check if the character at i_position is of any of the classes in i_classes.
+inline bool IsCharacterClass( std::string_view i_text, size_t i_position, uint8_t i_classes )
+{
+    return ( s_characterClasses[ static_cast< unsigned char >( i_text[ i_position ] ) ] & i_classes ) != 0;
+}
+
+#if defined( __AVX2__ )
+/// SIMD block size in bytes.
+constexpr size_t s_blockSize = 32;
+
+/// Per-byte mask of i_lower <= c <= i_upper, using a biased signed comparison.
+inline __m256i InRange( __m256i i_block, char i_lower, char i_upper )
+{
+    __m256i biased = _mm256_xor_si256( _mm256_sub_epi8( i_block, _mm256_set1_epi8( i_lower ) ),
+                                       _mm256_set1_epi8( static_cast< char >( 0x80 ) ) );
+    return _mm256_cmpgt_epi8( _mm256_set1_epi8( static_cast< char >( ( i_upper - i_lower + 1 ) ^ 0x80 ) ), biased );
+}
+
+/// Load a block of text, starting from i_position.
+inline __m256i LoadBlock( std::string_view i_text, size_t i_position )
+{
+    return _mm256_loadu_si256( reinterpret_cast< const __m256i* >( i_text.data() + i_position ) );
+}
+
+/// Bit mask of the bytes in the block which are whitespace.
+inline uint32_t WhitespaceMask( __m256i i_block )
+{
+    __m256i mask = _mm256_or_si256( _mm256_cmpeq_epi8( i_block, _mm256_set1_epi8( ' ' ) ),
+                                    InRange( i_block, '\t', '\r' ) );
+    return static_cast< uint32_t >( _mm256_movemask_epi8( mask ) );
+}
+
+/// Bit mask of the bytes in the block which are alphanumeric.
+inline uint32_t AlphaNumericMask( __m256i i_block )
+{
+    __m256i lower = _mm256_or_si256( i_block, _mm256_set1_epi8( 0x20 ) );
+    __m256i mask  = _mm256_or_si256( InRange( lower, 'a', 'z' ), InRange( i_block, '0', '9' ) );
+    return static_cast< uint32_t >( _mm256_movemask_epi8( mask ) );
+}
+#elif defined( __SSE2__ )
+/// SIMD block size in bytes.
+constexpr size_t s_blockSize = 16;
+
+/// Per-byte mask of i_lower <= c <= i_upper, using a biased signed comparison.
+inline __m128i InRange( __m128i i_block, char i_lower, char i_upper )
+{
+    __m128i biased = _mm_xor_si128( _mm_sub_epi8( i_block, _mm_set1_epi8( i_lower ) ),
+                                    _mm_set1_epi8( static_cast< char >( 0x80 ) ) );
+    return _mm_cmplt_epi8( biased, _mm_set1_epi8( static_cast< char >( ( i_upper - i_lower + 1 ) ^ 0x80 ) ) );
+}
+
+/// Load a block of text, starting from i_position.
+inline __m128i LoadBlock( std::string_view i_text, size_t i_position )
+{
+    return _mm_loadu_si128( reinterpret_cast< const __m128i* >( i_text.data() + i_position ) );
+}
+
+/// Bit mask of the bytes in the block which are whitespace.
+inline uint32_t WhitespaceMask( __m128i i_block )
+{
+    __m128i mask = _mm_or_si128( _mm_cmpeq_epi8( i_block, _mm_set1_epi8( ' ' ) ), InRange( i_block, '\t', '\r' ) );
+    return static_cast< uint32_t >( _mm_movemask_epi8( mask ) );
+}
+
+/// Bit mask of the bytes in the block which are alphanumeric.
+inline uint32_t AlphaNumericMask( __m128i i_block )
+{
+    __m128i lower = _mm_or_si128( i_block, _mm_set1_epi8( 0x20 ) );
+    __m128i mask  = _mm_or_si128( InRange( lower, 'a', 'z' ), InRange( i_block, '0', '9' ) );
+    return static_cast< uint32_t >( _mm_movemask_epi8( mask ) );
+}
+#endif
+
+/// Mask of all bits in a SIMD block.
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+constexpr uint32_t s_blockMask = static_cast< uint32_t >( ( uint64_t( 1 ) << s_blockSize ) - 1 );
+#endif
+
+/// Skip a run of whitespace characters.
+/// \return the position of the first non-whitespace character at, or after i_position.
+inline size_t SkipWhitespace( std::string_view i_text, size_t i_position )
+{
+    // Single separating spaces are the common case, so test the first character before scanning blocks.
+    if ( i_position >= i_text.size() || !IsCharacterClass( i_text, i_position, CharacterClass_Whitespace ) )
+    {
+        return i_position;
+    }
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+    while ( i_position + s_blockSize <= i_text.size() )
+    {
+        uint32_t mask = ~WhitespaceMask( LoadBlock( i_text, i_position ) ) & s_blockMask;
+        if ( mask != 0 )
+        {
+            return i_position + __builtin_ctz( mask );
+        }
+
+        i_position += s_blockSize;
+    }
+#endif
+
+    while ( i_position < i_text.size() && IsCharacterClass( i_text, i_position, CharacterClass_Whitespace ) )
+    {
+        i_position++;
+    }
+
+    return i_position;
+}
+
+/// Skip a run of alphanumeric characters.
+/// \return the position of the first non-alphanumeric character at, or after i_position.
+inline size_t SkipAlphaNumeric( std::string_view i_text, size_t i_position )
+{
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+    while ( i_position + s_blockSize <= i_text.size() )
+    {
+        uint32_t mask = ~AlphaNumericMask( LoadBlock( i_text, i_position ) ) & s_blockMask;
+        if ( mask != 0 )
+        {
+            return i_position + __builtin_ctz( mask );
+        }
+
+        i_position += s_blockSize;
+    }
+#endif
+
+    while ( i_position < i_text.size() &&
+            IsCharacterClass( i_text, i_position, CharacterClass_Alpha | CharacterClass_Digit ) )
+    {
+        i_position++;
+    }
+
+    return i_position;
+}
+
+/// Skip a run of numeric characters (digits and dots).
+/// \return the position of the first non-numeric character at, or after i_position.
+inline size_t SkipNumeric( std::string_view i_text, size_t i_position )
+{
+    // Numerals are short, so are not worth a SIMD scan.
+    while ( i_position < i_text.size() &&
+            IsCharacterClass( i_text, i_position, CharacterClass_Digit | CharacterClass_Dot ) )
+    {
+        i_position++;
+    }
+
+    return i_position;
+}
+
+/// Keyword text, and its associated token.
+struct KeywordEntry
+{
+    std::string_view m_text;
+    int              m_token = Token_Identifier;
+};
+
+/// All the keywords of the language.
+constexpr KeywordEntry s_keywords[] = {
+    {"def", Token_Def},
+    {"extern", Token_Extern},
+    {"if", Token_If},
+    {"then", Token_Then},
+    {"else", Token_Else},
+    {"for", Token_For},
+    {"in", Token_In},
+    {"var", Token_Var},
+};
+
+/// Number of slots in the keyword hash table.
+constexpr size_t s_keywordTableSize = 32;
+
+/// Hash of a keyword or identifier, from its first character, last character and length.
+/// The coefficients were chosen such that the hash is collision free over s_keywords.
+constexpr size_t KeywordHash( std::string_view i_text )
+{
+    return ( static_cast< unsigned char >( i_text.front() ) * 3 + static_cast< unsigned char >( i_text.back() ) * 7 +
+             i_text.size() ) &
+           ( s_keywordTableSize - 1 );
+}
+
+/// Build the keyword hash table, with each keyword placed in the slot of its hash.
+constexpr std::array< KeywordEntry, s_keywordTableSize > BuildKeywordTable()
+{
+    std::array< KeywordEntry, s_keywordTableSize > table{};
+    for ( const KeywordEntry& keyword : s_keywords )
+    {
+        table[ KeywordHash( keyword.m_text ) ] = keyword;
+    }
+
+    return table;
+}
+
+constexpr std::array< KeywordEntry, s_keywordTableSize > s_keywordTable = BuildKeywordTable();
+
+/// Check that every keyword occupies its own slot in the hash table.
+constexpr bool IsPerfectKeywordHash()
+{
+    for ( const KeywordEntry& keyword : s_keywords )
+    {
+        if ( s_keywordTable[ KeywordHash( keyword.m_text ) ].m_text != keyword.m_text )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static_assert( IsPerfectKeywordHash(), "Keyword hash has collisions, please update the KeywordHash coefficients." );
+
+/// Look up the token of an identifier.
+/// \return the keyword token, or Token_Identifier if the identifier is not a keyword.
+inline int LookupKeyword( std::string_view i_identifier )
+{
+    const KeywordEntry& entry = s_keywordTable[ KeywordHash( i_identifier ) ];
+    return entry.m_text == i_identifier ? entry.m_token : Token_Identifier;
+}
+
 } // namespace
 
 namespace kaleidoscope
 {
-Lexer::Lexer( const std::string& i_text )
+Lexer::Lexer( std::string_view i_text, SymbolTable& io_symbolTable, LexerMode i_mode )
     : m_text( i_text )
+    , m_symbolTable( io_symbolTable )
+    , m_mode( i_mode )
 {
 }
 
+Lexer::Lexer( std::istream& io_stream, SymbolTable& io_symbolTable, LexerMode i_mode )
+    : m_symbolTable( io_symbolTable )
+    , m_mode( i_mode )
+    , m_stream( &io_stream )
+    , m_streamBuffer( new char[ s_streamBufferSize ] )
+{
+    m_text = std::string_view( m_streamBuffer.get(), 0 );
+}
+
 int Lexer::GetNextToken()
+{
+    if ( m_mode == LexerMode_Accelerated )
+    {
+        return getNextTokenAccelerated();
+    }
+    else
+    {
+        return getNextTokenReference();
+    }
+}
+
+int Lexer::getNextTokenReference()
 {
     // Skip all whitespace characters.
-    while ( isspace( m_lastChar ) )
+    m_tokenPosition = m_position;
+    while ( isspace( peekChar() ) )
     {
-        m_lastChar = getChar();
+        m_tokenPosition = ++m_position;
     }
 
-    if ( isalpha( m_lastChar ) )
+    int thisChar = peekChar();
+    if ( isalpha( thisChar ) )
     {
         // Handle non-numerical tokens.
-        m_identifierValue = m_lastChar;
-        while ( isalnum( m_lastChar = getChar() ) )
+        do
         {
-            m_identifierValue += m_lastChar;
-        }
+            m_position++;
+        } while ( isalnum( peekChar() ) );
 
+        m_identifierValue = m_text.substr( m_tokenPosition, m_position - m_tokenPosition );
         if ( m_identifierValue == "def" )
         {
             return Token_Def;
@@ -58,52 +391,168 @@ int Lexer::GetNextToken()
         {
             return Token_In;
         }
+        else if ( m_identifierValue == "var" )
+        {
+            return Token_Var;
+        }
 
+        m_identifierSymbol = m_symbolTable.Intern( m_identifierValue );
         return Token_Identifier;
     }
-    else if ( isdigit( m_lastChar ) || m_lastChar == '.' )
+    else if ( isdigit( thisChar ) || thisChar == '.' )
     {
         // Handle numerical double-precision tokens.
-        std::string numberStr;
         do
         {
-            numberStr += m_lastChar;
-            m_lastChar = getChar();
-        } while ( isdigit( m_lastChar ) || m_lastChar == '.' );
+            m_position++;
+        } while ( isdigit( peekChar() ) || peekChar() == '.' );
 
-        m_numberValue = strtod( numberStr.c_str(), 0 );
+        m_numericText = m_text.substr( m_tokenPosition, m_position - m_tokenPosition );
+        m_numberValue = ParseNumeric( m_numericText );
         return Token_Numeric;
     }
-    else if ( m_lastChar == EOF )
+    else if ( thisChar == EOF )
+    {
+        return Token_Eof;
+    }
+    else
+    {
+        m_position++;
+        return thisChar;
+    }
+}
+
+int Lexer::getNextTokenAccelerated()
+{
+    // Skip whitespace, pulling more text whilst the whitespace extends to the end of the text.
+    do
+    {
+        m_position      = SkipWhitespace( m_text, m_position );
+        m_tokenPosition = m_position;
+    } while ( m_position >= m_text.size() && refill() );
+
+    if ( m_position >= m_text.size() )
     {
         return Token_Eof;
     }
+
+    unsigned char thisChar  = static_cast< unsigned char >( m_text[ m_position ] );
+    uint8_t       thisClass = s_characterClasses[ thisChar ];
+    if ( thisClass & CharacterClass_Alpha )
+    {
+        // Handle identifier and keyword tokens.
+        m_position = SkipAlphaNumeric( m_text, m_position + 1 );
+        while ( m_position >= m_text.size() && refill() )
+        {
+            m_position = SkipAlphaNumeric( m_text, m_position );
+        }
+
+        m_identifierValue = m_text.substr( m_tokenPosition, m_position - m_tokenPosition );
+
+        int token = LookupKeyword( m_identifierValue );
+        if ( token == Token_Identifier )
+        {
+            m_identifierSymbol = m_symbolTable.Intern( m_identifierValue );
+        }
+
+        return token;
+    }
+    else if ( thisClass & ( CharacterClass_Digit | CharacterClass_Dot ) )
+    {
+        // Handle numerical double-precision tokens.
+        m_position = SkipNumeric( m_text, m_position + 1 );
+        while ( m_position >= m_text.size() && refill() )
+        {
+            m_position = SkipNumeric( m_text, m_position );
+        }
+
+        m_numericText = m_text.substr( m_tokenPosition, m_position - m_tokenPosition );
+        m_numberValue = ParseNumericInPlace( m_numericText );
+        return Token_Numeric;
+    }
     else
     {
-        int thisCharInt = ( int ) m_lastChar;
-        m_lastChar      = getChar();
-        return thisCharInt;
+        m_position++;
+        return thisChar;
     }
 }
 
-const std::string& Lexer::GetIdentifierValue()
+std::string_view Lexer::GetIdentifierValue() const
 {
     return m_identifierValue;
 }
 
-double Lexer::GetNumericValue()
+SymbolId Lexer::GetIdentifierSymbol() const
+{
+    return m_identifierSymbol;
+}
+
+double Lexer::GetNumericValue() const
 {
     return m_numberValue;
 }
 
-char Lexer::getChar()
+std::string_view Lexer::GetNumericText() const
 {
-    if ( m_position >= m_text.size() )
+    return m_numericText;
+}
+
+size_t Lexer::GetTokenOffset() const
+{
+    return m_discardedSize + m_tokenPosition;
+}
+
+int Lexer::peekChar()
+{
+    if ( m_position >= m_text.size() && !refill() )
     {
         return EOF;
     }
 
-    return m_text.at( m_position++ );
+    return static_cast< unsigned char >( m_text[ m_position ] );
+}
+
+bool Lexer::refill()
+{
+    if ( m_stream == nullptr )
+    {
+        return false;
+    }
+
+    // Discard the text preceding the current token, by moving the remaining text to the front of the buffer.
+    size_t retainedSize = m_text.size() - m_tokenPosition;
+    memmove( m_streamBuffer.get(), m_text.data() + m_tokenPosition, retainedSize );
+    m_discardedSize += m_tokenPosition;
+    m_position -= m_tokenPosition;
+    m_tokenPosition = 0;
+    m_text          = std::string_view( m_streamBuffer.get(), retainedSize );
+
+    if ( retainedSize == s_streamBufferSize )
+    {
+        LogError( "Token exceeds the maximum length of %zu characters.", s_streamBufferSize );
+        return false;
+    }
+
+    // Pull whatever is available without blocking, or block for at least a single character.
+    // This keeps interactive streams responsive, whilst reading files in large chunks.
+    std::streambuf* streamBuffer = m_stream->rdbuf();
+    std::streamsize available    = streamBuffer->in_avail();
+    if ( available < 0 )
+    {
+        return false;
+    }
+
+    std::streamsize requestSize = std::max< std::streamsize >( available, 1 );
+    requestSize = std::min< std::streamsize >( requestSize, s_streamBufferSize - retainedSize );
+
+    std::streamsize readSize = streamBuffer->sgetn( m_streamBuffer.get() + retainedSize, requestSize );
+    if ( readSize <= 0 )
+    {
+        return false;
+    }
+
+    m_text = std::string_view( m_streamBuffer.get(), retainedSize + readSize );
+    return true;
 }
 
 } // namespace kaleidoscope
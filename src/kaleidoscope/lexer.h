@@ -1,8 +1,11 @@
 #pragma once
 
 #include <kaleidoscope/api.h>
+#include <kaleidoscope/symbolTable.h>
 
-#include <string>
+#include <istream>
+#include <memory>
+#include <string_view>
 
 namespace kaleidoscope
 {
@@ -27,41 +30,106 @@ enum Token
 
     /// For Control flow
     Token_For = -9,
-    Token_In = -10
+    Token_In = -10,
+
+    /// Mutable variables
+    Token_Var = -11
+};
+
+/// LexerMode selects the implementation used to scan the text.
+/// Both modes produce identical tokens.
+enum LexerMode
+{
+    /// Scans one character at a time, using the standard character classification functions.
+    LexerMode_Reference = 0,
+
+    /// Scans using a constant character class table, SIMD (SSE2 / AVX2) scanning of whitespace and
+    /// identifier runs, perfect-hash keyword lookup, and in-place numeric conversion.
+    LexerMode_Accelerated = 1
 };
 
 /// The Lexer consumes text and produces identifiable and relevant tokens to then be consumed by the parser.
+///
+/// The Lexer reads text from one of two sources:
+/// - A view of text, which the Lexer does not own, nor copy.  The caller is responsible for keeping the
+///   text (for example, a std::string or a memory-mapped file region) alive for the lifetime of the Lexer,
+///   and for the lifetime of any identifier or numeric views returned by it.
+/// - A stream, which the Lexer pulls text from on demand into a bounded buffer.  Text preceding the current
+///   token is discarded as the buffer is refilled, so memory use is constant regardless of the size of the
+///   stream, and identifier or numeric views are only valid until the next call to GetNextToken().
+///
+/// Identifiers are interned into a SymbolTable as they are scanned, so that consumers of the Lexer can
+/// refer to them by a compact SymbolId.
 class Lexer
 {
 public:
     /// Ctor.
+    /// \param i_text view of the text to tokenize.
+    /// \param io_symbolTable table to intern identifiers into.
+    /// \param i_mode the scanning implementation to use.
     KALEIDOSCOPE_API
-    explicit Lexer( const std::string& i_text );
+    Lexer( std::string_view i_text, SymbolTable& io_symbolTable, LexerMode i_mode = LexerMode_Accelerated );
+
+    /// Ctor.
+    /// \param io_stream stream of text to tokenize, which must outlive the Lexer.
+    /// \param io_symbolTable table to intern identifiers into.
+    /// \param i_mode the scanning implementation to use.
+    KALEIDOSCOPE_API
+    Lexer( std::istream& io_stream, SymbolTable& io_symbolTable, LexerMode i_mode = LexerMode_Accelerated );
 
     /// Get the next token.
     KALEIDOSCOPE_API
     int GetNextToken();
 
-    /// Get the value of the last Identifier token.
+    /// Get the value of the last Identifier token, as a view into the source text.
     KALEIDOSCOPE_API
-    const std::string& GetIdentifierValue();
+    std::string_view GetIdentifierValue() const;
+
+    /// Get the interned symbol of the last Identifier token.
+    KALEIDOSCOPE_API
+    SymbolId GetIdentifierSymbol() const;
 
     /// Get the value of the last Numeric token.
     KALEIDOSCOPE_API
-    double GetNumericValue();
+    double GetNumericValue() const;
+
+    /// Get the source text of the last Numeric token, as a view into the source text.
+    KALEIDOSCOPE_API
+    std::string_view GetNumericText() const;
+
+    /// Get the offset of the first character of the last token, from the beginning of the text or stream.
+    KALEIDOSCOPE_API
+    size_t GetTokenOffset() const;
 
 private:
     /// Hide private ctor.
     Lexer();
 
-    /// Private function for consuming and returning the next character.
-    char getChar();
+    /// Token scanning implementations, per LexerMode.
+    int getNextTokenReference();
+    int getNextTokenAccelerated();
+
+    /// Private function for returning the next character to consume, without consuming it.
+    /// \return the next character, or EOF if the end of the text has been reached.
+    int peekChar();
+
+    /// Pull more text from the stream, discarding the text preceding the current token.
+    /// \return true if more text was appended, false if there is no stream or it has been exhausted.
+    bool refill();
+
+    std::string_view m_text;                                     /// View of the text to read.
+    SymbolTable&     m_symbolTable;                              /// Table to intern identifiers into.
+    LexerMode        m_mode             = LexerMode_Accelerated; /// Scanning implementation.
+    size_t           m_position         = 0;                     /// Position of the next character to consume.
+    size_t           m_tokenPosition    = 0;                     /// Position of the first character of the token.
+    std::string_view m_identifierValue;                          /// View of the last Identifier value.
+    SymbolId         m_identifierSymbol = 0;                     /// Interned symbol of the last Identifier value.
+    std::string_view m_numericText;                              /// View of the last Numeric value.
+    double           m_numberValue = 0.0;                        /// Cached numerical value.
 
-    std::string m_text;                  /// Text to read.
-    size_t      m_position        = 0;   /// Position in the text to consume the next character (via getChar).
-    char        m_lastChar        = ' '; /// The last character which was consumed
-    std::string m_identifierValue = "";  /// Cached Identifier value.
-    double      m_numberValue     = 0.0; /// Cached numerical value.
+    std::istream*             m_stream = nullptr;  /// Stream to pull text from, if streaming.
+    std::unique_ptr< char[] > m_streamBuffer;      /// Bounded buffer of text pulled from the stream.
+    size_t                    m_discardedSize = 0; /// Number of characters discarded from the stream buffer.
 };
 
 } // namespace kaleidoscope
@@ -0,0 +1,216 @@
+#include <kaleidoscope/codeGenContext.h>
+#include <kaleidoscope/logger.h>
+#include <kaleidoscope/parallelCodeGen.h>
+#include <kaleidoscope/parser.h>
+#include <kaleidoscope/simplifier.h>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace
+{
+using namespace kaleidoscope;
+
+/// Number of chunks per thread, so that threads which finish early can pick up remaining work.
+constexpr size_t s_chunksPerThread = 4;
+
+/// A prototype declared at a top-level boundary.
+struct Declaration
+{
+    size_t        m_tokenIndex; /// Index of the 'def' or 'extern' token.
+    PrototypeAST* m_prototype;  /// Parsed prototype.
+};
+
+void HandleDefinition( Parser& io_parser, CodeGenContext& io_context )
+{
+    FunctionAST* expr = io_parser.ParseDefinitionExpr();
+    if ( expr != nullptr )
+    {
+        expr = SimplifyFunction( expr, io_parser.GetInterner(), SimplifyMode_Strict );
+        expr->GenerateCode( io_context );
+    }
+    else
+    {
+        io_parser.ParseNextToken();
+    }
+}
+
+void HandleExtern( Parser& io_parser, CodeGenContext& io_context )
+{
+    PrototypeAST* expr = io_parser.ParseExternExpr();
+    if ( expr != nullptr )
+    {
+        expr->GenerateCode( io_context );
+    }
+    else
+    {
+        io_parser.ParseNextToken();
+    }
+}
+
+void HandleTopLevelExpression( Parser& io_parser, CodeGenContext& io_context )
+{
+    FunctionAST* expr = io_parser.ParseTopLevelExpr();
+    if ( expr != nullptr )
+    {
+        expr = SimplifyFunction( expr, io_parser.GetInterner(), SimplifyMode_Strict );
+        expr->GenerateCode( io_context );
+    }
+    else
+    {
+        io_parser.ParseNextToken();
+    }
+}
+
+/// Parse and generate code for every top-level item of a parser.
+void GenerateTopLevelItems( Parser& io_parser, CodeGenContext& io_context )
+{
+    while ( io_parser.ParseCurrentToken() != Token_Eof )
+    {
+        switch ( io_parser.ParseCurrentToken() )
+        {
+        case ';': // ignore top-level semicolons.
+            io_parser.ParseNextToken();
+            break;
+        case Token_Def:
+            HandleDefinition( io_parser, io_context );
+            break;
+        case Token_Extern:
+            HandleExtern( io_parser, io_context );
+            break;
+        default:
+            HandleTopLevelExpression( io_parser, io_context );
+            break;
+        }
+    }
+}
+
+} // namespace
+
+namespace kaleidoscope
+{
+bool GenerateCodeParallel( const TokenArray&    i_tokens,
+                           CodeGenContext&      io_context,
+                           const std::string&   i_targetTriple,
+                           llvm::TargetMachine* i_targetMachine,
+                           size_t               i_threadCount )
+{
+    size_t threadCount = i_threadCount != 0 ? i_threadCount : std::max( 1u, std::thread::hardware_concurrency() );
+
+    // Split the tokens into chunks of similar size, at top-level boundaries.
+    size_t                chunkCount  = threadCount * s_chunksPerThread;
+    size_t                chunkTokens = std::max< size_t >( 1, i_tokens.GetSize() / chunkCount );
+    std::vector< size_t > boundaries  = i_tokens.FindTopLevelBoundaries();
+    std::vector< size_t > chunkBegins = {0};
+    for ( size_t boundary : boundaries )
+    {
+        if ( boundary - chunkBegins.back() >= chunkTokens )
+        {
+            chunkBegins.push_back( boundary );
+        }
+    }
+
+    // Parse the prototype at every boundary, so that each chunk can declare the functions preceding it.
+    // Prototypes are small, so this is cheap relative to parsing the function bodies.
+    Parser                     declarationParser( i_tokens, io_context.GetSymbolTable() );
+    std::vector< Declaration > declarations;
+    declarations.reserve( boundaries.size() );
+    for ( size_t boundary : boundaries )
+    {
+        declarationParser.SetTokenIndex( boundary );
+        PrototypeAST* prototype = declarationParser.ParseDeclarationExpr();
+        if ( prototype != nullptr )
+        {
+            declarations.push_back( {boundary, prototype} );
+        }
+    }
+
+    // Generate each chunk into a module in its own LLVM context, which is serialized as bitcode so that it
+    // can be loaded into the LLVM context of io_context.
+    std::vector< std::string > chunkBitcode( chunkBegins.size() );
+    std::atomic< size_t >      nextChunk( 0 );
+    auto                       generateChunks = [&]() {
+        for ( size_t chunkIndex = nextChunk++; chunkIndex < chunkBegins.size(); chunkIndex = nextChunk++ )
+        {
+            size_t begin = chunkBegins[ chunkIndex ];
+            size_t end   = chunkIndex + 1 < chunkBegins.size() ? chunkBegins[ chunkIndex + 1 ] : i_tokens.GetSize();
+
+            CodeGenContext context( io_context.GetSymbolTable() );
+            context.SetFloatingPointMode( io_context.GetFloatingPointMode() );
+            context.SetMathIntrinsics( io_context.GetMathIntrinsics() );
+            context.InitializeModule( i_targetTriple, i_targetMachine );
+            for ( const Declaration& declaration : declarations )
+            {
+                if ( declaration.m_tokenIndex >= begin )
+                {
+                    break;
+                }
+
+                bool isDefinition = i_tokens.GetKind( declaration.m_tokenIndex ) == Token_Def;
+                context.AddFunction( *declaration.m_prototype, isDefinition );
+            }
+
+            Parser parser( i_tokens, io_context.GetSymbolTable(), begin, end );
+            GenerateTopLevelItems( parser, context );
+
+            llvm::raw_string_ostream bitcodeStream( chunkBitcode[ chunkIndex ] );
+            llvm::WriteBitcodeToFile( *context.GetModule(), bitcodeStream );
+            bitcodeStream.flush();
+        }
+    };
+
+    std::vector< std::thread > threads;
+    for ( size_t threadIndex = 1; threadIndex < std::min( threadCount, chunkBegins.size() ); ++threadIndex )
+    {
+        threads.emplace_back( generateChunks );
+    }
+
+    generateChunks();
+    for ( std::thread& thread : threads )
+    {
+        thread.join();
+    }
+
+    // Link the chunks in source order.
+    llvm::Module* module = io_context.GetModule();
+    for ( const std::string& bitcode : chunkBitcode )
+    {
+        llvm::Expected< std::unique_ptr< llvm::Module > > chunkModule =
+            llvm::parseBitcodeFile( llvm::MemoryBufferRef( bitcode, "chunk" ), io_context.GetLLVMContext() );
+        if ( !chunkModule )
+        {
+            LogError( "Failed to load generated code: %s", llvm::toString( chunkModule.takeError() ).c_str() );
+            return false;
+        }
+
+        // A function is defined once, so a redefinition in a later chunk is discarded.
+        for ( llvm::Function& function : **chunkModule )
+        {
+            llvm::Function* existingFunction = module->getFunction( function.getName() );
+            if ( !function.isDeclaration() && existingFunction != nullptr && !existingFunction->isDeclaration() )
+            {
+                LogError( "Function '%s' cannot be redefined", function.getName().str().c_str() );
+                function.deleteBody();
+            }
+        }
+
+        if ( llvm::Linker::linkModules( *module, std::move( *chunkModule ) ) )
+        {
+            LogError( "Failed to link generated code." );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+} // namespace kaleidoscope
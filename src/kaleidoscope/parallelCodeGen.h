@@ -0,0 +1,47 @@
+#pragma once
+
+/* Parallel parsing and code generation of a source of many top-level items */
+
+#include <kaleidoscope/api.h>
+#include <kaleidoscope/tokenArray.h>
+
+#include <string>
+
+namespace llvm
+{
+class TargetMachine;
+} // namespace llvm
+
+namespace kaleidoscope
+{
+class CodeGenContext;
+
+/// Parse and generate code for a tokenized source on multiple threads, then link the generated code into
+/// the module of a CodeGenContext.
+///
+/// The tokens are split into chunks at top-level 'def' and 'extern' boundaries.  Each chunk is parsed and
+/// generated into its own CodeGenContext (and LLVM context) by a pool of threads.  The per-chunk modules are
+/// then linked into the module of io_context, in source order.
+///
+/// The result is equivalent to generating the items sequentially: each chunk is aware of the prototypes
+/// declared before it, and a function defined more than once keeps its first definition.  The chunks are
+/// generated with the floating point mode of io_context, and are not optimized, so that the linked module can be
+/// optimized as a whole with CodeGenContext::OptimizeModule.
+///
+/// The SymbolTable of io_context must contain every identifier of the tokens, and is only read while
+/// generating code.
+///
+/// \param i_tokens the tokenized source.
+/// \param io_context the context to link the generated code into.  Its module must be initialized.
+/// \param i_targetTriple the target triple of the per-chunk modules.
+/// \param i_targetMachine the target machine of the per-chunk modules.
+/// \param i_threadCount the number of threads.  0 uses a thread per hardware thread.
+/// \return false if the generated code could not be linked.
+KALEIDOSCOPE_API
+bool GenerateCodeParallel( const TokenArray&    i_tokens,
+                           CodeGenContext&      io_context,
+                           const std::string&   i_targetTriple,
+                           llvm::TargetMachine* i_targetMachine,
+                           size_t               i_threadCount );
+
+} // namespace kaleidoscope
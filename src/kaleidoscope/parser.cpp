@@ -2,55 +2,599 @@
 #include <kaleidoscope/logger.h>
 #include <kaleidoscope/parser.h>
 
-#include <map>
+#include <array>
 
 namespace
 {
 using namespace kaleidoscope;
 
-/// Binary operation precendence.
-/// An operator with higher number will be evaluated before one with a lower number.
-static std::map< char, int > s_binaryOperationPrecedence = {{'<', 10}, {'+', 20}, {'-', 20}, {'*', 20}};
+/// Build the table of binary operation precedence, indexed by operator character.
+/// An operator with higher number will be evaluated before one with a lower number, and characters which are not
+/// binary operators have a precedence of -1.
+constexpr std::array< int8_t, 256 > BuildBinaryOperationPrecedenceTable()
+{
+    std::array< int8_t, 256 > table{};
+    for ( int8_t& precedence : table )
+    {
+        precedence = -1;
+    }
+
+    table[ '=' ] = 2;
+    table[ '<' ] = 10;
+    table[ '+' ] = 20;
+    table[ '-' ] = 20;
+    table[ '*' ] = 20;
+    return table;
+}
+
+constexpr std::array< int8_t, 256 > s_binaryOperationPrecedence = BuildBinaryOperationPrecedenceTable();
+
+/// Get the precedence of a token as a binary operator.
+/// \returns -1 if the token is not a binary operator.
+inline int GetBinaryOperationPrecedence( int i_token )
+{
+    // Tokens which are not characters are negative.
+    return i_token >= 0 && i_token < 256 ? s_binaryOperationPrecedence[ i_token ] : -1;
+}
 
 } // namespace
 
 namespace kaleidoscope
 {
-Parser::Parser( const std::string& i_text )
-    : m_lexer( i_text )
+Parser::Parser( std::string_view i_text, SymbolTable& io_symbolTable )
+    : m_symbolTable( io_symbolTable )
+    , m_tokens( &m_lexedTokens )
+    , m_interner( m_arena )
+{
+    Lexer lexer( i_text, io_symbolTable );
+    m_lexedTokens.AppendAll( lexer );
+}
+
+Parser::Parser( std::istream& io_stream, SymbolTable& io_symbolTable )
+    : m_symbolTable( io_symbolTable )
+    , m_lexer( std::make_unique< Lexer >( io_stream, io_symbolTable ) )
+    , m_tokens( &m_lexedTokens )
+    , m_interner( m_arena )
 {
     /// Prime the current token.
-    ParseNextToken();
+    ParseCurrentToken();
+}
+
+Parser::Parser( const TokenArray& i_tokens, SymbolTable& io_symbolTable, size_t i_begin, size_t i_end )
+    : m_symbolTable( io_symbolTable )
+    , m_tokens( &i_tokens )
+    , m_tokenIndex( i_begin )
+    , m_tokenEnd( i_end )
+    , m_interner( m_arena )
+{
 }
 
 int Parser::ParseCurrentToken()
 {
-    return m_currentToken;
+    return getTokenKind( m_tokenIndex );
 }
 
 int Parser::ParseNextToken()
 {
-    m_currentToken = m_lexer.GetNextToken();
-    return m_currentToken;
+    // Stay on the last token once the end has been reached.
+    if ( ParseCurrentToken() != Token_Eof )
+    {
+        m_tokenIndex++;
+    }
+
+    return ParseCurrentToken();
+}
+
+int Parser::PeekToken( size_t i_offset )
+{
+    return getTokenKind( m_tokenIndex + i_offset );
+}
+
+size_t Parser::GetTokenIndex() const
+{
+    return m_tokenIndex;
+}
+
+void Parser::SetTokenIndex( size_t i_index )
+{
+    m_tokenIndex = i_index;
+}
+
+ASTArena& Parser::GetArena()
+{
+    return m_arena;
+}
+
+ExprInterner& Parser::GetInterner()
+{
+    return m_interner;
+}
+
+void Parser::SetMode( ParserMode i_mode )
+{
+    m_mode = i_mode;
+}
+
+ParserMode Parser::GetMode() const
+{
+    return m_mode;
+}
+
+void Parser::SetMaximumDepth( uint32_t i_depth )
+{
+    m_maximumDepth = i_depth;
+}
+
+uint32_t Parser::GetMaximumDepth() const
+{
+    return m_maximumDepth;
+}
+
+int Parser::getTokenKind( size_t i_index )
+{
+    // Pull tokens from the lexer until the index is available.
+    while ( m_lexer != nullptr && i_index >= m_lexedTokens.GetSize() )
+    {
+        int token = m_lexer->GetNextToken();
+        m_lexedTokens.Append( token, *m_lexer );
+        if ( token == Token_Eof )
+        {
+            break;
+        }
+    }
+
+    if ( i_index >= m_tokenEnd || i_index >= m_tokens->GetSize() )
+    {
+        return Token_Eof;
+    }
+
+    return m_tokens->GetKind( i_index );
+}
+
+void Parser::discardParsedTokens()
+{
+    if ( m_lexer != nullptr )
+    {
+        m_lexedTokens.DiscardFront( m_tokenIndex );
+        m_tokenIndex = 0;
+    }
+}
+
+ExprAST* Parser::parseExpr()
+{
+    ExprAST* expression = m_mode == ParserMode_Iterative ? parseExprIterative() : parseExprRecursive();
+    if ( expression != nullptr && expression->GetDepth() > m_maximumDepth )
+    {
+        LogError( "Expression is nested %u levels deep, beyond the maximum of %u.",
+                  expression->GetDepth(),
+                  m_maximumDepth );
+        return nullptr;
+    }
+
+    return expression;
+}
+
+/// Begin parsing a nested expression.
+void Parser::pushFrame( FrameKind i_kind, SymbolId i_symbol )
+{
+    ExprFrame frame;
+    frame.m_kind            = i_kind;
+    frame.m_symbol          = i_symbol;
+    frame.m_operationsBegin = m_operationStack.size();
+    frame.m_argumentsBegin  = m_argumentStack.size();
+    frame.m_children[ 0 ]   = nullptr;
+    frame.m_children[ 1 ]   = nullptr;
+    frame.m_children[ 2 ]   = nullptr;
+    m_frameStack.push_back( frame );
+}
+
+/// Combine the pending operations of the current frame, which bind at least as tightly as an operator of
+/// i_precedence, with a right hand side operand.  Operators are left associative.
+/// \returns the combined expression.
+ExprAST* Parser::reducePendingOperations( int i_precedence, ExprAST* io_rhs )
+{
+    size_t operationsBegin = m_frameStack.back().m_operationsBegin;
+    while ( m_operationStack.size() > operationsBegin &&
+            GetBinaryOperationPrecedence( m_operationStack.back().m_operation ) >= i_precedence )
+    {
+        const PendingOperation& operation = m_operationStack.back();
+        io_rhs = makeBinaryExpr( operation.m_operation, operation.m_lhs, io_rhs );
+        m_operationStack.pop_back();
+    }
+
+    return io_rhs;
+}
+
+/// Discard the state of a failed parse.
+/// \returns nullptr.
+ExprAST* Parser::abandonFrames( size_t i_framesBegin )
+{
+    m_operationStack.resize( m_frameStack[ i_framesBegin ].m_operationsBegin );
+    m_argumentStack.resize( m_frameStack[ i_framesBegin ].m_argumentsBegin );
+    m_frameStack.resize( i_framesBegin );
+    return nullptr;
+}
+
+/// Parses a potential binary expression, iteratively.
+///
+/// Operands are parsed in a loop.  A construct which contains nested expressions (parenthesis, call, 'if', 'for'
+/// and 'var') pushes a frame, and binary operations awaiting their right hand side are pushed onto the operation
+/// stack.  When the expression of a frame is complete, the frame is popped and the construct it was parsing
+/// becomes the operand of the enclosing frame.
+/// \returns parsed binary expression.
+ExprAST* Parser::parseExprIterative()
+{
+    size_t framesBegin = m_frameStack.size();
+    pushFrame( FrameKind_Expression, 0 );
+    while ( true )
+    {
+        // Parse an operand, or begin a nested expression which will produce the operand.
+        ExprAST* operand = nullptr;
+        int      token   = ParseCurrentToken();
+        switch ( token )
+        {
+        case Token_Numeric:
+            operand = m_interner.GetNumeric( m_tokens->GetNumericValue( m_tokenIndex ) );
+            ParseNextToken();
+            break;
+        case Token_Identifier:
+        {
+            SymbolId identifier = m_tokens->GetIdentifierSymbol( m_tokenIndex );
+            ParseNextToken();
+            if ( ParseCurrentToken() != '(' )
+            {
+                operand = resolveVariable( identifier );
+                break;
+            }
+
+            // Consume '('
+            ParseNextToken();
+            if ( ParseCurrentToken() == ')' )
+            {
+                ParseNextToken();
+                operand = m_interner.GetCall( identifier, nullptr, 0 );
+                break;
+            }
+
+            pushFrame( FrameKind_CallArgument, identifier );
+            continue;
+        }
+        case '(':
+            ParseNextToken();
+            pushFrame( FrameKind_Parenthesis, 0 );
+            continue;
+        case Token_If:
+            ParseNextToken();
+            pushFrame( FrameKind_IfCondition, 0 );
+            continue;
+        case Token_For:
+        {
+            // Consume 'for'
+            ParseNextToken();
+            if ( ParseCurrentToken() != Token_Identifier )
+            {
+                LogError( "Expected a variable identifier after 'for'." );
+                return abandonFrames( framesBegin );
+            }
+
+            SymbolId variableName = m_tokens->GetIdentifierSymbol( m_tokenIndex );
+            ParseNextToken();
+            if ( ParseCurrentToken() != '=' )
+            {
+                LogError( "Expected a '=' after variable identifier." );
+                return abandonFrames( framesBegin );
+            }
+
+            // Consume '='.
+            ParseNextToken();
+            pushFrame( FrameKind_ForStart, variableName );
+            continue;
+        }
+        case Token_Var:
+        {
+            // Consume 'var', and parse the variables up to the first initializer, or the body.
+            ParseNextToken();
+            pushFrame( FrameKind_VarInitializer, 0 );
+            ExprFrame& frame = m_frameStack.back();
+            frame.m_kind     = parseVarBindings( false, frame.m_symbol );
+            if ( frame.m_kind == FrameKind_Expression )
+            {
+                return abandonFrames( framesBegin );
+            }
+
+            continue;
+        }
+        default:
+            LogError( "unknown token when expecting an expression: %c", token );
+            return abandonFrames( framesBegin );
+        }
+
+        // Combine the operand with pending operations, and complete frames, until another operand is expected.
+        bool expectOperand = false;
+        while ( !expectOperand )
+        {
+            int precedence = parseCurrentTokenPrecendence();
+            operand        = reducePendingOperations( precedence, operand );
+            if ( precedence >= 0 )
+            {
+                // The operand is the left hand side of the current binary operator.
+                m_operationStack.push_back( {operand, static_cast< char >( ParseCurrentToken() )} );
+                ParseNextToken();
+                expectOperand = true;
+                continue;
+            }
+
+            // The expression of the current frame is complete.
+            ExprFrame& frame = m_frameStack.back();
+            switch ( frame.m_kind )
+            {
+            case FrameKind_Expression:
+                m_frameStack.pop_back();
+                return operand;
+            case FrameKind_Parenthesis:
+                if ( ParseCurrentToken() != ')' )
+                {
+                    LogError( "Expected ')' after expression" );
+                    return abandonFrames( framesBegin );
+                }
+
+                // Consume ')'
+                ParseNextToken();
+                m_frameStack.pop_back();
+                break;
+            case FrameKind_CallArgument:
+                m_argumentStack.push_back( operand );
+                if ( ParseCurrentToken() == ',' )
+                {
+                    // Consume ',', and parse the next argument within the same frame.
+                    ParseNextToken();
+                    expectOperand = true;
+                }
+                else if ( ParseCurrentToken() == ')' )
+                {
+                    // Consume ')', and move the collected arguments into the arena.
+                    ParseNextToken();
+                    operand = m_interner.GetCall( frame.m_symbol,
+                                                  m_argumentStack.data() + frame.m_argumentsBegin,
+                                                  m_argumentStack.size() - frame.m_argumentsBegin );
+                    m_argumentStack.resize( frame.m_argumentsBegin );
+                    m_frameStack.pop_back();
+                }
+                else
+                {
+                    LogError( "Expected ')' or ',' in argument list." );
+                    return abandonFrames( framesBegin );
+                }
+                break;
+            case FrameKind_IfCondition:
+                if ( ParseCurrentToken() != Token_Then )
+                {
+                    LogError( "Expected 'then' expression." );
+                    return abandonFrames( framesBegin );
+                }
+
+                // Consume 'then'.
+                ParseNextToken();
+                frame.m_children[ 0 ] = operand;
+                frame.m_kind          = FrameKind_IfThen;
+                expectOperand         = true;
+                break;
+            case FrameKind_IfThen:
+                if ( ParseCurrentToken() != Token_Else )
+                {
+                    LogError( "Expected 'else' expression." );
+                    return abandonFrames( framesBegin );
+                }
+
+                // Consume 'else'.
+                ParseNextToken();
+                frame.m_children[ 1 ] = operand;
+                frame.m_kind          = FrameKind_IfElse;
+                expectOperand         = true;
+                break;
+            case FrameKind_IfElse:
+                operand = m_interner.GetIf( frame.m_children[ 0 ], frame.m_children[ 1 ], operand );
+                m_frameStack.pop_back();
+                break;
+            case FrameKind_ForStart:
+                if ( ParseCurrentToken() != ',' )
+                {
+                    LogError( "Expected a ',' after for-loop start expression." );
+                    return abandonFrames( framesBegin );
+                }
+
+                // Consume ',', and bind the loop variable within the end, step and body expressions.
+                ParseNextToken();
+                frame.m_children[ 0 ] = operand;
+                frame.m_kind          = FrameKind_ForEnd;
+                expectOperand         = true;
+                m_scope.push_back( {frame.m_symbol, false} );
+                break;
+            case FrameKind_ForEnd:
+            case FrameKind_ForStep:
+                frame.m_children[ frame.m_kind == FrameKind_ForEnd ? 1 : 2 ] = operand;
+                if ( frame.m_kind == FrameKind_ForEnd && ParseCurrentToken() == ',' )
+                {
+                    // Consume ',', and parse the optional step expression.
+                    ParseNextToken();
+                    frame.m_kind  = FrameKind_ForStep;
+                    expectOperand = true;
+                    break;
+                }
+
+                if ( ParseCurrentToken() != Token_In )
+                {
+                    LogError( "Expected 'in' after for-loop end or step expression." );
+                    return abandonFrames( framesBegin );
+                }
+
+                // Consume 'in'.
+                ParseNextToken();
+                frame.m_kind  = FrameKind_ForBody;
+                expectOperand = true;
+                break;
+            case FrameKind_ForBody:
+                m_scope.pop_back();
+                operand = m_interner.GetFor( frame.m_symbol,
+                                             static_cast< uint32_t >( m_scope.size() ),
+                                             frame.m_children[ 0 ],
+                                             frame.m_children[ 1 ],
+                                             frame.m_children[ 2 ],
+                                             operand );
+                m_frameStack.pop_back();
+                break;
+            case FrameKind_VarInitializer:
+                // Bind the variable, and parse the variables up to the next initializer, or the body.
+                bindVariable( frame.m_symbol, operand );
+                frame.m_kind = parseVarBindings( true, frame.m_symbol );
+                if ( frame.m_kind == FrameKind_Expression )
+                {
+                    return abandonFrames( framesBegin );
+                }
+
+                expectOperand = true;
+                break;
+            case FrameKind_VarBody:
+                operand = makeVarExpr( frame.m_argumentsBegin, operand );
+                m_frameStack.pop_back();
+                break;
+            }
+        }
+    }
+}
+
+/// Get a reference to the innermost binding of a variable name.
+/// An unknown variable is reported, and the rest of the top-level item is parsed before rejecting it, so that
+/// parsing resumes after the item.
+VariableExprAST* Parser::resolveVariable( SymbolId i_name )
+{
+    for ( size_t slot = m_scope.size(); slot > 0; --slot )
+    {
+        const Binding& binding = m_scope[ slot - 1 ];
+        if ( binding.m_name == i_name )
+        {
+            return m_interner.GetVariable( i_name, static_cast< uint32_t >( slot - 1 ), binding.m_isMutable );
+        }
+    }
+
+    LogError( "Unknown variable name: %s", m_symbolTable.GetName( i_name ).c_str() );
+    m_hasInvalidVariable = true;
+    return m_interner.GetVariable( i_name, UINT32_MAX, false );
+}
+
+/// Get a binary operation, or an assignment if the operator is '='.
+/// Only variables bound by 'var' may be assigned.  Assigning anything else is reported, and the rest of the
+/// top-level item is parsed before rejecting it.
+ExprAST* Parser::makeBinaryExpr( char i_operation, ExprAST* i_lhs, ExprAST* i_rhs )
+{
+    if ( i_operation != '=' )
+    {
+        return m_interner.GetBinary( i_operation, i_lhs, i_rhs );
+    }
+
+    if ( i_lhs->GetKind() == ExprKind_Variable && static_cast< VariableExprAST* >( i_lhs )->IsMutable() )
+    {
+        return m_interner.GetAssign( static_cast< VariableExprAST* >( i_lhs ), i_rhs );
+    }
+
+    LogError( "Cannot assign to an expression which is not a variable bound by 'var'." );
+    m_hasInvalidVariable = true;
+    return i_rhs;
+}
+
+/// Parse the variables of a 'var' expression, binding those without an initializer to 0.0, up to the next
+/// variable with an initializer, or up to the body.
+/// \param i_afterInitializer whether an initializer has just been parsed, so a ',' or 'in' is expected.
+/// \param o_variableName the variable whose initializer is to be parsed next.
+/// \returns FrameKind_VarInitializer if an initializer is to be parsed next, FrameKind_VarBody if the body is to be
+/// parsed next, or FrameKind_Expression upon a syntax error.
+Parser::FrameKind Parser::parseVarBindings( bool i_afterInitializer, SymbolId& o_variableName )
+{
+    bool expectSeparator = i_afterInitializer;
+    while ( true )
+    {
+        if ( expectSeparator )
+        {
+            if ( ParseCurrentToken() == Token_In )
+            {
+                // Consume 'in'.
+                ParseNextToken();
+                return FrameKind_VarBody;
+            }
+
+            if ( ParseCurrentToken() != ',' )
+            {
+                LogError( "Expected ',' or 'in' after a 'var' variable." );
+                return FrameKind_Expression;
+            }
+
+            // Consume ','.
+            ParseNextToken();
+        }
+
+        if ( ParseCurrentToken() != Token_Identifier )
+        {
+            LogError( "Expected a variable identifier after 'var' or ','." );
+            return FrameKind_Expression;
+        }
+
+        o_variableName = m_tokens->GetIdentifierSymbol( m_tokenIndex );
+        ParseNextToken();
+        if ( ParseCurrentToken() == '=' )
+        {
+            // Consume '='.
+            ParseNextToken();
+            return FrameKind_VarInitializer;
+        }
+
+        bindVariable( o_variableName, m_interner.GetNumeric( 0.0 ) );
+        expectSeparator = true;
+    }
+}
+
+/// Bind a variable of a 'var' expression, in the next slot.  Its initializer is held on the argument stack until
+/// the body has been parsed.
+void Parser::bindVariable( SymbolId i_variableName, ExprAST* i_initializer )
+{
+    m_argumentStack.push_back( i_initializer );
+    m_scope.push_back( {i_variableName, true} );
+}
+
+/// Get the 'var' expression of the variables bound since i_initializersBegin, as nested bindings around a body,
+/// and unbind the variables.
+ExprAST* Parser::makeVarExpr( size_t i_initializersBegin, ExprAST* i_body )
+{
+    size_t variableCount = m_argumentStack.size() - i_initializersBegin;
+    size_t firstSlot     = m_scope.size() - variableCount;
+    for ( size_t variableIndex = variableCount; variableIndex > 0; --variableIndex )
+    {
+        uint32_t slot = static_cast< uint32_t >( firstSlot + variableIndex - 1 );
+        i_body        = m_interner.GetVar(
+            m_scope[ slot ].m_name, slot, m_argumentStack[ i_initializersBegin + variableIndex - 1 ], i_body );
+    }
+
+    m_scope.resize( firstSlot );
+    m_argumentStack.resize( i_initializersBegin );
+    return i_body;
 }
 
 /// Parse the current numeric expression.
 /// \return the parsed numeric AST expression.
-std::unique_ptr< ExprAST > Parser::parseNumericExpr()
+ExprAST* Parser::parseNumericExpr()
 {
-    std::unique_ptr< NumericExprAST > numeric = std::make_unique< NumericExprAST >( m_lexer.GetNumericValue() );
+    NumericExprAST* numeric = m_interner.GetNumeric( m_tokens->GetNumericValue( m_tokenIndex ) );
     ParseNextToken();
-    return std::move( numeric );
+    return numeric;
 }
 
 /// Parse the current parenthesis expression.
 /// \return the parsed expression within the parenthesis.
-std::unique_ptr< ExprAST > Parser::parseParenthesisExpr()
+ExprAST* Parser::parseParenthesisExpr()
 {
     // Consume '('
     ParseNextToken();
 
-    std::unique_ptr< ExprAST > expr = parseExpr();
+    ExprAST* expr = parseExprRecursive();
     if ( expr == nullptr )
     {
         return nullptr;
@@ -70,9 +614,9 @@ std::unique_ptr< ExprAST > Parser::parseParenthesisExpr()
 
 /// Parse the current identifier expression.
 /// \return the parsed identifier expression.
-std::unique_ptr< ExprAST > Parser::parseIdentifierExpr()
+ExprAST* Parser::parseIdentifierExpr()
 {
-    std::string identifier = m_lexer.GetIdentifierValue();
+    SymbolId identifier = m_tokens->GetIdentifierSymbol( m_tokenIndex );
 
     // Consume current identifier.
     ParseNextToken();
@@ -80,7 +624,7 @@ std::unique_ptr< ExprAST > Parser::parseIdentifierExpr()
     // If the current token is not a parenthesis, then it is a simple variable.
     if ( ParseCurrentToken() != '(' )
     {
-        return std::make_unique< VariableExprAST >( identifier );
+        return resolveVariable( identifier );
     }
 
     // It is as calling expression, with potential arguments.
@@ -88,20 +632,21 @@ std::unique_ptr< ExprAST > Parser::parseIdentifierExpr()
     // Consume '('
     ParseNextToken();
 
-    // Collect arguments.
-    std::vector< std::unique_ptr< ExprAST > > arguments;
+    // Collect arguments onto the top of the argument stack, above the arguments of any enclosing calls.
+    size_t argumentsBegin = m_argumentStack.size();
     if ( ParseCurrentToken() != ')' )
     {
         while ( true )
         {
-            std::unique_ptr< ExprAST > expression = parseExpr();
+            ExprAST* expression = parseExprRecursive();
             if ( expression != nullptr )
             {
-                arguments.push_back( std::move( expression ) );
+                m_argumentStack.push_back( expression );
             }
             else
             {
                 LogError( "Unknown error." );
+                m_argumentStack.resize( argumentsBegin );
                 return nullptr;
             }
 
@@ -112,6 +657,7 @@ std::unique_ptr< ExprAST > Parser::parseIdentifierExpr()
             else if ( ParseCurrentToken() != ',' )
             {
                 LogError( "Expected ')' or ',' in argument list." );
+                m_argumentStack.resize( argumentsBegin );
                 return nullptr;
             }
 
@@ -123,11 +669,15 @@ std::unique_ptr< ExprAST > Parser::parseIdentifierExpr()
     // Consume ')'
     ParseNextToken();
 
-    return std::make_unique< CallExprAST >( identifier, std::move( arguments ) );
+    // Move the collected arguments into the arena.
+    CallExprAST* call = m_interner.GetCall(
+        identifier, m_argumentStack.data() + argumentsBegin, m_argumentStack.size() - argumentsBegin );
+    m_argumentStack.resize( argumentsBegin );
+    return call;
 }
 
 /// Entry point for parsing a primary expression (identifier, numeric, or parenthensis)
-std::unique_ptr< ExprAST > Parser::parsePrimaryExpr()
+ExprAST* Parser::parsePrimaryExpr()
 {
     int token = ParseCurrentToken();
     switch ( token )
@@ -142,6 +692,8 @@ std::unique_ptr< ExprAST > Parser::parsePrimaryExpr()
         return parseIfExpr();
     case Token_For:
         return parseForExpr();
+    case Token_Var:
+        return parseVarExpr();
     default:
         LogError( "unknown token when expecting an expression: %c", token );
         return nullptr;
@@ -154,23 +706,12 @@ std::unique_ptr< ExprAST > Parser::parsePrimaryExpr()
 /// operator token will be returned.
 int Parser::parseCurrentTokenPrecendence()
 {
-    if ( !isascii( ParseCurrentToken() ) )
-    {
-        return -1;
-    }
-
-    std::map< char, int >::const_iterator it = s_binaryOperationPrecedence.find( ParseCurrentToken() );
-    if ( it == s_binaryOperationPrecedence.end() )
-    {
-        return -1;
-    }
-
-    return it->second;
+    return GetBinaryOperationPrecedence( ParseCurrentToken() );
 }
 
 /// Parses the RHS operand of a binary expression.
 /// \returns parsed RHS operand expression.
-std::unique_ptr< ExprAST > Parser::parseBinaryOperatorRHS( int i_precendence, std::unique_ptr< ExprAST > io_lhs )
+ExprAST* Parser::parseBinaryOperatorRHS( int i_precendence, ExprAST* io_lhs )
 {
     while ( true )
     {
@@ -186,7 +727,7 @@ std::unique_ptr< ExprAST > Parser::parseBinaryOperatorRHS( int i_precendence, st
         ParseNextToken();
 
         // Parse RHS
-        std::unique_ptr< ExprAST > rhs = parsePrimaryExpr();
+        ExprAST* rhs = parsePrimaryExpr();
         if ( rhs == nullptr )
         {
             return nullptr;
@@ -201,32 +742,36 @@ std::unique_ptr< ExprAST > Parser::parseBinaryOperatorRHS( int i_precendence, st
             // The reasoning for leftPrecedence + 1 is so that binary operations
             // expressions are consumed *up until* we reach a binary operation with
             // same or less precedence as the current 'left' binary operation.
-            rhs = parseBinaryOperatorRHS( leftPrecedence + 1, std::move( rhs ) );
+            rhs = parseBinaryOperatorRHS( leftPrecedence + 1, rhs );
+            if ( rhs == nullptr )
+            {
+                return nullptr;
+            }
         }
 
         // Merge LHS / RHS with left binary operator to form one a binary expression.
-        io_lhs = std::make_unique< BinaryExprAST >( leftBinaryOperator, std::move( io_lhs ), std::move( rhs ) );
+        io_lhs = makeBinaryExpr( leftBinaryOperator, io_lhs, rhs );
 
         // Loop back to top, continuing to parse binary expressions.
     }
 }
 
-/// Parses a potential binary expression.
+/// Parses a potential binary expression, recursively.
 /// \returns parsed binary expression.
-std::unique_ptr< ExprAST > Parser::parseExpr()
+ExprAST* Parser::parseExprRecursive()
 {
-    std::unique_ptr< ExprAST > lhs = parsePrimaryExpr();
+    ExprAST* lhs = parsePrimaryExpr();
     if ( lhs == nullptr )
     {
         return nullptr;
     }
 
-    return parseBinaryOperatorRHS( 0, std::move( lhs ) );
+    return parseBinaryOperatorRHS( 0, lhs );
 }
 
 /// Parses a function prototype.
 /// \returns parsed function prototype.
-std::unique_ptr< PrototypeAST > Parser::parsePrototypeExpr()
+PrototypeAST* Parser::parsePrototypeExpr()
 {
     if ( ParseCurrentToken() != Token_Identifier )
     {
@@ -235,14 +780,14 @@ std::unique_ptr< PrototypeAST > Parser::parsePrototypeExpr()
     }
 
     // Cache function name, then move on by consuming it.
-    std::string functionName = m_lexer.GetIdentifierValue();
+    SymbolId functionName = m_tokens->GetIdentifierSymbol( m_tokenIndex );
     ParseNextToken();
 
     // Parse argument names, until we reach a non-identifier.
-    std::vector< std::string > argumentNames;
+    m_argumentNames.clear();
     while ( ParseNextToken() == Token_Identifier )
     {
-        argumentNames.push_back( m_lexer.GetIdentifierValue() );
+        m_argumentNames.push_back( m_tokens->GetIdentifierSymbol( m_tokenIndex ) );
     }
 
     if ( ParseCurrentToken() != ')' )
@@ -254,12 +799,15 @@ std::unique_ptr< PrototypeAST > Parser::parsePrototypeExpr()
     // Consume ')'
     ParseNextToken();
 
-    return std::make_unique< PrototypeAST >( functionName, argumentNames );
+    return m_arena.Create< PrototypeAST >( functionName,
+                                           m_arena.CopyArray( m_argumentNames.data(), m_argumentNames.size() ) );
 }
 
-std::unique_ptr< FunctionAST > Parser::ParseDefinitionExpr()
+FunctionAST* Parser::ParseDefinitionExpr()
 {
-    if ( m_lexer.GetIdentifierValue() != "def" )
+    discardParsedTokens();
+    m_interner.Clear();
+    if ( ParseCurrentToken() != Token_Def )
     {
         LogError( "Expected 'def' at the beginning of function definition.\n" );
         return nullptr;
@@ -269,25 +817,36 @@ std::unique_ptr< FunctionAST > Parser::ParseDefinitionExpr()
     ParseNextToken();
 
     // Parse function prototype.
-    std::unique_ptr< PrototypeAST > prototypeExpr = parsePrototypeExpr();
+    PrototypeAST* prototypeExpr = parsePrototypeExpr();
     if ( prototypeExpr == nullptr )
     {
         return nullptr;
     }
 
+    // The arguments occupy the first slots.
+    ArenaArray< SymbolId > arguments = prototypeExpr->GetArguments();
+    m_scope.clear();
+    for ( SymbolId argument : arguments )
+    {
+        m_scope.push_back( {argument, false} );
+    }
+
+    m_hasInvalidVariable = false;
+
     // Parse potential binary operation expression in function definintion.
-    std::unique_ptr< ExprAST > definitionExpr = parseExpr();
-    if ( definitionExpr == nullptr )
+    ExprAST* definitionExpr = parseExpr();
+    if ( definitionExpr == nullptr || m_hasInvalidVariable )
     {
         return nullptr;
     }
 
-    return std::make_unique< FunctionAST >( std::move( prototypeExpr ), std::move( definitionExpr ) );
+    return m_arena.Create< FunctionAST >( prototypeExpr, definitionExpr );
 }
 
-std::unique_ptr< PrototypeAST > Parser::ParseExternExpr()
+PrototypeAST* Parser::ParseExternExpr()
 {
-    if ( m_lexer.GetIdentifierValue() != "extern" )
+    discardParsedTokens();
+    if ( ParseCurrentToken() != Token_Extern )
     {
         LogError( "Expected 'extern' at the beginning of extern prototype.\n" );
         return nullptr;
@@ -299,27 +858,45 @@ std::unique_ptr< PrototypeAST > Parser::ParseExternExpr()
     return parsePrototypeExpr();
 }
 
-std::unique_ptr< FunctionAST > Parser::ParseTopLevelExpr()
+PrototypeAST* Parser::ParseDeclarationExpr()
 {
-    std::unique_ptr< ExprAST > expression = parseExpr();
-    if ( expression == nullptr )
+    discardParsedTokens();
+    if ( ParseCurrentToken() != Token_Def && ParseCurrentToken() != Token_Extern )
+    {
+        LogError( "Expected 'def' or 'extern' at the beginning of a declaration.\n" );
+        return nullptr;
+    }
+
+    // Consume 'def' or 'extern'.
+    ParseNextToken();
+
+    return parsePrototypeExpr();
+}
+
+FunctionAST* Parser::ParseTopLevelExpr()
+{
+    discardParsedTokens();
+    m_interner.Clear();
+    m_scope.clear();
+    m_hasInvalidVariable = false;
+    ExprAST* expression  = parseExpr();
+    if ( expression == nullptr || m_hasInvalidVariable )
     {
         return nullptr;
     }
 
     // Create an anonymous function prototype, with no arguments to construct our function expression.
-    std::unique_ptr< PrototypeAST > prototypeExpr =
-        std::make_unique< PrototypeAST >( "__anon_expr", std::vector< std::string >() );
-    return std::make_unique< FunctionAST >( std::move( prototypeExpr ), std::move( expression ) );
+    PrototypeAST* prototypeExpr = m_arena.Create< PrototypeAST >( Symbol_AnonymousExpr, ArenaArray< SymbolId >() );
+    return m_arena.Create< FunctionAST >( prototypeExpr, expression );
 }
 
-std::unique_ptr< ExprAST > Parser::parseIfExpr()
+ExprAST* Parser::parseIfExpr()
 {
     // Consume the 'if'
     ParseNextToken();
 
     // Parse the conditional expression.
-    std::unique_ptr< ExprAST > conditionExpr = parseExpr();
+    ExprAST* conditionExpr = parseExprRecursive();
     if ( conditionExpr == nullptr )
     {
         LogError( "Failed to parse conditional expression." );
@@ -336,7 +913,7 @@ std::unique_ptr< ExprAST > Parser::parseIfExpr()
     ParseNextToken();
 
     // Parse the expression of then.
-    std::unique_ptr< ExprAST > thenExpr = parseExpr();
+    ExprAST* thenExpr = parseExprRecursive();
     if ( thenExpr == nullptr )
     {
         LogError( "Failed to parse then expression." );
@@ -353,17 +930,17 @@ std::unique_ptr< ExprAST > Parser::parseIfExpr()
     ParseNextToken();
 
     // Parse the expression of then.
-    std::unique_ptr< ExprAST > elseExpr = parseExpr();
+    ExprAST* elseExpr = parseExprRecursive();
     if ( elseExpr == nullptr )
     {
         LogError( "Failed to parse 'else' expression." );
         return nullptr;
     }
 
-    return std::make_unique< IfExprAST >( std::move( conditionExpr ), std::move( thenExpr ), std::move( elseExpr ) );
+    return m_interner.GetIf( conditionExpr, thenExpr, elseExpr );
 }
 
-std::unique_ptr< ExprAST > Parser::parseForExpr()
+ExprAST* Parser::parseForExpr()
 {
     // Consume 'for'
     ParseNextToken();
@@ -376,7 +953,7 @@ std::unique_ptr< ExprAST > Parser::parseForExpr()
     }
 
     // Cache identifier, then consume it.
-    std::string variableName = m_lexer.GetIdentifierValue();
+    SymbolId variableName = m_tokens->GetIdentifierSymbol( m_tokenIndex );
     ParseNextToken();
 
     // Check for variable value assignment.
@@ -390,7 +967,7 @@ std::unique_ptr< ExprAST > Parser::parseForExpr()
     ParseNextToken();
 
     // Parse start expression.
-    std::unique_ptr< ExprAST > startExpr = parseExpr();
+    ExprAST* startExpr = parseExprRecursive();
     if ( startExpr == nullptr )
     {
         LogError( "Failed to parse start expression." );
@@ -407,8 +984,12 @@ std::unique_ptr< ExprAST > Parser::parseForExpr()
     // Consume ','.
     ParseNextToken();
 
+    // Bind the loop variable within the end, step and body expressions.
+    uint32_t variableSlot = static_cast< uint32_t >( m_scope.size() );
+    m_scope.push_back( {variableName, false} );
+
     // Parse end expression.
-    std::unique_ptr< ExprAST > endExpr = parseExpr();
+    ExprAST* endExpr = parseExprRecursive();
     if ( endExpr == nullptr )
     {
         LogError( "Failed to parse end expression." );
@@ -416,13 +997,13 @@ std::unique_ptr< ExprAST > Parser::parseForExpr()
     }
 
     // Optional step value.
-    std::unique_ptr< ExprAST > stepExpr;
+    ExprAST* stepExpr = nullptr;
     if ( ParseCurrentToken() == ',' )
     {
         // Consume ','
         ParseNextToken();
 
-        stepExpr = parseExpr();
+        stepExpr = parseExprRecursive();
         if ( stepExpr == nullptr )
         {
             LogError( "Failed to parse step expression." );
@@ -441,18 +1022,56 @@ std::unique_ptr< ExprAST > Parser::parseForExpr()
     ParseNextToken();
 
     // Parse body expression.
-    std::unique_ptr< ExprAST > bodyExpr = parseExpr();
+    ExprAST* bodyExpr = parseExprRecursive();
+    if ( bodyExpr == nullptr )
+    {
+        LogError( "Failed to parse body expression." );
+        return nullptr;
+    }
+
+    m_scope.pop_back();
+    return m_interner.GetFor( variableName, variableSlot, startExpr, endExpr, stepExpr, bodyExpr );
+}
+
+ExprAST* Parser::parseVarExpr()
+{
+    // Consume 'var'.
+    ParseNextToken();
+
+    // Bind each variable after parsing its initializer, so that an initializer refers to the preceding variables.
+    size_t    initializersBegin = m_argumentStack.size();
+    SymbolId  variableName      = 0;
+    FrameKind next              = parseVarBindings( false, variableName );
+    while ( next == FrameKind_VarInitializer )
+    {
+        ExprAST* initializerExpr = parseExprRecursive();
+        if ( initializerExpr == nullptr )
+        {
+            LogError( "Failed to parse variable initializer expression." );
+            m_argumentStack.resize( initializersBegin );
+            return nullptr;
+        }
+
+        bindVariable( variableName, initializerExpr );
+        next = parseVarBindings( true, variableName );
+    }
+
+    if ( next != FrameKind_VarBody )
+    {
+        m_argumentStack.resize( initializersBegin );
+        return nullptr;
+    }
+
+    // Parse body expression.
+    ExprAST* bodyExpr = parseExprRecursive();
     if ( bodyExpr == nullptr )
     {
         LogError( "Failed to parse body expression." );
+        m_argumentStack.resize( initializersBegin );
         return nullptr;
     }
 
-    return std::make_unique< ForExprAST >( variableName,
-                                           std::move( startExpr ),
-                                           std::move( endExpr ),
-                                           std::move( stepExpr ),
-                                           std::move( bodyExpr ) );
+    return makeVarExpr( initializersBegin, bodyExpr );
 }
 
 } // namespace kaleidoscope
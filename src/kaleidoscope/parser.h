@@ -3,15 +3,87 @@
 /* Tools for parsing the kaleidoscope language into an AST (abstract syntax tree) */
 
 #include <kaleidoscope/ast.h>
+#include <kaleidoscope/astArena.h>
+#include <kaleidoscope/exprInterner.h>
+#include <kaleidoscope/lexer.h>
+#include <kaleidoscope/tokenArray.h>
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string_view>
+#include <vector>
 
 namespace kaleidoscope
 {
+/// Strategy of parsing expressions.
+enum ParserMode
+{
+    /// Recursive descent, with recursive precedence climbing of binary operations.
+    /// The depth of nesting is bounded by the size of the native stack.
+    ParserMode_Recursive = 0,
+
+    /// Iterative operator precedence parsing, where nested expressions are tracked on a stack allocated on the
+    /// heap, so the depth of nesting is bounded by memory rather than by the native stack.
+    ParserMode_Iterative = 1
+};
+
+/// Default maximum depth of a parsed expression (see Parser::SetMaximumDepth), which only bounds the depth by memory.
+/// The passes over expressions continue deeply nested visits on stacks of their own (see ExprVisitor), so do not
+/// overflow the native stack either.
+constexpr uint32_t s_defaultMaximumDepth = UINT32_MAX;
+
 /// Parser will parse a block of text into an abstract syntax tree.
+///
+/// The parser consumes a TokenArray by index, which allows for arbitrary lookahead and backtracking.
+/// The tokens originate from one of:
+/// - A view of text, which is tokenized in its entirety upon construction.
+/// - A stream, which is tokenized on demand as the parser advances.  Tokens preceding the current top-level
+///   item are discarded, so memory use is constant regardless of the size of the stream.
+/// - A pre-tokenized TokenArray, which can be shared between multiple parsers.
+///
+/// A single Parser can consume any number of top-level items until Token_Eof, and a top-level item
+/// may span multiple lines.
+///
+/// Identifiers are interned into the SymbolTable, which must outlive the Parser and the parsed AST.
+///
+/// The parsed AST is allocated from an ASTArena owned by the Parser, so the AST is valid until the arena
+/// is reset, or the Parser is destroyed.
 class Parser
 {
 public:
+    /// Construct a parser which tokenizes a view of text.  The text is not copied.
+    KALEIDOSCOPE_API
+    Parser( std::string_view i_text, SymbolTable& io_symbolTable );
+
+    /// Construct a parser which pulls text from a stream on demand.
+    /// The first token is read upon construction, which may block on an interactive stream.
+    KALEIDOSCOPE_API
+    Parser( std::istream& io_stream, SymbolTable& io_symbolTable );
+
+    /// Construct a parser over pre-tokenized text, which must outlive the Parser.
+    /// Tokens within [i_begin, i_end) are parsed, and the end of the range is treated as Token_Eof.
+    /// \param io_symbolTable the table which the identifiers of the tokens were interned into.
+    KALEIDOSCOPE_API
+    Parser( const TokenArray& i_tokens, SymbolTable& io_symbolTable, size_t i_begin = 0, size_t i_end = SIZE_MAX );
+
+    /// Set the strategy of parsing expressions.  ParserMode_Iterative is the default.
     KALEIDOSCOPE_API
-    explicit Parser( const std::string& i_text );
+    void SetMode( ParserMode i_mode );
+
+    /// Get the strategy of parsing expressions.
+    KALEIDOSCOPE_API
+    ParserMode GetMode() const;
+
+    /// Set the maximum depth of a parsed expression (see ExprAST::GetDepth), which is s_defaultMaximumDepth by
+    /// default.  A deeper expression is rejected with an error, which bounds the depth of input from an untrusted
+    /// source, or of input parsed with ParserMode_Recursive, which would otherwise overflow the native stack.
+    KALEIDOSCOPE_API
+    void SetMaximumDepth( uint32_t i_depth );
+
+    /// Get the maximum depth of a parsed expression.
+    KALEIDOSCOPE_API
+    uint32_t GetMaximumDepth() const;
 
     /// Get the current token.
     /// \return current token.
@@ -23,39 +95,168 @@ public:
     KALEIDOSCOPE_API
     int ParseNextToken();
 
+    /// Peek at a token ahead of the current token, without consuming any tokens.
+    /// \param i_offset number of tokens ahead of the current token.  An offset of 0 is the current token.
+    KALEIDOSCOPE_API
+    int PeekToken( size_t i_offset );
+
+    /// Get the index of the current token, which can be restored with SetTokenIndex to backtrack.
+    KALEIDOSCOPE_API
+    size_t GetTokenIndex() const;
+
+    /// Restore the current token to a previously obtained token index.
+    /// When streaming, tokens preceding the current top-level item are discarded, so only indices
+    /// obtained within the current top-level item remain valid.
+    KALEIDOSCOPE_API
+    void SetTokenIndex( size_t i_index );
+
+    /// Get the arena which the parsed AST is allocated from.
+    /// An interactive session may reset the arena after each top-level item, to reuse its memory.
+    ///
+    /// Structurally identical expressions within a top-level item are parsed into a single shared node, so the
+    /// AST of a function body is a directed acyclic graph rather than a tree.
+    KALEIDOSCOPE_API
+    ASTArena& GetArena();
+
+    /// Get the interner which constructs the nodes of the current top-level item, such that passes rewriting its
+    /// AST, such as SimplifyFunction, construct nodes which are shared with it.
+    KALEIDOSCOPE_API
+    ExprInterner& GetInterner();
+
     /// Parse an 'extern' function declaration, with no body (basically a prototype).
     /// \returns function prototype expression.
     KALEIDOSCOPE_API
-    std::unique_ptr< PrototypeAST > ParseExternExpr();
+    PrototypeAST* ParseExternExpr();
+
+    /// Parse the prototype of a function definition or 'extern' declaration, without parsing its body.
+    /// \returns function prototype expression.
+    KALEIDOSCOPE_API
+    PrototypeAST* ParseDeclarationExpr();
 
     /// Parses a function definition.
+    ///
+    /// Variables are resolved as they are parsed, into the slots of the arguments, loop variables and 'var'
+    /// variables which they refer to (see VariableExprAST), so a definition referring to an unknown variable, or
+    /// assigning a variable not bound by 'var', is rejected before any code is generated.
     /// \returns parsed function definition.
     KALEIDOSCOPE_API
-    std::unique_ptr< FunctionAST > ParseDefinitionExpr();
+    FunctionAST* ParseDefinitionExpr();
 
     /// Parse a top-level expression which is evaluated on the fly.
     /// \returns function exprssion.
     KALEIDOSCOPE_API
-    std::unique_ptr< FunctionAST > ParseTopLevelExpr();
+    FunctionAST* ParseTopLevelExpr();
 
 private:
     /// No default constructor.
     Parser();
 
-    /// Internal parsing utilities.
-    std::unique_ptr< ExprAST > parseExpr();
-    std::unique_ptr< ExprAST > parseNumericExpr();
-    std::unique_ptr< ExprAST > parseParenthesisExpr();
-    std::unique_ptr< ExprAST > parseIdentifierExpr();
-    std::unique_ptr< ExprAST > parsePrimaryExpr();
-    std::unique_ptr< ExprAST > parseBinaryOperatorRHS( int i_precendence, std::unique_ptr< ExprAST > io_lhs );
-    std::unique_ptr< PrototypeAST > parsePrototypeExpr();
-    std::unique_ptr< ExprAST > parseIfExpr();
-    std::unique_ptr< ExprAST > parseForExpr();
+    /// Kind of construct which an expression frame of the iterative parser is parsing.
+    enum FrameKind
+    {
+        FrameKind_Expression,     /// Top-level expression.
+        FrameKind_Parenthesis,    /// Expression within '(' and ')'.
+        FrameKind_CallArgument,   /// Argument of a call.
+        FrameKind_IfCondition,    /// Condition of an 'if'.
+        FrameKind_IfThen,         /// Expression after 'then'.
+        FrameKind_IfElse,         /// Expression after 'else'.
+        FrameKind_ForStart,       /// Start expression of a 'for'.
+        FrameKind_ForEnd,         /// End expression of a 'for'.
+        FrameKind_ForStep,        /// Step expression of a 'for'.
+        FrameKind_ForBody,        /// Body expression of a 'for'.
+        FrameKind_VarInitializer, /// Initial value expression of a variable of a 'var'.
+        FrameKind_VarBody         /// Body expression of a 'var'.
+    };
+
+    /// A nested expression being parsed by the iterative parser, in place of a native stack frame.
+    struct ExprFrame
+    {
+        FrameKind m_kind;            /// Construct being parsed.
+        SymbolId  m_symbol;          /// Callee, loop variable, or variable being initialized.
+        size_t    m_operationsBegin; /// Pending binary operations of this frame begin at this index.
+        size_t    m_argumentsBegin;  /// Call arguments, or variable initializers, of this frame begin at this index.
+        ExprAST*  m_children[ 3 ];   /// Completed child expressions of an 'if' or 'for'.
+    };
+
+    /// A binary operation awaiting its right hand side operand.
+    struct PendingOperation
+    {
+        ExprAST* m_lhs;       /// Left hand side operand.
+        char     m_operation; /// Operator character.
+    };
+
+    /// Parse an expression, with the current mode.
+    ExprAST* parseExpr();
+
+    /// Iterative parsing utilities.
+    ExprAST* parseExprIterative();
+    void pushFrame( FrameKind i_kind, SymbolId i_symbol );
+    ExprAST* reducePendingOperations( int i_precedence, ExprAST* io_rhs );
+    ExprAST* abandonFrames( size_t i_framesBegin );
+
+    /// Recursive parsing utilities.
+    ExprAST* parseExprRecursive();
+    ExprAST* parseNumericExpr();
+    ExprAST* parseParenthesisExpr();
+    ExprAST* parseIdentifierExpr();
+    ExprAST* parsePrimaryExpr();
+    ExprAST* parseBinaryOperatorRHS( int i_precendence, ExprAST* io_lhs );
+    PrototypeAST* parsePrototypeExpr();
+    ExprAST* parseIfExpr();
+    ExprAST* parseForExpr();
+    ExprAST* parseVarExpr();
     int parseCurrentTokenPrecendence();
 
-    Lexer m_lexer;            /// Internal lexer for token translation.
-    int   m_currentToken = 0; /// The current token.
+    /// Parse the variables of a 'var' expression, up to the next initializer or the body.
+    FrameKind parseVarBindings( bool i_afterInitializer, SymbolId& o_variableName );
+
+    /// Bind a variable of a 'var' expression, in the next slot.
+    void bindVariable( SymbolId i_variableName, ExprAST* i_initializer );
+
+    /// Get the 'var' expression of the variables bound since i_initializersBegin, around a body.
+    ExprAST* makeVarExpr( size_t i_initializersBegin, ExprAST* i_body );
+
+    /// Get a binary operation, or an assignment if the operator is '='.
+    ExprAST* makeBinaryExpr( char i_operation, ExprAST* i_lhs, ExprAST* i_rhs );
+
+    /// Get a reference to the innermost binding of a variable name.
+    VariableExprAST* resolveVariable( SymbolId i_name );
+
+    /// Get the kind of the token at an index, lexing on demand when streaming.
+    int getTokenKind( size_t i_index );
+
+    /// Discard the tokens preceding the current token, when streaming.
+    void discardParsedTokens();
+
+    SymbolTable&             m_symbolTable;           /// Table which identifiers are interned into.
+    std::unique_ptr< Lexer > m_lexer;                 /// Lexer to pull tokens from on demand, when streaming.
+    TokenArray               m_lexedTokens;           /// Tokens lexed by this parser.
+    const TokenArray*        m_tokens     = nullptr;  /// The tokens being parsed.
+    size_t                   m_tokenIndex = 0;        /// Index of the current token.
+    size_t                   m_tokenEnd   = SIZE_MAX; /// End of the range of tokens being parsed.
+
+    ParserMode m_mode         = ParserMode_Iterative;  /// Strategy of parsing expressions.
+    uint32_t   m_maximumDepth = s_defaultMaximumDepth; /// Maximum depth of a parsed expression.
+
+    ASTArena                m_arena;         /// Storage of the parsed AST.
+    ExprInterner            m_interner;      /// Shares identical expressions of the current top-level item.
+    std::vector< ExprAST* > m_argumentStack; /// Arguments of calls, and initializers of 'var', innermost last.
+    std::vector< SymbolId > m_argumentNames; /// Argument names of the prototype being parsed.
+
+    /// A name bound within the expression being parsed.
+    struct Binding
+    {
+        SymbolId m_name;      /// Name of the variable.
+        bool     m_isMutable; /// Whether the variable is bound by 'var'.
+    };
+
+    /// Names bound within the expression being parsed, indexed by slot: the arguments of the function, followed
+    /// by the variables of the enclosing loops and 'var' expressions, innermost last.
+    std::vector< Binding > m_scope;
+    bool m_hasInvalidVariable = false; /// Whether the item refers to an unknown variable, or assigns an immutable one.
+
+    std::vector< ExprFrame >        m_frameStack;     /// Nested expressions of the iterative parser.
+    std::vector< PendingOperation > m_operationStack; /// Binary operations of the iterative parser.
 };
 
 } // namespace kaleidoscope
@@ -0,0 +1,245 @@
+#include <kaleidoscope/astVisitor.h>
+#include <kaleidoscope/simplifier.h>
+
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+using namespace kaleidoscope;
+
+/// Whether an expression is a numeric literal of i_value, including the sign of zero.
+bool IsNumericValue( const ExprAST& i_expr, double i_value )
+{
+    if ( i_expr.GetKind() != ExprKind_Numeric )
+    {
+        return false;
+    }
+
+    double value = static_cast< const NumericExprAST& >( i_expr ).GetValue();
+    return value == i_value && std::signbit( value ) == std::signbit( i_value );
+}
+
+/// Evaluate a binary operation on constant operands, with the same semantics as ExprCodeGenerator::VisitBinary.
+/// \return false if the operation is unknown, and left to code generation to report.
+bool FoldBinaryOperation( char i_operation, double i_lhs, double i_rhs, double& o_value )
+{
+    switch ( i_operation )
+    {
+    case '+':
+        o_value = i_lhs + i_rhs;
+        return true;
+    case '-':
+        o_value = i_lhs - i_rhs;
+        return true;
+    case '*':
+        o_value = i_lhs * i_rhs;
+        return true;
+    case '<':
+        // Unordered less-than, so a NaN operand compares as true.
+        o_value = !( i_lhs >= i_rhs ) ? 1.0 : 0.0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// Simplify expressions bottom-up, constructing simplified nodes with an interner.
+class Simplifier : public ExprVisitor< Simplifier, ExprAST* >
+{
+public:
+    Simplifier( ExprInterner& io_interner, SimplifyMode i_mode )
+        : m_interner( io_interner )
+        , m_mode( i_mode )
+    {
+    }
+
+    /// Simplify an expression, or get its simplification if it is shared, and was already simplified.
+    ExprAST* Simplify( ExprAST* i_expr )
+    {
+        std::unordered_map< ExprAST*, ExprAST* >::iterator simplifiedIt = m_simplified.find( i_expr );
+        if ( simplifiedIt != m_simplified.end() )
+        {
+            return simplifiedIt->second;
+        }
+
+        ExprAST* simplified    = Visit( i_expr );
+        m_simplified[ i_expr ] = simplified;
+        return simplified;
+    }
+
+    ExprAST* VisitNumeric( NumericExprAST* i_expr )
+    {
+        return i_expr;
+    }
+
+    ExprAST* VisitVariable( VariableExprAST* i_expr )
+    {
+        return i_expr;
+    }
+
+    ExprAST* VisitBinary( BinaryExprAST* i_expr )
+    {
+        char     operation = i_expr->GetOperation();
+        ExprAST* lhs       = Simplify( i_expr->GetLHS() );
+        ExprAST* rhs       = Simplify( i_expr->GetRHS() );
+
+        double value = 0.0;
+        if ( lhs->GetKind() == ExprKind_Numeric && rhs->GetKind() == ExprKind_Numeric &&
+             FoldBinaryOperation( operation,
+                                  static_cast< NumericExprAST* >( lhs )->GetValue(),
+                                  static_cast< NumericExprAST* >( rhs )->GetValue(),
+                                  value ) )
+        {
+            return m_interner.GetNumeric( value );
+        }
+
+        // Identities which hold for every value, including NaN, infinities, and signed zeros.
+        if ( ( operation == '*' && IsNumericValue( *rhs, 1.0 ) ) ||
+             ( operation == '-' && IsNumericValue( *rhs, 0.0 ) ) ||
+             ( operation == '+' && IsNumericValue( *rhs, -0.0 ) ) )
+        {
+            return lhs;
+        }
+        else if ( ( operation == '*' && IsNumericValue( *lhs, 1.0 ) ) ||
+                  ( operation == '+' && IsNumericValue( *lhs, -0.0 ) ) )
+        {
+            return rhs;
+        }
+
+        if ( m_mode == SimplifyMode_FastMath )
+        {
+            if ( operation == '+' && IsNumericValue( *rhs, 0.0 ) )
+            {
+                return lhs;
+            }
+            else if ( operation == '+' && IsNumericValue( *lhs, 0.0 ) )
+            {
+                return rhs;
+            }
+            else if ( operation == '*' && IsNumericValue( *lhs, 0.0 ) && !rhs->HasSideEffects() )
+            {
+                return lhs;
+            }
+            else if ( operation == '*' && IsNumericValue( *rhs, 0.0 ) && !lhs->HasSideEffects() )
+            {
+                return rhs;
+            }
+        }
+
+        if ( lhs == i_expr->GetLHS() && rhs == i_expr->GetRHS() )
+        {
+            return i_expr;
+        }
+
+        return m_interner.GetBinary( operation, lhs, rhs );
+    }
+
+    ExprAST* VisitCall( CallExprAST* i_expr )
+    {
+        ArenaArray< ExprAST* >  arguments = i_expr->GetArguments();
+        std::vector< ExprAST* > simplifiedArguments( arguments.begin(), arguments.end() );
+        bool                    simplified = false;
+        for ( ExprAST*& argument : simplifiedArguments )
+        {
+            ExprAST* simplifiedArgument = Simplify( argument );
+            simplified                  = simplified || simplifiedArgument != argument;
+            argument                    = simplifiedArgument;
+        }
+
+        if ( !simplified )
+        {
+            return i_expr;
+        }
+
+        return m_interner.GetCall( i_expr->GetCallee(), simplifiedArguments.data(), simplifiedArguments.size() );
+    }
+
+    ExprAST* VisitIf( IfExprAST* i_expr )
+    {
+        ExprAST* condition = Simplify( i_expr->GetCondition() );
+        if ( condition->GetKind() == ExprKind_Numeric )
+        {
+            // The condition is true if ordered and not equal to zero, so a NaN condition is false.
+            double value = static_cast< NumericExprAST* >( condition )->GetValue();
+            return Simplify( !std::isnan( value ) && value != 0.0 ? i_expr->GetThen() : i_expr->GetElse() );
+        }
+
+        ExprAST* thenExpr = Simplify( i_expr->GetThen() );
+        ExprAST* elseExpr = Simplify( i_expr->GetElse() );
+        if ( condition == i_expr->GetCondition() && thenExpr == i_expr->GetThen() && elseExpr == i_expr->GetElse() )
+        {
+            return i_expr;
+        }
+
+        return m_interner.GetIf( condition, thenExpr, elseExpr );
+    }
+
+    ExprAST* VisitFor( ForExprAST* i_expr )
+    {
+        ExprAST* start = Simplify( i_expr->GetStart() );
+        ExprAST* end   = Simplify( i_expr->GetEnd() );
+        ExprAST* step  = i_expr->GetStep() != nullptr ? Simplify( i_expr->GetStep() ) : nullptr;
+        ExprAST* body  = Simplify( i_expr->GetBody() );
+        if ( start == i_expr->GetStart() && end == i_expr->GetEnd() && step == i_expr->GetStep() &&
+             body == i_expr->GetBody() )
+        {
+            return i_expr;
+        }
+
+        return m_interner.GetFor( i_expr->GetVariableName(), i_expr->GetVariableSlot(), start, end, step, body );
+    }
+
+    ExprAST* VisitVar( VarExprAST* i_expr )
+    {
+        ExprAST* initializer = Simplify( i_expr->GetInitializer() );
+        ExprAST* body        = Simplify( i_expr->GetBody() );
+        if ( initializer == i_expr->GetInitializer() && body == i_expr->GetBody() )
+        {
+            return i_expr;
+        }
+
+        return m_interner.GetVar( i_expr->GetVariableName(), i_expr->GetVariableSlot(), initializer, body );
+    }
+
+    ExprAST* VisitAssign( AssignExprAST* i_expr )
+    {
+        ExprAST* value = Simplify( i_expr->GetValue() );
+        if ( value == i_expr->GetValue() )
+        {
+            return i_expr;
+        }
+
+        return m_interner.GetAssign( i_expr->GetVariable(), value );
+    }
+
+private:
+    ExprInterner& m_interner; /// Constructs the simplified nodes.
+    SimplifyMode  m_mode;     /// Simplifications which may be applied.
+
+    /// Simplification of each visited expression, so that shared expressions are simplified once.
+    std::unordered_map< ExprAST*, ExprAST* > m_simplified;
+};
+
+} // namespace
+
+namespace kaleidoscope
+{
+ExprAST* SimplifyExpr( ExprAST* i_expr, ExprInterner& io_interner, SimplifyMode i_mode )
+{
+    return Simplifier( io_interner, i_mode ).Simplify( i_expr );
+}
+
+FunctionAST* SimplifyFunction( FunctionAST* i_function, ExprInterner& io_interner, SimplifyMode i_mode )
+{
+    ExprAST* body = SimplifyExpr( i_function->GetBody(), io_interner, i_mode );
+    if ( body == i_function->GetBody() )
+    {
+        return i_function;
+    }
+
+    return io_interner.GetArena().Create< FunctionAST >( i_function->GetPrototype(), body );
+}
+
+} // namespace kaleidoscope
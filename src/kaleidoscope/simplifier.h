@@ -0,0 +1,51 @@
+#pragma once
+
+/* Constant folding and algebraic simplification of the AST, ahead of code generation */
+
+#include <kaleidoscope/api.h>
+#include <kaleidoscope/ast.h>
+#include <kaleidoscope/exprInterner.h>
+
+namespace kaleidoscope
+{
+/// SimplifyMode selects which simplifications may be applied.
+enum SimplifyMode
+{
+    /// Only simplifications which preserve the IEEE-754 result of the expression, such as folding constant
+    /// operations, "x * 1", and "x - 0".
+    SimplifyMode_Strict = 0,
+
+    /// Additionally assume that values are never NaN or infinite, and that the sign of zero is insignificant,
+    /// which allows simplifying "x + 0" and "0 * x".
+    SimplifyMode_FastMath = 1
+};
+
+/// Simplify an expression.
+///
+/// Operations whose operands are all numeric literals are folded into a numeric literal, algebraic identities
+/// are removed, and conditionals with a constant condition are replaced by the branch they would take.
+/// Operands which call functions or run loops are never removed, as evaluating them may have side effects.
+///
+/// Nodes are not modified: simplified nodes are constructed by io_interner, and sub-expressions which do not
+/// simplify are shared with the original expression.  A shared sub-expression is simplified once, and simplified
+/// nodes are interned, so the simplified expression remains a directed acyclic graph, and expressions which
+/// simplify into the same expression are shared.
+///
+/// \param i_expr the expression to simplify.
+/// \param io_interner the interner to construct simplified nodes with, which constructed i_expr.
+/// \param i_mode the simplifications which may be applied.
+/// \return the simplified expression, which is i_expr if it cannot be simplified.
+KALEIDOSCOPE_API
+ExprAST* SimplifyExpr( ExprAST* i_expr, ExprInterner& io_interner, SimplifyMode i_mode );
+
+/// Simplify the body of a function.
+///
+/// \param i_function the function to simplify.
+/// \param io_interner the interner to construct simplified nodes with, which constructed the function body, such as
+/// Parser::GetInterner.
+/// \param i_mode the simplifications which may be applied.
+/// \return the simplified function, which is i_function if its body cannot be simplified.
+KALEIDOSCOPE_API
+FunctionAST* SimplifyFunction( FunctionAST* i_function, ExprInterner& io_interner, SimplifyMode i_mode );
+
+} // namespace kaleidoscope
@@ -0,0 +1,51 @@
+#include <kaleidoscope/symbolTable.h>
+
+#include <cassert>
+
+namespace kaleidoscope
+{
+SymbolTable::SymbolTable()
+{
+    SymbolId anonymousExpr = Intern( "__anon_expr" );
+    assert( anonymousExpr == Symbol_AnonymousExpr );
+    ( void ) anonymousExpr;
+}
+
+SymbolId SymbolTable::Intern( std::string_view i_name )
+{
+    std::unordered_map< std::string_view, SymbolId >::const_iterator symbolIt = m_symbols.find( i_name );
+    if ( symbolIt != m_symbols.end() )
+    {
+        return symbolIt->second;
+    }
+
+    SymbolId symbol = static_cast< SymbolId >( m_names.size() );
+    m_names.emplace_back( i_name );
+    m_symbols.emplace( m_names.back(), symbol );
+    return symbol;
+}
+
+bool SymbolTable::Find( std::string_view i_name, SymbolId& o_symbol ) const
+{
+    std::unordered_map< std::string_view, SymbolId >::const_iterator symbolIt = m_symbols.find( i_name );
+    if ( symbolIt == m_symbols.end() )
+    {
+        return false;
+    }
+
+    o_symbol = symbolIt->second;
+    return true;
+}
+
+const std::string& SymbolTable::GetName( SymbolId i_symbol ) const
+{
+    assert( i_symbol < m_names.size() );
+    return m_names[ i_symbol ];
+}
+
+size_t SymbolTable::GetSize() const
+{
+    return m_names.size();
+}
+
+} // namespace kaleidoscope
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <kaleidoscope/api.h>
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace kaleidoscope
+{
+/// SymbolId is a compact identifier of a name interned in a SymbolTable.
+using SymbolId = uint32_t;
+
+/// Symbol of the anonymous function which top-level expressions are wrapped in.
+/// It is interned upon SymbolTable construction, so is the same for every SymbolTable.
+constexpr SymbolId Symbol_AnonymousExpr = 0;
+
+/// SymbolTable interns names, such that each unique name is stored exactly once and identified by a SymbolId.
+///
+/// A single SymbolTable is shared by the Lexer, the AST, and the CodeGenContext, so that names are
+/// compared and looked up as integers rather than strings.
+class SymbolTable
+{
+public:
+    KALEIDOSCOPE_API
+    SymbolTable();
+
+    /// Intern a name.
+    /// \param i_name the name to intern.
+    /// \return the symbol of the name, which is allocated if the name was not previously interned.
+    KALEIDOSCOPE_API
+    SymbolId Intern( std::string_view i_name );
+
+    /// Find the symbol of a previously interned name.
+    /// \param i_name the name to find.
+    /// \param o_symbol the symbol of the name, if found.
+    /// \return true if the name has been interned.
+    KALEIDOSCOPE_API
+    bool Find( std::string_view i_name, SymbolId& o_symbol ) const;
+
+    /// Get the name of a symbol.
+    KALEIDOSCOPE_API
+    const std::string& GetName( SymbolId i_symbol ) const;
+
+    /// Get the number of interned names.
+    KALEIDOSCOPE_API
+    size_t GetSize() const;
+
+private:
+    /// Storage of interned names, indexed by symbol.
+    /// A deque does not relocate its elements as it grows, so views of its strings remain valid.
+    std::deque< std::string > m_names;
+
+    /// Maps names (viewing m_names) to their symbols.
+    std::unordered_map< std::string_view, SymbolId > m_symbols;
+};
+
+} // namespace kaleidoscope
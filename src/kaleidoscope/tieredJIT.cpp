@@ -0,0 +1,298 @@
+#include <kaleidoscope/KaleidoscopeJIT.h>
+#include <kaleidoscope/logger.h>
+#include <kaleidoscope/tieredJIT.h>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+/// Generate a pointer to an object of the host process, to be dereferenced by JIT compiled code.
+llvm::Value* GenerateHostAddress( llvm::IRBuilder<>& i_irBuilder, const void* i_address, llvm::Type* i_pointerType )
+{
+    llvm::Value* address =
+        i_irBuilder.getIntN( sizeof( uintptr_t ) * CHAR_BIT, reinterpret_cast< uintptr_t >( i_address ) );
+    return i_irBuilder.CreateIntToPtr( address, i_pointerType );
+}
+
+} // namespace
+
+namespace kaleidoscope
+{
+static_assert( sizeof( std::atomic< void* > ) == sizeof( void* ), "Stubs are loaded as plain pointers." );
+
+TieredJIT::TieredJIT( llvm::orc::KaleidoscopeJIT& io_jit,
+                      SymbolTable&                io_symbolTable,
+                      OptimizationLevel           i_optimizationLevel,
+                      uint64_t                    i_hotCallCount )
+    : m_jit( io_jit )
+    , m_symbolTable( io_symbolTable )
+    , m_optimizationLevel( std::max( i_optimizationLevel, OptimizationLevel_O1 ) )
+    , m_hotCallCount( i_hotCallCount )
+{
+    m_recompileThread = std::thread( &TieredJIT::recompileHotFunctions, this );
+}
+
+TieredJIT::~TieredJIT()
+{
+    {
+        std::lock_guard< std::mutex > lock( m_hotFunctionsMutex );
+        m_stopping = true;
+    }
+
+    m_hotFunctionsCondition.notify_one();
+    m_recompileThread.join();
+}
+
+TieredFunction* TieredJIT::DeclareFunction( SymbolId i_name )
+{
+    // An extern which has not been defined yet is defined through its stub, which its callers call.
+    TieredFunction* declaration = FindFunction( i_name );
+    if ( declaration != nullptr && !declaration->m_isDefined && declaration->m_externType != nullptr )
+    {
+        return declaration;
+    }
+
+    // Each declaration is compiled into distinctly named symbols, as a function may be redefined.
+    std::string     suffix   = "." + std::to_string( m_functions.size() );
+    TieredFunction& function = m_functions.emplace_back();
+    function.m_name          = m_symbolTable.GetName( i_name );
+    function.m_thunkName     = function.m_name + ".baseline" + suffix;
+    function.m_optimizedName = function.m_name + ".optimized" + suffix;
+
+    TieredFunction*& latest   = m_functionsByName[ i_name ];
+    TieredFunction*  previous = latest;
+    latest                    = &function;
+    return previous;
+}
+
+bool TieredJIT::DeclareExternFunction( SymbolId i_name, llvm::FunctionType* i_functionType )
+{
+    if ( FindFunction( i_name ) != nullptr )
+    {
+        return true;
+    }
+
+    DeclareFunction( i_name );
+    TieredFunction* tieredFunction = FindFunction( i_name );
+    tieredFunction->m_externType   = i_functionType;
+
+    // The thunk reports the call, and returns NaN in place of a result.
+    llvm::LLVMContext&              context = i_functionType->getContext();
+    std::unique_ptr< llvm::Module > module  = std::make_unique< llvm::Module >( tieredFunction->m_name, context );
+    module->setDataLayout( m_jit.getTargetMachine().createDataLayout() );
+    std::string     thunkName = tieredFunction->m_thunkName + ".undefined";
+    llvm::Function* thunk =
+        llvm::Function::Create( i_functionType, llvm::Function::ExternalLinkage, thunkName, module.get() );
+    llvm::IRBuilder<> irBuilder( llvm::BasicBlock::Create( context, "entry", thunk ) );
+
+    llvm::Type*         pointerType = irBuilder.getInt8PtrTy();
+    llvm::FunctionType* onUndefinedType =
+        llvm::FunctionType::get( irBuilder.getVoidTy(), {pointerType}, /* isVarArg */ false );
+    llvm::Value* onUndefinedAddress = GenerateHostAddress( irBuilder,
+                                                           reinterpret_cast< const void* >( &onUndefinedFunction ),
+                                                           onUndefinedType->getPointerTo() );
+    irBuilder.CreateCall(
+        onUndefinedType, onUndefinedAddress, {GenerateHostAddress( irBuilder, tieredFunction, pointerType )} );
+    irBuilder.CreateRet( llvm::ConstantFP::getNaN( irBuilder.getDoubleTy() ) );
+
+    m_jit.addModule( std::move( module ), llvm::CodeGenOpt::None );
+    llvm::JITTargetAddress address = m_jit.getSymbolAddress( thunkName );
+    if ( address == 0 )
+    {
+        LogError( "Failed to compile extern '%s'.", tieredFunction->m_name.c_str() );
+        RestoreFunction( i_name, nullptr );
+        return false;
+    }
+
+    tieredFunction->m_address.store( reinterpret_cast< void* >( address ), std::memory_order_release );
+    return true;
+}
+
+void TieredJIT::RestoreFunction( SymbolId i_name, TieredFunction* i_previous )
+{
+    if ( i_previous != nullptr )
+    {
+        m_functionsByName[ i_name ] = i_previous;
+    }
+    else
+    {
+        m_functionsByName.erase( i_name );
+    }
+}
+
+TieredFunction* TieredJIT::FindFunction( SymbolId i_name )
+{
+    std::unordered_map< SymbolId, TieredFunction* >::const_iterator functionIt = m_functionsByName.find( i_name );
+    return functionIt != m_functionsByName.end() ? functionIt->second : nullptr;
+}
+
+bool TieredJIT::AddFunctionModule( SymbolId i_name, std::unique_ptr< llvm::Module > i_module )
+{
+    TieredFunction* tieredFunction = FindFunction( i_name );
+    llvm::Function* function = tieredFunction != nullptr ? i_module->getFunction( tieredFunction->m_name ) : nullptr;
+    if ( function == nullptr || function->empty() )
+    {
+        LogError( "Function '%s' is not defined.", m_symbolTable.GetName( i_name ).c_str() );
+        return false;
+    }
+
+    // Callers of an extern call the definition with the arguments of the extern.
+    if ( tieredFunction->m_externType != nullptr && tieredFunction->m_externType != function->getFunctionType() )
+    {
+        LogError( "Function '%s' is defined with a different number of arguments than its extern.",
+                  tieredFunction->m_name.c_str() );
+        return false;
+    }
+
+    // Keep the IR of the baseline tier, to recompile once the function becomes hot.
+    tieredFunction->m_bitcode.clear();
+    llvm::raw_string_ostream bitcodeStream( tieredFunction->m_bitcode );
+    llvm::WriteBitcodeToFile( *i_module, bitcodeStream );
+    bitcodeStream.flush();
+
+    // The thunk counts calls, and queues the function for recompilation upon the hot call.
+    llvm::LLVMContext& context = i_module->getContext();
+    llvm::Function*    thunk   = llvm::Function::Create(
+        function->getFunctionType(), llvm::Function::ExternalLinkage, tieredFunction->m_thunkName, i_module.get() );
+    llvm::BasicBlock* entryBlock = llvm::BasicBlock::Create( context, "entry", thunk );
+    llvm::BasicBlock* hotBlock   = llvm::BasicBlock::Create( context, "hot", thunk );
+    llvm::BasicBlock* callBlock  = llvm::BasicBlock::Create( context, "call", thunk );
+    llvm::IRBuilder<> irBuilder( entryBlock );
+
+    llvm::Type*  countType = irBuilder.getInt64Ty();
+    llvm::Value* countAddress =
+        GenerateHostAddress( irBuilder, &tieredFunction->m_callCount, countType->getPointerTo() );
+    llvm::Value* count = irBuilder.CreateLoad( countType, countAddress );
+    count              = irBuilder.CreateAdd( count, irBuilder.getInt64( 1 ) );
+    irBuilder.CreateStore( count, countAddress );
+
+    llvm::Value* isHot = irBuilder.CreateICmpEQ( count, irBuilder.getInt64( m_hotCallCount ) );
+    irBuilder.CreateCondBr( isHot, hotBlock, callBlock );
+
+    irBuilder.SetInsertPoint( hotBlock );
+    llvm::Type*         pointerType = irBuilder.getInt8PtrTy();
+    llvm::FunctionType* onHotType =
+        llvm::FunctionType::get( irBuilder.getVoidTy(), {pointerType, pointerType}, /* isVarArg */ false );
+    llvm::Value* onHotAddress = GenerateHostAddress(
+        irBuilder, reinterpret_cast< const void* >( &TieredJIT::onHotFunction ), onHotType->getPointerTo() );
+    irBuilder.CreateCall( onHotType,
+                          onHotAddress,
+                          {GenerateHostAddress( irBuilder, this, pointerType ),
+                           GenerateHostAddress( irBuilder, tieredFunction, pointerType )} );
+    irBuilder.CreateBr( callBlock );
+
+    irBuilder.SetInsertPoint( callBlock );
+    std::vector< llvm::Value* > arguments;
+    for ( llvm::Argument& argument : thunk->args() )
+    {
+        arguments.push_back( &argument );
+    }
+
+    llvm::CallInst* result = irBuilder.CreateCall( function, arguments );
+    result->setTailCallKind( llvm::CallInst::TCK_MustTail );
+    irBuilder.CreateRet( result );
+
+    m_jit.addModule( std::move( i_module ), llvm::CodeGenOpt::None );
+    llvm::JITTargetAddress address = m_jit.getSymbolAddress( tieredFunction->m_thunkName );
+    if ( address == 0 )
+    {
+        LogError( "Failed to compile function '%s'.", tieredFunction->m_name.c_str() );
+        return false;
+    }
+
+    tieredFunction->m_isDefined = true;
+    tieredFunction->m_address.store( reinterpret_cast< void* >( address ), std::memory_order_release );
+    return true;
+}
+
+llvm::Value* TieredJIT::GenerateCall( llvm::IRBuilder<>&                 i_irBuilder,
+                                      TieredFunction&                    i_function,
+                                      llvm::FunctionType*                i_functionType,
+                                      const std::vector< llvm::Value* >& i_arguments )
+{
+    // The stub is loaded upon every call, as it is repointed by the background thread.  The load is volatile, so
+    // that it is not hoisted out of a loop, which would keep the loop calling the baseline tier.
+    llvm::Type*  functionPointerType = i_functionType->getPointerTo();
+    llvm::Value* stubAddress =
+        GenerateHostAddress( i_irBuilder, &i_function.m_address, functionPointerType->getPointerTo() );
+    llvm::Value* callee = i_irBuilder.CreateLoad( functionPointerType, stubAddress, /* isVolatile */ true );
+    return i_irBuilder.CreateCall( i_functionType, callee, i_arguments, "calltmp" );
+}
+
+void TieredJIT::onHotFunction( TieredJIT* io_tieredJIT, TieredFunction* io_function )
+{
+    {
+        std::lock_guard< std::mutex > lock( io_tieredJIT->m_hotFunctionsMutex );
+        io_tieredJIT->m_hotFunctions.push_back( io_function );
+    }
+
+    io_tieredJIT->m_hotFunctionsCondition.notify_one();
+}
+
+void TieredJIT::onUndefinedFunction( TieredFunction* i_function )
+{
+    LogError( "Function '%s' is not defined.", i_function->m_name.c_str() );
+}
+
+void TieredJIT::recompileHotFunctions()
+{
+    std::unique_lock< std::mutex > lock( m_hotFunctionsMutex );
+    while ( true )
+    {
+        m_hotFunctionsCondition.wait( lock, [this]() { return m_stopping || !m_hotFunctions.empty(); } );
+        if ( m_stopping )
+        {
+            return;
+        }
+
+        TieredFunction* function = m_hotFunctions.front();
+        m_hotFunctions.pop_front();
+
+        lock.unlock();
+        recompileFunction( *function );
+        lock.lock();
+    }
+}
+
+void TieredJIT::recompileFunction( TieredFunction& io_function )
+{
+    // The function is loaded into its own LLVM context, as the LLVM context of the code generator is in use by the
+    // main thread.
+    llvm::LLVMContext                                 context;
+    llvm::Expected< std::unique_ptr< llvm::Module > > module =
+        llvm::parseBitcodeFile( llvm::MemoryBufferRef( io_function.m_bitcode, io_function.m_name ), context );
+    if ( !module )
+    {
+        LogError( "Failed to load function '%s' for recompilation: %s",
+                  io_function.m_name.c_str(),
+                  llvm::toString( module.takeError() ).c_str() );
+        return;
+    }
+
+    llvm::Function* function = ( *module )->getFunction( io_function.m_name );
+    function->setName( io_function.m_optimizedName );
+
+    llvm::CodeGenOpt::Level codeGenOptLevel = GetCodeGenOptLevel( m_optimizationLevel );
+    llvm::TargetMachine&    targetMachine   = m_jit.getTargetMachine( codeGenOptLevel );
+    ( *module )->setTargetTriple( targetMachine.getTargetTriple().str() );
+    RunOptimizationPipeline( **module, &targetMachine, m_optimizationLevel );
+
+    m_jit.addModule( std::move( *module ), codeGenOptLevel );
+    llvm::JITTargetAddress address = m_jit.getSymbolAddress( io_function.m_optimizedName );
+    if ( address == 0 )
+    {
+        LogError( "Failed to recompile function '%s'.", io_function.m_name.c_str() );
+        return;
+    }
+
+    io_function.m_address.store( reinterpret_cast< void* >( address ), std::memory_order_release );
+}
+
+} // namespace kaleidoscope
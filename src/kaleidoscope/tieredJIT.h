@@ -0,0 +1,147 @@
+#pragma once
+
+/* Two-tier JIT compilation of function definitions */
+
+#include <kaleidoscope/api.h>
+#include <kaleidoscope/codeGenContext.h>
+#include <kaleidoscope/symbolTable.h>
+
+#include <llvm/IR/IRBuilder.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace llvm
+{
+class Module;
+namespace orc
+{
+class KaleidoscopeJIT;
+}
+} // namespace llvm
+
+namespace kaleidoscope
+{
+/// The number of calls after which a function is recompiled at full optimization, by default.
+constexpr uint64_t s_defaultHotCallCount = 1000;
+
+/// TieredFunction is the stub of a function compiled by a TieredJIT, which its callers call through.
+struct TieredFunction
+{
+    /// Address called by the stub: the counting thunk of the baseline tier, until replaced by the optimized tier.
+    /// The stub of an extern which is not defined yet calls a thunk reporting the call instead.
+    std::atomic< void* > m_address{nullptr};
+
+    uint64_t            m_callCount  = 0;       /// Number of calls of the baseline tier.
+    bool                m_isDefined  = false;   /// Whether the stub has been pointed at a definition.
+    llvm::FunctionType* m_externType = nullptr; /// Type declared by an extern, which a definition must match.
+    std::string         m_name;                 /// Name of the function in its module.
+    std::string         m_thunkName;            /// Name of the counting thunk of the baseline tier.
+    std::string         m_optimizedName;        /// Name of the function recompiled at full optimization.
+    std::string         m_bitcode;              /// Bitcode of the module of the baseline tier, prior to the thunk.
+};
+
+/// TieredJIT compiles function definitions in two tiers, to keep the latency of defining a function low without
+/// giving up the throughput of long running code.
+///
+/// A function is first compiled without IR passes, and with FastISel.  Its callers call it through a stub
+/// (TieredFunction), whose address points at a thunk which counts calls.  Once a function is called
+/// i_hotCallCount times, it is recompiled by a background thread with the optimization pipeline of
+/// i_optimizationLevel (see RunOptimizationPipeline), and the stub is repointed at the optimized function.  Calls in
+/// progress complete in the baseline tier.
+///
+/// The optimized tier is at least OptimizationLevel_O1.  Code is generated for each level of machine code generation
+/// with a TargetMachine of its own (see KaleidoscopeJIT::getTargetMachine), so the background thread must not share
+/// that of the baseline tier, which the compiling thread uses concurrently.
+///
+/// Code is generated for a TieredJIT by setting it on the CodeGenContext (CodeGenContext::SetTieredJIT).
+class TieredJIT
+{
+public:
+    KALEIDOSCOPE_API
+    TieredJIT( llvm::orc::KaleidoscopeJIT& io_jit,
+               SymbolTable&                io_symbolTable,
+               OptimizationLevel           i_optimizationLevel = OptimizationLevel_O3,
+               uint64_t                    i_hotCallCount      = s_defaultHotCallCount );
+
+    /// Stops the background thread.  Functions pending recompilation remain in the baseline tier.
+    KALEIDOSCOPE_API
+    ~TieredJIT();
+
+    /// Declare a function prior to generating its code, so that calls to it, including recursive calls, are
+    /// generated through its stub.  A function which is declared again replaces the previous declaration, for
+    /// calls generated from then on, unless the previous declaration is an extern which has not been defined yet
+    /// (see DeclareExternFunction), which is kept so that its callers call the definition.
+    /// \return the previous declaration of the function, to restore if the new definition fails, or nullptr if
+    /// the function was not declared.
+    KALEIDOSCOPE_API
+    TieredFunction* DeclareFunction( SymbolId i_name );
+
+    /// Declare a function which is called before it is defined, such as by an extern which the host does not
+    /// resolve, so that calls to it are generated through its stub.  Until the function is defined, its stub points
+    /// at a thunk which reports the call as an error, and returns NaN.  A function which is already declared is kept.
+    /// \return false if the thunk could not be compiled.
+    KALEIDOSCOPE_API
+    bool DeclareExternFunction( SymbolId i_name, llvm::FunctionType* i_functionType );
+
+    /// Restore the declaration which preceded DeclareFunction, such as if the code of the new definition could not
+    /// be generated or compiled, so that calls generated from then on go through the previous, working stub.
+    /// \param i_previous the declaration returned by DeclareFunction.  nullptr removes the declaration.
+    KALEIDOSCOPE_API
+    void RestoreFunction( SymbolId i_name, TieredFunction* i_previous );
+
+    /// Find the stub of a declared function.
+    /// \return nullptr if the function has not been declared.
+    KALEIDOSCOPE_API
+    TieredFunction* FindFunction( SymbolId i_name );
+
+    /// Compile the module defining a declared function at the baseline tier, and point its stub at it.
+    /// \return false if the function could not be compiled.
+    KALEIDOSCOPE_API
+    bool AddFunctionModule( SymbolId i_name, std::unique_ptr< llvm::Module > i_module );
+
+    /// Generate a call through the stub of a function.
+    KALEIDOSCOPE_API
+    llvm::Value* GenerateCall( llvm::IRBuilder<>&                 i_irBuilder,
+                               TieredFunction&                    i_function,
+                               llvm::FunctionType*                i_functionType,
+                               const std::vector< llvm::Value* >& i_arguments );
+
+private:
+    /// Called by the thunk of a function once it becomes hot, to queue it for recompilation.
+    static void onHotFunction( TieredJIT* io_tieredJIT, TieredFunction* io_function );
+
+    /// Called by the thunk of an extern which is called before it is defined.
+    static void onUndefinedFunction( TieredFunction* i_function );
+
+    /// Recompile hot functions, until the TieredJIT is destroyed.
+    void recompileHotFunctions();
+
+    /// Recompile a function at the optimization level of the optimized tier, and point its stub at it.
+    void recompileFunction( TieredFunction& io_function );
+
+    llvm::orc::KaleidoscopeJIT& m_jit;               /// JIT compiling and executing both tiers.
+    SymbolTable&                m_symbolTable;       /// Interned names, shared with the parser.
+    OptimizationLevel           m_optimizationLevel; /// Optimization level of the optimized tier.
+    uint64_t                    m_hotCallCount;      /// Number of calls after which a function is recompiled.
+
+    /// Stubs are never removed, as callers may hold their addresses.
+    std::deque< TieredFunction >                    m_functions;
+    std::unordered_map< SymbolId, TieredFunction* > m_functionsByName; /// Latest declaration of each name.
+
+    std::mutex                    m_hotFunctionsMutex;     /// Guards m_hotFunctions and m_stopping.
+    std::condition_variable       m_hotFunctionsCondition; /// Notified upon queueing a function, or stopping.
+    std::deque< TieredFunction* > m_hotFunctions;          /// Functions queued for recompilation.
+    bool                          m_stopping = false;      /// Whether the background thread should stop.
+    std::thread                   m_recompileThread;       /// Background thread recompiling hot functions.
+};
+
+} // namespace kaleidoscope
@@ -0,0 +1,110 @@
+#include <kaleidoscope/tokenArray.h>
+
+#include <cassert>
+
+namespace kaleidoscope
+{
+void TokenArray::Append( int i_token, const Lexer& i_lexer )
+{
+    uint32_t payload = 0;
+    if ( i_token == Token_Identifier )
+    {
+        payload = i_lexer.GetIdentifierSymbol();
+    }
+    else if ( i_token == Token_Numeric )
+    {
+        payload = static_cast< uint32_t >( m_numericValues.size() );
+        m_numericValues.push_back( i_lexer.GetNumericValue() );
+    }
+
+    m_kinds.push_back( static_cast< int16_t >( i_token ) );
+    m_payloads.push_back( payload );
+    m_sourceOffsets.push_back( static_cast< uint32_t >( i_lexer.GetTokenOffset() ) );
+}
+
+void TokenArray::AppendAll( Lexer& io_lexer )
+{
+    int token = 0;
+    do
+    {
+        token = io_lexer.GetNextToken();
+        Append( token, io_lexer );
+    } while ( token != Token_Eof );
+}
+
+void TokenArray::DiscardFront( size_t i_count )
+{
+    assert( i_count <= m_kinds.size() );
+    m_kinds.erase( m_kinds.begin(), m_kinds.begin() + i_count );
+    m_payloads.erase( m_payloads.begin(), m_payloads.begin() + i_count );
+    m_sourceOffsets.erase( m_sourceOffsets.begin(), m_sourceOffsets.begin() + i_count );
+
+    // Numeric values are appended in token order, so the values of the discarded tokens are at the front.
+    uint32_t discardedValues = static_cast< uint32_t >( m_numericValues.size() );
+    for ( size_t index = 0; index < m_kinds.size(); ++index )
+    {
+        if ( m_kinds[ index ] == Token_Numeric )
+        {
+            discardedValues = m_payloads[ index ];
+            break;
+        }
+    }
+
+    m_numericValues.erase( m_numericValues.begin(), m_numericValues.begin() + discardedValues );
+    for ( size_t index = 0; index < m_kinds.size(); ++index )
+    {
+        if ( m_kinds[ index ] == Token_Numeric )
+        {
+            m_payloads[ index ] -= discardedValues;
+        }
+    }
+}
+
+size_t TokenArray::GetSize() const
+{
+    return m_kinds.size();
+}
+
+int TokenArray::GetKind( size_t i_index ) const
+{
+    return m_kinds[ i_index ];
+}
+
+uint32_t TokenArray::GetPayload( size_t i_index ) const
+{
+    return m_payloads[ i_index ];
+}
+
+uint32_t TokenArray::GetSourceOffset( size_t i_index ) const
+{
+    return m_sourceOffsets[ i_index ];
+}
+
+SymbolId TokenArray::GetIdentifierSymbol( size_t i_index ) const
+{
+    assert( m_kinds[ i_index ] == Token_Identifier );
+    return m_payloads[ i_index ];
+}
+
+double TokenArray::GetNumericValue( size_t i_index ) const
+{
+    assert( m_kinds[ i_index ] == Token_Numeric );
+    return m_numericValues[ m_payloads[ i_index ] ];
+}
+
+std::vector< size_t > TokenArray::FindTopLevelBoundaries() const
+{
+    // 'def' and 'extern' cannot appear within an expression, so each one begins a top-level item.
+    std::vector< size_t > boundaries;
+    for ( size_t index = 0; index < m_kinds.size(); ++index )
+    {
+        if ( m_kinds[ index ] == Token_Def || m_kinds[ index ] == Token_Extern )
+        {
+            boundaries.push_back( index );
+        }
+    }
+
+    return boundaries;
+}
+
+} // namespace kaleidoscope
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <kaleidoscope/api.h>
+#include <kaleidoscope/lexer.h>
+#include <kaleidoscope/symbolTable.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace kaleidoscope
+{
+/// TokenArray stores a sequence of lexed tokens as a structure of arrays, so that a translation unit can be
+/// tokenized once, then parsed (or re-parsed) by indexing into the arrays.
+///
+/// Each token is described by:
+/// - its kind (a Token, or a single character).
+/// - a payload, which is the SymbolId of an identifier, or the index of a numeric value in a side table.
+/// - the offset of its first character in the source text.  Offsets are 32-bit, so wrap for sources beyond 4 GiB.
+class TokenArray
+{
+public:
+    /// Append the token most recently returned by the lexer, along with its payload.
+    /// \param i_token the token returned by Lexer::GetNextToken.
+    /// \param i_lexer the lexer which returned the token.
+    KALEIDOSCOPE_API
+    void Append( int i_token, const Lexer& i_lexer );
+
+    /// Lex and append all remaining tokens from a lexer, up to and including Token_Eof.
+    KALEIDOSCOPE_API
+    void AppendAll( Lexer& io_lexer );
+
+    /// Discard the leading tokens, such that the token at i_count becomes the first token.
+    KALEIDOSCOPE_API
+    void DiscardFront( size_t i_count );
+
+    /// Get the number of tokens.
+    KALEIDOSCOPE_API
+    size_t GetSize() const;
+
+    /// Get the kind of a token.
+    KALEIDOSCOPE_API
+    int GetKind( size_t i_index ) const;
+
+    /// Get the payload of a token.
+    KALEIDOSCOPE_API
+    uint32_t GetPayload( size_t i_index ) const;
+
+    /// Get the offset of the first character of a token in the source text.
+    KALEIDOSCOPE_API
+    uint32_t GetSourceOffset( size_t i_index ) const;
+
+    /// Get the symbol of a Token_Identifier token.
+    KALEIDOSCOPE_API
+    SymbolId GetIdentifierSymbol( size_t i_index ) const;
+
+    /// Get the value of a Token_Numeric token.
+    KALEIDOSCOPE_API
+    double GetNumericValue( size_t i_index ) const;
+
+    /// Find the indices of the tokens which begin a top-level definition or extern declaration.
+    /// Top-level expressions belong to the preceding boundary.
+    KALEIDOSCOPE_API
+    std::vector< size_t > FindTopLevelBoundaries() const;
+
+private:
+    std::vector< int16_t >  m_kinds;         /// Kind of each token.
+    std::vector< uint32_t > m_payloads;      /// Payload of each token.
+    std::vector< uint32_t > m_sourceOffsets; /// Source offset of each token.
+    std::vector< double >   m_numericValues; /// Side table of numeric values, indexed by payload.
+};
+
+} // namespace kaleidoscope
@@ -0,0 +1,272 @@
+#include <kaleidoscope/logger.h>
+#include <kaleidoscope/virtualMachine.h>
+
+// Direct threading requires taking the address of labels, which is a GCC (and Clang) extension.
+#if defined( __GNUC__ )
+#define KALEIDOSCOPE_DIRECT_THREADING
+#endif
+
+namespace
+{
+using namespace kaleidoscope;
+
+/// Call a native function, taking i_argumentCount doubles and returning a double.
+double CallNative( void* i_address, const double* i_arguments, size_t i_argumentCount )
+{
+    const double* a = i_arguments;
+    switch ( i_argumentCount )
+    {
+    case 0:
+        return reinterpret_cast< double ( * )() >( i_address )();
+    case 1:
+        return reinterpret_cast< double ( * )( double ) >( i_address )( a[ 0 ] );
+    case 2:
+        return reinterpret_cast< double ( * )( double, double ) >( i_address )( a[ 0 ], a[ 1 ] );
+    case 3:
+        return reinterpret_cast< double ( * )( double, double, double ) >( i_address )( a[ 0 ], a[ 1 ], a[ 2 ] );
+    case 4:
+        return reinterpret_cast< double ( * )( double, double, double, double ) >( i_address )(
+            a[ 0 ], a[ 1 ], a[ 2 ], a[ 3 ] );
+    case 5:
+        return reinterpret_cast< double ( * )( double, double, double, double, double ) >( i_address )(
+            a[ 0 ], a[ 1 ], a[ 2 ], a[ 3 ], a[ 4 ] );
+    case 6:
+        return reinterpret_cast< double ( * )( double, double, double, double, double, double ) >( i_address )(
+            a[ 0 ], a[ 1 ], a[ 2 ], a[ 3 ], a[ 4 ], a[ 5 ] );
+    case 7:
+        return reinterpret_cast< double ( * )( double, double, double, double, double, double, double ) >(
+            i_address )( a[ 0 ], a[ 1 ], a[ 2 ], a[ 3 ], a[ 4 ], a[ 5 ], a[ 6 ] );
+    default:
+        static_assert( s_maxNativeArguments == 8, "Native calls must handle up to s_maxNativeArguments." );
+        return reinterpret_cast< double ( * )( double, double, double, double, double, double, double, double ) >(
+            i_address )( a[ 0 ], a[ 1 ], a[ 2 ], a[ 3 ], a[ 4 ], a[ 5 ], a[ 6 ], a[ 7 ] );
+    }
+}
+
+/// Whether a value is true as a condition, which is if it is ordered and not equal to zero.
+inline bool IsTrue( double i_value )
+{
+    return i_value < 0.0 || i_value > 0.0;
+}
+
+} // namespace
+
+namespace kaleidoscope
+{
+VirtualMachine::VirtualMachine( BytecodeModule& io_module, size_t i_registerCount )
+    : m_module( io_module )
+    , m_registers( i_registerCount )
+{
+}
+
+bool VirtualMachine::Execute( BytecodeFunction& i_function, const double* i_arguments, double& o_result )
+{
+    if ( i_function.m_instructions.empty() )
+    {
+        if ( i_function.m_nativeAddress == nullptr )
+        {
+            LogError( "Function '%s' is not defined.", m_module.GetSymbolTable().GetName( i_function.m_name ).c_str() );
+            return false;
+        }
+
+        o_result = CallNative( i_function.m_nativeAddress, i_arguments, i_function.m_argumentCount );
+        return true;
+    }
+
+#if defined( KALEIDOSCOPE_DIRECT_THREADING )
+    // Handler of each opcode, in the order of Opcode.
+    static const void* const s_handlers[ Opcode_Count ] = {&&handleLoadConstant,
+                                                           &&handleMove,
+                                                           &&handleAdd,
+                                                           &&handleSubtract,
+                                                           &&handleMultiply,
+                                                           &&handleLess,
+                                                           &&handleJump,
+                                                           &&handleJumpIfFalse,
+                                                           &&handleJumpIfTrue,
+                                                           &&handleCall,
+                                                           &&handleReturn};
+#endif
+
+    // State of the executing function.
+    BytecodeFunction*  function     = nullptr;
+    const Instruction* instructions = nullptr;
+    const double*      constants    = nullptr;
+    const void* const* threadedCode = nullptr;
+    const Instruction* instruction  = nullptr;
+    uint32_t           pc           = 0;
+
+    // Begin executing a function, threading its code upon first execution.
+    auto enterFunction = [&]( BytecodeFunction& io_function, uint32_t i_pc ) {
+#if defined( KALEIDOSCOPE_DIRECT_THREADING )
+        if ( io_function.m_threadedCode.size() != io_function.m_instructions.size() )
+        {
+            io_function.m_threadedCode.clear();
+            for ( const Instruction& functionInstruction : io_function.m_instructions )
+            {
+                io_function.m_threadedCode.push_back( s_handlers[ functionInstruction.m_opcode ] );
+            }
+        }
+#endif
+
+        function     = &io_function;
+        instructions = io_function.m_instructions.data();
+        constants    = io_function.m_constants.data();
+        threadedCode = io_function.m_threadedCode.data();
+        pc           = i_pc;
+    };
+
+    // The frame of this execution begins above the frames of any enclosing execution.
+    size_t  registerTop    = m_registerTop;
+    size_t  callStackBegin = m_callStack.size();
+    double* registers      = m_registers.data() + registerTop;
+    double* registersEnd   = m_registers.data() + m_registers.size();
+    if ( registers + i_function.m_registerCount > registersEnd )
+    {
+        LogError( "Virtual machine registers exhausted." );
+        return false;
+    }
+
+    std::copy( i_arguments, i_arguments + i_function.m_argumentCount, registers );
+    enterFunction( i_function, 0 );
+
+#if defined( KALEIDOSCOPE_DIRECT_THREADING )
+#define VM_DISPATCH()                                                                                                  \
+    instruction = instructions + pc;                                                                                   \
+    goto* threadedCode[ pc++ ]
+#else
+#define VM_DISPATCH() goto dispatch
+dispatch:
+    instruction = instructions + pc++;
+    switch ( instruction->m_opcode )
+    {
+    case Opcode_LoadConstant:
+        goto handleLoadConstant;
+    case Opcode_Move:
+        goto handleMove;
+    case Opcode_Add:
+        goto handleAdd;
+    case Opcode_Subtract:
+        goto handleSubtract;
+    case Opcode_Multiply:
+        goto handleMultiply;
+    case Opcode_Less:
+        goto handleLess;
+    case Opcode_Jump:
+        goto handleJump;
+    case Opcode_JumpIfFalse:
+        goto handleJumpIfFalse;
+    case Opcode_JumpIfTrue:
+        goto handleJumpIfTrue;
+    case Opcode_Call:
+        goto handleCall;
+    default:
+        goto handleReturn;
+    }
+#endif
+
+    VM_DISPATCH();
+
+handleLoadConstant:
+    registers[ instruction->m_a ] = constants[ instruction->m_b ];
+    VM_DISPATCH();
+
+handleMove:
+    registers[ instruction->m_a ] = registers[ instruction->m_b ];
+    VM_DISPATCH();
+
+handleAdd:
+    registers[ instruction->m_a ] = registers[ instruction->m_b ] + registers[ instruction->m_c ];
+    VM_DISPATCH();
+
+handleSubtract:
+    registers[ instruction->m_a ] = registers[ instruction->m_b ] - registers[ instruction->m_c ];
+    VM_DISPATCH();
+
+handleMultiply:
+    registers[ instruction->m_a ] = registers[ instruction->m_b ] * registers[ instruction->m_c ];
+    VM_DISPATCH();
+
+handleLess:
+    // Unordered less-than, so a NaN operand compares as true.
+    registers[ instruction->m_a ] = !( registers[ instruction->m_b ] >= registers[ instruction->m_c ] ) ? 1.0 : 0.0;
+    VM_DISPATCH();
+
+handleJump:
+    pc = instruction->m_b;
+    VM_DISPATCH();
+
+handleJumpIfFalse:
+    if ( !IsTrue( registers[ instruction->m_a ] ) )
+    {
+        pc = instruction->m_b;
+    }
+    VM_DISPATCH();
+
+handleJumpIfTrue:
+    if ( IsTrue( registers[ instruction->m_a ] ) )
+    {
+        pc = instruction->m_b;
+    }
+    VM_DISPATCH();
+
+handleCall:
+{
+    BytecodeFunction& callee    = m_module.GetFunction( instruction->m_b );
+    const double*     arguments = registers + instruction->m_c;
+    if ( !callee.m_instructions.empty() )
+    {
+        // The frame of the callee begins above the frame of the caller.
+        double* calleeRegisters = registers + function->m_registerCount;
+        if ( calleeRegisters + callee.m_registerCount > registersEnd )
+        {
+            LogError( "Virtual machine registers exhausted, calling '%s'.",
+                      m_module.GetSymbolTable().GetName( callee.m_name ).c_str() );
+            m_callStack.resize( callStackBegin );
+            return false;
+        }
+
+        m_callStack.push_back( {function, pc, registers, instruction->m_a} );
+        std::copy( arguments, arguments + callee.m_argumentCount, calleeRegisters );
+        registers = calleeRegisters;
+        enterFunction( callee, 0 );
+    }
+    else if ( callee.m_nativeAddress != nullptr )
+    {
+        // The native function may execute bytecode, in the registers above this frame.
+        m_registerTop                 = ( registers + function->m_registerCount ) - m_registers.data();
+        double result                 = CallNative( callee.m_nativeAddress, arguments, callee.m_argumentCount );
+        m_registerTop                 = registerTop;
+        registers[ instruction->m_a ] = result;
+    }
+    else
+    {
+        LogError( "Function '%s' is not defined.", m_module.GetSymbolTable().GetName( callee.m_name ).c_str() );
+        m_callStack.resize( callStackBegin );
+        return false;
+    }
+
+    VM_DISPATCH();
+}
+
+handleReturn:
+{
+    double result = registers[ instruction->m_a ];
+    if ( m_callStack.size() == callStackBegin )
+    {
+        o_result = result;
+        return true;
+    }
+
+    const CallFrame& caller = m_callStack.back();
+    registers               = caller.m_registers;
+    registers[ caller.m_resultRegister ] = result;
+    enterFunction( *caller.m_function, caller.m_instructionIndex );
+    m_callStack.pop_back();
+    VM_DISPATCH();
+}
+
+#undef VM_DISPATCH
+}
+
+} // namespace kaleidoscope
@@ -0,0 +1,54 @@
+#pragma once
+
+/* Execution of bytecode functions */
+
+#include <kaleidoscope/api.h>
+#include <kaleidoscope/bytecode.h>
+
+#include <vector>
+
+namespace kaleidoscope
+{
+/// VirtualMachine executes the bytecode functions of a BytecodeModule.
+///
+/// Upon first executing a function, its opcodes are translated into the addresses of their handlers
+/// (direct threading), so each instruction jumps straight to the handler of the next one, rather than through a
+/// central dispatch switch.  Compilers without computed goto fall back to a switch.
+///
+/// Calls between bytecode functions push a frame onto the VM's own call stack rather than recursing natively,
+/// so executing a function has a fixed native stack cost.  Calls to native functions (JIT compiled, or host
+/// functions) are made directly, and may execute bytecode again.
+class VirtualMachine
+{
+public:
+    /// \param io_module module of the functions to execute.
+    /// \param i_registerCount the number of registers of the VM, which bounds the depth of calls.
+    KALEIDOSCOPE_API
+    explicit VirtualMachine( BytecodeModule& io_module, size_t i_registerCount = 1 << 20 );
+
+    /// Execute a function.
+    /// \param i_function the function to execute, which must be defined.
+    /// \param i_arguments the arguments of the function.
+    /// \param o_result the value returned by the function.
+    /// \return false if executing failed, such as upon calling a function which is not defined, or exhausting
+    /// the registers of the VM.
+    KALEIDOSCOPE_API
+    bool Execute( BytecodeFunction& i_function, const double* i_arguments, double& o_result );
+
+private:
+    /// State of a bytecode function being executed, in the call stack.
+    struct CallFrame
+    {
+        BytecodeFunction* m_function;         /// Function being executed.
+        uint32_t          m_instructionIndex; /// Instruction to resume at.
+        double*           m_registers;        /// First register of the frame.
+        uint32_t          m_resultRegister;   /// Register of the caller receiving the returned value.
+    };
+
+    BytecodeModule&          m_module;          /// Module of the functions to execute.
+    std::vector< double >    m_registers;       /// Registers of all the frames in the call stack.
+    size_t                   m_registerTop = 0; /// First register free for a nested execution.
+    std::vector< CallFrame > m_callStack;       /// Frames of the callers of the executing functions.
+};
+
+} // namespace kaleidoscope
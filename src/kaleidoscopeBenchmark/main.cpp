@@ -0,0 +1,1127 @@
+#include <kaleidoscope/KaleidoscopeJIT.h>
+#include <kaleidoscope/astVisitor.h>
+#include <kaleidoscope/batchEvaluator.h>
+#include <kaleidoscope/bytecode.h>
+#include <kaleidoscope/codeGenContext.h>
+#include <kaleidoscope/engine.h>
+#include <kaleidoscope/exprInterner.h>
+#include <kaleidoscope/flatAST.h>
+#include <kaleidoscope/lexer.h>
+#include <kaleidoscope/logger.h>
+#include <kaleidoscope/parser.h>
+#include <kaleidoscope/virtualMachine.h>
+
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+#include <string>
+#include <vector>
+
+using namespace kaleidoscope;
+
+/// Number of timed iterations per measurement.  The fastest iteration is reported.
+constexpr size_t s_iterations = 10;
+
+/// Number of top-level expressions evaluated by the execution latency benchmark.
+constexpr size_t s_latencyExpressions = 256;
+
+/// Number of top-level items generated by the declaration benchmark.
+constexpr size_t s_declarationItems = 4096;
+
+/// Kernels of the kernel benchmark, which sum the integers up to n: by a loop accumulating into a mutable variable,
+/// and by recursion.
+constexpr const char* s_kernelSource = "def sumloop(n) var s = 0 in ( for i = 0, i < n in s = s + i ) + s;"
+                                       "def sumrec(n) if n < 1 then 0 else n + sumrec(n - 1);";
+
+/// Argument of the kernels, which bounds the depth of recursion.
+constexpr double s_kernelArgument = 10000.0;
+
+/// Number of calls of each kernel per measurement.
+constexpr size_t s_kernelCalls = 1000;
+
+/// Definitions of the inlining benchmark, each compiled into its own module as by the interpreter.  The kernel
+/// sumsquares calls a helper defined in a previous module.
+constexpr const char* s_inliningSource =
+    "def square(x) x * x;"
+    "def sumsquares(n) var s = 0 in ( for i = 0, i < n in s = s + square(i) ) + s;";
+
+/// Maximum instructions of the functions imported for inlining, by the inlining benchmark.
+constexpr size_t s_inlineImportLimit = 64;
+
+/// Formula of the batch benchmark, evaluated over every row of its input columns.
+constexpr const char* s_batchSource = "def formula(x y) (x * x + y * 0.5) * (x - y) + 1;";
+
+/// Number of rows of the batch benchmark.
+constexpr size_t s_batchRows = 1 << 22;
+
+/// Generate a synthetic source of many small definitions, of at least i_minimumSize bytes.
+std::string GenerateSource( size_t i_minimumSize )
+{
+    std::string source;
+    source.reserve( i_minimumSize + 256 );
+    for ( size_t index = 0; source.size() < i_minimumSize; ++index )
+    {
+        std::string suffix = std::to_string( index );
+        source += "def function" + suffix + "(x y)\n";
+        source += "    if x < " + suffix + ".5 then (1+2+x)*(y+(1+2)) else ";
+        source += "function" + suffix + "(x - 1.0, y * 0.25);\n";
+        source += "for i = 1, i < 10, 1.0 in function" + suffix + "(i, 2);\n";
+    }
+
+    return source;
+}
+
+/// Time i_function over s_iterations.
+/// \return the duration of the fastest iteration, in seconds.
+double MeasureSeconds( const std::function< void() >& i_function )
+{
+    double bestSeconds = std::numeric_limits< double >::max();
+    for ( size_t iteration = 0; iteration < s_iterations; ++iteration )
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        i_function();
+        std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+        bestSeconds                             = std::min( bestSeconds, elapsed.count() );
+    }
+
+    return bestSeconds;
+}
+
+/// Report the throughput of processing i_bytes in i_seconds.
+void ReportThroughput( const char* i_name, size_t i_bytes, double i_seconds )
+{
+    LogInfo( "%-32s %10.2f MB/s", i_name, ( double ) i_bytes / i_seconds / 1.0e6 );
+}
+
+/// Lex the entire source.
+/// \return the number of tokens.
+size_t LexAll( std::string_view i_source, LexerMode i_mode )
+{
+    SymbolTable symbolTable;
+    Lexer       lexer( i_source, symbolTable, i_mode );
+    size_t      tokenCount = 0;
+    while ( lexer.GetNextToken() != Token_Eof )
+    {
+        tokenCount++;
+    }
+
+    return tokenCount;
+}
+
+/// Compare the throughput of the reference and accelerated lexer modes.
+int BenchmarkLexer( std::string_view i_source )
+{
+    size_t referenceTokens   = 0;
+    size_t acceleratedTokens = 0;
+    double referenceSeconds  = MeasureSeconds( [&]() { referenceTokens = LexAll( i_source, LexerMode_Reference ); } );
+    double acceleratedSeconds =
+        MeasureSeconds( [&]() { acceleratedTokens = LexAll( i_source, LexerMode_Accelerated ); } );
+
+    if ( referenceTokens != acceleratedTokens )
+    {
+        LogError( "Token count mismatch: reference %zu, accelerated %zu", referenceTokens, acceleratedTokens );
+        return -1;
+    }
+
+    LogInfo( "Lexed %zu bytes into %zu tokens.", i_source.size(), referenceTokens );
+    ReportThroughput( "Lexer (reference)", i_source.size(), referenceSeconds );
+    ReportThroughput( "Lexer (accelerated)", i_source.size(), acceleratedSeconds );
+    return 0;
+}
+
+/// Parse all the function definitions and top-level expressions of a source.
+void ParseAll( Parser& io_parser, std::vector< FunctionAST* >& o_functions )
+{
+    while ( io_parser.ParseCurrentToken() != Token_Eof )
+    {
+        FunctionAST* function = nullptr;
+        switch ( io_parser.ParseCurrentToken() )
+        {
+        case ';':
+            io_parser.ParseNextToken();
+            continue;
+        case Token_Def:
+            function = io_parser.ParseDefinitionExpr();
+            break;
+        case Token_Extern:
+            if ( io_parser.ParseExternExpr() == nullptr )
+            {
+                io_parser.ParseNextToken();
+            }
+            continue;
+        default:
+            function = io_parser.ParseTopLevelExpr();
+            break;
+        }
+
+        if ( function != nullptr )
+        {
+            o_functions.push_back( function );
+        }
+        else
+        {
+            io_parser.ParseNextToken();
+        }
+    }
+}
+
+/// Parse the entire source.
+/// \return the number of parsed functions.
+size_t ParseAll( std::string_view i_source, ParserMode i_mode )
+{
+    SymbolTable                 symbolTable;
+    Parser                      parser( i_source, symbolTable );
+    std::vector< FunctionAST* > functions;
+    parser.SetMode( i_mode );
+    ParseAll( parser, functions );
+    return functions.size();
+}
+
+/// Compare the throughput of the recursive and iterative parser modes.
+int BenchmarkParser( std::string_view i_source )
+{
+    size_t recursiveFunctions = 0;
+    size_t iterativeFunctions = 0;
+    double recursiveSeconds =
+        MeasureSeconds( [&]() { recursiveFunctions = ParseAll( i_source, ParserMode_Recursive ); } );
+    double iterativeSeconds =
+        MeasureSeconds( [&]() { iterativeFunctions = ParseAll( i_source, ParserMode_Iterative ); } );
+
+    if ( recursiveFunctions != iterativeFunctions )
+    {
+        LogError( "Function count mismatch: recursive %zu, iterative %zu", recursiveFunctions, iterativeFunctions );
+        return -1;
+    }
+
+    LogInfo( "Parsed %zu bytes into %zu functions.", i_source.size(), recursiveFunctions );
+    ReportThroughput( "Parser (recursive)", i_source.size(), recursiveSeconds );
+    ReportThroughput( "Parser (iterative)", i_source.size(), iterativeSeconds );
+    return 0;
+}
+
+/// Sum the numeric literals of an expression, by traversing its nodes.
+class NumericSumVisitor : public ExprVisitor< NumericSumVisitor, double >
+{
+public:
+    double VisitNumeric( NumericExprAST* i_expr )
+    {
+        return i_expr->GetValue();
+    }
+
+    double VisitVariable( VariableExprAST* )
+    {
+        return 0.0;
+    }
+
+    double VisitBinary( BinaryExprAST* i_expr )
+    {
+        return Visit( i_expr->GetLHS() ) + Visit( i_expr->GetRHS() );
+    }
+
+    double VisitCall( CallExprAST* i_expr )
+    {
+        double sum = 0.0;
+        for ( ExprAST* argument : i_expr->GetArguments() )
+        {
+            sum += Visit( argument );
+        }
+
+        return sum;
+    }
+
+    double VisitIf( IfExprAST* i_expr )
+    {
+        return Visit( i_expr->GetCondition() ) + Visit( i_expr->GetThen() ) + Visit( i_expr->GetElse() );
+    }
+
+    double VisitFor( ForExprAST* i_expr )
+    {
+        double sum = Visit( i_expr->GetStart() ) + Visit( i_expr->GetEnd() ) + Visit( i_expr->GetBody() );
+        return i_expr->GetStep() != nullptr ? sum + Visit( i_expr->GetStep() ) : sum;
+    }
+
+    double VisitVar( VarExprAST* i_expr )
+    {
+        return Visit( i_expr->GetInitializer() ) + Visit( i_expr->GetBody() );
+    }
+
+    double VisitAssign( AssignExprAST* i_expr )
+    {
+        return Visit( i_expr->GetValue() );
+    }
+};
+
+/// Sum the numeric literals of a flat expression, by traversing its nodes depth first with an explicit stack.
+double SumNumericValues( const FlatAST& i_flatAST, FlatNodeIndex i_root, std::vector< FlatNodeIndex >& io_pending )
+{
+    double sum = 0.0;
+    io_pending.assign( 1, i_root );
+    while ( !io_pending.empty() )
+    {
+        FlatNodeIndex node = io_pending.back();
+        io_pending.pop_back();
+        if ( i_flatAST.GetKind( node ) == ExprKind_Numeric )
+        {
+            sum += i_flatAST.GetNumericValue( node );
+            continue;
+        }
+
+        // Push the children in reverse, so they are summed in order.
+        for ( size_t childIndex = i_flatAST.GetChildCount( node ); childIndex > 0; --childIndex )
+        {
+            FlatNodeIndex child = i_flatAST.GetChild( node, childIndex - 1 );
+            if ( child != FlatNode_None )
+            {
+                io_pending.push_back( child );
+            }
+        }
+    }
+
+    return sum;
+}
+
+/// Compare the memory use and traversal speed of the pointer-based AST and the flat AST.
+int BenchmarkFlatAST( std::string_view i_source )
+{
+    SymbolTable                 symbolTable;
+    Parser                      parser( i_source, symbolTable );
+    std::vector< FunctionAST* > functions;
+    ParseAll( parser, functions );
+
+    FlatAST flatAST;
+    double  flattenSeconds = MeasureSeconds( [&]() {
+        flatAST.Clear();
+        for ( const FunctionAST* function : functions )
+        {
+            flatAST.AppendFunction( *function );
+        }
+    } );
+
+    // Round trip through serialization.
+    std::vector< char > buffer;
+    FlatAST             deserializedAST;
+    double serializeSeconds = MeasureSeconds( [&]() { flatAST.Serialize( buffer ); } );
+    double deserializeSeconds =
+        MeasureSeconds( [&]() { deserializedAST.Deserialize( buffer.data(), buffer.size() ); } );
+
+    double pointerSum     = 0.0;
+    double pointerSeconds = MeasureSeconds( [&]() {
+        pointerSum = 0.0;
+        for ( const FunctionAST* function : functions )
+        {
+            pointerSum += NumericSumVisitor().Visit( function->GetBody() );
+        }
+    } );
+
+    double                       flatSum = 0.0;
+    std::vector< FlatNodeIndex > pending;
+    double                       flatSeconds = MeasureSeconds( [&]() {
+        flatSum = 0.0;
+        for ( size_t functionIndex = 0; functionIndex < deserializedAST.GetFunctionCount(); ++functionIndex )
+        {
+            flatSum +=
+                SumNumericValues( deserializedAST, deserializedAST.GetFunction( functionIndex ).m_body, pending );
+        }
+    } );
+
+    // Children precede their parents, so visiting every node does not require recursion.
+    double linearSum     = 0.0;
+    double linearSeconds = MeasureSeconds( [&]() {
+        linearSum = 0.0;
+        for ( FlatNodeIndex node = 0; node < deserializedAST.GetNodeCount(); ++node )
+        {
+            if ( deserializedAST.GetKind( node ) == ExprKind_Numeric )
+            {
+                linearSum += deserializedAST.GetNumericValue( node );
+            }
+        }
+    } );
+
+    // Expand the flat AST back into expression nodes, as for code generation.
+    ASTArena                    expandedArena;
+    ExprInterner                expandedInterner( expandedArena );
+    std::vector< FunctionAST* > expandedFunctions;
+    double                      expandSeconds = MeasureSeconds( [&]() {
+        expandedInterner.Clear();
+        expandedArena.Reset();
+        expandedFunctions.clear();
+        for ( size_t functionIndex = 0; functionIndex < deserializedAST.GetFunctionCount(); ++functionIndex )
+        {
+            expandedFunctions.push_back( deserializedAST.ExpandFunction( functionIndex, expandedInterner ) );
+        }
+    } );
+
+    double expandedSum = 0.0;
+    for ( const FunctionAST* function : expandedFunctions )
+    {
+        expandedSum += NumericSumVisitor().Visit( function->GetBody() );
+    }
+
+    // The flat traversals sum in a different order, so may differ by rounding.
+    double tolerance = 1.0e-9 * std::abs( pointerSum );
+    if ( pointerSum != expandedSum || std::abs( pointerSum - flatSum ) > tolerance ||
+         std::abs( pointerSum - linearSum ) > tolerance )
+    {
+        LogError( "Traversal mismatch: pointer AST sum %f, flat AST sum %f, %f, expanded AST sum %f",
+                  pointerSum,
+                  flatSum,
+                  linearSum,
+                  expandedSum );
+        return -1;
+    }
+
+    size_t nodeCount = flatAST.GetNodeCount();
+    LogInfo( "Parsed %zu functions, with %zu expression nodes.", functions.size(), nodeCount );
+    LogInfo( "%-32s %10zu bytes (%.2f bytes/node)",
+             "AST memory (pointer)",
+             parser.GetArena().GetBytesAllocated(),
+             ( double ) parser.GetArena().GetBytesAllocated() / nodeCount );
+    LogInfo( "%-32s %10zu bytes (%.2f bytes/node)",
+             "AST memory (flat)",
+             flatAST.GetMemoryUsage(),
+             ( double ) flatAST.GetMemoryUsage() / nodeCount );
+    ReportThroughput( "Flatten", i_source.size(), flattenSeconds );
+    ReportThroughput( "Serialize", i_source.size(), serializeSeconds );
+    ReportThroughput( "Deserialize", i_source.size(), deserializeSeconds );
+    ReportThroughput( "Traverse (pointer)", i_source.size(), pointerSeconds );
+    ReportThroughput( "Traverse (flat)", i_source.size(), flatSeconds );
+    ReportThroughput( "Traverse (flat, linear)", i_source.size(), linearSeconds );
+    ReportThroughput( "Expand", i_source.size(), expandSeconds );
+    return 0;
+}
+
+/// Compare the latency of evaluating top-level expressions with the bytecode virtual machine, against JIT
+/// compiling them.  Each evaluation includes compiling the expression, executing it, and discarding its code.
+int BenchmarkVirtualMachine( std::string_view i_source )
+{
+    // Parse the definitions preceding the first top-level expressions of the source.
+    SymbolTable                 symbolTable;
+    Parser                      parser( i_source, symbolTable );
+    std::vector< FunctionAST* > definitions;
+    std::vector< FunctionAST* > expressions;
+    while ( parser.ParseCurrentToken() != Token_Eof && expressions.size() < s_latencyExpressions )
+    {
+        FunctionAST* function = nullptr;
+        switch ( parser.ParseCurrentToken() )
+        {
+        case ';':
+            parser.ParseNextToken();
+            continue;
+        case Token_Def:
+            function = parser.ParseDefinitionExpr();
+            break;
+        case Token_Extern:
+            if ( parser.ParseExternExpr() == nullptr )
+            {
+                parser.ParseNextToken();
+            }
+            continue;
+        default:
+            function = parser.ParseTopLevelExpr();
+            break;
+        }
+
+        if ( function == nullptr )
+        {
+            parser.ParseNextToken();
+        }
+        else if ( function->GetPrototype()->GetName() == Symbol_AnonymousExpr )
+        {
+            expressions.push_back( function );
+        }
+        else
+        {
+            definitions.push_back( function );
+        }
+    }
+
+    if ( expressions.empty() )
+    {
+        LogError( "No top-level expressions to evaluate." );
+        return -1;
+    }
+
+    // Define the functions ahead of time, so that only the evaluation of expressions is measured.
+    BytecodeModule bytecodeModule( symbolTable );
+    VirtualMachine virtualMachine( bytecodeModule );
+    for ( const FunctionAST* definition : definitions )
+    {
+        bytecodeModule.CompileFunction( *definition );
+    }
+
+    llvm::orc::KaleidoscopeJIT jit;
+    CodeGenContext             codeGenContext( symbolTable );
+    codeGenContext.InitializeModuleWithJIT( jit );
+    for ( FunctionAST* definition : definitions )
+    {
+        definition->GenerateCode( codeGenContext );
+    }
+
+    codeGenContext.OptimizeModule();
+    jit.addModule( std::move( codeGenContext.MoveModule() ) );
+    codeGenContext.InitializeModuleWithJIT( jit );
+
+    std::vector< double > vmResults( expressions.size() );
+    double                vmSeconds = MeasureSeconds( [&]() {
+        for ( size_t expressionIndex = 0; expressionIndex < expressions.size(); ++expressionIndex )
+        {
+            BytecodeFunction* function = bytecodeModule.CompileFunction( *expressions[ expressionIndex ] );
+            if ( function != nullptr )
+            {
+                virtualMachine.Execute( *function, nullptr, vmResults[ expressionIndex ] );
+                bytecodeModule.RemoveFunction( Symbol_AnonymousExpr );
+            }
+        }
+    } );
+
+    std::vector< double > jitResults( expressions.size() );
+    double                jitSeconds = MeasureSeconds( [&]() {
+        for ( size_t expressionIndex = 0; expressionIndex < expressions.size(); ++expressionIndex )
+        {
+            if ( expressions[ expressionIndex ]->GenerateCode( codeGenContext ) != nullptr )
+            {
+                codeGenContext.OptimizeModule();
+                llvm::orc::VModuleKey moduleKey = jit.addModule( std::move( codeGenContext.MoveModule() ) );
+                codeGenContext.InitializeModuleWithJIT( jit );
+
+                llvm::Expected< uintptr_t > address = jit.findSymbol( "__anon_expr" ).getAddress();
+                if ( address )
+                {
+                    jitResults[ expressionIndex ] = reinterpret_cast< double ( * )() >( *address )();
+                }
+                else
+                {
+                    llvm::consumeError( address.takeError() );
+                }
+
+                jit.removeModule( moduleKey );
+            }
+        }
+    } );
+
+    for ( size_t expressionIndex = 0; expressionIndex < expressions.size(); ++expressionIndex )
+    {
+        if ( vmResults[ expressionIndex ] != jitResults[ expressionIndex ] )
+        {
+            LogError( "Result mismatch of expression %zu: virtual machine %f, JIT %f",
+                      expressionIndex,
+                      vmResults[ expressionIndex ],
+                      jitResults[ expressionIndex ] );
+            return -1;
+        }
+    }
+
+    LogInfo( "Evaluated %zu top-level expressions, after %zu definitions.", expressions.size(), definitions.size() );
+    LogInfo( "%-32s %10.2f us/expression", "Evaluate (virtual machine)", vmSeconds * 1.0e6 / expressions.size() );
+    LogInfo( "%-32s %10.2f us/expression", "Evaluate (JIT)", jitSeconds * 1.0e6 / expressions.size() );
+    return 0;
+}
+
+/// Measure the code generation of top-level items into a module each, as the interpreter does, which declares the
+/// functions called by each item in its module.
+int BenchmarkDeclarations( std::string_view i_source )
+{
+    SymbolTable                 symbolTable;
+    Parser                      parser( i_source, symbolTable );
+    std::vector< FunctionAST* > functions;
+    ParseAll( parser, functions );
+    functions.resize( std::min( functions.size(), s_declarationItems ) );
+
+    llvm::orc::KaleidoscopeJIT jit;
+    CodeGenContext             codeGenContext( symbolTable );
+    codeGenContext.InitializeModuleWithJIT( jit );
+
+    size_t generatedCount = 0;
+    double seconds        = MeasureSeconds( [&]() {
+        generatedCount = 0;
+        for ( FunctionAST* function : functions )
+        {
+            if ( function->GenerateCode( codeGenContext ) != nullptr )
+            {
+                generatedCount += 1;
+            }
+
+            codeGenContext.MoveModule();
+            codeGenContext.InitializeModuleWithJIT( jit );
+        }
+    } );
+
+    if ( generatedCount != functions.size() )
+    {
+        LogError( "Generated %zu of %zu top-level items.", generatedCount, functions.size() );
+        return -1;
+    }
+
+    double declarations = ( double ) codeGenContext.GetDeclarationCount() / s_iterations;
+    LogInfo( "Generated %zu top-level items, into a module each.", functions.size() );
+    LogInfo( "%-32s %10.2f per item", "Declarations materialized", declarations / functions.size() );
+    LogInfo( "%-32s %10.2f us/item", "Generate", seconds * 1.0e6 / functions.size() );
+    return 0;
+}
+
+/// Options of compiling a source with CompileSource, which default to those of CodeGenContext.
+struct CompileOptions
+{
+    OptimizationLevel m_optimizationLevel   = OptimizationLevel_O2; /// Optimization pipeline of the modules.
+    size_t            m_inlineImportLimit   = 0;                    /// Maximum instructions of an imported function.
+    bool              m_mathIntrinsics      = true;                 /// Call math functions as intrinsics.
+    bool              m_batchFunctions      = false;                /// Generate the batch function of each definition.
+    bool              m_modulePerDefinition = false;                /// Compile each definition into its own module.
+};
+
+/// JIT compile the externs and definitions of a source, and look up the addresses of compiled functions.
+/// \param io_jit the JIT to compile the source with, which must outlive the use of the functions.
+/// \param i_options the options of code generation.
+/// \param i_symbolNames the names of the functions to look up.
+/// \param o_addresses the addresses of the functions, in order of i_symbolNames.
+/// \param o_vectorizedLoopCount the number of loops vectorized, unless nullptr.
+/// \return false if the source could not be compiled.
+bool CompileSource( llvm::orc::KaleidoscopeJIT&          io_jit,
+                    const char*                          i_source,
+                    const CompileOptions&                i_options,
+                    std::initializer_list< const char* > i_symbolNames,
+                    std::vector< uintptr_t >&            o_addresses,
+                    size_t*                              o_vectorizedLoopCount = nullptr )
+{
+    SymbolTable    symbolTable;
+    Parser         parser( i_source, symbolTable );
+    CodeGenContext codeGenContext( symbolTable );
+    codeGenContext.SetOptimizationLevel( i_options.m_optimizationLevel );
+    codeGenContext.SetInlineImportLimit( i_options.m_inlineImportLimit );
+    codeGenContext.SetMathIntrinsics( i_options.m_mathIntrinsics );
+    codeGenContext.InitializeModuleWithJIT( io_jit );
+
+    auto addModule = [&]() {
+        codeGenContext.OptimizeModule();
+        io_jit.addModule( std::move( codeGenContext.MoveModule() ), codeGenContext.GetCodeGenOptLevel() );
+        codeGenContext.InitializeModuleWithJIT( io_jit );
+    };
+
+    while ( parser.ParseCurrentToken() != Token_Eof )
+    {
+        if ( parser.ParseCurrentToken() == ';' )
+        {
+            parser.ParseNextToken();
+        }
+        else if ( parser.ParseCurrentToken() == Token_Extern )
+        {
+            PrototypeAST* prototype = parser.ParseExternExpr();
+            if ( prototype == nullptr || prototype->GenerateCode( codeGenContext ) == nullptr )
+            {
+                LogError( "Failed to declare an extern." );
+                return false;
+            }
+
+            codeGenContext.AddFunction( *prototype, /* isDefinition */ false );
+        }
+        else
+        {
+            FunctionAST* function = parser.ParseDefinitionExpr();
+            if ( function == nullptr || function->GenerateCode( codeGenContext ) == nullptr ||
+                 ( i_options.m_batchFunctions &&
+                   GenerateBatchFunction( codeGenContext, function->GetPrototype()->GetName() ) == nullptr ) )
+            {
+                LogError( "Failed to generate a definition." );
+                return false;
+            }
+
+            if ( i_options.m_modulePerDefinition )
+            {
+                addModule();
+            }
+        }
+    }
+
+    if ( !i_options.m_modulePerDefinition )
+    {
+        addModule();
+    }
+
+    if ( o_vectorizedLoopCount != nullptr )
+    {
+        *o_vectorizedLoopCount = codeGenContext.GetVectorizedLoopCount();
+    }
+
+    o_addresses.clear();
+    for ( const char* symbolName : i_symbolNames )
+    {
+        llvm::Expected< uintptr_t > address = io_jit.findSymbol( symbolName ).getAddress();
+        if ( !address )
+        {
+            llvm::consumeError( address.takeError() );
+            LogError( "Failed to compile '%s'.", symbolName );
+            return false;
+        }
+
+        o_addresses.push_back( *address );
+    }
+
+    return true;
+}
+
+/// A kernel compiled from s_kernelSource, which takes n.
+using KernelFunction = double ( * )( double );
+
+/// Measure s_kernelCalls calls of a kernel with s_kernelArgument.
+/// \param i_kernel the kernel to call.
+/// \param o_result the sum of the results of the calls, which keeps the calls from being optimized away.
+/// \return the fastest duration of the calls, in seconds.
+double MeasureKernel( KernelFunction i_kernel, double& o_result )
+{
+    return MeasureSeconds( [&]() {
+        o_result = 0.0;
+        for ( size_t callIndex = 0; callIndex < s_kernelCalls; ++callIndex )
+        {
+            o_result += i_kernel( s_kernelArgument );
+        }
+    } );
+}
+
+/// Compare the JIT compiled code of a loop accumulating into a mutable variable, against recursion computing the
+/// same sum.  The kernels are compiled from s_kernelSource, rather than the benchmarked source.
+int BenchmarkKernels( std::string_view )
+{
+    llvm::orc::KaleidoscopeJIT jit;
+    std::vector< uintptr_t >   kernels;
+    if ( !CompileSource( jit, s_kernelSource, CompileOptions(), {"sumloop", "sumrec"}, kernels ) )
+    {
+        return -1;
+    }
+
+    KernelFunction loopSum   = reinterpret_cast< KernelFunction >( kernels[ 0 ] );
+    KernelFunction recursive = reinterpret_cast< KernelFunction >( kernels[ 1 ] );
+    double loopResult       = 0.0;
+    double loopSeconds      = MeasureKernel( loopSum, loopResult );
+    double recursiveResult  = 0.0;
+    double recursiveSeconds = MeasureKernel( recursive, recursiveResult );
+    if ( loopResult != recursiveResult )
+    {
+        LogError( "Result mismatch: loop %f, recursion %f", loopResult, recursiveResult );
+        return -1;
+    }
+
+    LogInfo( "Summed the integers up to %.0f, %zu times.", s_kernelArgument, s_kernelCalls );
+    LogInfo( "%-32s %10.2f us/call", "Loop (mutable variable)", loopSeconds * 1.0e6 / s_kernelCalls );
+    LogInfo( "%-32s %10.2f us/call", "Recursion", recursiveSeconds * 1.0e6 / s_kernelCalls );
+    return 0;
+}
+
+/// Compare the compile time, and the throughput of the generated code, of the kernels of s_kernelSource at each
+/// optimization level.
+int BenchmarkOptimizationLevels( std::string_view )
+{
+    static const std::pair< OptimizationLevel, const char* > levels[] = {
+        {OptimizationLevel_O0, "O0"},
+        {OptimizationLevel_O1, "O1"},
+        {OptimizationLevel_O2, "O2"},
+        {OptimizationLevel_O3, "O3"},
+    };
+
+    LogInfo( "Summed the integers up to %.0f, %zu times.", s_kernelArgument, s_kernelCalls );
+    LogInfo( "%-8s %12s %16s %20s", "Level", "Compile (ms)", "Loop (us/call)", "Recursion (us/call)" );
+    double referenceResult = 0.0;
+    for ( const std::pair< OptimizationLevel, const char* >& level : levels )
+    {
+        // Each level compiles into its own JIT, so that the kernels of the levels do not collide.
+        llvm::orc::KaleidoscopeJIT jit;
+        CompileOptions             options;
+        std::vector< uintptr_t >   kernels;
+        options.m_optimizationLevel                 = level.first;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if ( !CompileSource( jit, s_kernelSource, options, {"sumloop", "sumrec"}, kernels ) )
+        {
+            return -1;
+        }
+
+        std::chrono::duration< double > compileSeconds = std::chrono::steady_clock::now() - start;
+        KernelFunction                  loopSum        = reinterpret_cast< KernelFunction >( kernels[ 0 ] );
+        KernelFunction                  recursive      = reinterpret_cast< KernelFunction >( kernels[ 1 ] );
+
+        double loopResult       = 0.0;
+        double loopSeconds      = MeasureKernel( loopSum, loopResult );
+        double recursiveResult  = 0.0;
+        double recursiveSeconds = MeasureKernel( recursive, recursiveResult );
+        if ( level.first == OptimizationLevel_O0 )
+        {
+            referenceResult = loopResult;
+        }
+
+        if ( loopResult != referenceResult || recursiveResult != referenceResult )
+        {
+            LogError( "Result mismatch at %s: loop %f, recursion %f, expected %f",
+                      level.second,
+                      loopResult,
+                      recursiveResult,
+                      referenceResult );
+            return -1;
+        }
+
+        LogInfo( "%-8s %12.2f %16.2f %20.2f",
+                 level.second,
+                 compileSeconds.count() * 1.0e3,
+                 loopSeconds * 1.0e6 / s_kernelCalls,
+                 recursiveSeconds * 1.0e6 / s_kernelCalls );
+    }
+
+    return 0;
+}
+
+/// Compare a kernel calling a helper defined in a previous module, with and without importing the helper for
+/// inlining.
+int BenchmarkInlining( std::string_view )
+{
+    // Each definition is compiled into its own module, as the interpreter does.
+    llvm::orc::KaleidoscopeJIT callJIT;
+    llvm::orc::KaleidoscopeJIT inlineJIT;
+    CompileOptions             callOptions;
+    CompileOptions             inlineOptions;
+    std::vector< uintptr_t >   callKernels;
+    std::vector< uintptr_t >   inlineKernels;
+    callOptions.m_modulePerDefinition   = true;
+    inlineOptions.m_modulePerDefinition = true;
+    inlineOptions.m_inlineImportLimit   = s_inlineImportLimit;
+    if ( !CompileSource( callJIT, s_inliningSource, callOptions, {"sumsquares"}, callKernels ) ||
+         !CompileSource( inlineJIT, s_inliningSource, inlineOptions, {"sumsquares"}, inlineKernels ) )
+    {
+        return -1;
+    }
+
+    KernelFunction callKernel   = reinterpret_cast< KernelFunction >( callKernels[ 0 ] );
+    KernelFunction inlineKernel = reinterpret_cast< KernelFunction >( inlineKernels[ 0 ] );
+
+    double callResult    = 0.0;
+    double callSeconds   = MeasureKernel( callKernel, callResult );
+    double inlineResult  = 0.0;
+    double inlineSeconds = MeasureKernel( inlineKernel, inlineResult );
+    if ( callResult != inlineResult )
+    {
+        LogError( "Result mismatch: call %f, inlined %f", callResult, inlineResult );
+        return -1;
+    }
+
+    LogInfo( "Summed the squares of the integers up to %.0f, %zu times.", s_kernelArgument, s_kernelCalls );
+    LogInfo( "%-32s %10.2f us/call", "Call across modules", callSeconds * 1.0e6 / s_kernelCalls );
+    LogInfo( "%-32s %10.2f us/call", "Imported and inlined", inlineSeconds * 1.0e6 / s_kernelCalls );
+    return 0;
+}
+
+/// Compare evaluating the formula of s_batchSource over columns of rows, by calling the compiled function per row,
+/// against its batch function on one, and on every hardware thread.
+int BenchmarkBatch( std::string_view )
+{
+    Engine                               engine;
+    Compiled< double( double, double ) > scalarFormula =
+        engine.Compile< double( double, double ) >( s_batchSource, "formula" );
+    BatchEvaluator                       batchEvaluator = engine.CompileBatch( s_batchSource );
+    if ( !scalarFormula || !batchEvaluator )
+    {
+        LogError( "Failed to compile the formula." );
+        return -1;
+    }
+
+    std::vector< double > xColumn( s_batchRows );
+    std::vector< double > yColumn( s_batchRows );
+    for ( size_t rowIndex = 0; rowIndex < s_batchRows; ++rowIndex )
+    {
+        xColumn[ rowIndex ] = ( double ) ( rowIndex % 1000 ) * 0.25;
+        yColumn[ rowIndex ] = ( double ) ( rowIndex % 333 ) * 1.5;
+    }
+
+    // The function is looked up by name, and the number of columns is checked against its arity.
+    const double*         columns[] = {xColumn.data(), yColumn.data()};
+    std::vector< double > batchOutput( s_batchRows );
+    if ( batchEvaluator.Evaluate( "unknown", columns, 2, batchOutput.data(), s_batchRows ) ||
+         batchEvaluator.Evaluate( "formula", columns, 1, batchOutput.data(), s_batchRows ) )
+    {
+        LogError( "Evaluated a batch of an unknown function, or with the wrong number of columns." );
+        return -1;
+    }
+
+    std::vector< double > scalarOutput( s_batchRows );
+    double                scalarSeconds = MeasureSeconds( [&]() {
+        for ( size_t rowIndex = 0; rowIndex < s_batchRows; ++rowIndex )
+        {
+            scalarOutput[ rowIndex ] = scalarFormula( xColumn[ rowIndex ], yColumn[ rowIndex ] );
+        }
+    } );
+
+    bool   succeeded    = true;
+    double batchSeconds = MeasureSeconds( [&]() {
+        succeeded &= batchEvaluator.Evaluate( "formula", columns, 2, batchOutput.data(), s_batchRows, 1 );
+    } );
+
+    std::vector< double > threadedOutput( s_batchRows );
+    double                threadedSeconds = MeasureSeconds( [&]() {
+        succeeded &= batchEvaluator.Evaluate( "formula", columns, 2, threadedOutput.data(), s_batchRows, 0 );
+    } );
+
+    if ( !succeeded )
+    {
+        LogError( "Failed to evaluate the batch." );
+        return -1;
+    }
+
+    if ( scalarOutput != batchOutput || scalarOutput != threadedOutput )
+    {
+        LogError( "Result mismatch between the scalar and batch evaluations." );
+        return -1;
+    }
+
+    LogInfo( "Evaluated %zu rows, with %zu vectorized loops.", s_batchRows, engine.GetVectorizedLoopCount() );
+    LogInfo( "%-32s %10.2f M rows/s", "Scalar call per row", s_batchRows / scalarSeconds * 1.0e-6 );
+    LogInfo( "%-32s %10.2f M rows/s", "Batch", s_batchRows / batchSeconds * 1.0e-6 );
+    LogInfo( "%-32s %10.2f M rows/s", "Batch (all threads)", s_batchRows / threadedSeconds * 1.0e-6 );
+    return 0;
+}
+
+/// Formula of the math intrinsics benchmark, calling functions of the C math library.
+constexpr const char* s_mathSource = "extern sqrt(x); extern floor(x); extern fabs(x);"
+                                     "def mathformula(x y) sqrt(x * x + y * y) + floor(y) * fabs(x - y);";
+
+/// Compare the batch function of the formula of s_mathSource when its calls to the math library are generated as
+/// intrinsics, which are vectorized, against calling the library on every row.
+int BenchmarkMathIntrinsics( std::string_view )
+{
+    llvm::orc::KaleidoscopeJIT callJIT;
+    llvm::orc::KaleidoscopeJIT intrinsicJIT;
+    CompileOptions             callOptions;
+    CompileOptions             intrinsicOptions;
+    std::vector< uintptr_t >   callFormulas;
+    std::vector< uintptr_t >   intrinsicFormulas;
+    size_t                     callLoopCount      = 0;
+    size_t                     intrinsicLoopCount = 0;
+    callOptions.m_mathIntrinsics                  = false;
+    callOptions.m_batchFunctions                  = true;
+    intrinsicOptions.m_batchFunctions             = true;
+    if ( !CompileSource(
+             callJIT, s_mathSource, callOptions, {"__batch_mathformula"}, callFormulas, &callLoopCount ) ||
+         !CompileSource( intrinsicJIT,
+                         s_mathSource,
+                         intrinsicOptions,
+                         {"__batch_mathformula"},
+                         intrinsicFormulas,
+                         &intrinsicLoopCount ) )
+    {
+        return -1;
+    }
+
+    BatchFunction callFormula      = reinterpret_cast< BatchFunction >( callFormulas[ 0 ] );
+    BatchFunction intrinsicFormula = reinterpret_cast< BatchFunction >( intrinsicFormulas[ 0 ] );
+
+    std::vector< double > xColumn( s_batchRows );
+    std::vector< double > yColumn( s_batchRows );
+    for ( size_t rowIndex = 0; rowIndex < s_batchRows; ++rowIndex )
+    {
+        xColumn[ rowIndex ] = ( double ) ( rowIndex % 1000 ) * 0.25;
+        yColumn[ rowIndex ] = ( double ) ( rowIndex % 333 ) * 1.5;
+    }
+
+    const double*         columns[] = {xColumn.data(), yColumn.data()};
+    std::vector< double > callOutput( s_batchRows );
+    double                callSeconds =
+        MeasureSeconds( [&]() { EvaluateBatch( callFormula, columns, callOutput.data(), s_batchRows, 1 ); } );
+
+    std::vector< double > intrinsicOutput( s_batchRows );
+    double                intrinsicSeconds =
+        MeasureSeconds( [&]() { EvaluateBatch( intrinsicFormula, columns, intrinsicOutput.data(), s_batchRows, 1 ); } );
+
+    if ( callOutput != intrinsicOutput )
+    {
+        LogError( "Result mismatch between the library calls and the intrinsics." );
+        return -1;
+    }
+
+    LogInfo( "Evaluated %zu rows, with %zu and %zu vectorized loops.", s_batchRows, callLoopCount, intrinsicLoopCount );
+    LogInfo( "%-32s %10.2f M rows/s", "Library calls", s_batchRows / callSeconds * 1.0e-6 );
+    LogInfo( "%-32s %10.2f M rows/s", "Intrinsics", s_batchRows / intrinsicSeconds * 1.0e-6 );
+    return 0;
+}
+
+/// Measure compiling s_kernelSource with an Engine, and compiling it again from the cache, then compare calling the
+/// compiled handle against calling its native function pointer.
+int BenchmarkEngine( std::string_view )
+{
+    Engine engine;
+
+    std::chrono::steady_clock::time_point start   = std::chrono::steady_clock::now();
+    Compiled< double( double ) >          loopSum = engine.Compile< double( double ) >( s_kernelSource, "sumloop" );
+
+    std::chrono::duration< double > compileSeconds = std::chrono::steady_clock::now() - start;
+    if ( !loopSum )
+    {
+        LogError( "Failed to compile the kernels." );
+        return -1;
+    }
+
+    Compiled< double( double ) > cachedLoopSum;
+    double                       cachedSeconds = MeasureSeconds(
+        [&]() { cachedLoopSum = engine.Compile< double( double ) >( s_kernelSource, "sumloop" ); } );
+    if ( cachedLoopSum.GetFunctionPointer() != loopSum.GetFunctionPointer() || engine.GetCompileCount() != 1 )
+    {
+        LogError( "Compiling the kernels again did not hit the cache." );
+        return -1;
+    }
+
+    // The arity of a function is checked against its prototype.
+    if ( engine.Compile< double( double, double ) >( s_kernelSource, "sumrec" ) )
+    {
+        LogError( "Compiled a kernel with the wrong number of arguments." );
+        return -1;
+    }
+
+    double handleResult  = 0.0;
+    double handleSeconds = MeasureSeconds( [&]() {
+        handleResult = 0.0;
+        for ( size_t callIndex = 0; callIndex < s_kernelCalls; ++callIndex )
+        {
+            handleResult += loopSum( s_kernelArgument );
+        }
+    } );
+
+    double pointerResult  = 0.0;
+    double pointerSeconds = MeasureKernel( loopSum.GetFunctionPointer(), pointerResult );
+    if ( handleResult != pointerResult )
+    {
+        LogError( "Result mismatch: handle %f, function pointer %f", handleResult, pointerResult );
+        return -1;
+    }
+
+    LogInfo( "%-32s %10.2f ms", "Compile", compileSeconds.count() * 1.0e3 );
+    LogInfo( "%-32s %10.2f us", "Compile (cached)", cachedSeconds * 1.0e6 );
+    LogInfo( "%-32s %10.2f us/call", "Call (handle)", handleSeconds * 1.0e6 / s_kernelCalls );
+    LogInfo( "%-32s %10.2f us/call", "Call (function pointer)", pointerSeconds * 1.0e6 / s_kernelCalls );
+    return 0;
+}
+
+/// Kernel of the host function benchmark, which calls a host function with a loop invariant argument.
+constexpr const char* s_hostFunctionSource =
+    "extern hostdecay(x);"
+    "def decayloop(n) var s = 0 in ( for i = 0, i < n in s = s + hostdecay(2) ) + s;";
+
+/// Host function called by s_hostFunctionSource, whose result only depends on its argument.
+double HostDecay( double i_value )
+{
+    return std::exp( -i_value ) * std::sqrt( i_value );
+}
+
+/// Compare the kernel of s_hostFunctionSource when its host function is registered as pure, which allows the call
+/// to be hoisted out of the loop, against registering it without attributes, which calls it on every iteration.
+int BenchmarkHostFunctions( std::string_view )
+{
+    Engine pureEngine;
+    Engine opaqueEngine;
+    if ( !pureEngine.GetHostFunctions().Register(
+             "hostdecay", HostDecay, HostFunctionAttribute_Pure | HostFunctionAttribute_NoUnwind ) ||
+         !opaqueEngine.GetHostFunctions().Register( "hostdecay", HostDecay, HostFunctionAttribute_None ) )
+    {
+        LogError( "Failed to register the host function." );
+        return -1;
+    }
+
+    Compiled< double( double ) > pureLoop =
+        pureEngine.Compile< double( double ) >( s_hostFunctionSource, "decayloop" );
+    Compiled< double( double ) > opaqueLoop =
+        opaqueEngine.Compile< double( double ) >( s_hostFunctionSource, "decayloop" );
+    if ( !pureLoop || !opaqueLoop )
+    {
+        LogError( "Failed to compile the kernels." );
+        return -1;
+    }
+
+    double pureResult    = 0.0;
+    double opaqueResult  = 0.0;
+    double pureSeconds   = MeasureKernel( pureLoop.GetFunctionPointer(), pureResult );
+    double opaqueSeconds = MeasureKernel( opaqueLoop.GetFunctionPointer(), opaqueResult );
+    if ( pureResult != opaqueResult )
+    {
+        LogError( "Result mismatch: pure %f, opaque %f", pureResult, opaqueResult );
+        return -1;
+    }
+
+    LogInfo( "%-32s %10.2f us/call", "Host function (pure)", pureSeconds * 1.0e6 / s_kernelCalls );
+    LogInfo( "%-32s %10.2f us/call", "Host function (no attributes)", opaqueSeconds * 1.0e6 / s_kernelCalls );
+    return 0;
+}
+
+/// Named benchmark entry point, taking the source text to benchmark with.
+struct Benchmark
+{
+    const char* m_name;
+    int ( *m_function )( std::string_view i_source );
+};
+
+static const Benchmark s_benchmarks[] = {
+    {"lexer", BenchmarkLexer},
+    {"parser", BenchmarkParser},
+    {"flatAST", BenchmarkFlatAST},
+    {"vm", BenchmarkVirtualMachine},
+    {"declarations", BenchmarkDeclarations},
+    {"kernels", BenchmarkKernels},
+    {"levels", BenchmarkOptimizationLevels},
+    {"inlining", BenchmarkInlining},
+    {"batch", BenchmarkBatch},
+    {"engine", BenchmarkEngine},
+    {"hostFunctions", BenchmarkHostFunctions},
+    {"mathIntrinsics", BenchmarkMathIntrinsics},
+};
+
+int main( int i_argc, char** i_argv )
+{
+    if ( i_argc != 2 && i_argc != 3 )
+    {
+        LogError( "usage: kaleidoscopeBenchmark <benchmark> [sourceFile]" );
+        for ( const Benchmark& benchmark : s_benchmarks )
+        {
+            LogError( "    %s", benchmark.m_name );
+        }
+
+        return -1;
+    }
+
+    // The benchmarks which JIT compile share the initialization of the native target.
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    // Benchmark with the specified source file, otherwise a generated source.
+    std::unique_ptr< llvm::MemoryBuffer > sourceBuffer;
+    std::string                           generatedSource;
+    std::string_view                      source;
+    if ( i_argc == 3 )
+    {
+        llvm::ErrorOr< std::unique_ptr< llvm::MemoryBuffer > > fileBuffer =
+            llvm::MemoryBuffer::getFile( i_argv[ 2 ], /* FileSize */ -1, /* RequiresNullTerminator */ false );
+        if ( !fileBuffer )
+        {
+            LogError( "Failed to load file: %s, %s", i_argv[ 2 ], fileBuffer.getError().message().c_str() );
+            return -1;
+        }
+
+        sourceBuffer = std::move( *fileBuffer );
+        source       = std::string_view( sourceBuffer->getBufferStart(), sourceBuffer->getBufferSize() );
+    }
+    else
+    {
+        generatedSource = GenerateSource( 16 * 1024 * 1024 );
+        source          = generatedSource;
+    }
+
+    for ( const Benchmark& benchmark : s_benchmarks )
+    {
+        if ( strcmp( benchmark.m_name, i_argv[ 1 ] ) == 0 )
+        {
+            return benchmark.m_function( source );
+        }
+    }
+
+    LogError( "Unknown benchmark: %s", i_argv[ 1 ] );
+    return -1;
+}
@@ -1,24 +1,32 @@
 #include <kaleidoscope/codeGenContext.h>
 #include <kaleidoscope/lexer.h>
 #include <kaleidoscope/logger.h>
+#include <kaleidoscope/parallelCodeGen.h>
 #include <kaleidoscope/parser.h>
+#include <kaleidoscope/simplifier.h>
+#include <kaleidoscope/tokenArray.h>
 
+#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
 
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <vector>
 
 using namespace kaleidoscope;
 
 void HandleDefinition( Parser& io_parser, CodeGenContext& io_codeGenContext )
 {
-    std::unique_ptr< FunctionAST > expr = io_parser.ParseDefinitionExpr();
+    FunctionAST* expr = io_parser.ParseDefinitionExpr();
     if ( expr != nullptr )
     {
+        expr = SimplifyFunction( expr, io_parser.GetInterner(), SimplifyMode_Strict );
         expr->GenerateCode( io_codeGenContext );
     }
     else
@@ -29,7 +37,7 @@ void HandleDefinition( Parser& io_parser, CodeGenContext& io_codeGenContext )
 
 void HandleExtern( Parser& io_parser, CodeGenContext& io_codeGenContext )
 {
-    std::unique_ptr< PrototypeAST > expr = io_parser.ParseExternExpr();
+    PrototypeAST* expr = io_parser.ParseExternExpr();
     if ( expr != nullptr )
     {
         expr->GenerateCode( io_codeGenContext );
@@ -42,9 +50,10 @@ void HandleExtern( Parser& io_parser, CodeGenContext& io_codeGenContext )
 
 void HandleTopLevelExpression( Parser& io_parser, CodeGenContext& io_codeGenContext )
 {
-    std::unique_ptr< FunctionAST > expr = io_parser.ParseTopLevelExpr();
+    FunctionAST* expr = io_parser.ParseTopLevelExpr();
     if ( expr != nullptr )
     {
+        expr = SimplifyFunction( expr, io_parser.GetInterner(), SimplifyMode_Strict );
         expr->GenerateCode( io_codeGenContext );
     }
     else
@@ -55,20 +64,87 @@ void HandleTopLevelExpression( Parser& io_parser, CodeGenContext& io_codeGenCont
 
 int main( int i_argc, char** i_argv )
 {
-    if ( i_argc != 3 )
+    // Parse options, which may precede the positional arguments.
+    // -j <threadCount> parses and generates code on multiple threads.  A thread count of 0 uses every core.
+    // --fp-mode=contract allows fusing multiplications with additions, and --fp-mode=fast allows reordering
+    // floating point operations, which lets loops of reductions be vectorized.
+    // -O0, -O1, -O2 (the default) and -O3 select the optimization pipeline, and the code generation level.
+    // --no-math-intrinsics calls the functions of the C math library as external functions, rather than as LLVM
+    // intrinsics, so that functions of the same names can be defined.
+    size_t                     threadCount       = 1;
+    FloatingPointMode          floatingPointMode = FloatingPointMode_Strict;
+    OptimizationLevel          optimizationLevel = OptimizationLevel_O2;
+    bool                       mathIntrinsics    = true;
+    std::vector< std::string > arguments;
+    for ( int argIndex = 1; argIndex < i_argc; ++argIndex )
     {
-        LogError( "usage: kaleidoscopeCompiler <sourceFile> <objectFile>" );
-        return -1;
+        if ( strcmp( i_argv[ argIndex ], "-j" ) == 0 && argIndex + 1 < i_argc )
+        {
+            threadCount = strtoul( i_argv[ ++argIndex ], nullptr, 10 );
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--fp-mode=strict" ) == 0 )
+        {
+            floatingPointMode = FloatingPointMode_Strict;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--fp-mode=contract" ) == 0 )
+        {
+            floatingPointMode = FloatingPointMode_Contract;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--fp-mode=fast" ) == 0 )
+        {
+            floatingPointMode = FloatingPointMode_Fast;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "-O0" ) == 0 )
+        {
+            optimizationLevel = OptimizationLevel_O0;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "-O1" ) == 0 )
+        {
+            optimizationLevel = OptimizationLevel_O1;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "-O2" ) == 0 )
+        {
+            optimizationLevel = OptimizationLevel_O2;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "-O3" ) == 0 )
+        {
+            optimizationLevel = OptimizationLevel_O3;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--no-math-intrinsics" ) == 0 )
+        {
+            mathIntrinsics = false;
+        }
+        else
+        {
+            arguments.push_back( i_argv[ argIndex ] );
+        }
     }
 
-    std::string   sourceFile( i_argv[ 1 ] );
-    std::ifstream fileStream( sourceFile );
-    if ( !fileStream )
+    if ( arguments.size() != 2 )
     {
-        LogError( "Failed to load file: %s", sourceFile.c_str() );
+        LogError( "usage: kaleidoscopeCompiler [-j <threadCount>] [--fp-mode=strict|contract|fast] [-O0|-O1|-O2|-O3] "
+                  "[--no-math-intrinsics] <sourceFile | -> <objectFile>" );
         return -1;
     }
 
+    // Map the source file into memory.  Large files are mmap'ed rather than read, and no null terminator is
+    // required as the lexer is bounded by the size of the buffer.
+    // A source file of "-" is streamed from stdin instead.
+    std::string                           sourceFile( arguments[ 0 ] );
+    std::unique_ptr< llvm::MemoryBuffer > sourceBuffer;
+    if ( sourceFile != "-" )
+    {
+        llvm::ErrorOr< std::unique_ptr< llvm::MemoryBuffer > > fileBuffer =
+            llvm::MemoryBuffer::getFile( sourceFile, /* FileSize */ -1, /* RequiresNullTerminator */ false );
+        if ( !fileBuffer )
+        {
+            LogError( "Failed to load file: %s, %s", sourceFile.c_str(), fileBuffer.getError().message().c_str() );
+            return -1;
+        }
+
+        sourceBuffer = std::move( *fileBuffer );
+    }
+
     llvm::InitializeAllTargetInfos();
     llvm::InitializeAllTargets();
     llvm::InitializeAllTargetMCs();
@@ -85,50 +161,79 @@ int main( int i_argc, char** i_argv )
         return -1;
     }
 
-    // Create target machine.
+    SymbolTable    symbolTable;
+    CodeGenContext codeGenContext( symbolTable );
+    codeGenContext.SetFloatingPointMode( floatingPointMode );
+    codeGenContext.SetOptimizationLevel( optimizationLevel );
+    codeGenContext.SetMathIntrinsics( mathIntrinsics );
+
+    // Create target machine, generating code at the selected optimization level.
     std::string cpu      = "generic";
     std::string features = "";
 
     llvm::TargetOptions                  targetOptions;
     llvm::Optional< llvm::Reloc::Model > model;
-    llvm::TargetMachine*                 targetMachine =
-        targetArch->createTargetMachine( targetTriple, cpu, features, targetOptions, model );
+    llvm::TargetMachine*                 targetMachine = targetArch->createTargetMachine(
+        targetTriple, cpu, features, targetOptions, model, llvm::None, codeGenContext.GetCodeGenOptLevel() );
 
-    CodeGenContext codeGenContext;
     codeGenContext.InitializeModule( targetTriple, targetMachine );
-    std::string lineString;
     LogInfo( "Compiling '%s'...", sourceFile.c_str() );
-    while ( std::getline( fileStream, lineString ) )
-    {
-        LogInfo( "%s", lineString.c_str() );
 
-        // Depending on token,
-        Parser parser( lineString );
-        switch ( parser.ParseCurrentToken() )
+    if ( threadCount != 1 )
+    {
+        // Tokenize the entire source up front, so that it can be split into chunks for each thread.
+        TokenArray               tokens;
+        std::unique_ptr< Lexer > lexer =
+            sourceBuffer != nullptr
+                ? std::make_unique< Lexer >(
+                      std::string_view( sourceBuffer->getBufferStart(), sourceBuffer->getBufferSize() ), symbolTable )
+                : std::make_unique< Lexer >( std::cin, symbolTable );
+        tokens.AppendAll( *lexer );
+        if ( !GenerateCodeParallel( tokens, codeGenContext, targetTriple, targetMachine, threadCount ) )
         {
-        case Token_Eof:
-            break;
-        case ';': // ignore top-level semicolons.
-            parser.ParseNextToken();
-            break;
-        case Token_Def:
-            HandleDefinition( parser, codeGenContext );
-            break;
-        case Token_Extern:
-            HandleExtern( parser, codeGenContext );
-            break;
-        default:
-            HandleTopLevelExpression( parser, codeGenContext );
-            break;
+            return -1;
         }
     }
+    else
+    {
+        // A single parser consumes the entire source, so definitions are free to span multiple lines.
+        std::unique_ptr< Parser > parserPtr =
+            sourceBuffer != nullptr
+                ? std::make_unique< Parser >(
+                      std::string_view( sourceBuffer->getBufferStart(), sourceBuffer->getBufferSize() ), symbolTable )
+                : std::make_unique< Parser >( std::cin, symbolTable );
+        Parser& parser = *parserPtr;
+        while ( parser.ParseCurrentToken() != Token_Eof )
+        {
+            // Depending on token,
+            switch ( parser.ParseCurrentToken() )
+            {
+            case ';': // ignore top-level semicolons.
+                parser.ParseNextToken();
+                break;
+            case Token_Def:
+                HandleDefinition( parser, codeGenContext );
+                break;
+            case Token_Extern:
+                HandleExtern( parser, codeGenContext );
+                break;
+            default:
+                HandleTopLevelExpression( parser, codeGenContext );
+                break;
+            }
+        }
+    }
+
+    // Optimize the whole program at once, so that functions can be inlined into their callers.
+    codeGenContext.OptimizeModule();
+    LogInfo( "Vectorized %zu loops.", codeGenContext.GetVectorizedLoopCount() );
 
     LogInfo( "Successfully compiled '%s', generated IR:", sourceFile.c_str() );
     codeGenContext.Print();
 
     // Compiling to object code.
     std::error_code      errorCode;
-    std::string          objectFile( i_argv[ 2 ] );
+    std::string          objectFile( arguments[ 1 ] );
     llvm::raw_fd_ostream dest( objectFile.c_str(), errorCode, llvm::sys::fs::OF_None );
     if ( errorCode )
     {
@@ -1,32 +1,96 @@
 #include <kaleidoscope/KaleidoscopeJIT.h>
+#include <kaleidoscope/bytecode.h>
 #include <kaleidoscope/codeGenContext.h>
+#include <kaleidoscope/hostFunctions.h>
 #include <kaleidoscope/lexer.h>
+#include <kaleidoscope/logger.h>
 #include <kaleidoscope/parser.h>
+#include <kaleidoscope/simplifier.h>
+#include <kaleidoscope/tieredJIT.h>
+#include <kaleidoscope/virtualMachine.h>
 
 #include <llvm/IR/Function.h>
+#include <llvm/Support/DynamicLibrary.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 using namespace kaleidoscope;
 
 typedef double ( *GetDoubleFn )();
 
-void HandleDefinition( Parser& io_parser, CodeGenContext& io_codeGenContext, llvm::orc::KaleidoscopeJIT& io_jit )
+/// Default maximum instructions of the functions imported from previous definitions for inlining.
+constexpr size_t s_defaultInlineImportLimit = 64;
+
+/// ExecutionMode selects how functions are executed.
+enum ExecutionMode
+{
+    ExecutionMode_JIT = 0,   /// Generate LLVM IR, and JIT compile it into native code.
+    ExecutionMode_TieredJIT, /// JIT compile quickly, then recompile hot functions at full optimization.
+    ExecutionMode_VM,        /// Compile into bytecode, and execute it with a virtual machine.
+};
+
+void HandleDefinition( Parser&                     io_parser,
+                       CodeGenContext&             io_codeGenContext,
+                       llvm::orc::KaleidoscopeJIT& io_jit,
+                       TieredJIT*                  io_tieredJIT,
+                       SimplifyMode                i_simplifyMode )
 {
-    std::unique_ptr< FunctionAST > expr = io_parser.ParseDefinitionExpr();
+    FunctionAST* expr = io_parser.ParseDefinitionExpr();
     if ( expr != nullptr )
     {
-        llvm::Value* value = expr->GenerateCode( io_codeGenContext );
+        // Declare the function to the tiered JIT first, so that recursive calls are made through its stub.
+        // The previous declaration is restored if the definition fails, so that callers keep calling it.
+        SymbolId        name                = expr->GetPrototype()->GetName();
+        TieredFunction* previousDeclaration = nullptr;
+        if ( io_tieredJIT != nullptr )
+        {
+            previousDeclaration = io_tieredJIT->DeclareFunction( name );
+        }
+
+        expr                             = SimplifyFunction( expr, io_parser.GetInterner(), i_simplifyMode );
+        size_t       vectorizedLoopCount = io_codeGenContext.GetVectorizedLoopCount();
+        size_t       inlineImportCount   = io_codeGenContext.GetInlineImportCount();
+        llvm::Value* value               = expr->GenerateCode( io_codeGenContext );
         if ( value != nullptr )
         {
             fprintf( stderr, "Parsed a function definition.\n" );
+            if ( io_tieredJIT == nullptr )
+            {
+                // The baseline tier of the tiered JIT runs no IR passes, so does not vectorize.
+                io_codeGenContext.OptimizeModule();
+                fprintf( stderr,
+                         "Vectorized %zu loops.\n",
+                         io_codeGenContext.GetVectorizedLoopCount() - vectorizedLoopCount );
+                fprintf( stderr,
+                         "Imported %zu functions for inlining.\n",
+                         io_codeGenContext.GetInlineImportCount() - inlineImportCount );
+            }
+
             value->print( llvm::errs() );
-            io_jit.addModule( std::move( io_codeGenContext.MoveModule() ) );
+            if ( io_tieredJIT != nullptr )
+            {
+                // A stub without an address must not be called, so the failed definition is forgotten.
+                if ( !io_tieredJIT->AddFunctionModule( name, io_codeGenContext.MoveModule() ) )
+                {
+                    io_tieredJIT->RestoreFunction( name, previousDeclaration );
+                }
+            }
+            else
+            {
+                io_jit.addModule( std::move( io_codeGenContext.MoveModule() ), io_codeGenContext.GetCodeGenOptLevel() );
+            }
+
             io_codeGenContext.InitializeModuleWithJIT( io_jit );
             fprintf( stderr, "\n" );
         }
+        else if ( io_tieredJIT != nullptr )
+        {
+            io_tieredJIT->RestoreFunction( name, previousDeclaration );
+        }
     }
     else
     {
@@ -35,9 +99,12 @@ void HandleDefinition( Parser& io_parser, CodeGenContext& io_codeGenContext, llv
     }
 }
 
-void HandleExtern( Parser& io_parser, CodeGenContext& io_codeGenContext )
+void HandleExtern( Parser&                  io_parser,
+                   CodeGenContext&          io_codeGenContext,
+                   TieredJIT*               io_tieredJIT,
+                   const HostFunctionTable& i_hostFunctions )
 {
-    std::unique_ptr< PrototypeAST > expr = io_parser.ParseExternExpr();
+    PrototypeAST* expr = io_parser.ParseExternExpr();
     if ( expr != nullptr )
     {
         llvm::Value* value = expr->GenerateCode( io_codeGenContext );
@@ -46,7 +113,18 @@ void HandleExtern( Parser& io_parser, CodeGenContext& io_codeGenContext )
             fprintf( stderr, "Parsed an extern\n" );
             value->print( llvm::errs() );
             fprintf( stderr, "\n" );
-            io_codeGenContext.AddFunction( expr );
+            io_codeGenContext.AddFunction( *expr, /* isDefinition */ false );
+
+            // The tiered JIT compiles each definition as it is parsed, so an extern which the host does not resolve
+            // is called through a stub, which its later definition points at, as in the virtual machine.
+            const std::string& name = io_codeGenContext.GetSymbolTable().GetName( expr->GetName() );
+            if ( io_tieredJIT != nullptr && i_hostFunctions.Find( name ) == nullptr &&
+                 ( !i_hostFunctions.GetProcessSymbolSearch() ||
+                   llvm::sys::DynamicLibrary::SearchForAddressOfSymbol( name ) == nullptr ) )
+            {
+                io_tieredJIT->DeclareExternFunction( expr->GetName(),
+                                                     llvm::cast< llvm::Function >( value )->getFunctionType() );
+            }
         }
     }
     else
@@ -58,28 +136,42 @@ void HandleExtern( Parser& io_parser, CodeGenContext& io_codeGenContext )
 
 void HandleTopLevelExpression( Parser&                     io_parser,
                                CodeGenContext&             io_codeGenContext,
-                               llvm::orc::KaleidoscopeJIT& io_jit )
+                               llvm::orc::KaleidoscopeJIT& io_jit,
+                               TieredJIT*                  io_tieredJIT,
+                               SimplifyMode                i_simplifyMode )
 {
     // Evaluate a top-level expression into an anonymous function.
-    std::unique_ptr< FunctionAST > expr = io_parser.ParseTopLevelExpr();
+    FunctionAST* expr = io_parser.ParseTopLevelExpr();
     if ( expr != nullptr )
     {
+        expr = SimplifyFunction( expr, io_parser.GetInterner(), i_simplifyMode );
+        if ( expr->GetBody()->GetKind() == ExprKind_Numeric )
+        {
+            // The expression folded into a constant, so there is no code to generate and evaluate.
+            fprintf( stderr, "Evaluated to %f\n", static_cast< NumericExprAST* >( expr->GetBody() )->GetValue() );
+            return;
+        }
+
         llvm::Value* value = expr->GenerateCode( io_codeGenContext );
         if ( value != nullptr )
         {
-            // JIT compile the module.
-            llvm::orc::VModuleKey moduleKey = io_jit.addModule( std::move( io_codeGenContext.MoveModule() ) );
-            io_codeGenContext.InitializeModuleWithJIT( io_jit );
+            // JIT compile the module.  The tiered JIT compiles it at its baseline tier, as it is executed once.
+            llvm::CodeGenOpt::Level optLevel = llvm::CodeGenOpt::None;
+            if ( io_tieredJIT == nullptr )
+            {
+                io_codeGenContext.OptimizeModule();
+                optLevel = io_codeGenContext.GetCodeGenOptLevel();
+            }
 
-            // Find anonymous symbol
-            llvm::JITSymbol exprSymbol = io_jit.findSymbol( "__anon_expr" );
-            assert( exprSymbol );
+            llvm::orc::VModuleKey moduleKey = io_jit.addModule( std::move( io_codeGenContext.MoveModule() ), optLevel );
+            io_codeGenContext.InitializeModuleWithJIT( io_jit );
 
             // Get the expression's symbol address, and cast it to a function ptr which
             // takes no arguments and returns a double on invocation.
-            llvm::Expected< uintptr_t > addr = exprSymbol.getAddress();
-            assert( addr );
-            GetDoubleFn functionPtr = ( GetDoubleFn )( uintptr_t ) addr.get();
+            // The symbol is looked up with the JIT locked, as the tiered JIT adds modules from another thread.
+            llvm::JITTargetAddress addr = io_jit.getSymbolAddress( "__anon_expr" );
+            assert( addr != 0 );
+            GetDoubleFn functionPtr = ( GetDoubleFn )( uintptr_t ) addr;
 
             // Evaluate function ptr.
             fprintf( stderr, "Evaluated to %f\n", functionPtr() );
@@ -95,46 +187,304 @@ void HandleTopLevelExpression( Parser&                     io_parser,
     }
 }
 
-void MainLoop()
+void HandleDefinitionVM( Parser&                  io_parser,
+                         BytecodeModule&          io_module,
+                         const HostFunctionTable& i_hostFunctions,
+                         SimplifyMode             i_simplifyMode )
+{
+    FunctionAST* expr = io_parser.ParseDefinitionExpr();
+    if ( expr != nullptr )
+    {
+        // Host functions cannot be redefined, as in JIT compiled code.
+        const std::string& name = io_module.GetSymbolTable().GetName( expr->GetPrototype()->GetName() );
+        if ( i_hostFunctions.Find( name ) != nullptr )
+        {
+            LogError( "Function '%s' is defined by the host, and cannot be redefined", name.c_str() );
+            return;
+        }
+
+        expr = SimplifyFunction( expr, io_parser.GetInterner(), i_simplifyMode );
+        if ( io_module.CompileFunction( *expr ) != nullptr )
+        {
+            fprintf( stderr, "Parsed a function definition.\n" );
+        }
+    }
+    else
+    {
+        // Skip token for error recovery.
+        io_parser.ParseNextToken();
+    }
+}
+
+void HandleExternVM( Parser& io_parser, BytecodeModule& io_module, const HostFunctionTable& i_hostFunctions )
+{
+    PrototypeAST* expr = io_parser.ParseExternExpr();
+    if ( expr != nullptr )
+    {
+        const std::string&  name         = io_module.GetSymbolTable().GetName( expr->GetName() );
+        const HostFunction* hostFunction = i_hostFunctions.Find( name );
+        if ( hostFunction != nullptr && hostFunction->m_argumentCount != expr->GetArguments().GetSize() )
+        {
+            LogError( "Host function '%s' takes %zu arguments, but is declared with %zu",
+                      name.c_str(),
+                      hostFunction->m_argumentCount,
+                      expr->GetArguments().GetSize() );
+            return;
+        }
+
+        BytecodeFunction* function = io_module.DeclareFunction( *expr );
+        if ( function != nullptr && function->m_nativeAddress == nullptr && function->m_instructions.empty() )
+        {
+            // Resolve the extern against the registered host functions, then against the symbols of the process,
+            // unless its search is disabled.
+            void* address = nullptr;
+            if ( hostFunction != nullptr )
+            {
+                address = hostFunction->m_address;
+            }
+            else if ( i_hostFunctions.GetProcessSymbolSearch() )
+            {
+                address = llvm::sys::DynamicLibrary::SearchForAddressOfSymbol( name );
+            }
+
+            if ( address != nullptr )
+            {
+                io_module.DefineNativeFunction( expr->GetName(), function->m_argumentCount, address );
+            }
+
+            fprintf( stderr, "Parsed an extern\n" );
+        }
+    }
+    else
+    {
+        // Skip token for error recovery.
+        io_parser.ParseNextToken();
+    }
+}
+
+void HandleTopLevelExpressionVM( Parser&         io_parser,
+                                 BytecodeModule& io_module,
+                                 VirtualMachine& io_virtualMachine,
+                                 SimplifyMode    i_simplifyMode )
+{
+    // Evaluate a top-level expression as an anonymous function.
+    FunctionAST* expr = io_parser.ParseTopLevelExpr();
+    if ( expr != nullptr )
+    {
+        expr = SimplifyFunction( expr, io_parser.GetInterner(), i_simplifyMode );
+        if ( expr->GetBody()->GetKind() == ExprKind_Numeric )
+        {
+            fprintf( stderr, "Evaluated to %f\n", static_cast< NumericExprAST* >( expr->GetBody() )->GetValue() );
+            return;
+        }
+
+        BytecodeFunction* function = io_module.CompileFunction( *expr );
+        if ( function != nullptr )
+        {
+            double result = 0.0;
+            if ( io_virtualMachine.Execute( *function, nullptr, result ) )
+            {
+                fprintf( stderr, "Evaluated to %f\n", result );
+            }
+
+            io_module.RemoveFunction( Symbol_AnonymousExpr );
+        }
+    }
+    else
+    {
+        // Skip token for error recovery.
+        io_parser.ParseNextToken();
+    }
+}
+
+void MainLoop( SimplifyMode      i_simplifyMode,
+               FloatingPointMode i_floatingPointMode,
+               OptimizationLevel i_optimizationLevel,
+               size_t            i_inlineImportLimit,
+               bool              i_processSymbolSearch,
+               bool              i_mathIntrinsics,
+               ExecutionMode     i_executionMode )
 {
     llvm::InitializeNativeTarget();
     llvm::InitializeNativeTargetAsmPrinter();
     llvm::InitializeNativeTargetAsmParser();
 
-    CodeGenContext codeGenContext;
+    // Externs of the C math library are resolved through the host function table, and declared as pure.
+    HostFunctionTable hostFunctions;
+    hostFunctions.RegisterMathFunctions();
+    hostFunctions.SetProcessSymbolSearch( i_processSymbolSearch );
+
+    SymbolTable    symbolTable;
+    CodeGenContext codeGenContext( symbolTable );
+    codeGenContext.SetHostFunctions( &hostFunctions );
+    codeGenContext.SetFloatingPointMode( i_floatingPointMode );
+    codeGenContext.SetOptimizationLevel( i_optimizationLevel );
+    codeGenContext.SetInlineImportLimit( i_inlineImportLimit );
+    codeGenContext.SetMathIntrinsics( i_mathIntrinsics );
 
     llvm::orc::KaleidoscopeJIT jit;
+    hostFunctions.AddToJIT( jit );
     codeGenContext.InitializeModuleWithJIT( jit );
 
+    // Hot functions are recompiled in the background, when tiered.
+    std::unique_ptr< TieredJIT > tieredJIT;
+    if ( i_executionMode == ExecutionMode_TieredJIT )
+    {
+        tieredJIT = std::make_unique< TieredJIT >( jit, symbolTable, i_optimizationLevel );
+        codeGenContext.SetTieredJIT( tieredJIT.get() );
+    }
+
+    BytecodeModule bytecodeModule( symbolTable );
+    VirtualMachine virtualMachine( bytecodeModule );
+    llvm::sys::DynamicLibrary::LoadLibraryPermanently( nullptr );
+
+    // A single parser streams from stdin, so a definition may span multiple lines.
+    // Decouple from C stdio so that std::cin buffers, and the lexer can pull all the available input at once.
+    std::ios::sync_with_stdio( false );
     fprintf( stderr, "kaleidoscope> " );
-    std::string line;
-    while ( std::getline( std::cin, line ) )
+    Parser parser( std::cin, symbolTable );
+    while ( parser.ParseCurrentToken() != Token_Eof )
     {
-        Parser parser( line );
         switch ( parser.ParseCurrentToken() )
         {
-        case Token_Eof:
-            break;
         case ';': // ignore top-level semicolons.
+            fprintf( stderr, "kaleidoscope> " );
             parser.ParseNextToken();
             break;
         case Token_Def:
-            HandleDefinition( parser, codeGenContext, jit );
+            if ( i_executionMode == ExecutionMode_VM )
+            {
+                HandleDefinitionVM( parser, bytecodeModule, hostFunctions, i_simplifyMode );
+            }
+            else
+            {
+                HandleDefinition( parser, codeGenContext, jit, tieredJIT.get(), i_simplifyMode );
+            }
             break;
         case Token_Extern:
-            HandleExtern( parser, codeGenContext );
+            if ( i_executionMode == ExecutionMode_VM )
+            {
+                HandleExternVM( parser, bytecodeModule, hostFunctions );
+            }
+            else
+            {
+                HandleExtern( parser, codeGenContext, tieredJIT.get(), hostFunctions );
+            }
             break;
         default:
-            HandleTopLevelExpression( parser, codeGenContext, jit );
+            if ( i_executionMode == ExecutionMode_VM )
+            {
+                HandleTopLevelExpressionVM( parser, bytecodeModule, virtualMachine, i_simplifyMode );
+            }
+            else
+            {
+                HandleTopLevelExpression( parser, codeGenContext, jit, tieredJIT.get(), i_simplifyMode );
+            }
             break;
         }
 
-        fprintf( stderr, "kaleidoscope> " );
+        // The AST of each top-level item is discarded once its code is generated.
+        parser.GetArena().Reset();
     }
 }
 
-int main()
+int main( int i_argc, char** i_argv )
 {
-    MainLoop();
+    // --fast-math allows simplifications which assume that values are finite, and that the sign of zero is
+    // insignificant, and generates code with FloatingPointMode_Fast.
+    // --fp-mode=contract allows fusing multiplications with additions, and --fp-mode=fast allows the generated
+    // code to reorder floating point operations, without the simplifications of --fast-math.
+    // -O0, -O1, -O2 (the default) and -O3 select the optimization pipeline of JIT compiled code.
+    // --inline-limit=<n> sets the maximum instructions of the previously defined functions which are imported into
+    // each definition, so that they can be inlined into it.  0 disables importing.
+    // --no-process-symbols only resolves externs against the registered host functions, such as the C math library,
+    // rather than against every symbol of the process.
+    // --no-math-intrinsics calls the functions of the C math library as external functions, rather than as LLVM
+    // intrinsics which the optimizer folds, hoists and vectorizes.
+    // --exec=tiered JIT compiles functions quickly at first, and recompiles the hot ones at the selected level.
+    // --exec=vm executes with the bytecode virtual machine, which avoids the latency of JIT compilation for
+    // short-lived code.
+    SimplifyMode      simplifyMode      = SimplifyMode_Strict;
+    FloatingPointMode floatingPointMode = FloatingPointMode_Strict;
+    OptimizationLevel optimizationLevel = OptimizationLevel_O2;
+    size_t            inlineImportLimit   = s_defaultInlineImportLimit;
+    bool              processSymbolSearch = true;
+    bool              mathIntrinsics      = true;
+    ExecutionMode     executionMode       = ExecutionMode_JIT;
+    for ( int argIndex = 1; argIndex < i_argc; ++argIndex )
+    {
+        if ( strcmp( i_argv[ argIndex ], "--fast-math" ) == 0 )
+        {
+            simplifyMode      = SimplifyMode_FastMath;
+            floatingPointMode = FloatingPointMode_Fast;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--fp-mode=strict" ) == 0 )
+        {
+            floatingPointMode = FloatingPointMode_Strict;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--fp-mode=contract" ) == 0 )
+        {
+            floatingPointMode = FloatingPointMode_Contract;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--fp-mode=fast" ) == 0 )
+        {
+            floatingPointMode = FloatingPointMode_Fast;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "-O0" ) == 0 )
+        {
+            optimizationLevel = OptimizationLevel_O0;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "-O1" ) == 0 )
+        {
+            optimizationLevel = OptimizationLevel_O1;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "-O2" ) == 0 )
+        {
+            optimizationLevel = OptimizationLevel_O2;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "-O3" ) == 0 )
+        {
+            optimizationLevel = OptimizationLevel_O3;
+        }
+        else if ( strncmp( i_argv[ argIndex ], "--inline-limit=", strlen( "--inline-limit=" ) ) == 0 )
+        {
+            inlineImportLimit = strtoul( i_argv[ argIndex ] + strlen( "--inline-limit=" ), nullptr, 10 );
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--no-process-symbols" ) == 0 )
+        {
+            processSymbolSearch = false;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--no-math-intrinsics" ) == 0 )
+        {
+            mathIntrinsics = false;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--exec=jit" ) == 0 )
+        {
+            executionMode = ExecutionMode_JIT;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--exec=tiered" ) == 0 )
+        {
+            executionMode = ExecutionMode_TieredJIT;
+        }
+        else if ( strcmp( i_argv[ argIndex ], "--exec=vm" ) == 0 )
+        {
+            executionMode = ExecutionMode_VM;
+        }
+        else
+        {
+            fprintf( stderr,
+                     "usage: kaleidoscopeInterpreter [--fast-math] [--fp-mode=strict|contract|fast] [-O0|-O1|-O2|-O3] "
+                     "[--inline-limit=<n>] [--no-process-symbols] [--no-math-intrinsics] [--exec=jit|tiered|vm]\n" );
+            return -1;
+        }
+    }
+
+    MainLoop( simplifyMode,
+              floatingPointMode,
+              optimizationLevel,
+              inlineImportLimit,
+              processSymbolSearch,
+              mathIntrinsics,
+              executionMode );
     return 0;
 }